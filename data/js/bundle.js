@@ -41,6 +41,12 @@ let inFlightCtrl = null;
 /** @type {number | null} Timer ID for the next scheduled update */
 let nextTimer = null;
 
+/** @type {string | null} ETag of the snapshot currently in the table */
+let lastEtag = null;
+
+/** @type {boolean} Whether polling was started (it backs up /events) */
+let started = false;
+
 /**
  * Performs a single status update tick with error handling and race condition prevention
  * @returns {Promise<void>}
@@ -64,15 +70,24 @@ async function tick() {
 
   try {
     const r = await fetch("/status.html", {
-      cache: "no-store",
+      // Revalidate with the snapshot ETag; an unchanged snapshot is a 304
+      cache: "no-cache",
       signal: ctrl.signal,
     });
     if (!r.ok) throw new Error("HTTP " + r.status);
 
+    // Same snapshot as last time: nothing to re-render
+    const etag = r.headers.get("ETag");
+    if (etag && etag === lastEtag) {
+      failStreak = 0;
+      return;
+    }
+
     const html = await r.text();
 
     // If a newer tick started while we awaited, drop this result
     if (myGen !== generation) return;
+    lastEtag = etag;
 
     const tb = document.querySelector("#diagnostics-table tbody");
     if (tb) {
@@ -107,7 +122,7 @@ async function tick() {
 document.addEventListener("visibilitychange", () => {
   if (document.visibilityState === "visible") {
     // Start a fresh generation immediately
-    scheduleNext(0);
+    if (started) scheduleNext(0);
   } else {
     // Stop any pending work
     if (nextTimer) {
@@ -128,6 +143,7 @@ document.addEventListener("visibilitychange", () => {
  * @returns {void}
  */
 function scheduleNext(milliseconds) {
+  started = true;
   if (nextTimer) {
     clearTimeout(nextTimer);
   }
@@ -181,9 +197,167 @@ const rotateImg = () => {
 };
 
 // @ts-check
+/**
+ * @fileoverview Server push from /events: new frames and changed status cells
+ */
+
+const liveImgElement = document.getElementById("img");
+const liveImg =
+  liveImgElement instanceof HTMLImageElement ? liveImgElement : null;
+
+/** @type {EventSource | null} Open connection, null while hidden */
+let source = null;
+
+/** @type {number} Newest frame sequence announced by the device */
+let wantedSeq = 0;
+
+/** @type {number} Sequence currently shown or loading */
+let shownSeq = 0;
+
+/** @type {boolean} Whether a frame download is in flight */
+let loading = false;
+
+/**
+ * Loads the newest announced frame; at most one download at a time
+ * @returns {void}
+ */
+function loadFrame() {
+  if (loading || wantedSeq === shownSeq) return;
+  const seq = wantedSeq;
+  const url = `/i/latest.jpg?seq=${seq}`;
+  const tmp = new Image();
+  loading = true;
+  tmp.onload = () => {
+    loading = false;
+    shownSeq = seq;
+    if (liveImg) {
+      liveImg.src = url;
+    }
+    loadFrame(); // another frame may have been announced meanwhile
+  };
+  tmp.onerror = () => {
+    loading = false; // wait for the next announcement
+  };
+  tmp.src = url;
+}
+
+/**
+ * Replaces the whole status table body
+ * @param {string} html - Full <tbody>...</tbody> markup
+ * @returns {void}
+ */
+function replaceRows(html) {
+  const tb = document.querySelector("#diagnostics-table tbody");
+  if (tb) {
+    tb.outerHTML = html;
+  }
+}
+
+/**
+ * Replaces the value cells of the named rows
+ * @param {Record<string, string>} cells - Row key to value <td> markup
+ * @returns {void}
+ */
+function updateCells(cells) {
+  const tb = document.querySelector("#diagnostics-table tbody");
+  if (!(tb instanceof HTMLTableSectionElement)) return;
+  for (const row of Array.from(tb.rows)) {
+    const key = row.cells[0]?.textContent ?? "";
+    const cell = row.cells[1];
+    if (cell && Object.prototype.hasOwnProperty.call(cells, key)) {
+      cell.outerHTML = cells[key];
+    }
+  }
+}
+
+/**
+ * Opens the event stream; EventSource reconnects on its own after errors
+ * @returns {void}
+ */
+function openEvents() {
+  if (source) return;
+  source = new EventSource("/events");
+  source.addEventListener("frame", (e) => {
+    wantedSeq = JSON.parse(e.data).seq;
+    loadFrame();
+  });
+  source.addEventListener("status", (e) => replaceRows(e.data));
+  source.addEventListener("rows", (e) => updateCells(JSON.parse(e.data)));
+}
+
+// Visibility-aware: drop the connection when hidden, reopen when visible
+document.addEventListener("visibilitychange", () => {
+  if (document.visibilityState === "visible") {
+    openEvents();
+  } else if (source) {
+    source.close();
+    source = null;
+  }
+});
+
+/**
+ * Starts live updates if the browser supports server-sent events
+ * @returns {boolean} False when the caller should fall back to polling
+ */
+const connectLive = () => {
+  if (typeof EventSource === "undefined") return false;
+  if (document.visibilityState === "visible") {
+    openEvents();
+  }
+  return true;
+};
+
+// @ts-check
+/**
+ * @fileoverview Reports first contentful paint and the bytes it took to /vitals
+ */
 
+/**
+ * Sends the first contentful paint time and the bytes transferred up to it
+ * once, via a beacon; does nothing where the browser lacks the APIs
+ * @returns {void}
+ */
+const reportPaint = () => {
+  if (
+    typeof PerformanceObserver === "undefined" ||
+    !navigator.sendBeacon ||
+    !(PerformanceObserver.supportedEntryTypes || []).includes("paint")
+  ) {
+    return;
+  }
+  const observer = new PerformanceObserver((list) => {
+    const fcp = list
+      .getEntries()
+      .find((entry) => entry.name === "first-contentful-paint");
+    if (!fcp) return;
+    observer.disconnect();
+    let bytes = 0;
+    for (const entry of performance.getEntriesByType("navigation")) {
+      bytes += /** @type {PerformanceNavigationTiming} */ (entry).transferSize;
+    }
+    for (const entry of performance.getEntriesByType("resource")) {
+      if (entry.startTime <= fcp.startTime) {
+        bytes += /** @type {PerformanceResourceTiming} */ (entry).transferSize;
+      }
+    }
+    navigator.sendBeacon(
+      `/vitals?fcp=${Math.round(fcp.startTime)}&bytes=${bytes}`,
+    );
+  });
+  observer.observe({ type: "paint", buffered: true });
+};
+
+// @ts-check
+
+/**
+ * @fileoverview Main entry point for ESP32-S3 camera web interface
+ */
 
-// Initialize the web interface
+
+// Initialize the web interface: pushed updates, or polling without them
 updateText();
-scheduleNext(0);
-rotateImg();
+reportPaint();
+if (!connectLive()) {
+  scheduleNext(0);
+  rotateImg();
+}
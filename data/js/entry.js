@@ -7,8 +7,13 @@
 import { updateText } from "./update-text.js";
 import { scheduleNext } from "./schedule-next.js";
 import { rotateImg } from "./rotate-image.js";
+import { connectLive } from "./live-events.js";
+import { reportPaint } from "./report-paint.js";
 
-// Initialize the web interface
+// Initialize the web interface: pushed updates, or polling without them
 updateText();
-scheduleNext(0);
-rotateImg();
+reportPaint();
+if (!connectLive()) {
+  scheduleNext(0);
+  rotateImg();
+}
@@ -0,0 +1,110 @@
+// @ts-check
+/**
+ * @fileoverview Server push from /events: new frames and changed status cells
+ */
+
+const liveImgElement = document.getElementById("img");
+const liveImg =
+  liveImgElement instanceof HTMLImageElement ? liveImgElement : null;
+
+/** @type {EventSource | null} Open connection, null while hidden */
+let source = null;
+
+/** @type {number} Newest frame sequence announced by the device */
+let wantedSeq = 0;
+
+/** @type {number} Sequence currently shown or loading */
+let shownSeq = 0;
+
+/** @type {boolean} Whether a frame download is in flight */
+let loading = false;
+
+/**
+ * Loads the newest announced frame; at most one download at a time
+ * @returns {void}
+ */
+function loadFrame() {
+  if (loading || wantedSeq === shownSeq) return;
+  const seq = wantedSeq;
+  const url = `/i/latest.jpg?seq=${seq}`;
+  const tmp = new Image();
+  loading = true;
+  tmp.onload = () => {
+    loading = false;
+    shownSeq = seq;
+    if (liveImg) {
+      liveImg.src = url;
+    }
+    loadFrame(); // another frame may have been announced meanwhile
+  };
+  tmp.onerror = () => {
+    loading = false; // wait for the next announcement
+  };
+  tmp.src = url;
+}
+
+/**
+ * Replaces the whole status table body
+ * @param {string} html - Full <tbody>...</tbody> markup
+ * @returns {void}
+ */
+function replaceRows(html) {
+  const tb = document.querySelector("#diagnostics-table tbody");
+  if (tb) {
+    tb.outerHTML = html;
+  }
+}
+
+/**
+ * Replaces the value cells of the named rows
+ * @param {Record<string, string>} cells - Row key to value <td> markup
+ * @returns {void}
+ */
+function updateCells(cells) {
+  const tb = document.querySelector("#diagnostics-table tbody");
+  if (!(tb instanceof HTMLTableSectionElement)) return;
+  for (const row of Array.from(tb.rows)) {
+    const key = row.cells[0]?.textContent ?? "";
+    const cell = row.cells[1];
+    if (cell && Object.prototype.hasOwnProperty.call(cells, key)) {
+      cell.outerHTML = cells[key];
+    }
+  }
+}
+
+/**
+ * Opens the event stream; EventSource reconnects on its own after errors
+ * @returns {void}
+ */
+function openEvents() {
+  if (source) return;
+  source = new EventSource("/events");
+  source.addEventListener("frame", (e) => {
+    wantedSeq = JSON.parse(e.data).seq;
+    loadFrame();
+  });
+  source.addEventListener("status", (e) => replaceRows(e.data));
+  source.addEventListener("rows", (e) => updateCells(JSON.parse(e.data)));
+}
+
+// Visibility-aware: drop the connection when hidden, reopen when visible
+document.addEventListener("visibilitychange", () => {
+  if (document.visibilityState === "visible") {
+    openEvents();
+  } else if (source) {
+    source.close();
+    source = null;
+  }
+});
+
+/**
+ * Starts live updates if the browser supports server-sent events
+ * @returns {boolean} False when the caller should fall back to polling
+ */
+export const connectLive = () => {
+  if (typeof EventSource === "undefined") return false;
+  if (document.visibilityState === "visible") {
+    openEvents();
+  }
+  return true;
+};
@@ -0,0 +1,39 @@
+// @ts-check
+/**
+ * @fileoverview Reports first contentful paint and the bytes it took to /vitals
+ */
+
+/**
+ * Sends the first contentful paint time and the bytes transferred up to it
+ * once, via a beacon; does nothing where the browser lacks the APIs
+ * @returns {void}
+ */
+export const reportPaint = () => {
+  if (
+    typeof PerformanceObserver === "undefined" ||
+    !navigator.sendBeacon ||
+    !(PerformanceObserver.supportedEntryTypes || []).includes("paint")
+  ) {
+    return;
+  }
+  const observer = new PerformanceObserver((list) => {
+    const fcp = list
+      .getEntries()
+      .find((entry) => entry.name === "first-contentful-paint");
+    if (!fcp) return;
+    observer.disconnect();
+    let bytes = 0;
+    for (const entry of performance.getEntriesByType("navigation")) {
+      bytes += /** @type {PerformanceNavigationTiming} */ (entry).transferSize;
+    }
+    for (const entry of performance.getEntriesByType("resource")) {
+      if (entry.startTime <= fcp.startTime) {
+        bytes += /** @type {PerformanceResourceTiming} */ (entry).transferSize;
+      }
+    }
+    navigator.sendBeacon(
+      `/vitals?fcp=${Math.round(fcp.startTime)}&bytes=${bytes}`,
+    );
+  });
+  observer.observe({ type: "paint", buffered: true });
+};
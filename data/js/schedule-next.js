@@ -24,6 +24,12 @@ let inFlightCtrl = null;
 /** @type {number | null} Timer ID for the next scheduled update */
 let nextTimer = null;
 
+/** @type {string | null} ETag of the snapshot currently in the table */
+let lastEtag = null;
+
+/** @type {boolean} Whether polling was started (it backs up /events) */
+let started = false;
+
 /**
  * Performs a single status update tick with error handling and race condition prevention
  * @returns {Promise<void>}
@@ -47,15 +53,24 @@ async function tick() {
 
   try {
     const r = await fetch("/status.html", {
-      cache: "no-store",
+      // Revalidate with the snapshot ETag; an unchanged snapshot is a 304
+      cache: "no-cache",
       signal: ctrl.signal,
     });
     if (!r.ok) throw new Error("HTTP " + r.status);
 
+    // Same snapshot as last time: nothing to re-render
+    const etag = r.headers.get("ETag");
+    if (etag && etag === lastEtag) {
+      failStreak = 0;
+      return;
+    }
+
     const html = await r.text();
 
     // If a newer tick started while we awaited, drop this result
     if (myGen !== generation) return;
+    lastEtag = etag;
 
     const tb = document.querySelector("#diagnostics-table tbody");
     if (tb) {
@@ -90,7 +105,7 @@ async function tick() {
 document.addEventListener("visibilitychange", () => {
   if (document.visibilityState === "visible") {
     // Start a fresh generation immediately
-    scheduleNext(0);
+    if (started) scheduleNext(0);
   } else {
     // Stop any pending work
     if (nextTimer) {
@@ -111,6 +126,7 @@ document.addEventListener("visibilitychange", () => {
  * @returns {void}
  */
 export function scheduleNext(milliseconds) {
+  started = true;
   if (nextTimer) {
     clearTimeout(nextTimer);
   }
@@ -0,0 +1,30 @@
+#pragma once
+// Host stand-in for the status LED: colours are kept, nothing lights up
+#include <Arduino.h>
+#include <vector>
+
+#define NEO_GRB ((1 << 6) | (1 << 4) | (0 << 2) | (2))
+#define NEO_KHZ800 0x0000
+
+class Adafruit_NeoPixel {
+public:
+  Adafruit_NeoPixel(uint16_t n, int16_t pin, uint16_t type = NEO_GRB)
+      : pixels(n) {}
+  void begin() {}
+  void show() {}
+  void clear() { std::fill(pixels.begin(), pixels.end(), 0); }
+  void setBrightness(uint8_t b) {}
+  void setPixelColor(uint16_t n, uint32_t c) {
+    if (n < pixels.size())
+      pixels[n] = c;
+  }
+  uint32_t getPixelColor(uint16_t n) const {
+    return n < pixels.size() ? pixels[n] : 0;
+  }
+  static uint32_t Color(uint8_t r, uint8_t g, uint8_t b) {
+    return (uint32_t)r << 16 | (uint32_t)g << 8 | b;
+  }
+
+private:
+  std::vector<uint32_t> pixels;
+};
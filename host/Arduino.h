@@ -0,0 +1,305 @@
+#pragma once
+// Host stand-in for the Arduino-ESP32 core: just the parts of String, Print,
+// Serial, timing and EspClass the firmware uses, on top of the C++ library.
+#include <algorithm>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define F(x) x
+#define PROGMEM
+#define IRAM_ATTR
+#define ARDUINO_ISR_ATTR
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define DEC 10
+#define HEX 16
+
+class String {
+public:
+  String() = default;
+  String(const char *c) : s(c ? c : "") {}
+  String(const std::string &c) : s(c) {}
+  String(char c) : s(1, c) {}
+  String(int v, unsigned char base = 10);
+  String(unsigned v, unsigned char base = 10);
+  String(long v, unsigned char base = 10);
+  String(unsigned long v, unsigned char base = 10);
+  String(long long v, unsigned char base = 10);
+  String(unsigned long long v, unsigned char base = 10);
+  String(float v, unsigned decimals = 2);
+  String(double v, unsigned decimals = 2);
+
+  size_t length() const { return s.size(); }
+  const char *c_str() const { return s.c_str(); }
+  bool reserve(size_t n) {
+    s.reserve(n);
+    return true;
+  }
+  bool isEmpty() const { return s.empty(); }
+  explicit operator bool() const { return true; }
+
+  String &operator+=(const String &o) {
+    s += o.s;
+    return *this;
+  }
+  String &operator+=(const char *o) {
+    s += o ? o : "";
+    return *this;
+  }
+  String &operator+=(char o) {
+    s += o;
+    return *this;
+  }
+  template <typename T> String &operator+=(T v) { return *this += String(v); }
+
+  bool concat(const char *c, size_t n) {
+    s.append(c, n);
+    return true;
+  }
+  bool concat(const String &o) {
+    s += o.s;
+    return true;
+  }
+  template <typename T> bool concat(T v) {
+    *this += v;
+    return true;
+  }
+
+  char operator[](size_t i) const { return i < s.size() ? s[i] : 0; }
+  char &operator[](size_t i) { return s[i]; }
+  char charAt(size_t i) const { return (*this)[i]; }
+  void setCharAt(size_t i, char c) {
+    if (i < s.size())
+      s[i] = c;
+  }
+
+  int indexOf(char c, unsigned from = 0) const { return pos(s.find(c, from)); }
+  int indexOf(const String &c, unsigned from = 0) const {
+    return pos(s.find(c.s, from));
+  }
+  int lastIndexOf(char c) const { return pos(s.rfind(c)); }
+  int lastIndexOf(const String &c) const { return pos(s.rfind(c.s)); }
+  String substring(unsigned from) const {
+    return from < s.size() ? String(s.substr(from)) : String();
+  }
+  String substring(unsigned from, unsigned to) const;
+
+  bool startsWith(const String &x) const { return s.rfind(x.s, 0) == 0; }
+  bool endsWith(const String &x) const {
+    return s.size() >= x.s.size() &&
+           s.compare(s.size() - x.s.size(), x.s.size(), x.s) == 0;
+  }
+  bool equals(const String &x) const { return s == x.s; }
+  bool equalsIgnoreCase(const String &x) const;
+  bool operator==(const String &x) const { return s == x.s; }
+  bool operator==(const char *x) const { return s == (x ? x : ""); }
+  bool operator!=(const String &x) const { return s != x.s; }
+  bool operator!=(const char *x) const { return !(*this == x); }
+  bool operator<(const String &x) const { return s < x.s; }
+
+  long toInt() const { return strtol(s.c_str(), nullptr, 10); }
+  float toFloat() const { return strtof(s.c_str(), nullptr); }
+  void trim();
+  void toLowerCase();
+  void toUpperCase();
+  void replace(const String &from, const String &to);
+  void remove(unsigned index) {
+    if (index < s.size())
+      s.erase(index);
+  }
+  void remove(unsigned index, unsigned count) {
+    if (index < s.size())
+      s.erase(index, count);
+  }
+
+  friend String operator+(const String &a, const String &b) {
+    return String(a.s + b.s);
+  }
+  friend String operator+(const String &a, const char *b) {
+    return String(a.s + (b ? b : ""));
+  }
+  friend String operator+(const char *a, const String &b) {
+    return String((a ? a : "") + b.s);
+  }
+  friend String operator+(const String &a, char b) { return String(a.s + b); }
+
+private:
+  static int pos(size_t p) { return p == std::string::npos ? -1 : (int)p; }
+  std::string s;
+};
+
+class Print;
+
+class Printable {
+public:
+  virtual ~Printable() = default;
+  virtual size_t printTo(Print &p) const = 0;
+};
+
+class Print {
+public:
+  virtual ~Print() = default;
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buf, size_t len);
+  size_t write(const char *s) { return s ? write(s, strlen(s)) : 0; }
+  size_t write(const char *buf, size_t len) {
+    return write((const uint8_t *)buf, len);
+  }
+  virtual void flush() {}
+
+  size_t print(const char *s) { return write(s); }
+  size_t print(const String &s) { return write(s.c_str(), s.length()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int v, int base = DEC) { return print((long)v, base); }
+  size_t print(unsigned v, int base = DEC) {
+    return print((unsigned long)v, base);
+  }
+  size_t print(long v, int base = DEC);
+  size_t print(unsigned long v, int base = DEC);
+  size_t print(long long v, int base = DEC);
+  size_t print(unsigned long long v, int base = DEC);
+  size_t print(double v, int digits = 2);
+  size_t print(const Printable &p) { return p.printTo(*this); }
+
+  size_t println() { return write("\r\n", 2); }
+  template <typename T> size_t println(const T &v) {
+    size_t n = print(v);
+    return n + println();
+  }
+  size_t println(double v, int digits) { return print(v, digits) + println(); }
+
+  size_t printf(const char *format, ...)
+      __attribute__((format(printf, 2, 3)));
+  size_t vprintf(const char *format, va_list args);
+};
+
+class Stream : public Print {
+public:
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+  virtual int peek() { return -1; }
+  size_t readBytes(char *buf, size_t len);
+  size_t readBytes(uint8_t *buf, size_t len) {
+    return readBytes((char *)buf, len);
+  }
+  String readStringUntil(char terminator);
+};
+
+// USB CDC console: stdout, and stdin when it has data
+class HWCDC : public Stream {
+public:
+  void begin(unsigned long baud = 0) {}
+  void end() {}
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *buf, size_t len) override;
+  using Print::write;
+  int available() override;
+  int read() override;
+  void flush() override;
+  operator bool() const { return true; }
+};
+extern HWCDC Serial;
+
+class IPAddress : public Printable {
+public:
+  IPAddress() = default;
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+      : address((uint32_t)a | (uint32_t)b << 8 | (uint32_t)c << 16 |
+                (uint32_t)d << 24) {}
+  explicit IPAddress(uint32_t a) : address(a) {}
+  operator uint32_t() const { return address; }
+  uint8_t operator[](int i) const { return (address >> (8 * i)) & 0xff; }
+  String toString() const;
+  size_t printTo(Print &p) const override { return p.print(toString()); }
+
+private:
+  uint32_t address = 0;
+};
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+// PSRAM allocations are accounted separately from internal RAM; see heap.cpp
+void *ps_malloc(size_t size);
+void *ps_calloc(size_t n, size_t size);
+void *ps_realloc(void *ptr, size_t size);
+bool psramFound();
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define INPUT_PULLDOWN 0x09
+#define LOW 0x0
+#define HIGH 0x1
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+#define digitalPinToInterrupt(p) (p)
+
+// No GPIO on the host: inputs read high, interrupts never fire
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t value);
+void attachInterrupt(uint8_t pin, void (*fn)(void), int mode);
+void attachInterruptArg(uint8_t pin, void (*fn)(void *), void *arg,
+                        int mode);
+void detachInterrupt(uint8_t pin);
+
+class EspClass {
+public:
+  uint32_t getHeapSize();
+  uint32_t getFreeHeap();
+  uint32_t getMinFreeHeap();
+  uint32_t getMaxAllocHeap();
+  uint32_t getPsramSize();
+  uint32_t getFreePsram();
+  uint32_t getMinFreePsram();
+  uint32_t getMaxAllocPsram();
+  const char *getChipModel() { return "host"; }
+  uint8_t getChipRevision() { return 0; }
+  uint8_t getChipCores() { return 2; }
+  uint32_t getCpuFreqMHz() { return 240; }
+  const char *getSdkVersion();
+  uint32_t getFlashChipSize() { return 16 * 1024 * 1024; }
+  uint32_t getFlashChipSpeed() { return 80000000; }
+  int getFlashChipMode() { return 0; }
+  uint32_t getSketchSize() { return 0; }
+  uint32_t getFreeSketchSpace() { return 0; }
+  String getSketchMD5() { return String("00000000000000000000000000000000"); }
+  uint64_t getEfuseMac();
+  // Re-executes the process with the same arguments, like a reboot
+  [[noreturn]] void restart();
+};
+extern EspClass ESP;
+
+using std::max;
+using std::min;
+template <class T, class L, class H>
+auto constrain(const T &v, const L &lo, const H &hi) {
+  return v < lo ? lo : v > hi ? hi : v;
+}
+
+// Provided by the sketch (src/main.cpp)
+void setup();
+void loop();
@@ -0,0 +1,117 @@
+#pragma once
+// Host stand-in for AsyncTCP on BSD sockets. One "async_tcp" task polls
+// every connection and runs the callbacks, as the real library does on its
+// own task. write() may be called from any task: it copies into a send
+// window of TCP_SND_BUF bytes, and the bytes count as acknowledged once the
+// kernel has taken them. Connections are polled every 500 ms, like lwIP.
+#include <Arduino.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include "lwip/opt.h"
+
+#define ASYNC_WRITE_FLAG_COPY 0x01
+#define ASYNC_WRITE_FLAG_MORE 0x02
+
+class AsyncClient;
+class AsyncServer;
+
+typedef std::function<void(void *, AsyncClient *)> AcConnectHandler;
+typedef std::function<void(void *, AsyncClient *, size_t len, uint32_t time)>
+    AcAckHandler;
+typedef std::function<void(void *, AsyncClient *, int8_t error)>
+    AcErrorHandler;
+typedef std::function<void(void *, AsyncClient *, void *data, size_t len)>
+    AcDataHandler;
+typedef std::function<void(void *, AsyncClient *, uint32_t time)>
+    AcTimeoutHandler;
+
+class AsyncClient {
+public:
+  // Adopts a connected socket; the async_tcp task owns the client from
+  // here on and frees it after the disconnect callback has run
+  explicit AsyncClient(int fd);
+  AsyncClient(const AsyncClient &) = delete;
+  AsyncClient &operator=(const AsyncClient &) = delete;
+
+  size_t space();
+  bool canSend() { return space() > 0; }
+  size_t add(const char *data, size_t size,
+             uint8_t apiflags = ASYNC_WRITE_FLAG_COPY);
+  bool send();
+  size_t write(const char *data) { return write(data, strlen(data)); }
+  size_t write(const char *data, size_t size,
+               uint8_t apiflags = ASYNC_WRITE_FLAG_COPY);
+  // Sends what is queued (unless `now`), closes the socket and runs the
+  // disconnect callback on the calling task
+  void close(bool now = false);
+  void abort() { close(true); }
+  bool connected() { return open.load(); }
+  bool freeable() { return !open.load(); }
+
+  uint16_t getMss() { return TCP_MSS; }
+  uint32_t getRxTimeout() { return rxTimeout; }
+  void setRxTimeout(uint32_t seconds) { rxTimeout = seconds; }
+  void setNoDelay(bool nodelay);
+  void setAckTimeout(uint32_t ms) {}
+  IPAddress remoteIP();
+  uint16_t remotePort();
+  IPAddress localIP();
+  uint16_t localPort();
+
+  void onConnect(AcConnectHandler cb, void *arg = nullptr);
+  void onDisconnect(AcConnectHandler cb, void *arg = nullptr);
+  void onAck(AcAckHandler cb, void *arg = nullptr);
+  void onError(AcErrorHandler cb, void *arg = nullptr);
+  void onData(AcDataHandler cb, void *arg = nullptr);
+  void onTimeout(AcTimeoutHandler cb, void *arg = nullptr);
+  void onPoll(AcConnectHandler cb, void *arg = nullptr);
+
+private:
+  friend struct AsyncTcpLoop;
+  ~AsyncClient();
+  void transmit();
+  void flush(int timeoutMs);
+  void drop(); // shuts the socket down, then runs the disconnect callback
+
+  std::mutex lock; // fd, tx and unacked
+  int fd;
+  std::atomic<bool> open{true};
+  bool released = false; // disconnect callback done; under the loop's lock
+  std::string tx;       // written, not yet taken by the kernel
+  size_t unacked = 0;   // taken by the kernel, not yet reported to onAck
+  uint32_t rxTimeout = 0;
+  uint32_t lastRx;
+  uint32_t lastPoll;
+
+  AcConnectHandler disconnectCb, pollCb;
+  AcAckHandler ackCb;
+  AcErrorHandler errorCb;
+  AcDataHandler dataCb;
+  AcTimeoutHandler timeoutCb;
+  void *disconnectArg = nullptr, *pollArg = nullptr, *ackArg = nullptr,
+       *errorArg = nullptr, *dataArg = nullptr, *timeoutArg = nullptr;
+};
+
+class AsyncServer {
+public:
+  explicit AsyncServer(uint16_t port) : port_(port) {}
+  ~AsyncServer() { end(); }
+  void onClient(AcConnectHandler cb, void *arg);
+  void begin();
+  void end();
+  void setNoDelay(bool nodelay) { noDelay = nodelay; }
+  uint16_t port() const { return port_; } // as bound, after begin()
+  void setPort(uint16_t port) { port_ = port; } // host only, before begin()
+  // Hands over a connected socket as if it had been accepted
+  void adopt(int fd);
+
+private:
+  friend struct AsyncTcpLoop;
+  void accept();
+  uint16_t port_;
+  int fd = -1;
+  bool noDelay = false;
+  AcConnectHandler connectCb;
+  void *connectArg = nullptr;
+};
@@ -0,0 +1,415 @@
+#pragma once
+// Host stand-in for ESPAsyncWebServer (esphome 3.1): the parts of the
+// request, response, handler and event-source API the firmware uses, on
+// the host AsyncTCP. Responses follow the library's own state machine
+// (_respond, then _ack as the window frees), so the custom responses in
+// src/ run unchanged. Every response is sent with "Connection: close".
+// Template processors are not supported.
+#include <Arduino.h>
+#include <FS.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "AsyncTCP.h"
+
+#define RESPONSE_TRY_AGAIN 0xFFFFFFFF
+
+typedef enum {
+  HTTP_GET = 0b00000001,
+  HTTP_POST = 0b00000010,
+  HTTP_DELETE = 0b00000100,
+  HTTP_PUT = 0b00001000,
+  HTTP_PATCH = 0b00010000,
+  HTTP_HEAD = 0b00100000,
+  HTTP_OPTIONS = 0b01000000,
+  HTTP_ANY = 0b01111111,
+} WebRequestMethod;
+typedef uint8_t WebRequestMethodComposite;
+
+class AsyncWebServer;
+class AsyncWebServerRequest;
+class AsyncWebServerResponse;
+class AsyncResponseStream;
+class AsyncWebHandler;
+
+typedef std::function<String(const String &)> AwsTemplateProcessor;
+typedef std::function<size_t(uint8_t *, size_t, size_t)> AwsResponseFiller;
+typedef std::function<void(AsyncWebServerRequest *)> ArRequestHandlerFunction;
+typedef std::function<void(AsyncWebServerRequest *, const String &, size_t,
+                           uint8_t *, size_t, bool)>
+    ArUploadHandlerFunction;
+typedef std::function<void(AsyncWebServerRequest *, uint8_t *, size_t, size_t,
+                           size_t)>
+    ArBodyHandlerFunction;
+typedef std::function<void(void)> ArDisconnectHandler;
+
+class AsyncWebHeader {
+public:
+  AsyncWebHeader(const String &name, const String &value)
+      : _name(name), _value(value) {}
+  const String &name() const { return _name; }
+  const String &value() const { return _value; }
+
+private:
+  String _name;
+  String _value;
+};
+
+class AsyncWebParameter {
+public:
+  AsyncWebParameter(const String &name, const String &value, bool form)
+      : _name(name), _value(value), _isForm(form) {}
+  const String &name() const { return _name; }
+  const String &value() const { return _value; }
+  size_t size() const { return _value.length(); }
+  bool isPost() const { return _isForm; }
+  bool isFile() const { return false; }
+
+private:
+  String _name;
+  String _value;
+  bool _isForm;
+};
+
+typedef enum {
+  RESPONSE_SETUP,
+  RESPONSE_HEADERS,
+  RESPONSE_CONTENT,
+  RESPONSE_WAIT_ACK,
+  RESPONSE_END,
+  RESPONSE_FAILED
+} WebResponseState;
+
+class AsyncWebServerResponse {
+protected:
+  int _code;
+  std::list<AsyncWebHeader> _headers;
+  String _contentType;
+  size_t _contentLength;
+  bool _sendContentLength;
+  bool _chunked;
+  size_t _headLength;
+  size_t _sentLength;
+  size_t _ackedLength;
+  size_t _writtenLength;
+  WebResponseState _state;
+  static const char *_responseCodeToString(int code);
+
+public:
+  AsyncWebServerResponse();
+  virtual ~AsyncWebServerResponse() = default;
+  virtual void setCode(int code);
+  virtual void setContentLength(size_t len);
+  virtual void setContentType(const String &type);
+  virtual void addHeader(const String &name, const String &value);
+  virtual String _assembleHead(uint8_t version);
+  virtual bool _started() const;
+  virtual bool _finished() const;
+  virtual bool _failed() const;
+  virtual bool _sourceValid() const;
+  virtual void _respond(AsyncWebServerRequest *request);
+  virtual size_t _ack(AsyncWebServerRequest *request, size_t len,
+                      uint32_t time);
+};
+
+class AsyncBasicResponse : public AsyncWebServerResponse {
+public:
+  AsyncBasicResponse(int code, const String &contentType = String(),
+                     const String &content = String());
+  void _respond(AsyncWebServerRequest *request) override;
+  size_t _ack(AsyncWebServerRequest *request, size_t len,
+              uint32_t time) override;
+  bool _sourceValid() const override { return true; }
+
+private:
+  String _content;
+};
+
+class AsyncAbstractResponse : public AsyncWebServerResponse {
+private:
+  String _head;
+
+protected:
+  AwsTemplateProcessor _callback;
+
+public:
+  AsyncAbstractResponse(AwsTemplateProcessor callback = nullptr);
+  void _respond(AsyncWebServerRequest *request) override;
+  size_t _ack(AsyncWebServerRequest *request, size_t len,
+              uint32_t time) override;
+  bool _sourceValid() const override { return false; }
+  virtual size_t _fillBuffer(uint8_t *buf, size_t maxLen) { return 0; }
+};
+
+class AsyncFileResponse : public AsyncAbstractResponse {
+public:
+  AsyncFileResponse(FS &fs, const String &path,
+                    const String &contentType = String(),
+                    bool download = false,
+                    AwsTemplateProcessor callback = nullptr);
+  bool _sourceValid() const override { return (bool)_content; }
+  size_t _fillBuffer(uint8_t *buf, size_t maxLen) override;
+
+private:
+  File _content;
+};
+
+class AsyncCallbackResponse : public AsyncAbstractResponse {
+public:
+  AsyncCallbackResponse(const String &contentType, size_t len,
+                        AwsResponseFiller callback,
+                        AwsTemplateProcessor templateCallback = nullptr);
+  bool _sourceValid() const override { return (bool)_content; }
+  size_t _fillBuffer(uint8_t *buf, size_t maxLen) override;
+
+protected:
+  AwsResponseFiller _content;
+  size_t _filledLength = 0;
+};
+
+class AsyncChunkedResponse : public AsyncCallbackResponse {
+public:
+  AsyncChunkedResponse(const String &contentType, AwsResponseFiller callback,
+                       AwsTemplateProcessor templateCallback = nullptr);
+};
+
+class AsyncProgmemResponse : public AsyncAbstractResponse {
+public:
+  AsyncProgmemResponse(int code, const String &contentType,
+                       const uint8_t *content, size_t len,
+                       AwsTemplateProcessor callback = nullptr);
+  bool _sourceValid() const override { return true; }
+  size_t _fillBuffer(uint8_t *buf, size_t maxLen) override;
+
+private:
+  const uint8_t *_content;
+  size_t _readLength = 0;
+};
+
+class AsyncResponseStream : public AsyncAbstractResponse, public Print {
+public:
+  AsyncResponseStream(const String &contentType, size_t bufferSize);
+  bool _sourceValid() const override { return _state < RESPONSE_END; }
+  size_t _fillBuffer(uint8_t *buf, size_t maxLen) override;
+  size_t write(const uint8_t *data, size_t len) override;
+  size_t write(uint8_t data) override;
+  using Print::write;
+
+private:
+  std::string _content;
+  size_t _readLength = 0;
+};
+
+class AsyncWebServerRequest {
+public:
+  AsyncWebServerRequest(AsyncWebServer *server, AsyncClient *client);
+  ~AsyncWebServerRequest();
+
+  AsyncClient *client() { return _client; }
+  uint8_t version() const { return _version; }
+  WebRequestMethodComposite method() const { return _method; }
+  const String &url() const { return _url; }
+  const String &host() const { return _host; }
+  const char *methodToString() const;
+
+  void redirect(const String &url);
+  void send(AsyncWebServerResponse *response);
+  void send(int code, const String &contentType = String(),
+            const String &content = String());
+  void send(FS &fs, const String &path, const String &contentType = String(),
+            bool download = false, AwsTemplateProcessor callback = nullptr);
+  void send(const String &contentType, size_t len, AwsResponseFiller callback,
+            AwsTemplateProcessor templateCallback = nullptr);
+  void sendChunked(const String &contentType, AwsResponseFiller callback,
+                   AwsTemplateProcessor templateCallback = nullptr);
+
+  AsyncWebServerResponse *beginResponse(int code,
+                                        const String &contentType = String(),
+                                        const String &content = String());
+  AsyncWebServerResponse *beginResponse(
+      FS &fs, const String &path, const String &contentType = String(),
+      bool download = false, AwsTemplateProcessor callback = nullptr);
+  AsyncWebServerResponse *beginResponse(
+      const String &contentType, size_t len, AwsResponseFiller callback,
+      AwsTemplateProcessor templateCallback = nullptr);
+  AsyncWebServerResponse *beginChunkedResponse(
+      const String &contentType, AwsResponseFiller callback,
+      AwsTemplateProcessor templateCallback = nullptr);
+  AsyncResponseStream *beginResponseStream(const String &contentType,
+                                           size_t bufferSize = 1460);
+  AsyncWebServerResponse *beginResponse_P(
+      int code, const String &contentType, const uint8_t *content, size_t len,
+      AwsTemplateProcessor callback = nullptr);
+
+  size_t headers() const { return _headers.size(); }
+  bool hasHeader(const String &name) const;
+  AsyncWebHeader *getHeader(const String &name) const;
+  const String &header(const char *name) const;
+  size_t params() const { return _params.size(); }
+  bool hasParam(const String &name, bool post = false,
+                bool file = false) const;
+  AsyncWebParameter *getParam(const String &name, bool post = false,
+                              bool file = false) const;
+  const String &arg(const String &name) const;
+  bool hasArg(const char *name) const;
+
+  void onDisconnect(ArDisconnectHandler fn) { _onDisconnectfn = fn; }
+
+private:
+  friend class AsyncWebServer;
+  void _onData(void *buf, size_t len);
+  void _onAck(size_t len, uint32_t time);
+  void _onPoll();
+  void _onDisconnect();
+  bool _parseHead(); // false on a malformed request
+  void _addParams(const String &query, bool form);
+  void _handle();
+  void _closeIfFinished();
+
+  bool *_gone = nullptr; // set when a callback frees the request under us
+  AsyncWebServer *_server;
+  AsyncClient *_client;
+  AsyncWebServerResponse *_response = nullptr;
+  ArDisconnectHandler _onDisconnectfn;
+  std::string _in;
+  size_t _bodyLength = 0;
+  bool _handled = false;
+  uint8_t _version = 1;
+  WebRequestMethodComposite _method = HTTP_GET;
+  String _url;
+  String _host;
+  std::vector<std::unique_ptr<AsyncWebHeader>> _headers;
+  std::vector<std::unique_ptr<AsyncWebParameter>> _params;
+};
+
+class AsyncWebHandler {
+public:
+  virtual ~AsyncWebHandler() = default;
+  virtual bool canHandle(AsyncWebServerRequest *request) { return false; }
+  virtual void handleRequest(AsyncWebServerRequest *request) {}
+  // True when handleRequest() takes over the connection itself, as the
+  // event source does; the request is freed once the handler returns
+  virtual bool takesConnection() const { return false; }
+};
+
+class AsyncCallbackWebHandler : public AsyncWebHandler {
+public:
+  AsyncCallbackWebHandler(const String &uri, WebRequestMethodComposite method,
+                          ArRequestHandlerFunction onRequest)
+      : _uri(uri), _method(method), _onRequest(onRequest) {}
+  bool canHandle(AsyncWebServerRequest *request) override;
+  void handleRequest(AsyncWebServerRequest *request) override;
+
+private:
+  String _uri;
+  WebRequestMethodComposite _method;
+  ArRequestHandlerFunction _onRequest;
+};
+
+class AsyncStaticWebHandler : public AsyncWebHandler {
+public:
+  AsyncStaticWebHandler(const char *uri, FS &fs, const char *path,
+                        const char *cacheControl);
+  bool canHandle(AsyncWebServerRequest *request) override;
+  void handleRequest(AsyncWebServerRequest *request) override;
+  AsyncStaticWebHandler &setCacheControl(const char *cacheControl);
+  AsyncStaticWebHandler &setDefaultFile(const char *filename);
+
+private:
+  bool find(const String &path, String &found) const;
+  FS &_fs;
+  String _uri;
+  String _path;
+  String _defaultFile = "index.htm";
+  String _cacheControl;
+};
+
+class AsyncEventSource;
+
+class AsyncEventSourceClient {
+public:
+  AsyncEventSourceClient(AsyncWebServerRequest *request,
+                         AsyncEventSource *server);
+  void send(const char *message, const char *event = nullptr, uint32_t id = 0,
+            uint32_t reconnect = 0);
+  bool connected() const { return _client && _client->connected(); }
+  uint32_t lastId() const { return _lastId; }
+  size_t packetsWaiting() const;
+  AsyncClient *client() { return _client; }
+
+private:
+  friend class AsyncEventSource;
+  void _write(std::string message);
+  void _pump(); // sends what the window takes; under the source's lock
+  AsyncClient *_client;
+  AsyncEventSource *_server;
+  std::list<std::string> _messages; // the front one partly sent
+  size_t _sent = 0;
+  uint32_t _lastId = 0;
+};
+
+typedef std::function<void(AsyncEventSourceClient *)> ArEventHandlerFunction;
+
+class AsyncEventSource : public AsyncWebHandler {
+public:
+  explicit AsyncEventSource(const String &url) : _url(url) {}
+  ~AsyncEventSource() override;
+  const char *url() const { return _url.c_str(); }
+  void close();
+  void onConnect(ArEventHandlerFunction cb) { _connectcb = cb; }
+  void send(const char *message, const char *event = nullptr, uint32_t id = 0,
+            uint32_t reconnect = 0);
+  size_t count() const;
+  size_t avgPacketsWaiting() const;
+  bool canHandle(AsyncWebServerRequest *request) override;
+  void handleRequest(AsyncWebServerRequest *request) override;
+  bool takesConnection() const override { return true; }
+
+private:
+  friend class AsyncEventSourceClient;
+  void _drop(AsyncEventSourceClient *client);
+  String _url;
+  mutable std::recursive_mutex _lock;
+  std::list<std::unique_ptr<AsyncEventSourceClient>> _clients;
+  ArEventHandlerFunction _connectcb;
+};
+
+class AsyncWebServer {
+public:
+  explicit AsyncWebServer(uint16_t port);
+  ~AsyncWebServer();
+  void begin();
+  void end();
+
+  AsyncCallbackWebHandler &on(const char *uri,
+                              ArRequestHandlerFunction onRequest);
+  AsyncCallbackWebHandler &on(const char *uri,
+                              WebRequestMethodComposite method,
+                              ArRequestHandlerFunction onRequest);
+  AsyncCallbackWebHandler &on(const char *uri,
+                              WebRequestMethodComposite method,
+                              ArRequestHandlerFunction onRequest,
+                              ArUploadHandlerFunction onUpload);
+  AsyncCallbackWebHandler &on(const char *uri,
+                              WebRequestMethodComposite method,
+                              ArRequestHandlerFunction onRequest,
+                              ArUploadHandlerFunction onUpload,
+                              ArBodyHandlerFunction onBody);
+  AsyncStaticWebHandler &serveStatic(const char *uri, FS &fs,
+                                     const char *path,
+                                     const char *cacheControl = nullptr);
+  AsyncWebHandler &addHandler(AsyncWebHandler *handler);
+  void onNotFound(ArRequestHandlerFunction fn) { _notFound = fn; }
+  void reset();
+
+  AsyncServer &server() { return _server; } // for Host::fetch()
+
+private:
+  friend class AsyncWebServerRequest;
+  void _attach(AsyncWebServerRequest *request);
+  AsyncServer _server;
+  std::vector<AsyncWebHandler *> _handlers;
+  std::vector<std::unique_ptr<AsyncWebHandler>> _owned;
+  ArRequestHandlerFunction _notFound;
+};
@@ -0,0 +1,14 @@
+#pragma once
+// Host stand-in for mDNS: names are not advertised
+#include <Arduino.h>
+
+class MDNSResponder {
+public:
+  bool begin(const char *hostName) { return true; }
+  void end() {}
+  bool addService(const char *service, const char *proto, uint16_t port) {
+    return true;
+  }
+};
+
+extern MDNSResponder MDNS;
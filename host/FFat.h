@@ -0,0 +1,18 @@
+#pragma once
+// Host stand-in for FFat: the "ffat" partition is <data dir>/ffat. Sizes
+// are reported against the partition size, in 4 KiB clusters.
+#include "FS.h"
+
+class F_Fat : public fs::FS {
+public:
+  F_Fat() : fs::FS("ffat") {}
+  bool begin(bool formatOnFail = false, const char *basePath = "/ffat",
+             uint8_t maxOpenFiles = 10, const char *partitionLabel = "ffat");
+  bool format(bool fullWipe = false, char *partitionLabel = nullptr);
+  void end();
+  size_t totalBytes();
+  size_t usedBytes();
+  size_t freeBytes();
+};
+
+extern F_Fat FFat;
@@ -0,0 +1,78 @@
+#pragma once
+// Host stand-in for the Arduino FS layer: paths map onto a directory of the
+// host filesystem (see FFat.h). A File is a shared handle, as on the chip.
+#include <Arduino.h>
+#include <ctime>
+#include <memory>
+
+namespace fs {
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+struct FileImpl;
+
+class File : public Stream {
+public:
+  File() = default;
+  explicit File(std::shared_ptr<FileImpl> impl) : impl(std::move(impl)) {}
+
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *buf, size_t len) override;
+  using Print::write;
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t read(uint8_t *buf, size_t len);
+  bool seek(uint32_t pos, SeekMode mode = SeekSet);
+  size_t position() const;
+  size_t size() const;
+  void flush() override;
+  void close();
+  time_t getLastWrite();
+  const char *name() const;
+  const char *path() const;
+  bool isDirectory() const;
+  File openNextFile(const char *mode = "r");
+  void rewindDirectory();
+  operator bool() const;
+
+private:
+  std::shared_ptr<FileImpl> impl;
+};
+
+class FS {
+public:
+  explicit FS(const char *subdir) : subdir(subdir) {}
+  File open(const char *path, const char *mode = "r",
+            const bool create = false);
+  File open(const String &path, const char *mode = "r",
+            const bool create = false) {
+    return open(path.c_str(), mode, create);
+  }
+  bool exists(const char *path);
+  bool exists(const String &path) { return exists(path.c_str()); }
+  bool remove(const char *path);
+  bool remove(const String &path) { return remove(path.c_str()); }
+  bool rename(const char *from, const char *to);
+  bool rename(const String &from, const String &to) {
+    return rename(from.c_str(), to.c_str());
+  }
+  bool mkdir(const char *path);
+  bool mkdir(const String &path) { return mkdir(path.c_str()); }
+  bool rmdir(const char *path);
+  bool rmdir(const String &path) { return rmdir(path.c_str()); }
+
+protected:
+  std::string hostPath(const char *path) const;
+  const char *subdir; // under Host::dataDir()
+  bool mounted = false;
+};
+
+} // namespace fs
+
+using fs::File;
+using fs::FS;
+using fs::SeekCur;
+using fs::SeekEnd;
+using fs::SeekMode;
+using fs::SeekSet;
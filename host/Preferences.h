@@ -0,0 +1,24 @@
+#pragma once
+// Host stand-in for NVS Preferences: one file per namespace under
+// <data dir>/nvs, rewritten on every put
+#include <Arduino.h>
+#include <map>
+
+class Preferences {
+public:
+  bool begin(const char *name, bool readOnly = false,
+             const char *partition = nullptr);
+  void end();
+  bool clear();
+  bool remove(const char *key);
+  bool isKey(const char *key);
+  uint32_t getUInt(const char *key, uint32_t defaultValue = 0);
+  size_t putUInt(const char *key, uint32_t value);
+
+private:
+  bool save();
+  std::string path;
+  std::map<std::string, uint32_t> values;
+  bool readOnly = false;
+  bool started = false;
+};
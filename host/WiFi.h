@@ -0,0 +1,53 @@
+#pragma once
+// Host stand-in for the Wi-Fi station: always connected, on the loopback
+// address, so the web server is reachable at 127.0.0.1
+#include <Arduino.h>
+
+typedef enum {
+  WL_NO_SHIELD = 255,
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL,
+  WL_SCAN_COMPLETED,
+  WL_CONNECTED,
+  WL_CONNECT_FAILED,
+  WL_CONNECTION_LOST,
+  WL_DISCONNECTED
+} wl_status_t;
+
+typedef enum { WIFI_OFF, WIFI_STA, WIFI_AP, WIFI_AP_STA } wifi_mode_t;
+
+class WiFiClass {
+public:
+  wl_status_t begin(const char *ssid, const char *passphrase = nullptr);
+  bool disconnect(bool wifiOff = false, bool eraseAp = false);
+  wl_status_t status();
+  bool isConnected() { return status() == WL_CONNECTED; }
+  bool mode(wifi_mode_t m);
+  wifi_mode_t getMode();
+  bool softAP(const char *ssid, const char *passphrase = nullptr,
+              int channel = 1, int ssidHidden = 0, int maxConnection = 4);
+  bool setHostname(const char *name);
+  const char *getHostname();
+  void setSleep(bool enable) {}
+  int16_t scanNetworks(bool async = false, bool showHidden = false);
+  String SSID();
+  String SSID(uint8_t i);
+  int8_t RSSI();
+  int8_t RSSI(uint8_t i);
+  int32_t channel();
+  int32_t channel(uint8_t i);
+  String macAddress();
+  String BSSIDstr();
+  IPAddress localIP();
+  IPAddress gatewayIP();
+  IPAddress subnetMask();
+  IPAddress dnsIP(uint8_t i = 0);
+  IPAddress softAPIP();
+
+private:
+  String ssid;
+  wifi_mode_t wifiMode = WIFI_OFF;
+  bool connected = false;
+};
+
+extern WiFiClass WiFi;
@@ -0,0 +1,303 @@
+// Arduino core stand-in: String, Print, Serial, timing and EspClass
+#include <Arduino.h>
+#include "esp_system.h"
+#include <cctype>
+#include <mutex>
+#include <poll.h>
+#include <random>
+#include <thread>
+#include <unistd.h>
+
+HWCDC Serial;
+EspClass ESP;
+
+// ---- String ----
+
+static std::string integer(unsigned long long v, bool negative,
+                           unsigned char base) {
+  if (base < 2 || base > 36)
+    base = 10;
+  std::string out;
+  do {
+    int d = v % base;
+    out += (char)(d < 10 ? '0' + d : 'a' + d - 10);
+    v /= base;
+  } while (v);
+  if (negative)
+    out += '-';
+  return std::string(out.rbegin(), out.rend());
+}
+
+static std::string signedInteger(long long v, unsigned char base) {
+  // Like the core, only base 10 prints a sign
+  if (base == 10 && v < 0)
+    return integer(0ull - (unsigned long long)v, true, base);
+  return integer((unsigned long long)v, false, base);
+}
+
+static std::string decimal(double v, unsigned decimals) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%.*f", (int)decimals, v);
+  return buf;
+}
+
+String::String(int v, unsigned char base) : s(signedInteger(v, base)) {}
+String::String(unsigned v, unsigned char base) : s(integer(v, false, base)) {}
+String::String(long v, unsigned char base) : s(signedInteger(v, base)) {}
+String::String(unsigned long v, unsigned char base)
+    : s(integer(v, false, base)) {}
+String::String(long long v, unsigned char base) : s(signedInteger(v, base)) {}
+String::String(unsigned long long v, unsigned char base)
+    : s(integer(v, false, base)) {}
+String::String(float v, unsigned decimals) : s(decimal(v, decimals)) {}
+String::String(double v, unsigned decimals) : s(decimal(v, decimals)) {}
+
+String String::substring(unsigned from, unsigned to) const {
+  if (from > to)
+    std::swap(from, to);
+  if (from >= s.size())
+    return String();
+  return String(s.substr(from, std::min<size_t>(to, s.size()) - from));
+}
+
+bool String::equalsIgnoreCase(const String &x) const {
+  if (s.size() != x.s.size())
+    return false;
+  for (size_t i = 0; i < s.size(); i++)
+    if (tolower((unsigned char)s[i]) != tolower((unsigned char)x.s[i]))
+      return false;
+  return true;
+}
+
+void String::trim() {
+  size_t first = 0, last = s.size();
+  while (first < last && isspace((unsigned char)s[first]))
+    first++;
+  while (last > first && isspace((unsigned char)s[last - 1]))
+    last--;
+  s = s.substr(first, last - first);
+}
+
+void String::toLowerCase() {
+  for (char &c : s)
+    c = tolower((unsigned char)c);
+}
+
+void String::toUpperCase() {
+  for (char &c : s)
+    c = toupper((unsigned char)c);
+}
+
+void String::replace(const String &from, const String &to) {
+  if (from.s.empty())
+    return;
+  for (size_t at = s.find(from.s); at != std::string::npos;
+       at = s.find(from.s, at + to.s.size()))
+    s.replace(at, from.s.size(), to.s);
+}
+
+// ---- Print ----
+
+size_t Print::write(const uint8_t *buf, size_t len) {
+  size_t n = 0;
+  while (len--) {
+    if (!write(*buf++))
+      break;
+    n++;
+  }
+  return n;
+}
+
+size_t Print::print(long v, int base) {
+  std::string s = signedInteger(v, base);
+  return write(s.data(), s.size());
+}
+
+size_t Print::print(unsigned long v, int base) {
+  std::string s = integer(v, false, base);
+  return write(s.data(), s.size());
+}
+
+size_t Print::print(long long v, int base) {
+  std::string s = signedInteger(v, base);
+  return write(s.data(), s.size());
+}
+
+size_t Print::print(unsigned long long v, int base) {
+  std::string s = integer(v, false, base);
+  return write(s.data(), s.size());
+}
+
+size_t Print::print(double v, int digits) {
+  std::string s = decimal(v, digits);
+  return write(s.data(), s.size());
+}
+
+size_t Print::printf(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  size_t n = vprintf(format, args);
+  va_end(args);
+  return n;
+}
+
+size_t Print::vprintf(const char *format, va_list args) {
+  // Formatted on the stack when it fits
+  char small[256];
+  va_list copy;
+  va_copy(copy, args);
+  int len = vsnprintf(small, sizeof(small), format, copy);
+  va_end(copy);
+  if (len < 0)
+    return 0;
+  if ((size_t)len < sizeof(small))
+    return write((const uint8_t *)small, len);
+  std::unique_ptr<char[]> big(new char[len + 1]);
+  vsnprintf(big.get(), len + 1, format, args);
+  return write((const uint8_t *)big.get(), len);
+}
+
+// ---- Stream ----
+
+size_t Stream::readBytes(char *buf, size_t len) {
+  size_t n = 0;
+  while (n < len) {
+    int c = read();
+    if (c < 0)
+      break;
+    buf[n++] = (char)c;
+  }
+  return n;
+}
+
+String Stream::readStringUntil(char terminator) {
+  String out;
+  for (int c = read(); c >= 0 && c != terminator; c = read())
+    out += (char)c;
+  return out;
+}
+
+// ---- Serial: stdout, and stdin without blocking ----
+
+static std::mutex serialLock;
+
+size_t HWCDC::write(uint8_t c) { return write(&c, 1); }
+
+// Line buffered even into a pipe or file, so a log shows each line as the
+// console would
+size_t HWCDC::write(const uint8_t *buf, size_t len) {
+  std::lock_guard<std::mutex> guard(serialLock);
+  size_t n = fwrite(buf, 1, len, stdout);
+  if (memchr(buf, '\n', len))
+    fflush(stdout);
+  return n;
+}
+
+void HWCDC::flush() {
+  std::lock_guard<std::mutex> guard(serialLock);
+  fflush(stdout);
+}
+
+int HWCDC::available() {
+  pollfd p = {STDIN_FILENO, POLLIN, 0};
+  return poll(&p, 1, 0) == 1 && (p.revents & POLLIN) ? 1 : 0;
+}
+
+int HWCDC::read() {
+  if (!available())
+    return -1;
+  unsigned char c;
+  return ::read(STDIN_FILENO, &c, 1) == 1 ? c : -1;
+}
+
+// ---- IPAddress ----
+
+String IPAddress::toString() const {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%u.%u.%u.%u", (*this)[0], (*this)[1],
+           (*this)[2], (*this)[3]);
+  return String(buf);
+}
+
+// ---- Timing ----
+
+unsigned long millis() { return (unsigned long)(esp_timer_get_time() / 1000); }
+
+unsigned long micros() { return (unsigned long)esp_timer_get_time(); }
+
+void delay(uint32_t ms) { vTaskDelay(pdMS_TO_TICKS(ms)); }
+
+void delayMicroseconds(uint32_t us) {
+  std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void yield() { std::this_thread::yield(); }
+
+// ---- Random ----
+
+static std::mutex randomLock;
+static std::minstd_rand randomEngine(1);
+
+long random(long max) { return max <= 0 ? 0 : random(0, max); }
+
+long random(long min, long max) {
+  if (min >= max)
+    return min;
+  std::lock_guard<std::mutex> guard(randomLock);
+  return min + (long)(randomEngine() % (unsigned long)(max - min));
+}
+
+void randomSeed(unsigned long seed) {
+  std::lock_guard<std::mutex> guard(randomLock);
+  randomEngine.seed(seed ? seed : 1);
+}
+
+// ---- GPIO ----
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+int digitalRead(uint8_t pin) { return HIGH; }
+void digitalWrite(uint8_t pin, uint8_t value) {}
+void attachInterrupt(uint8_t pin, void (*fn)(void), int mode) {}
+void attachInterruptArg(uint8_t pin, void (*fn)(void *), void *arg,
+                        int mode) {}
+void detachInterrupt(uint8_t pin) {}
+
+// ---- EspClass: the heap figures come from heap.cpp ----
+
+uint32_t EspClass::getHeapSize() {
+  return heap_caps_get_total_size(MALLOC_CAP_INTERNAL);
+}
+
+uint32_t EspClass::getFreeHeap() {
+  return heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+}
+
+uint32_t EspClass::getMinFreeHeap() {
+  return heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+}
+
+uint32_t EspClass::getMaxAllocHeap() {
+  return heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+}
+
+uint32_t EspClass::getPsramSize() {
+  return heap_caps_get_total_size(MALLOC_CAP_SPIRAM);
+}
+
+uint32_t EspClass::getFreePsram() {
+  return heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+}
+
+uint32_t EspClass::getMinFreePsram() {
+  return heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM);
+}
+
+uint32_t EspClass::getMaxAllocPsram() {
+  return heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+}
+
+const char *EspClass::getSdkVersion() { return esp_get_idf_version(); }
+
+uint64_t EspClass::getEfuseMac() { return 0x0000a1b2c3d4e5f6ull; }
+
+void EspClass::restart() { esp_restart(); }
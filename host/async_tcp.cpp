@@ -0,0 +1,395 @@
+// AsyncTCP on non-blocking sockets and poll(). The async_tcp task owns the
+// clients: it accepts, reads, reports acknowledged bytes, polls, and frees
+// a client on the pass after its disconnect callback has returned.
+#include "AsyncTCP.h"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#ifndef CONFIG_ASYNC_TCP_RUNNING_CORE
+#define CONFIG_ASYNC_TCP_RUNNING_CORE 1
+#endif
+#ifndef CONFIG_ASYNC_TCP_STACK_SIZE
+#define CONFIG_ASYNC_TCP_STACK_SIZE (8192 * 2)
+#endif
+#define ASYNC_TCP_PRIORITY 3
+#define ASYNC_TCP_POLL_MS 500 // lwIP's coarse timer, twice a second
+#define ASYNC_TCP_SNDBUF 16384 // kernel buffer behind the send window
+
+struct AsyncTcpLoop {
+  std::mutex lock; // the lists below
+  std::vector<AsyncClient *> clients;
+  std::vector<AsyncServer *> servers;
+  std::vector<std::pair<AsyncServer *, AsyncClient *>> adopted;
+  int wake[2] = {-1, -1};
+
+  static AsyncTcpLoop &get() {
+    static AsyncTcpLoop *loop = [] {
+      AsyncTcpLoop *l = new AsyncTcpLoop;
+      if (pipe2(l->wake, O_NONBLOCK | O_CLOEXEC) != 0)
+        abort();
+      xTaskCreatePinnedToCore(run, "async_tcp", CONFIG_ASYNC_TCP_STACK_SIZE,
+                              l, ASYNC_TCP_PRIORITY, nullptr,
+                              CONFIG_ASYNC_TCP_RUNNING_CORE);
+      return l;
+    }();
+    return *loop;
+  }
+
+  void wakeUp() {
+    char c = 0;
+    (void)!::write(wake[1], &c, 1);
+  }
+
+  static void run(void *arg) { ((AsyncTcpLoop *)arg)->loop(); }
+  void loop();
+  void service(AsyncClient *c, short revents, uint32_t now);
+};
+
+void AsyncTcpLoop::loop() {
+  std::vector<pollfd> fds;
+  std::vector<AsyncClient *> polled;
+  std::vector<AsyncServer *> listening;
+  char drain[64];
+  for (;;) {
+    std::vector<std::pair<AsyncServer *, AsyncClient *>> fresh;
+    fds.clear();
+    polled.clear();
+    fds.push_back({wake[0], POLLIN, 0});
+    uint32_t now = millis();
+    int timeout = ASYNC_TCP_POLL_MS;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      fresh.swap(adopted);
+      for (size_t i = 0; i < clients.size();) {
+        AsyncClient *c = clients[i];
+        if (c->released) {
+          clients[i] = clients.back();
+          clients.pop_back();
+          delete c;
+          continue;
+        }
+        i++;
+      }
+      listening = servers;
+      for (AsyncServer *s : servers)
+        fds.push_back({s->fd, POLLIN, 0});
+      for (AsyncClient *c : clients) {
+        std::lock_guard<std::mutex> cg(c->lock);
+        if (c->fd < 0 || !c->open)
+          continue;
+        short events = POLLIN;
+        if (!c->tx.empty())
+          events |= POLLOUT;
+        if (c->unacked)
+          timeout = 0;
+        fds.push_back({c->fd, events, 0});
+        polled.push_back(c);
+        int due = (int)(c->lastPoll + ASYNC_TCP_POLL_MS - now);
+        timeout = std::max(0, std::min(timeout, due));
+      }
+    }
+    for (auto &[server, client] : fresh)
+      if (server->connectCb)
+        server->connectCb(server->connectArg, client);
+    if (!fresh.empty())
+      continue; // their sockets join the next poll
+
+    poll(fds.data(), fds.size(), timeout);
+    while (::read(wake[0], drain, sizeof(drain)) > 0)
+      ;
+    now = millis();
+    for (size_t i = 0; i < listening.size(); i++)
+      if (fds[1 + i].revents & POLLIN)
+        listening[i]->accept();
+    size_t first = 1 + listening.size();
+    for (size_t i = 0; i < polled.size(); i++)
+      service(polled[i], fds[first + i].revents, now);
+  }
+}
+
+// One client's events; any callback may close it, so `open` is rechecked
+void AsyncTcpLoop::service(AsyncClient *c, short revents, uint32_t now) {
+  if (revents & (POLLIN | POLLHUP | POLLERR)) {
+    char buf[TCP_MSS];
+    ssize_t n = recv(c->fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n > 0) {
+      c->lastRx = now;
+      if (c->dataCb)
+        c->dataCb(c->dataArg, c, buf, n);
+    } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+      c->drop();
+      return;
+    }
+  }
+  if (!c->open)
+    return;
+  size_t acked;
+  {
+    std::lock_guard<std::mutex> guard(c->lock);
+    if (revents & POLLOUT)
+      c->transmit();
+    acked = c->unacked;
+    c->unacked = 0;
+  }
+  if (acked && c->ackCb)
+    c->ackCb(c->ackArg, c, acked, 0);
+  if (!c->open)
+    return;
+  if ((int32_t)(now - c->lastPoll) >= ASYNC_TCP_POLL_MS) {
+    c->lastPoll = now;
+    if (c->pollCb)
+      c->pollCb(c->pollArg, c);
+  }
+  if (c->open && c->rxTimeout && now - c->lastRx > c->rxTimeout * 1000) {
+    if (c->timeoutCb)
+      c->timeoutCb(c->timeoutArg, c, now - c->lastRx);
+    else
+      c->close(true);
+  }
+}
+
+// ---- AsyncClient ----
+
+AsyncClient::AsyncClient(int fd) : fd(fd) {
+  lastRx = lastPoll = millis();
+  int size = ASYNC_TCP_SNDBUF;
+  setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+AsyncClient::~AsyncClient() {
+  if (fd >= 0)
+    ::close(fd);
+}
+
+size_t AsyncClient::space() {
+  std::lock_guard<std::mutex> guard(lock);
+  return open && tx.size() < TCP_SND_BUF ? TCP_SND_BUF - tx.size() : 0;
+}
+
+size_t AsyncClient::add(const char *data, size_t size, uint8_t apiflags) {
+  if (!data || !size)
+    return 0;
+  std::lock_guard<std::mutex> guard(lock);
+  if (!open || tx.size() >= TCP_SND_BUF)
+    return 0;
+  size_t n = std::min(size, TCP_SND_BUF - tx.size());
+  tx.append(data, n);
+  return n;
+}
+
+bool AsyncClient::send() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!open)
+      return false;
+    transmit();
+  }
+  AsyncTcpLoop::get().wakeUp(); // acks, and POLLOUT for the rest
+  return true;
+}
+
+size_t AsyncClient::write(const char *data, size_t size, uint8_t apiflags) {
+  size_t n = add(data, size, apiflags);
+  if (!n || !send())
+    return 0;
+  return n;
+}
+
+// Hands the kernel what it takes; lock held
+void AsyncClient::transmit() {
+  while (!tx.empty()) {
+    ssize_t n = ::send(fd, tx.data(), tx.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n <= 0)
+      return;
+    tx.erase(0, n);
+    unacked += n;
+  }
+}
+
+void AsyncClient::flush(int timeoutMs) {
+  std::lock_guard<std::mutex> guard(lock);
+  uint32_t start = millis();
+  while (open && !tx.empty()) {
+    transmit();
+    int left = timeoutMs - (int)(millis() - start);
+    if (tx.empty() || left <= 0)
+      return;
+    pollfd p = {fd, POLLOUT, 0};
+    if (poll(&p, 1, left) <= 0 || (p.revents & (POLLERR | POLLHUP)))
+      return;
+  }
+}
+
+void AsyncClient::close(bool now) {
+  if (!now)
+    flush(1000);
+  drop();
+}
+
+// The socket is only shut down here; the async_tcp task closes it with the
+// client, so its number cannot be reused while a poll still lists it
+void AsyncClient::drop() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!open)
+      return;
+    open = false;
+    shutdown(fd, SHUT_WR);
+    tx.clear();
+  }
+  if (disconnectCb)
+    disconnectCb(disconnectArg, this);
+  std::lock_guard<std::mutex> guard(AsyncTcpLoop::get().lock);
+  released = true;
+  AsyncTcpLoop::get().wakeUp();
+}
+
+void AsyncClient::setNoDelay(bool nodelay) {
+  int on = nodelay;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+static bool address(int fd, bool peer, sockaddr_in &out) {
+  sockaddr_storage ss;
+  socklen_t len = sizeof(ss);
+  int rc = peer ? getpeername(fd, (sockaddr *)&ss, &len)
+                : getsockname(fd, (sockaddr *)&ss, &len);
+  if (rc != 0 || ss.ss_family != AF_INET)
+    return false;
+  out = *(sockaddr_in *)&ss;
+  return true;
+}
+
+// A socket pair from Host::fetch() reads as a loopback connection
+IPAddress AsyncClient::remoteIP() {
+  sockaddr_in a;
+  return address(fd, true, a) ? IPAddress(a.sin_addr.s_addr)
+                              : IPAddress(127, 0, 0, 1);
+}
+
+uint16_t AsyncClient::remotePort() {
+  sockaddr_in a;
+  return address(fd, true, a) ? ntohs(a.sin_port) : 0;
+}
+
+IPAddress AsyncClient::localIP() {
+  sockaddr_in a;
+  return address(fd, false, a) ? IPAddress(a.sin_addr.s_addr)
+                               : IPAddress(127, 0, 0, 1);
+}
+
+uint16_t AsyncClient::localPort() {
+  sockaddr_in a;
+  return address(fd, false, a) ? ntohs(a.sin_port) : 0;
+}
+
+void AsyncClient::onConnect(AcConnectHandler cb, void *arg) {}
+
+void AsyncClient::onDisconnect(AcConnectHandler cb, void *arg) {
+  disconnectCb = cb;
+  disconnectArg = arg;
+}
+
+void AsyncClient::onAck(AcAckHandler cb, void *arg) {
+  ackCb = cb;
+  ackArg = arg;
+}
+
+void AsyncClient::onError(AcErrorHandler cb, void *arg) {
+  errorCb = cb;
+  errorArg = arg;
+}
+
+void AsyncClient::onData(AcDataHandler cb, void *arg) {
+  dataCb = cb;
+  dataArg = arg;
+}
+
+void AsyncClient::onTimeout(AcTimeoutHandler cb, void *arg) {
+  timeoutCb = cb;
+  timeoutArg = arg;
+}
+
+void AsyncClient::onPoll(AcConnectHandler cb, void *arg) {
+  pollCb = cb;
+  pollArg = arg;
+}
+
+// ---- AsyncServer ----
+
+void AsyncServer::onClient(AcConnectHandler cb, void *arg) {
+  connectCb = cb;
+  connectArg = arg;
+}
+
+void AsyncServer::begin() {
+  if (fd >= 0)
+    return;
+  fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  sockaddr_in a = {};
+  a.sin_family = AF_INET;
+  a.sin_addr.s_addr = htonl(INADDR_ANY);
+  a.sin_port = htons(port_);
+  if (bind(fd, (sockaddr *)&a, sizeof(a)) != 0 || listen(fd, 64) != 0) {
+    Serial.printf("AsyncTCP (host): cannot listen on port %u: %s\n", port_,
+                  strerror(errno));
+    ::close(fd);
+    fd = -1;
+    return;
+  }
+  socklen_t len = sizeof(a);
+  getsockname(fd, (sockaddr *)&a, &len);
+  port_ = ntohs(a.sin_port);
+  AsyncTcpLoop &loop = AsyncTcpLoop::get();
+  std::lock_guard<std::mutex> guard(loop.lock);
+  loop.servers.push_back(this);
+  loop.wakeUp();
+}
+
+void AsyncServer::end() {
+  if (fd < 0)
+    return;
+  AsyncTcpLoop &loop = AsyncTcpLoop::get();
+  std::lock_guard<std::mutex> guard(loop.lock);
+  loop.servers.erase(
+      std::find(loop.servers.begin(), loop.servers.end(), this));
+  ::close(fd);
+  fd = -1;
+}
+
+// On the async_tcp task
+void AsyncServer::accept() {
+  for (;;) {
+    int c = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (c < 0)
+      return;
+    if (noDelay) {
+      int on = 1;
+      setsockopt(c, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    AsyncClient *client = new AsyncClient(c);
+    AsyncTcpLoop &loop = AsyncTcpLoop::get();
+    std::lock_guard<std::mutex> guard(loop.lock);
+    loop.clients.push_back(client);
+    loop.adopted.push_back({this, client});
+  }
+}
+
+void AsyncServer::adopt(int fd) {
+  AsyncClient *client = new AsyncClient(fd);
+  AsyncTcpLoop &loop = AsyncTcpLoop::get();
+  std::lock_guard<std::mutex> guard(loop.lock);
+  loop.clients.push_back(client);
+  loop.adopted.push_back({this, client});
+  loop.wakeUp();
+}
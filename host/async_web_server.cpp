@@ -0,0 +1,1149 @@
+// ESPAsyncWebServer on the host AsyncTCP. The response state machines are
+// the library's own (AsyncAbstractResponse::_ack in particular), so the
+// firmware's responses see the same calls in the same order as on the chip.
+#include <ESPAsyncWebServer.h>
+#include "host.h"
+#include <cctype>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define SSE_MAX_QUEUED_MESSAGES 32
+
+static uint16_t portOverride = 0;
+static bool portOverridden = false;
+static uint16_t boundPort = 0;
+static AsyncWebServer *running = nullptr; // begun last, for Host::fetch
+
+namespace Host {
+
+void setWebServerPort(uint16_t port) {
+  portOverride = port;
+  portOverridden = true;
+}
+
+uint16_t webServerPort() { return boundPort; }
+
+std::string fetch(const std::string &request, uint32_t timeoutMs) {
+  int sv[2];
+  if (!running ||
+      socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0)
+    return std::string();
+  running->server().adopt(sv[0]);
+  std::string response;
+  if (::send(sv[1], request.data(), request.size(), MSG_NOSIGNAL) ==
+      (ssize_t)request.size()) {
+    uint32_t start = millis();
+    char buf[4096];
+    for (;;) {
+      int left = (int)timeoutMs - (int)(millis() - start);
+      pollfd p = {sv[1], POLLIN, 0};
+      if (left <= 0 || poll(&p, 1, left) <= 0)
+        break;
+      ssize_t n = recv(sv[1], buf, sizeof(buf), 0);
+      if (n <= 0)
+        break;
+      response.append(buf, n);
+    }
+  }
+  close(sv[1]);
+  return response;
+}
+
+std::string get(const char *url, uint32_t timeoutMs) {
+  return fetch(std::string("GET ") + url + " HTTP/1.1\r\nHost: host\r\n\r\n",
+               timeoutMs);
+}
+
+} // namespace Host
+
+// ---- Responses ----
+
+const char *AsyncWebServerResponse::_responseCodeToString(int code) {
+  switch (code) {
+  case 100:
+    return "Continue";
+  case 101:
+    return "Switching Protocols";
+  case 200:
+    return "OK";
+  case 201:
+    return "Created";
+  case 202:
+    return "Accepted";
+  case 204:
+    return "No Content";
+  case 206:
+    return "Partial Content";
+  case 301:
+    return "Moved Permanently";
+  case 302:
+    return "Found";
+  case 304:
+    return "Not Modified";
+  case 400:
+    return "Bad Request";
+  case 401:
+    return "Unauthorized";
+  case 403:
+    return "Forbidden";
+  case 404:
+    return "Not Found";
+  case 405:
+    return "Method Not Allowed";
+  case 408:
+    return "Request Time-out";
+  case 409:
+    return "Conflict";
+  case 411:
+    return "Length Required";
+  case 412:
+    return "Precondition Failed";
+  case 413:
+    return "Request Entity Too Large";
+  case 416:
+    return "Requested range not satisfiable";
+  case 429:
+    return "Too Many Requests";
+  case 500:
+    return "Internal Server Error";
+  case 501:
+    return "Not Implemented";
+  case 503:
+    return "Service Unavailable";
+  default:
+    return "";
+  }
+}
+
+AsyncWebServerResponse::AsyncWebServerResponse()
+    : _code(0), _contentType(), _contentLength(0), _sendContentLength(true),
+      _chunked(false), _headLength(0), _sentLength(0), _ackedLength(0),
+      _writtenLength(0), _state(RESPONSE_SETUP) {}
+
+void AsyncWebServerResponse::setCode(int code) {
+  if (_state == RESPONSE_SETUP)
+    _code = code;
+}
+
+void AsyncWebServerResponse::setContentLength(size_t len) {
+  if (_state == RESPONSE_SETUP)
+    _contentLength = len;
+}
+
+void AsyncWebServerResponse::setContentType(const String &type) {
+  if (_state == RESPONSE_SETUP)
+    _contentType = type;
+}
+
+void AsyncWebServerResponse::addHeader(const String &name,
+                                       const String &value) {
+  _headers.emplace_back(name, value);
+}
+
+String AsyncWebServerResponse::_assembleHead(uint8_t version) {
+  if (version) {
+    addHeader("Accept-Ranges", "none");
+    if (_chunked)
+      addHeader("Transfer-Encoding", "chunked");
+  }
+  String out;
+  char buf[300];
+  snprintf(buf, sizeof(buf), "HTTP/1.%d %d %s\r\n", version, _code,
+           _responseCodeToString(_code));
+  out.concat(buf);
+  if (_sendContentLength) {
+    snprintf(buf, sizeof(buf), "Content-Length: %u\r\n",
+             (unsigned)_contentLength);
+    out.concat(buf);
+  }
+  if (_contentType.length()) {
+    snprintf(buf, sizeof(buf), "Content-Type: %s\r\n", _contentType.c_str());
+    out.concat(buf);
+  }
+  for (const AsyncWebHeader &h : _headers) {
+    snprintf(buf, sizeof(buf), "%s: %s\r\n", h.name().c_str(),
+             h.value().c_str());
+    out.concat(buf);
+  }
+  _headers.clear();
+  out.concat("\r\n");
+  _headLength = out.length();
+  return out;
+}
+
+bool AsyncWebServerResponse::_started() const {
+  return _state > RESPONSE_SETUP;
+}
+
+bool AsyncWebServerResponse::_finished() const {
+  return _state > RESPONSE_WAIT_ACK;
+}
+
+bool AsyncWebServerResponse::_failed() const {
+  return _state == RESPONSE_FAILED;
+}
+
+bool AsyncWebServerResponse::_sourceValid() const { return false; }
+
+void AsyncWebServerResponse::_respond(AsyncWebServerRequest *request) {
+  _state = RESPONSE_END;
+  request->client()->close();
+}
+
+size_t AsyncWebServerResponse::_ack(AsyncWebServerRequest *request,
+                                    size_t len, uint32_t time) {
+  return 0;
+}
+
+// Head and body go out as one string, as much as the window takes each time
+AsyncBasicResponse::AsyncBasicResponse(int code, const String &contentType,
+                                       const String &content) {
+  _code = code;
+  _content = content;
+  _contentType = contentType;
+  if (_content.length()) {
+    _contentLength = _content.length();
+    if (!_contentType.length())
+      _contentType = "text/plain";
+  }
+  addHeader("Connection", "close");
+}
+
+void AsyncBasicResponse::_respond(AsyncWebServerRequest *request) {
+  _state = RESPONSE_CONTENT;
+  _content = _assembleHead(request->version()) + _content;
+  _ack(request, 0, 0);
+}
+
+size_t AsyncBasicResponse::_ack(AsyncWebServerRequest *request, size_t len,
+                                uint32_t time) {
+  _ackedLength += len;
+  if (_state == RESPONSE_CONTENT) {
+    size_t space = request->client()->space();
+    size_t n = std::min(space, _content.length());
+    if (n) {
+      n = request->client()->write(_content.c_str(), n);
+      _writtenLength += n;
+      _content = _content.substring(n);
+    }
+    if (!_content.length())
+      _state = RESPONSE_WAIT_ACK;
+    return n;
+  }
+  if (_state == RESPONSE_WAIT_ACK && _ackedLength >= _writtenLength)
+    _state = RESPONSE_END;
+  return 0;
+}
+
+AsyncAbstractResponse::AsyncAbstractResponse(AwsTemplateProcessor callback)
+    : _callback(callback) {}
+
+void AsyncAbstractResponse::_respond(AsyncWebServerRequest *request) {
+  addHeader("Connection", "close");
+  _head = _assembleHead(request->version());
+  _state = RESPONSE_HEADERS;
+  _ack(request, 0, 0);
+}
+
+size_t AsyncAbstractResponse::_ack(AsyncWebServerRequest *request, size_t len,
+                                   uint32_t time) {
+  if (!_sourceValid()) {
+    _state = RESPONSE_FAILED;
+    request->client()->close();
+    return 0;
+  }
+  _ackedLength += len;
+  size_t space = request->client()->space();
+  size_t headLen = _head.length();
+  if (_state == RESPONSE_HEADERS) {
+    if (space >= headLen) {
+      _state = RESPONSE_CONTENT;
+    } else {
+      String out = _head.substring(0, space);
+      _head = _head.substring(space);
+      _writtenLength += request->client()->write(out.c_str(), out.length());
+      return out.length();
+    }
+  }
+
+  if (_state == RESPONSE_CONTENT) {
+    // The head goes out with the first data; a filler with nothing yet
+    // leaves it pending, so it comes out of the window on every try
+    if (space < headLen)
+      return 0;
+    space -= headLen;
+    size_t outLen;
+    if (_chunked) {
+      if (space <= 8)
+        return 0;
+      outLen = space;
+    } else if (!_sendContentLength) {
+      outLen = space;
+    } else {
+      outLen = std::min(_contentLength - _sentLength, space);
+    }
+    uint8_t *buf = (uint8_t *)malloc(outLen + headLen);
+    if (!buf)
+      return 0;
+    if (headLen)
+      memcpy(buf, _head.c_str(), headLen);
+    size_t readLen;
+    if (_chunked) {
+      // Leading zeros or spaces in the chunk size are allowed (RFC 2616)
+      readLen = _fillBuffer(buf + headLen + 6, outLen - 8);
+      if (readLen == RESPONSE_TRY_AGAIN) {
+        free(buf);
+        return 0;
+      }
+      outLen = sprintf((char *)buf + headLen, "%x", (unsigned)readLen) +
+               headLen;
+      while (outLen < headLen + 4)
+        buf[outLen++] = ' ';
+      buf[outLen++] = '\r';
+      buf[outLen++] = '\n';
+      outLen += readLen;
+      buf[outLen++] = '\r';
+      buf[outLen++] = '\n';
+    } else {
+      readLen = _fillBuffer(buf + headLen, outLen);
+      if (readLen == RESPONSE_TRY_AGAIN) {
+        free(buf);
+        return 0;
+      }
+      outLen = readLen + headLen;
+    }
+    if (headLen)
+      _head = String();
+    if (outLen)
+      _writtenLength += request->client()->write((const char *)buf, outLen);
+    if (_chunked)
+      _sentLength += readLen;
+    else
+      _sentLength += outLen - headLen;
+    free(buf);
+    if ((_chunked && readLen == 0) || (!_sendContentLength && outLen == 0) ||
+        (!_chunked && _sentLength == _contentLength))
+      _state = RESPONSE_WAIT_ACK;
+    return outLen;
+  }
+
+  if (_state == RESPONSE_WAIT_ACK) {
+    if (!_sendContentLength || _ackedLength >= _writtenLength) {
+      _state = RESPONSE_END;
+      if (!_chunked && !_sendContentLength)
+        request->client()->close(true);
+    }
+  }
+  return 0;
+}
+
+static String contentTypeFor(const String &path) {
+  static const char *const types[][2] = {
+      {".html", "text/html"},          {".htm", "text/html"},
+      {".css", "text/css"},            {".json", "application/json"},
+      {".js", "application/javascript"}, {".png", "image/png"},
+      {".gif", "image/gif"},           {".jpg", "image/jpeg"},
+      {".ico", "image/x-icon"},        {".svg", "image/svg+xml"},
+      {".woff2", "font/woff2"},        {".woff", "font/woff"},
+      {".xml", "text/xml"},            {".pdf", "application/pdf"},
+      {".zip", "application/zip"},     {".gz", "application/x-gzip"},
+  };
+  for (const auto &t : types)
+    if (path.endsWith(t[0]))
+      return t[1];
+  return "text/plain";
+}
+
+AsyncFileResponse::AsyncFileResponse(FS &fs, const String &path,
+                                     const String &contentType, bool download,
+                                     AwsTemplateProcessor callback)
+    : AsyncAbstractResponse(callback) {
+  _code = 200;
+  String actual = path;
+  if (!download && !fs.exists(path) && fs.exists(path + ".gz")) {
+    actual = path + ".gz";
+    addHeader("Content-Encoding", "gzip");
+  }
+  _content = fs.open(actual, "r");
+  _contentLength = _content.size();
+  _contentType = contentType.length() ? contentType : contentTypeFor(path);
+  String filename = path.substring(path.lastIndexOf('/') + 1);
+  addHeader("Content-Disposition",
+            String(download ? "attachment" : "inline") + "; filename=\"" +
+                filename + "\"");
+}
+
+size_t AsyncFileResponse::_fillBuffer(uint8_t *buf, size_t maxLen) {
+  return _content.read(buf, maxLen);
+}
+
+AsyncCallbackResponse::AsyncCallbackResponse(
+    const String &contentType, size_t len, AwsResponseFiller callback,
+    AwsTemplateProcessor templateCallback)
+    : AsyncAbstractResponse(templateCallback) {
+  _code = 200;
+  _content = callback;
+  _contentLength = len;
+  if (!len)
+    _sendContentLength = false;
+  _contentType = contentType;
+}
+
+size_t AsyncCallbackResponse::_fillBuffer(uint8_t *buf, size_t maxLen) {
+  size_t n = _content(buf, maxLen, _filledLength);
+  if (n != RESPONSE_TRY_AGAIN)
+    _filledLength += n;
+  return n;
+}
+
+AsyncChunkedResponse::AsyncChunkedResponse(
+    const String &contentType, AwsResponseFiller callback,
+    AwsTemplateProcessor templateCallback)
+    : AsyncCallbackResponse(contentType, 0, callback, templateCallback) {
+  _sendContentLength = false;
+  _chunked = true;
+}
+
+AsyncProgmemResponse::AsyncProgmemResponse(int code,
+                                           const String &contentType,
+                                           const uint8_t *content, size_t len,
+                                           AwsTemplateProcessor callback)
+    : AsyncAbstractResponse(callback), _content(content) {
+  _code = code;
+  _contentType = contentType;
+  _contentLength = len;
+}
+
+size_t AsyncProgmemResponse::_fillBuffer(uint8_t *buf, size_t maxLen) {
+  size_t n = std::min(maxLen, _contentLength - _readLength);
+  memcpy(buf, _content + _readLength, n);
+  _readLength += n;
+  return n;
+}
+
+AsyncResponseStream::AsyncResponseStream(const String &contentType,
+                                         size_t bufferSize) {
+  _code = 200;
+  _contentType = contentType;
+  _content.reserve(bufferSize);
+}
+
+size_t AsyncResponseStream::_fillBuffer(uint8_t *buf, size_t maxLen) {
+  size_t n = std::min(maxLen, _content.size() - _readLength);
+  memcpy(buf, _content.data() + _readLength, n);
+  _readLength += n;
+  return n;
+}
+
+size_t AsyncResponseStream::write(const uint8_t *data, size_t len) {
+  if (_started())
+    return 0;
+  _content.append((const char *)data, len);
+  _contentLength += len;
+  return len;
+}
+
+size_t AsyncResponseStream::write(uint8_t data) { return write(&data, 1); }
+
+// ---- Requests ----
+
+static String urlDecode(const std::string &in) {
+  std::string out;
+  out.reserve(in.size());
+  for (size_t i = 0; i < in.size(); i++) {
+    if (in[i] == '%' && i + 2 < in.size() &&
+        isxdigit((unsigned char)in[i + 1]) &&
+        isxdigit((unsigned char)in[i + 2])) {
+      out += (char)strtol(in.substr(i + 1, 2).c_str(), nullptr, 16);
+      i += 2;
+    } else {
+      out += in[i] == '+' ? ' ' : in[i];
+    }
+  }
+  return String(out);
+}
+
+AsyncWebServerRequest::AsyncWebServerRequest(AsyncWebServer *server,
+                                             AsyncClient *client)
+    : _server(server), _client(client) {
+  client->setRxTimeout(3);
+  client->onAck(
+      [](void *r, AsyncClient *, size_t len, uint32_t time) {
+        ((AsyncWebServerRequest *)r)->_onAck(len, time);
+      },
+      this);
+  client->onDisconnect(
+      [](void *r, AsyncClient *) {
+        ((AsyncWebServerRequest *)r)->_onDisconnect();
+      },
+      this);
+  client->onTimeout(
+      [](void *r, AsyncClient *c, uint32_t) { c->close(); }, this);
+  client->onData(
+      [](void *r, AsyncClient *, void *buf, size_t len) {
+        ((AsyncWebServerRequest *)r)->_onData(buf, len);
+      },
+      this);
+  client->onPoll(
+      [](void *r, AsyncClient *) { ((AsyncWebServerRequest *)r)->_onPoll(); },
+      this);
+}
+
+AsyncWebServerRequest::~AsyncWebServerRequest() {
+  if (_gone)
+    *_gone = true;
+  delete _response;
+}
+
+const char *AsyncWebServerRequest::methodToString() const {
+  switch (_method) {
+  case HTTP_GET:
+    return "GET";
+  case HTTP_POST:
+    return "POST";
+  case HTTP_DELETE:
+    return "DELETE";
+  case HTTP_PUT:
+    return "PUT";
+  case HTTP_PATCH:
+    return "PATCH";
+  case HTTP_HEAD:
+    return "HEAD";
+  case HTTP_OPTIONS:
+    return "OPTIONS";
+  default:
+    return "UNKNOWN";
+  }
+}
+
+bool AsyncWebServerRequest::_parseHead() {
+  size_t end = _in.find("\r\n\r\n");
+  size_t lineEnd = _in.find("\r\n");
+  std::string line = _in.substr(0, lineEnd);
+  size_t sp1 = line.find(' '), sp2 = line.rfind(' ');
+  if (sp1 == std::string::npos || sp2 <= sp1)
+    return false;
+  std::string method = line.substr(0, sp1);
+  static const std::pair<const char *, WebRequestMethod> methods[] = {
+      {"GET", HTTP_GET},       {"POST", HTTP_POST},
+      {"DELETE", HTTP_DELETE}, {"PUT", HTTP_PUT},
+      {"PATCH", HTTP_PATCH},   {"HEAD", HTTP_HEAD},
+      {"OPTIONS", HTTP_OPTIONS},
+  };
+  _method = 0;
+  for (const auto &m : methods)
+    if (method == m.first)
+      _method = m.second;
+  if (!_method)
+    return false;
+  std::string target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+  _version = line.compare(sp2 + 1, std::string::npos, "HTTP/1.0") ? 1 : 0;
+  size_t q = target.find('?');
+  _url = urlDecode(target.substr(0, q));
+  if (q != std::string::npos)
+    _addParams(target.substr(q + 1).c_str(), false);
+
+  for (size_t at = lineEnd + 2; at < end;) {
+    size_t next = _in.find("\r\n", at);
+    std::string h = _in.substr(at, next - at);
+    at = next + 2;
+    size_t colon = h.find(':');
+    if (colon == std::string::npos)
+      continue;
+    size_t v = h.find_first_not_of(' ', colon + 1);
+    String name(h.substr(0, colon));
+    String value(v == std::string::npos ? std::string() : h.substr(v));
+    if (name.equalsIgnoreCase("Host"))
+      _host = value;
+    else if (name.equalsIgnoreCase("Content-Length"))
+      _bodyLength = strtoul(value.c_str(), nullptr, 10);
+    _headers.emplace_back(new AsyncWebHeader(name, value));
+  }
+  _in.erase(0, end + 4);
+  return true;
+}
+
+void AsyncWebServerRequest::_addParams(const String &query, bool form) {
+  std::string s = query.c_str();
+  for (size_t at = 0; at <= s.size();) {
+    size_t amp = s.find('&', at);
+    if (amp == std::string::npos)
+      amp = s.size();
+    std::string pair = s.substr(at, amp - at);
+    at = amp + 1;
+    if (pair.empty())
+      continue;
+    size_t eq = pair.find('=');
+    _params.emplace_back(new AsyncWebParameter(
+        urlDecode(pair.substr(0, eq)),
+        eq == std::string::npos ? String() : urlDecode(pair.substr(eq + 1)),
+        form));
+  }
+}
+
+void AsyncWebServerRequest::_onData(void *buf, size_t len) {
+  if (_handled)
+    return; // one request per connection
+  _in.append((const char *)buf, len);
+  if (_headers.empty() && _url.isEmpty()) {
+    if (_in.find("\r\n\r\n") == std::string::npos) {
+      if (_in.size() > 8192)
+        _client->close(true);
+      return;
+    }
+    if (!_parseHead()) {
+      bool gone = false;
+      _gone = &gone;
+      send(400);
+      if (!gone) {
+        _gone = nullptr;
+        _closeIfFinished();
+      }
+      return;
+    }
+  }
+  if (_in.size() < _bodyLength)
+    return;
+  AsyncWebHeader *type = getHeader("Content-Type");
+  if (type && type->value().startsWith("application/x-www-form-urlencoded"))
+    _addParams(String(_in.substr(0, _bodyLength)), true);
+  _in.clear();
+  _handled = true;
+  _handle();
+}
+
+void AsyncWebServerRequest::_handle() {
+  bool gone = false;
+  _gone = &gone;
+  AsyncWebHandler *handler = nullptr;
+  for (AsyncWebHandler *h : _server->_handlers) {
+    if (h->canHandle(this)) {
+      handler = h;
+      break;
+    }
+  }
+  if (handler) {
+    handler->handleRequest(this);
+    if (!gone && handler->takesConnection()) {
+      _response = nullptr; // sent by the handler itself
+      delete this;
+      return;
+    }
+  } else if (_server->_notFound) {
+    _server->_notFound(this);
+  } else {
+    send(404);
+  }
+  if (!gone) {
+    _gone = nullptr;
+    _closeIfFinished();
+  }
+}
+
+void AsyncWebServerRequest::_closeIfFinished() {
+  if (_response && (_response->_finished() || _response->_failed()))
+    _client->close(); // frees this request
+}
+
+void AsyncWebServerRequest::_onAck(size_t len, uint32_t time) {
+  if (!_response)
+    return;
+  bool gone = false;
+  _gone = &gone;
+  if (!_response->_finished())
+    _response->_ack(this, len, time);
+  if (!gone) {
+    _gone = nullptr;
+    _closeIfFinished();
+  }
+}
+
+void AsyncWebServerRequest::_onPoll() {
+  if (!_response || !_client->canSend() || _response->_finished())
+    return;
+  bool gone = false;
+  _gone = &gone;
+  _response->_ack(this, 0, 0);
+  if (!gone) {
+    _gone = nullptr;
+    _closeIfFinished();
+  }
+}
+
+void AsyncWebServerRequest::_onDisconnect() {
+  if (_onDisconnectfn)
+    _onDisconnectfn();
+  delete this;
+}
+
+void AsyncWebServerRequest::redirect(const String &url) {
+  AsyncWebServerResponse *response = beginResponse(302);
+  response->addHeader("Location", url);
+  send(response);
+}
+
+void AsyncWebServerRequest::send(AsyncWebServerResponse *response) {
+  _response = response;
+  if (!_response) {
+    _client->close(true);
+    return;
+  }
+  if (!_response->_sourceValid()) {
+    delete response;
+    _response = nullptr;
+    send(500);
+    return;
+  }
+  _client->setRxTimeout(0);
+  _response->_respond(this);
+}
+
+void AsyncWebServerRequest::send(int code, const String &contentType,
+                                 const String &content) {
+  send(beginResponse(code, contentType, content));
+}
+
+void AsyncWebServerRequest::send(FS &fs, const String &path,
+                                 const String &contentType, bool download,
+                                 AwsTemplateProcessor callback) {
+  if (fs.exists(path) || (!download && fs.exists(path + ".gz")))
+    send(beginResponse(fs, path, contentType, download, callback));
+  else
+    send(404);
+}
+
+void AsyncWebServerRequest::send(const String &contentType, size_t len,
+                                 AwsResponseFiller callback,
+                                 AwsTemplateProcessor templateCallback) {
+  send(beginResponse(contentType, len, callback, templateCallback));
+}
+
+void AsyncWebServerRequest::sendChunked(const String &contentType,
+                                        AwsResponseFiller callback,
+                                        AwsTemplateProcessor templateCallback) {
+  send(beginChunkedResponse(contentType, callback, templateCallback));
+}
+
+AsyncWebServerResponse *AsyncWebServerRequest::beginResponse(
+    int code, const String &contentType, const String &content) {
+  return new AsyncBasicResponse(code, contentType, content);
+}
+
+AsyncWebServerResponse *AsyncWebServerRequest::beginResponse(
+    FS &fs, const String &path, const String &contentType, bool download,
+    AwsTemplateProcessor callback) {
+  if (fs.exists(path) || (!download && fs.exists(path + ".gz")))
+    return new AsyncFileResponse(fs, path, contentType, download, callback);
+  return nullptr;
+}
+
+AsyncWebServerResponse *AsyncWebServerRequest::beginResponse(
+    const String &contentType, size_t len, AwsResponseFiller callback,
+    AwsTemplateProcessor templateCallback) {
+  return new AsyncCallbackResponse(contentType, len, callback,
+                                   templateCallback);
+}
+
+AsyncWebServerResponse *AsyncWebServerRequest::beginChunkedResponse(
+    const String &contentType, AwsResponseFiller callback,
+    AwsTemplateProcessor templateCallback) {
+  if (_version)
+    return new AsyncChunkedResponse(contentType, callback, templateCallback);
+  return new AsyncCallbackResponse(contentType, 0, callback,
+                                   templateCallback);
+}
+
+AsyncResponseStream *AsyncWebServerRequest::beginResponseStream(
+    const String &contentType, size_t bufferSize) {
+  return new AsyncResponseStream(contentType, bufferSize);
+}
+
+AsyncWebServerResponse *AsyncWebServerRequest::beginResponse_P(
+    int code, const String &contentType, const uint8_t *content, size_t len,
+    AwsTemplateProcessor callback) {
+  return new AsyncProgmemResponse(code, contentType, content, len, callback);
+}
+
+bool AsyncWebServerRequest::hasHeader(const String &name) const {
+  return getHeader(name) != nullptr;
+}
+
+AsyncWebHeader *AsyncWebServerRequest::getHeader(const String &name) const {
+  for (const auto &h : _headers)
+    if (h->name().equalsIgnoreCase(name))
+      return h.get();
+  return nullptr;
+}
+
+const String &AsyncWebServerRequest::header(const char *name) const {
+  static const String empty;
+  AsyncWebHeader *h = getHeader(name);
+  return h ? h->value() : empty;
+}
+
+bool AsyncWebServerRequest::hasParam(const String &name, bool post,
+                                     bool file) const {
+  return getParam(name, post, file) != nullptr;
+}
+
+AsyncWebParameter *AsyncWebServerRequest::getParam(const String &name,
+                                                   bool post,
+                                                   bool file) const {
+  for (const auto &p : _params)
+    if (p->name() == name && p->isPost() == post && p->isFile() == file)
+      return p.get();
+  return nullptr;
+}
+
+const String &AsyncWebServerRequest::arg(const String &name) const {
+  static const String empty;
+  for (const auto &p : _params)
+    if (p->name() == name)
+      return p->value();
+  return empty;
+}
+
+bool AsyncWebServerRequest::hasArg(const char *name) const {
+  for (const auto &p : _params)
+    if (p->name() == name)
+      return true;
+  return false;
+}
+
+// ---- Handlers ----
+
+bool AsyncCallbackWebHandler::canHandle(AsyncWebServerRequest *request) {
+  if (!_onRequest || !(_method & request->method()))
+    return false;
+  const String &url = request->url();
+  if (_uri.length() && _uri.startsWith("/*.")) {
+    if (!url.endsWith(_uri.substring(_uri.lastIndexOf('.'))))
+      return false;
+  } else if (_uri.length() && _uri.endsWith("*")) {
+    if (!url.startsWith(_uri.substring(0, _uri.length() - 1)))
+      return false;
+  } else if (_uri.length() && _uri != url && !url.startsWith(_uri + "/")) {
+    return false;
+  }
+  return true;
+}
+
+void AsyncCallbackWebHandler::handleRequest(AsyncWebServerRequest *request) {
+  _onRequest(request);
+}
+
+AsyncStaticWebHandler::AsyncStaticWebHandler(const char *uri, FS &fs,
+                                             const char *path,
+                                             const char *cacheControl)
+    : _fs(fs), _uri(uri), _path(path),
+      _cacheControl(cacheControl ? cacheControl : "") {
+  if (_uri.endsWith("/"))
+    _uri.remove(_uri.length() - 1);
+  if (_path.endsWith("/"))
+    _path.remove(_path.length() - 1);
+}
+
+AsyncStaticWebHandler &
+AsyncStaticWebHandler::setCacheControl(const char *cacheControl) {
+  _cacheControl = cacheControl;
+  return *this;
+}
+
+AsyncStaticWebHandler &
+AsyncStaticWebHandler::setDefaultFile(const char *filename) {
+  _defaultFile = filename;
+  return *this;
+}
+
+// A regular file at `path`, or its .gz; directories do not count
+bool AsyncStaticWebHandler::find(const String &path, String &found) const {
+  for (const String &candidate : {path, path + ".gz"}) {
+    File f = _fs.open(candidate, "r");
+    if (f && !f.isDirectory()) {
+      found = path;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool AsyncStaticWebHandler::canHandle(AsyncWebServerRequest *request) {
+  if (request->method() != HTTP_GET || !request->url().startsWith(_uri))
+    return false;
+  String found;
+  String path = _path + request->url().substring(_uri.length());
+  if (!path.endsWith("/") && find(path, found))
+    return true;
+  if (!_defaultFile.length())
+    return false;
+  if (!path.endsWith("/"))
+    path += "/";
+  return find(path + _defaultFile, found);
+}
+
+void AsyncStaticWebHandler::handleRequest(AsyncWebServerRequest *request) {
+  String path = _path + request->url().substring(_uri.length());
+  String found;
+  if (path.endsWith("/") || !find(path, found)) {
+    if (!path.endsWith("/"))
+      path += "/";
+    if (!find(path + _defaultFile, found)) {
+      request->send(404);
+      return;
+    }
+  }
+  AsyncWebServerResponse *response =
+      new AsyncFileResponse(_fs, found, String(), false, nullptr);
+  File f = _fs.open(found, "r");
+  String etag = f ? String((unsigned long)f.size()) : String();
+  f.close();
+  if (_cacheControl.length() && etag.length() &&
+      request->header("If-None-Match") == etag) {
+    delete response;
+    response = new AsyncBasicResponse(304);
+    response->addHeader("Cache-Control", _cacheControl);
+    response->addHeader("ETag", etag);
+  } else if (_cacheControl.length()) {
+    response->addHeader("Cache-Control", _cacheControl);
+    response->addHeader("ETag", etag);
+  }
+  request->send(response);
+}
+
+// ---- Server-sent events ----
+
+static std::string eventMessage(const char *message, const char *event,
+                                uint32_t id, uint32_t reconnect) {
+  std::string out;
+  char buf[32];
+  if (reconnect) {
+    snprintf(buf, sizeof(buf), "retry: %lu\r\n", (unsigned long)reconnect);
+    out += buf;
+  }
+  if (id) {
+    snprintf(buf, sizeof(buf), "id: %lu\r\n", (unsigned long)id);
+    out += buf;
+  }
+  if (event && *event)
+    out += std::string("event: ") + event + "\r\n";
+  if (message) {
+    // One data line per line of the message
+    const char *line = message;
+    while (*line) {
+      size_t n = strcspn(line, "\r\n");
+      out += "data: ";
+      out.append(line, n);
+      out += "\r\n";
+      line += n;
+      if (*line == '\r' && line[1] == '\n')
+        line++;
+      if (*line)
+        line++;
+    }
+  }
+  out += "\r\n";
+  return out;
+}
+
+AsyncEventSourceClient::AsyncEventSourceClient(AsyncWebServerRequest *request,
+                                               AsyncEventSource *server)
+    : _client(request->client()), _server(server) {
+  if (AsyncWebHeader *last = request->getHeader("Last-Event-ID"))
+    _lastId = atoi(last->value().c_str());
+  _client->setRxTimeout(0);
+  _client->onData(nullptr, nullptr);
+  _client->onAck(
+      [](void *r, AsyncClient *, size_t, uint32_t) {
+        AsyncEventSourceClient *c = (AsyncEventSourceClient *)r;
+        std::lock_guard<std::recursive_mutex> guard(c->_server->_lock);
+        c->_pump();
+      },
+      this);
+  _client->onPoll(
+      [](void *r, AsyncClient *) {
+        AsyncEventSourceClient *c = (AsyncEventSourceClient *)r;
+        std::lock_guard<std::recursive_mutex> guard(c->_server->_lock);
+        c->_pump();
+      },
+      this);
+  _client->onDisconnect(
+      [](void *r, AsyncClient *) {
+        AsyncEventSourceClient *c = (AsyncEventSourceClient *)r;
+        c->_server->_drop(c);
+      },
+      this);
+  _write("HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+         "Cache-Control: no-cache\r\nConnection: keep-alive\r\n\r\n");
+}
+
+void AsyncEventSourceClient::send(const char *message, const char *event,
+                                  uint32_t id, uint32_t reconnect) {
+  std::lock_guard<std::recursive_mutex> guard(_server->_lock);
+  _write(eventMessage(message, event, id, reconnect));
+}
+
+size_t AsyncEventSourceClient::packetsWaiting() const {
+  std::lock_guard<std::recursive_mutex> guard(_server->_lock);
+  return _messages.size();
+}
+
+// Queued, and dropped when the client is this far behind, as the library
+// does; under the source's lock
+void AsyncEventSourceClient::_write(std::string message) {
+  if (_messages.size() >= SSE_MAX_QUEUED_MESSAGES)
+    return;
+  _messages.push_back(std::move(message));
+  _pump();
+}
+
+void AsyncEventSourceClient::_pump() {
+  while (!_messages.empty() && _client->connected()) {
+    const std::string &front = _messages.front();
+    size_t n = std::min(_client->space(), front.size() - _sent);
+    if (!n)
+      return;
+    _sent += _client->write(front.data() + _sent, n);
+    if (_sent < front.size())
+      return;
+    _messages.pop_front();
+    _sent = 0;
+  }
+}
+
+AsyncEventSource::~AsyncEventSource() { close(); }
+
+void AsyncEventSource::close() {
+  std::lock_guard<std::recursive_mutex> guard(_lock);
+  std::vector<AsyncClient *> open;
+  for (auto &c : _clients)
+    open.push_back(c->client());
+  for (AsyncClient *c : open)
+    c->close(); // each drops its entry
+}
+
+void AsyncEventSource::send(const char *message, const char *event,
+                            uint32_t id, uint32_t reconnect) {
+  std::string msg = eventMessage(message, event, id, reconnect);
+  std::lock_guard<std::recursive_mutex> guard(_lock);
+  for (auto &c : _clients)
+    if (c->connected())
+      c->_write(msg);
+}
+
+size_t AsyncEventSource::count() const {
+  std::lock_guard<std::recursive_mutex> guard(_lock);
+  size_t n = 0;
+  for (const auto &c : _clients)
+    if (c->connected())
+      n++;
+  return n;
+}
+
+size_t AsyncEventSource::avgPacketsWaiting() const {
+  std::lock_guard<std::recursive_mutex> guard(_lock);
+  size_t packets = 0, n = 0;
+  for (const auto &c : _clients) {
+    if (c->connected()) {
+      packets += c->_messages.size();
+      n++;
+    }
+  }
+  return n ? (packets + n - 1) / n : 0;
+}
+
+bool AsyncEventSource::canHandle(AsyncWebServerRequest *request) {
+  return request->method() == HTTP_GET && request->url() == _url;
+}
+
+void AsyncEventSource::handleRequest(AsyncWebServerRequest *request) {
+  std::lock_guard<std::recursive_mutex> guard(_lock);
+  _clients.emplace_back(new AsyncEventSourceClient(request, this));
+  if (_connectcb)
+    _connectcb(_clients.back().get());
+}
+
+void AsyncEventSource::_drop(AsyncEventSourceClient *client) {
+  std::lock_guard<std::recursive_mutex> guard(_lock);
+  _clients.remove_if(
+      [client](const std::unique_ptr<AsyncEventSourceClient> &c) {
+        return c.get() == client;
+      });
+}
+
+// ---- Server ----
+
+AsyncWebServer::AsyncWebServer(uint16_t port) : _server(port) {
+  _server.onClient(
+      [](void *s, AsyncClient *c) {
+        new AsyncWebServerRequest((AsyncWebServer *)s, c);
+      },
+      this);
+}
+
+AsyncWebServer::~AsyncWebServer() { end(); }
+
+void AsyncWebServer::begin() {
+  if (portOverridden)
+    _server.setPort(portOverride);
+  _server.setNoDelay(true);
+  _server.begin();
+  boundPort = _server.port();
+  running = this;
+}
+
+void AsyncWebServer::end() {
+  _server.end();
+  if (running == this)
+    running = nullptr;
+}
+
+AsyncCallbackWebHandler &
+AsyncWebServer::on(const char *uri, ArRequestHandlerFunction onRequest) {
+  return on(uri, HTTP_ANY, onRequest);
+}
+
+AsyncCallbackWebHandler &
+AsyncWebServer::on(const char *uri, WebRequestMethodComposite method,
+                   ArRequestHandlerFunction onRequest) {
+  auto *handler = new AsyncCallbackWebHandler(uri, method, onRequest);
+  _owned.emplace_back(handler);
+  _handlers.push_back(handler);
+  return *handler;
+}
+
+// Uploads and raw bodies are not passed on; the firmware takes neither
+AsyncCallbackWebHandler &AsyncWebServer::on(const char *uri,
+                                            WebRequestMethodComposite method,
+                                            ArRequestHandlerFunction onRequest,
+                                            ArUploadHandlerFunction onUpload) {
+  return on(uri, method, onRequest);
+}
+
+AsyncCallbackWebHandler &AsyncWebServer::on(const char *uri,
+                                            WebRequestMethodComposite method,
+                                            ArRequestHandlerFunction onRequest,
+                                            ArUploadHandlerFunction onUpload,
+                                            ArBodyHandlerFunction onBody) {
+  return on(uri, method, onRequest);
+}
+
+AsyncStaticWebHandler &AsyncWebServer::serveStatic(const char *uri, FS &fs,
+                                                   const char *path,
+                                                   const char *cacheControl) {
+  auto *handler = new AsyncStaticWebHandler(uri, fs, path, cacheControl);
+  _owned.emplace_back(handler);
+  _handlers.push_back(handler);
+  return *handler;
+}
+
+AsyncWebHandler &AsyncWebServer::addHandler(AsyncWebHandler *handler) {
+  _handlers.push_back(handler);
+  return *handler;
+}
+
+void AsyncWebServer::reset() {
+  _handlers.clear();
+  _owned.clear();
+  _notFound = nullptr;
+}
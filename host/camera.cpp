@@ -0,0 +1,283 @@
+// Mock OV-series sensor and JPEG decode stand-in. Frames come from a
+// directory of JPEGs (replayed in name order, looping) or are generated:
+// a fixed noise field with, unless the scene is still, a bright band that
+// moves down a sixteenth of the frame per frame. Frame n is ready at n/fps
+// seconds after init, and esp_camera_fb_get() hands out the newest ready
+// frame it has not handed out yet, waiting for the next one if need be.
+#include <Arduino.h>
+#include "esp_camera.h"
+#include "esp_jpg_decode.h"
+#include "host.h"
+#include <algorithm>
+#include <condition_variable>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+const resolution_info_t resolution[] = {
+    {96, 96, 0},     {160, 120, 0},  {176, 144, 0},   {240, 176, 0},
+    {240, 240, 0},   {320, 240, 0},  {400, 296, 0},   {480, 320, 0},
+    {640, 480, 0},   {800, 600, 0},  {1024, 768, 0},  {1280, 720, 0},
+    {1280, 1024, 0}, {1600, 1200, 0}, {0, 0, 0},
+};
+
+static std::string jpegDir;
+static uint32_t sensorFps = 5;
+static bool sceneMoving = true;
+static std::atomic<uint32_t> framesOut{0};
+
+namespace Host {
+
+void setCamera(const char *dir, uint32_t fps, bool moving) {
+  jpegDir = dir ? dir : "";
+  sensorFps = std::max<uint32_t>(1, fps);
+  sceneMoving = moving;
+}
+
+uint32_t cameraFrames() { return framesOut.load(); }
+
+} // namespace Host
+
+struct Buffer {
+  camera_fb_t fb;
+  size_t capacity;
+  bool out;
+};
+
+static std::mutex cameraLock;
+static std::condition_variable bufferReturned;
+static std::vector<Buffer> buffers;
+static std::vector<std::string> replayFiles;
+static int64_t startUs;
+static int64_t lastFrame = -1;
+static uint16_t width, height;
+static sensor_t sensor;
+
+static int setFramesize(sensor_t *s, framesize_t size) {
+  s->framesize = size;
+  return 0;
+}
+
+static int setQuality(sensor_t *s, int quality) { return 0; }
+
+// Bytes 0x10..0xbf, a fixed function of the position, so never a marker
+static uint8_t noise(size_t i) {
+  uint32_t x = (uint32_t)i * 2654435761u;
+  return 0x10 + (x >> 24) % 0xb0;
+}
+
+static size_t put16(uint8_t *out, uint16_t v) {
+  out[0] = v >> 8;
+  out[1] = v & 0xff;
+  return 2;
+}
+
+// SOI, a baseline SOF0 with the frame size, SOS, the scan, EOI
+static size_t generate(uint8_t *out, size_t capacity, int64_t frame) {
+  static const uint8_t sos[] = {0xff, 0xda, 0x00, 0x0c, 0x03, 0x01, 0x00,
+                                0x02, 0x11, 0x03, 0x11, 0x00, 0x3f, 0x00};
+  size_t scan = std::min<size_t>((size_t)width * height / 10,
+                                 capacity - 19 - sizeof(sos) - 2);
+  size_t n = 0;
+  out[n++] = 0xff;
+  out[n++] = 0xd8;
+  out[n++] = 0xff;
+  out[n++] = 0xc0;
+  n += put16(out + n, 17);
+  out[n++] = 8;
+  n += put16(out + n, height);
+  n += put16(out + n, width);
+  out[n++] = 3;
+  for (uint8_t c = 1; c <= 3; c++) {
+    out[n++] = c;
+    out[n++] = c == 1 ? 0x22 : 0x11;
+    out[n++] = c == 1 ? 0 : 1;
+  }
+  memcpy(out + n, sos, sizeof(sos));
+  n += sizeof(sos);
+  size_t band = scan / 16;
+  size_t bandStart = sceneMoving ? (size_t)(frame % 16) * band : scan;
+  for (size_t i = 0; i < scan; i++)
+    out[n + i] = i >= bandStart && i < bandStart + band ? 0xf0 : noise(i);
+  n += scan;
+  out[n++] = 0xff;
+  out[n++] = 0xd9;
+  return n;
+}
+
+static size_t replay(uint8_t *out, size_t capacity, int64_t frame) {
+  const std::string &path = replayFiles[frame % replayFiles.size()];
+  FILE *f = fopen(path.c_str(), "rbe");
+  if (!f)
+    return 0;
+  size_t n = fread(out, 1, capacity, f);
+  fclose(f);
+  return n;
+}
+
+esp_err_t esp_camera_init(const camera_config_t *config) {
+  std::lock_guard<std::mutex> guard(cameraLock);
+  if (!buffers.empty())
+    return ESP_ERR_INVALID_STATE;
+  width = resolution[config->frame_size].width;
+  height = resolution[config->frame_size].height;
+  size_t capacity = (size_t)width * height / 5;
+  replayFiles.clear();
+  if (!jpegDir.empty()) {
+    std::error_code ec;
+    for (const auto &e : std::filesystem::directory_iterator(jpegDir, ec)) {
+      std::string ext = e.path().extension().string();
+      if (ext == ".jpg" || ext == ".jpeg" || ext == ".JPG") {
+        replayFiles.push_back(e.path().string());
+        capacity = std::max<size_t>(capacity, e.file_size(ec));
+      }
+    }
+    std::sort(replayFiles.begin(), replayFiles.end());
+    if (replayFiles.empty()) {
+      Serial.printf("Camera (host): no JPEGs in %s\n", jpegDir.c_str());
+      return ESP_ERR_NOT_FOUND;
+    }
+  }
+  size_t count = std::max<size_t>(1, config->fb_count);
+  for (size_t i = 0; i < count; i++) {
+    uint8_t *buf = (uint8_t *)(config->fb_location == CAMERA_FB_IN_PSRAM
+                                   ? ps_malloc(capacity)
+                                   : malloc(capacity));
+    if (!buf)
+      return ESP_ERR_NO_MEM;
+    buffers.push_back({{buf, 0, width, height, PIXFORMAT_JPEG, {0, 0}},
+                       capacity, false});
+  }
+  sensor = {};
+  sensor.pixformat = config->pixel_format;
+  sensor.framesize = config->frame_size;
+  sensor.set_framesize = setFramesize;
+  sensor.set_quality = setQuality;
+  startUs = esp_timer_get_time();
+  lastFrame = -1;
+  return ESP_OK;
+}
+
+esp_err_t esp_camera_deinit() {
+  std::lock_guard<std::mutex> guard(cameraLock);
+  for (Buffer &b : buffers)
+    free(b.fb.buf);
+  buffers.clear();
+  return ESP_OK;
+}
+
+camera_fb_t *esp_camera_fb_get() {
+  std::unique_lock<std::mutex> lock(cameraLock);
+  if (buffers.empty())
+    return nullptr;
+  auto freeBuffer = [] {
+    for (Buffer &b : buffers)
+      if (!b.out)
+        return &b;
+    return (Buffer *)nullptr;
+  };
+  if (!bufferReturned.wait_for(lock, std::chrono::seconds(4),
+                               [&] { return freeBuffer() != nullptr; })) {
+    Serial.println("Camera (host): no free frame buffer");
+    return nullptr;
+  }
+  Buffer *b = freeBuffer();
+  b->out = true;
+  int64_t periodUs = 1000000 / sensorFps;
+  int64_t frame = (esp_timer_get_time() - startUs) / periodUs;
+  if (frame <= lastFrame) {
+    frame = lastFrame + 1;
+    int64_t readyUs = startUs + frame * periodUs;
+    lock.unlock();
+    int64_t wait = readyUs - esp_timer_get_time();
+    if (wait > 0)
+      delayMicroseconds(wait);
+    lock.lock();
+  }
+  lastFrame = frame;
+  b->fb.len = replayFiles.empty() ? generate(b->fb.buf, b->capacity, frame)
+                                  : replay(b->fb.buf, b->capacity, frame);
+  int64_t now = esp_timer_get_time();
+  b->fb.timestamp.tv_sec = now / 1000000;
+  b->fb.timestamp.tv_usec = now % 1000000;
+  framesOut.fetch_add(1);
+  return &b->fb;
+}
+
+void esp_camera_fb_return(camera_fb_t *fb) {
+  std::lock_guard<std::mutex> guard(cameraLock);
+  for (Buffer &b : buffers)
+    if (&b.fb == fb)
+      b.out = false;
+  bufferReturned.notify_all();
+}
+
+sensor_t *esp_camera_sensor_get() {
+  std::lock_guard<std::mutex> guard(cameraLock);
+  return buffers.empty() ? nullptr : &sensor;
+}
+
+// ---- esp_jpg_decode ----
+
+// The work area tjpgd asks for (JD_WORKSPACE), so a decode costs the heap
+// what it does on the chip; the JPEG itself is only read through `reader`
+static constexpr size_t DECODE_WORK_BYTES = 3100;
+
+esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader,
+                         jpg_writer_cb writer, void *arg) {
+  std::unique_ptr<uint8_t, void (*)(void *)> work(
+      (uint8_t *)malloc(DECODE_WORK_BYTES), free);
+  if (!work)
+    return ESP_FAIL;
+  auto byteAt = [&](size_t i) -> uint8_t {
+    uint8_t b = 0;
+    return reader(arg, i, &b, 1) == 1 ? b : 0;
+  };
+  if (len < 4 || byteAt(0) != 0xff || byteAt(1) != 0xd8)
+    return ESP_FAIL;
+  // Walk the marker segments up to the start of scan
+  uint16_t w = 0, h = 0;
+  size_t at = 2, scan = 0;
+  while (at + 4 <= len && byteAt(at) == 0xff) {
+    uint8_t marker = byteAt(at + 1);
+    size_t seg = (size_t)byteAt(at + 2) << 8 | byteAt(at + 3);
+    if (marker == 0xc0 || marker == 0xc1 || marker == 0xc2) {
+      if (at + 9 > len)
+        return ESP_FAIL;
+      h = byteAt(at + 5) << 8 | byteAt(at + 6);
+      w = byteAt(at + 7) << 8 | byteAt(at + 8);
+    }
+    at += 2 + seg;
+    if (marker == 0xda) {
+      scan = at;
+      break;
+    }
+  }
+  if (!w || !h || !scan || scan >= len)
+    return ESP_FAIL;
+  size_t scanLen = len - scan;
+  uint16_t ow = w >> scale, oh = h >> scale;
+  if (!ow || !oh || !writer(arg, 0, 0, ow, oh, nullptr))
+    return ESP_FAIL;
+  // 2x2 output blocks, the size of a 4:2:0 MCU at 1/8 scale
+  uint8_t *rgb = work.get();
+  size_t pixels = (size_t)ow * oh;
+  for (uint16_t y = 0; y < oh; y += 2) {
+    for (uint16_t x = 0; x < ow; x += 2) {
+      uint16_t bw = std::min<uint16_t>(2, ow - x);
+      uint16_t bh = std::min<uint16_t>(2, oh - y);
+      for (uint16_t r = 0; r < bh; r++) {
+        for (uint16_t c = 0; c < bw; c++) {
+          size_t p = (size_t)(y + r) * ow + x + c;
+          uint8_t v = byteAt(scan + p * scanLen / pixels);
+          uint8_t *out = rgb + (r * bw + c) * 3;
+          out[0] = out[1] = out[2] = v;
+        }
+      }
+      if (!writer(arg, x, y, bw, bh, rgb))
+        return ESP_FAIL;
+    }
+  }
+  writer(arg, ow, oh, ow, oh, nullptr);
+  return ESP_OK;
+}
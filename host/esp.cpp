@@ -0,0 +1,115 @@
+// The smaller ESP-IDF calls: chip and app identity, CRC, reset and restart
+#include <Arduino.h>
+#include "esp_app_desc.h"
+#include "esp_chip_info.h"
+#include "esp_flash.h"
+#include "esp_mac.h"
+#include "esp_psram.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+#include <fstream>
+#include <iterator>
+#include <unistd.h>
+#include <vector>
+
+// Set across ESP.restart() so the next boot reports a software reset
+static const char *RESET_ENV = "HOST_RESET_REASON";
+
+const char *esp_err_to_name(esp_err_t err) {
+  switch (err) {
+  case ESP_OK:
+    return "ESP_OK";
+  case ESP_FAIL:
+    return "ESP_FAIL";
+  case ESP_ERR_NO_MEM:
+    return "ESP_ERR_NO_MEM";
+  case ESP_ERR_INVALID_ARG:
+    return "ESP_ERR_INVALID_ARG";
+  case ESP_ERR_INVALID_STATE:
+    return "ESP_ERR_INVALID_STATE";
+  case ESP_ERR_INVALID_SIZE:
+    return "ESP_ERR_INVALID_SIZE";
+  case ESP_ERR_NOT_FOUND:
+    return "ESP_ERR_NOT_FOUND";
+  case ESP_ERR_TIMEOUT:
+    return "ESP_ERR_TIMEOUT";
+  default:
+    return "UNKNOWN ERROR";
+  }
+}
+
+void esp_chip_info(esp_chip_info_t *out) {
+  out->model = CHIP_ESP32S3;
+  out->features = CHIP_FEATURE_WIFI_BGN | CHIP_FEATURE_BLE;
+  out->revision = 0;
+  out->cores = 2;
+}
+
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type) {
+  uint64_t efuse = ESP.getEfuseMac();
+  for (int i = 0; i < 6; i++)
+    mac[i] = efuse >> (8 * i);
+  mac[5] += type;
+  return ESP_OK;
+}
+
+esp_err_t esp_flash_get_size(esp_flash_t *chip, uint32_t *size) {
+  *size = ESP.getFlashChipSize();
+  return ESP_OK;
+}
+
+esp_err_t esp_flash_read_id(esp_flash_t *chip, uint32_t *id) {
+  *id = 0x204018; // 16 MB, the id the board's chip reports
+  return ESP_OK;
+}
+
+const esp_app_desc_t *esp_app_get_description() {
+  static const esp_app_desc_t desc = {
+      0xABCD5432, 0, "host", "printer-cam", __TIME__, __DATE__, "host", {}};
+  return &desc;
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len) {
+  crc = ~crc;
+  while (len--) {
+    crc ^= *buf++;
+    for (int k = 0; k < 8; k++)
+      crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+  }
+  return ~crc;
+}
+
+size_t esp_psram_get_size() { return ESP.getPsramSize(); }
+
+esp_reset_reason_t esp_reset_reason() {
+  static const esp_reset_reason_t reason =
+      getenv(RESET_ENV) ? ESP_RST_SW : ESP_RST_POWERON;
+  return reason;
+}
+
+const char *esp_get_idf_version() { return "v5.1-host"; }
+
+uint32_t esp_get_free_heap_size() {
+  return heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+}
+
+uint32_t esp_get_minimum_free_heap_size() {
+  return heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+}
+
+void esp_restart() {
+  Serial.flush();
+  std::ifstream in("/proc/self/cmdline", std::ios::binary);
+  std::string cmdline((std::istreambuf_iterator<char>(in)),
+                      std::istreambuf_iterator<char>());
+  std::vector<char *> argv;
+  for (size_t at = 0; at < cmdline.size(); at += strlen(&cmdline[at]) + 1)
+    argv.push_back(&cmdline[at]);
+  argv.push_back(nullptr);
+  setenv(RESET_ENV, "sw", 1);
+  // Sockets and files are opened close-on-exec, so the new image can bind
+  // the same port
+  execv("/proc/self/exe", argv.data());
+  perror("host: restart");
+  _exit(1);
+}
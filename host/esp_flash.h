@@ -0,0 +1,11 @@
+#pragma once
+extern "C++" {
+#include <cstdint>
+#include "esp_err.h"
+
+typedef struct esp_flash_t esp_flash_t;
+extern esp_flash_t *esp_flash_default_chip;
+
+esp_err_t esp_flash_get_size(esp_flash_t *chip, uint32_t *size);
+esp_err_t esp_flash_read_id(esp_flash_t *chip, uint32_t *id);
+}
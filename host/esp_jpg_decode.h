@@ -0,0 +1,17 @@
+#pragma once
+extern "C++" {
+#include "esp_err.h"
+#include "img_converters.h"
+
+typedef size_t (*jpg_reader_cb)(void *arg, size_t index, uint8_t *buf,
+                                size_t len);
+typedef bool (*jpg_writer_cb)(void *arg, uint16_t x, uint16_t y, uint16_t w,
+                              uint16_t h, uint8_t *data);
+
+// Not a JPEG decoder. The frame size comes from the SOF marker, and each
+// output block is filled with a grey level derived from the compressed
+// bytes that fall at its position, so identical frames decode identically
+// and changed frames change the planes, which is all motion scoring needs.
+esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader,
+                         jpg_writer_cb writer, void *arg);
+}
@@ -0,0 +1,6 @@
+#pragma once
+extern "C++" {
+#include <cstddef>
+
+size_t esp_psram_get_size();
+}
@@ -0,0 +1,7 @@
+#pragma once
+extern "C++" {
+#include <cstdint>
+
+// Same CRC-32 (IEEE, reflected) as the ROM routine
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
+}
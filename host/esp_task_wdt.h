@@ -0,0 +1,10 @@
+#pragma once
+extern "C++" {
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+// No watchdog on the host
+inline esp_err_t esp_task_wdt_add(TaskHandle_t task) { return ESP_OK; }
+inline esp_err_t esp_task_wdt_delete(TaskHandle_t task) { return ESP_OK; }
+inline esp_err_t esp_task_wdt_reset() { return ESP_OK; }
+}
@@ -0,0 +1,131 @@
+// esp_timer on the host: the monotonic clock, and one "esp_timer" task
+// that runs the callbacks in deadline order
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <chrono>
+#include <condition_variable>
+#include <list>
+
+struct esp_timer {
+  esp_timer_cb_t callback;
+  void *arg;
+  bool skipUnhandled;
+  bool active = false;
+  int64_t due = 0;    // us
+  uint64_t period = 0; // us, 0 = one-shot
+};
+
+static std::mutex timersLock;
+static std::condition_variable timersChanged;
+static std::list<esp_timer *> timers;
+static TaskHandle_t timerTask = nullptr;
+
+int64_t esp_timer_get_time() {
+  using namespace std::chrono;
+  static const steady_clock::time_point start = steady_clock::now();
+  return duration_cast<microseconds>(steady_clock::now() - start).count();
+}
+
+static void runTimers(void *) {
+  std::unique_lock<std::mutex> lock(timersLock);
+  for (;;) {
+    esp_timer *next = nullptr;
+    for (esp_timer *t : timers)
+      if (t->active && (!next || t->due < next->due))
+        next = t;
+    if (!next) {
+      timersChanged.wait(lock);
+      continue;
+    }
+    int64_t wait = next->due - esp_timer_get_time();
+    if (wait > 0) {
+      timersChanged.wait_for(lock, std::chrono::microseconds(wait));
+      continue;
+    }
+    if (next->period) {
+      next->due += next->period;
+      int64_t now = esp_timer_get_time();
+      if (next->skipUnhandled && next->due < now)
+        next->due = now + next->period;
+    } else {
+      next->active = false;
+    }
+    esp_timer_cb_t callback = next->callback;
+    void *arg = next->arg;
+    lock.unlock();
+    callback(arg);
+    lock.lock();
+  }
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args,
+                           esp_timer_handle_t *out) {
+  if (!args || !args->callback || !out)
+    return ESP_ERR_INVALID_ARG;
+  esp_timer *t = new esp_timer;
+  t->callback = args->callback;
+  t->arg = args->arg;
+  t->skipUnhandled = args->skip_unhandled_events;
+  std::lock_guard<std::mutex> guard(timersLock);
+  timers.push_back(t);
+  if (!timerTask)
+    xTaskCreatePinnedToCore(runTimers, "esp_timer", 4096, nullptr, 22,
+                            &timerTask, 0);
+  *out = t;
+  return ESP_OK;
+}
+
+static esp_err_t start(esp_timer_handle_t t, uint64_t us, uint64_t period) {
+  std::lock_guard<std::mutex> guard(timersLock);
+  if (t->active)
+    return ESP_ERR_INVALID_STATE;
+  t->active = true;
+  t->due = esp_timer_get_time() + us;
+  t->period = period;
+  timersChanged.notify_all();
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeoutUs) {
+  return start(timer, timeoutUs, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer,
+                                   uint64_t periodUs) {
+  return start(timer, periodUs, periodUs);
+}
+
+esp_err_t esp_timer_restart(esp_timer_handle_t timer, uint64_t timeoutUs) {
+  std::lock_guard<std::mutex> guard(timersLock);
+  if (!timer->active)
+    return ESP_ERR_INVALID_STATE;
+  timer->due = esp_timer_get_time() + timeoutUs;
+  if (timer->period)
+    timer->period = timeoutUs;
+  timersChanged.notify_all();
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+  std::lock_guard<std::mutex> guard(timersLock);
+  if (!timer->active)
+    return ESP_ERR_INVALID_STATE;
+  timer->active = false;
+  timersChanged.notify_all();
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+  std::lock_guard<std::mutex> guard(timersLock);
+  if (timer->active)
+    return ESP_ERR_INVALID_STATE;
+  timers.remove(timer);
+  delete timer;
+  return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer) {
+  std::lock_guard<std::mutex> guard(timersLock);
+  return timer->active;
+}
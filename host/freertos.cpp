@@ -0,0 +1,561 @@
+// FreeRTOS on host threads. Each task is a detached std::thread with a
+// HostTask record; threads the stand-in did not create (the main thread,
+// test runners) are adopted on first use. Queues, semaphores, stream
+// buffers and notifications are a mutex and condition variable apiece.
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/stream_buffer.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+struct HostTask {
+  const char *name;
+  UBaseType_t priority;
+  BaseType_t core;
+  uint32_t stackDepth;
+  UBaseType_t number;
+  clockid_t clock;
+  bool hasClock = false;
+
+  std::mutex notifyLock;
+  std::condition_variable notified;
+  uint32_t notifyValue = 0;
+  bool notifyPending = false;
+};
+
+// Thrown by vTaskDelete(nullptr) and caught where the task's thread began
+struct TaskDeleted {};
+
+static std::mutex tasksLock;
+static std::vector<HostTask *> tasks;
+static UBaseType_t nextTaskNumber = 1;
+static HostTask idleTasks[portNUM_PROCESSORS];
+static thread_local HostTask *current = nullptr;
+
+// Task names outlive their tasks, as TaskStatus_t readers expect
+static const char *intern(const char *name) {
+  static std::mutex lock;
+  static std::set<std::string> names;
+  std::lock_guard<std::mutex> guard(lock);
+  return names.insert(name ? name : "").first->c_str();
+}
+
+static void registerTask(HostTask *t) {
+  std::lock_guard<std::mutex> guard(tasksLock);
+  t->number = nextTaskNumber++;
+  tasks.push_back(t);
+}
+
+static void bindThread(HostTask *t) {
+  current = t;
+  std::lock_guard<std::mutex> guard(tasksLock);
+  t->hasClock = pthread_getcpuclockid(pthread_self(), &t->clock) == 0;
+}
+
+static HostTask *self() {
+  if (!current) {
+    bool main = syscall(SYS_gettid) == getpid();
+    HostTask *t = new HostTask;
+    t->name = intern(main ? "loopTask" : "host");
+    t->priority = 1;
+    t->core = 1;
+    t->stackDepth = 8192;
+    registerTask(t);
+    bindThread(t);
+  }
+  return current;
+}
+
+template <typename Ready>
+static bool waitFor(std::condition_variable &cv,
+                    std::unique_lock<std::mutex> &lock, TickType_t ticks,
+                    Ready ready) {
+  if (ticks == portMAX_DELAY) {
+    cv.wait(lock, ready);
+    return true;
+  }
+  return cv.wait_for(lock, std::chrono::milliseconds(ticks), ready);
+}
+
+BaseType_t xPortGetCoreID() {
+  BaseType_t core = self()->core;
+  return core == tskNO_AFFINITY ? 0 : core;
+}
+
+// ---- Tasks ----
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name,
+                                   uint32_t stackDepth, void *param,
+                                   UBaseType_t priority, TaskHandle_t *created,
+                                   BaseType_t core) {
+  HostTask *t = new HostTask;
+  t->name = intern(name);
+  t->priority = priority;
+  t->core = core;
+  t->stackDepth = stackDepth;
+  registerTask(t);
+  if (created)
+    *created = t; // before the task runs, as the scheduler guarantees
+  std::thread([t, fn, param] {
+    bindThread(t);
+    try {
+      fn(param);
+    } catch (const TaskDeleted &) {
+    }
+    {
+      std::lock_guard<std::mutex> guard(tasksLock);
+      tasks.erase(std::find(tasks.begin(), tasks.end(), t));
+    }
+    delete t;
+  }).detach();
+  return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name,
+                       uint32_t stackDepth, void *param, UBaseType_t priority,
+                       TaskHandle_t *created) {
+  return xTaskCreatePinnedToCore(fn, name, stackDepth, param, priority,
+                                 created, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+  if (task && task != current) {
+    fprintf(stderr, "host: vTaskDelete() of another task is not supported\n");
+    abort();
+  }
+  throw TaskDeleted();
+}
+
+void vTaskDelay(TickType_t ticks) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+void vTaskDelayUntil(TickType_t *previousWake, TickType_t period) {
+  TickType_t wake = *previousWake + period;
+  TickType_t now = xTaskGetTickCount();
+  if ((int32_t)(wake - now) > 0)
+    vTaskDelay(wake - now);
+  *previousWake = wake;
+}
+
+TickType_t xTaskGetTickCount() {
+  return (TickType_t)(esp_timer_get_time() / 1000);
+}
+
+TickType_t xTaskGetTickCountFromISR() { return xTaskGetTickCount(); }
+
+TaskHandle_t xTaskGetCurrentTaskHandle() { return self(); }
+
+static HostTask *taskOf(TaskHandle_t task) {
+  return task ? (HostTask *)task : self();
+}
+
+char *pcTaskGetName(TaskHandle_t task) {
+  return (char *)taskOf(task)->name;
+}
+
+BaseType_t xTaskGetAffinity(TaskHandle_t task) { return taskOf(task)->core; }
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task) {
+  return taskOf(task)->priority;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+  return taskOf(task)->stackDepth;
+}
+
+TaskHandle_t xTaskGetIdleTaskHandleForCore(BaseType_t core) {
+  if (core < 0 || core >= portNUM_PROCESSORS)
+    return nullptr;
+  HostTask &idle = idleTasks[core];
+  if (!idle.name) {
+    idle.name = intern(core ? "IDLE1" : "IDLE0");
+    idle.core = core;
+    idle.stackDepth = 1536;
+  }
+  return &idle;
+}
+
+UBaseType_t uxTaskGetNumberOfTasks() {
+  std::lock_guard<std::mutex> guard(tasksLock);
+  return tasks.size() + portNUM_PROCESSORS;
+}
+
+static uint32_t cpuMicros(clockid_t clock) {
+  timespec ts;
+  if (clock_gettime(clock, &ts) != 0)
+    return 0;
+  return (uint32_t)(ts.tv_sec * 1000000ull + ts.tv_nsec / 1000);
+}
+
+// Run time is each thread's CPU time. The idle tasks get whatever of the
+// wall clock the tasks pinned to their core did not use.
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *out, UBaseType_t max,
+                                 configRUN_TIME_COUNTER_TYPE *totalRunTime) {
+  HostTask *me = self();
+  uint32_t total = (uint32_t)esp_timer_get_time();
+  std::lock_guard<std::mutex> guard(tasksLock);
+  if (max < tasks.size() + portNUM_PROCESSORS)
+    return 0;
+  uint64_t used[portNUM_PROCESSORS] = {};
+  UBaseType_t n = 0;
+  for (HostTask *t : tasks) {
+    TaskStatus_t &s = out[n++];
+    s.xHandle = t;
+    s.pcTaskName = t->name;
+    s.xTaskNumber = t->number;
+    s.eCurrentState = t == me ? eRunning : eBlocked;
+    s.uxCurrentPriority = s.uxBasePriority = t->priority;
+    s.ulRunTimeCounter = t->hasClock ? cpuMicros(t->clock) : 0;
+    s.pxStackBase = nullptr;
+    s.usStackHighWaterMark = t->stackDepth;
+    s.xCoreID = t->core;
+    if (t->core >= 0 && t->core < portNUM_PROCESSORS)
+      used[t->core] += s.ulRunTimeCounter;
+  }
+  for (BaseType_t c = 0; c < portNUM_PROCESSORS; c++) {
+    HostTask *idle = (HostTask *)xTaskGetIdleTaskHandleForCore(c);
+    TaskStatus_t &s = out[n++];
+    s = {};
+    s.xHandle = idle;
+    s.pcTaskName = idle->name;
+    s.xTaskNumber = 1000 + c;
+    s.eCurrentState = eReady;
+    s.ulRunTimeCounter = used[c] < total ? total - used[c] : 0;
+    s.usStackHighWaterMark = idle->stackDepth;
+    s.xCoreID = c;
+  }
+  if (totalRunTime)
+    *totalRunTime = total;
+  return n;
+}
+
+// ---- Notifications ----
+
+static BaseType_t notify(TaskHandle_t task, uint32_t value,
+                         eNotifyAction action) {
+  HostTask *t = (HostTask *)task;
+  std::lock_guard<std::mutex> guard(t->notifyLock);
+  switch (action) {
+  case eSetBits:
+    t->notifyValue |= value;
+    break;
+  case eIncrement:
+    t->notifyValue++;
+    break;
+  case eSetValueWithOverwrite:
+    t->notifyValue = value;
+    break;
+  case eSetValueWithoutOverwrite:
+    if (t->notifyPending)
+      return pdFAIL;
+    t->notifyValue = value;
+    break;
+  case eNoAction:
+    break;
+  }
+  t->notifyPending = true;
+  t->notified.notify_all();
+  return pdPASS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  return notify(task, 0, eIncrement);
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) {
+  notify(task, 0, eIncrement);
+  if (woken)
+    *woken = pdTRUE;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks) {
+  HostTask *t = self();
+  std::unique_lock<std::mutex> lock(t->notifyLock);
+  waitFor(t->notified, lock, ticks, [t] { return t->notifyValue != 0; });
+  uint32_t value = t->notifyValue;
+  if (value)
+    t->notifyValue = clearOnExit ? 0 : value - 1;
+  t->notifyPending = false;
+  return value;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value,
+                       eNotifyAction action) {
+  return notify(task, value, action);
+}
+
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value,
+                              eNotifyAction action, BaseType_t *woken) {
+  if (woken)
+    *woken = pdTRUE;
+  return notify(task, value, action);
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clearOnEntry, uint32_t clearOnExit,
+                           uint32_t *value, TickType_t ticks) {
+  HostTask *t = self();
+  std::unique_lock<std::mutex> lock(t->notifyLock);
+  if (!t->notifyPending)
+    t->notifyValue &= ~clearOnEntry;
+  bool got = waitFor(t->notified, lock, ticks,
+                     [t] { return t->notifyPending; });
+  if (value)
+    *value = t->notifyValue;
+  if (!got)
+    return pdFALSE;
+  t->notifyValue &= ~clearOnExit;
+  t->notifyPending = false;
+  return pdTRUE;
+}
+
+// ---- Queues and semaphores ----
+
+struct HostQueue {
+  enum Kind { Queue, Mutex, RecursiveMutex, Semaphore } kind;
+  UBaseType_t length;
+  UBaseType_t itemSize;
+  std::vector<uint8_t> storage; // ring of length items
+  UBaseType_t head = 0;
+  UBaseType_t count = 0;
+  TaskHandle_t holder = nullptr; // mutexes
+  UBaseType_t depth = 0;         // recursive takes by the holder
+  std::mutex lock;
+  std::condition_variable changed;
+};
+
+static QueueHandle_t makeQueue(HostQueue::Kind kind, UBaseType_t length,
+                               UBaseType_t itemSize, UBaseType_t count) {
+  HostQueue *q = new HostQueue;
+  q->kind = kind;
+  q->length = length;
+  q->itemSize = itemSize;
+  q->storage.resize((size_t)length * itemSize);
+  q->count = count;
+  return q;
+}
+
+static BaseType_t send(QueueHandle_t q, const void *item, TickType_t ticks,
+                       bool front) {
+  std::unique_lock<std::mutex> lock(q->lock);
+  if (!waitFor(q->changed, lock, ticks,
+               [q] { return q->count < q->length; }))
+    return errQUEUE_FULL;
+  if (q->itemSize) {
+    UBaseType_t at;
+    if (front) {
+      q->head = (q->head + q->length - 1) % q->length;
+      at = q->head;
+    } else {
+      at = (q->head + q->count) % q->length;
+    }
+    memcpy(&q->storage[(size_t)at * q->itemSize], item, q->itemSize);
+  }
+  q->count++;
+  q->changed.notify_all();
+  return pdPASS;
+}
+
+static BaseType_t receive(QueueHandle_t q, void *item, TickType_t ticks,
+                          bool remove) {
+  std::unique_lock<std::mutex> lock(q->lock);
+  if (!waitFor(q->changed, lock, ticks, [q] { return q->count > 0; }))
+    return pdFALSE;
+  if (q->itemSize && item)
+    memcpy(item, &q->storage[(size_t)q->head * q->itemSize], q->itemSize);
+  if (remove) {
+    q->head = (q->head + 1) % q->length;
+    q->count--;
+    q->changed.notify_all();
+  }
+  return pdTRUE;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+  return length ? makeQueue(HostQueue::Queue, length, itemSize, 0) : nullptr;
+}
+
+void vQueueDelete(QueueHandle_t queue) { delete queue; }
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item,
+                      TickType_t ticks) {
+  return send(queue, item, ticks, false);
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item,
+                            TickType_t ticks) {
+  return send(queue, item, ticks, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item,
+                             TickType_t ticks) {
+  return send(queue, item, ticks, true);
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item,
+                             BaseType_t *woken) {
+  if (woken)
+    *woken = pdFALSE;
+  return send(queue, item, 0, false);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks) {
+  return receive(queue, item, ticks, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t ticks) {
+  return receive(queue, item, ticks, false);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+  std::lock_guard<std::mutex> guard(queue->lock);
+  return queue->count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue) {
+  std::lock_guard<std::mutex> guard(queue->lock);
+  return queue->length - queue->count;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+  std::lock_guard<std::mutex> guard(queue->lock);
+  queue->head = 0;
+  queue->count = 0;
+  queue->changed.notify_all();
+  return pdPASS;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+  return makeQueue(HostQueue::Mutex, 1, 0, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex() {
+  return makeQueue(HostQueue::RecursiveMutex, 1, 0, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+  return makeQueue(HostQueue::Semaphore, 1, 0, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max,
+                                           UBaseType_t initial) {
+  return makeQueue(HostQueue::Semaphore, max, 0, initial);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem) { delete sem; }
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+  if (!receive(sem, nullptr, ticks, true))
+    return pdFALSE;
+  if (sem->kind != HostQueue::Semaphore) {
+    std::lock_guard<std::mutex> guard(sem->lock);
+    sem->holder = self();
+  }
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+  if (sem->kind != HostQueue::Semaphore) {
+    std::lock_guard<std::mutex> guard(sem->lock);
+    if (sem->holder != self())
+      return pdFALSE;
+    sem->holder = nullptr;
+  }
+  return send(sem, nullptr, 0, false);
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken) {
+  if (woken)
+    *woken = pdFALSE;
+  return send(sem, nullptr, 0, false);
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t sem, TickType_t ticks) {
+  {
+    std::lock_guard<std::mutex> guard(sem->lock);
+    if (sem->holder == self()) {
+      sem->depth++;
+      return pdTRUE;
+    }
+  }
+  return xSemaphoreTake(sem, ticks);
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t sem) {
+  {
+    std::lock_guard<std::mutex> guard(sem->lock);
+    if (sem->holder != self())
+      return pdFALSE;
+    if (sem->depth) {
+      sem->depth--;
+      return pdTRUE;
+    }
+  }
+  return xSemaphoreGive(sem);
+}
+
+// ---- Stream buffers ----
+
+struct HostStreamBuffer {
+  size_t size;
+  size_t triggerLevel;
+  std::string data;
+  std::mutex lock;
+  std::condition_variable changed;
+};
+
+StreamBufferHandle_t xStreamBufferCreate(size_t size, size_t triggerLevel) {
+  HostStreamBuffer *b = new HostStreamBuffer;
+  b->size = size;
+  b->triggerLevel = std::max<size_t>(1, std::min(triggerLevel, size));
+  return b;
+}
+
+void vStreamBufferDelete(StreamBufferHandle_t buffer) { delete buffer; }
+
+// Waits for room for all of `len` (up to the timeout), then sends what fits
+size_t xStreamBufferSend(StreamBufferHandle_t b, const void *data, size_t len,
+                         TickType_t ticks) {
+  std::unique_lock<std::mutex> lock(b->lock);
+  size_t want = std::min(len, b->size);
+  waitFor(b->changed, lock, ticks,
+          [b, want] { return b->size - b->data.size() >= want; });
+  size_t n = std::min(len, b->size - b->data.size());
+  b->data.append((const char *)data, n);
+  if (n)
+    b->changed.notify_all();
+  return n;
+}
+
+size_t xStreamBufferReceive(StreamBufferHandle_t b, void *data, size_t len,
+                            TickType_t ticks) {
+  std::unique_lock<std::mutex> lock(b->lock);
+  waitFor(b->changed, lock, ticks,
+          [b] { return b->data.size() >= b->triggerLevel; });
+  size_t n = std::min(len, b->data.size());
+  memcpy(data, b->data.data(), n);
+  b->data.erase(0, n);
+  if (n)
+    b->changed.notify_all();
+  return n;
+}
+
+size_t xStreamBufferBytesAvailable(StreamBufferHandle_t b) {
+  std::lock_guard<std::mutex> guard(b->lock);
+  return b->data.size();
+}
@@ -0,0 +1,53 @@
+#pragma once
+// Host stand-in for FreeRTOS (ESP-IDF SMP flavour): tasks are threads, ticks
+// are milliseconds, and a critical section is a recursive lock per portMUX.
+// The firmware includes these inside extern "C"; every host header keeps
+// C++ linkage so the stand-ins can use the standard library.
+extern "C++" {
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t StackType_t;
+typedef void *TaskHandle_t;
+typedef struct HostQueue *QueueHandle_t;
+typedef QueueHandle_t SemaphoreHandle_t;
+typedef uint32_t configRUN_TIME_COUNTER_TYPE;
+
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define pdTICKS_TO_MS(ticks) ((uint32_t)(ticks))
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define errQUEUE_FULL 0
+#define tskNO_AFFINITY 0x7fffffff
+#define configNUM_CORES 2
+#define portNUM_PROCESSORS 2
+#define configUSE_TRACE_FACILITY 1
+#define configGENERATE_RUN_TIME_STATS 1
+#define configMAX_TASK_NAME_LEN 16
+#define portYIELD_FROM_ISR(woken) (void)(woken)
+
+// Interrupts never preempt a host thread, so a critical section only has to
+// exclude the other tasks using the same mux. Recursive, as on the chip.
+typedef struct {
+  std::recursive_mutex lock;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {}
+
+inline void portENTER_CRITICAL(portMUX_TYPE *mux) { mux->lock.lock(); }
+inline void portEXIT_CRITICAL(portMUX_TYPE *mux) { mux->lock.unlock(); }
+inline void portENTER_CRITICAL_ISR(portMUX_TYPE *mux) { mux->lock.lock(); }
+inline void portEXIT_CRITICAL_ISR(portMUX_TYPE *mux) { mux->lock.unlock(); }
+#define taskENTER_CRITICAL(mux) portENTER_CRITICAL(mux)
+#define taskEXIT_CRITICAL(mux) portEXIT_CRITICAL(mux)
+
+BaseType_t xPortGetCoreID();
+}
@@ -0,0 +1,14 @@
+#pragma once
+extern "C++" {
+#include "FreeRTOS.h"
+
+typedef struct HostStreamBuffer *StreamBufferHandle_t;
+
+StreamBufferHandle_t xStreamBufferCreate(size_t size, size_t triggerLevel);
+void vStreamBufferDelete(StreamBufferHandle_t buffer);
+size_t xStreamBufferSend(StreamBufferHandle_t buffer, const void *data,
+                         size_t len, TickType_t ticks);
+size_t xStreamBufferReceive(StreamBufferHandle_t buffer, void *data,
+                            size_t len, TickType_t ticks);
+size_t xStreamBufferBytesAvailable(StreamBufferHandle_t buffer);
+}
@@ -0,0 +1,269 @@
+// FFat on a host directory. Paths are the firmware's ("/i/img_1.jpg"),
+// resolved under <data dir>/<subdir>. Host::setFsDelayUs() makes every write
+// and remove slow, to stand in for a busy flash.
+#include <FFat.h>
+#include "host.h"
+#include <atomic>
+#include <cerrno>
+#include <dirent.h>
+#include <filesystem>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+F_Fat FFat;
+
+static std::atomic<uint32_t> fsDelayUs{0};
+
+static void slowFlash() {
+  uint32_t us = fsDelayUs.load(std::memory_order_relaxed);
+  if (us)
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+namespace Host {
+void setFsDelayUs(uint32_t us) { fsDelayUs.store(us); }
+} // namespace Host
+
+namespace fs {
+
+struct FileImpl {
+  std::string path; // as the firmware sees it
+  std::string host;
+  std::string mode;
+  FILE *file = nullptr;
+  DIR *dir = nullptr;
+
+  ~FileImpl() { close(); }
+  void close() {
+    if (file)
+      fclose(file);
+    if (dir)
+      closedir(dir);
+    file = nullptr;
+    dir = nullptr;
+  }
+};
+
+size_t File::write(uint8_t c) { return write(&c, 1); }
+
+size_t File::write(const uint8_t *buf, size_t len) {
+  if (!impl || !impl->file || impl->mode == "r")
+    return 0;
+  slowFlash();
+  return fwrite(buf, 1, len, impl->file);
+}
+
+int File::available() {
+  if (!impl || !impl->file)
+    return 0;
+  return (int)(size() - position());
+}
+
+int File::read() {
+  if (!impl || !impl->file)
+    return -1;
+  int c = fgetc(impl->file);
+  return c == EOF ? -1 : c;
+}
+
+int File::peek() {
+  if (!impl || !impl->file)
+    return -1;
+  int c = fgetc(impl->file);
+  if (c == EOF)
+    return -1;
+  ungetc(c, impl->file);
+  return c;
+}
+
+size_t File::read(uint8_t *buf, size_t len) {
+  if (!impl || !impl->file)
+    return 0;
+  return fread(buf, 1, len, impl->file);
+}
+
+bool File::seek(uint32_t pos, SeekMode mode) {
+  if (!impl || !impl->file)
+    return false;
+  static const int whence[] = {SEEK_SET, SEEK_CUR, SEEK_END};
+  return fseek(impl->file, pos, whence[mode]) == 0;
+}
+
+size_t File::position() const {
+  if (!impl || !impl->file)
+    return 0;
+  long pos = ftell(impl->file);
+  return pos < 0 ? 0 : pos;
+}
+
+size_t File::size() const {
+  if (!impl || !impl->file)
+    return 0;
+  fflush(impl->file);
+  struct stat st;
+  return fstat(fileno(impl->file), &st) == 0 ? st.st_size : 0;
+}
+
+void File::flush() {
+  if (impl && impl->file)
+    fflush(impl->file);
+}
+
+void File::close() {
+  if (impl)
+    impl->close();
+  impl.reset();
+}
+
+time_t File::getLastWrite() {
+  if (!impl)
+    return 0;
+  flush();
+  struct stat st;
+  return stat(impl->host.c_str(), &st) == 0 ? st.st_mtime : 0;
+}
+
+const char *File::name() const {
+  if (!impl)
+    return nullptr;
+  size_t slash = impl->path.rfind('/');
+  return impl->path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+}
+
+const char *File::path() const { return impl ? impl->path.c_str() : nullptr; }
+
+bool File::isDirectory() const { return impl && impl->dir; }
+
+static std::shared_ptr<FileImpl> openHost(const std::string &path,
+                                          const std::string &host,
+                                          const char *mode) {
+  auto impl = std::make_shared<FileImpl>();
+  impl->path = path;
+  impl->host = host;
+  impl->mode = mode;
+  struct stat st;
+  if (stat(host.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+    impl->dir = opendir(host.c_str());
+  } else {
+    if (impl->mode != "r")
+      slowFlash();
+    // Binary, close-on-exec
+    std::string flags = std::string(mode) + "be";
+    impl->file = fopen(host.c_str(), flags.c_str());
+  }
+  if (!impl->file && !impl->dir)
+    return nullptr;
+  return impl;
+}
+
+File File::openNextFile(const char *mode) {
+  if (!impl || !impl->dir)
+    return File();
+  while (dirent *e = readdir(impl->dir)) {
+    if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+      continue;
+    std::string sep = impl->path == "/" ? "" : "/";
+    auto next = openHost(impl->path + sep + e->d_name,
+                         impl->host + "/" + e->d_name, mode);
+    if (next)
+      return File(next);
+  }
+  return File();
+}
+
+void File::rewindDirectory() {
+  if (impl && impl->dir)
+    rewinddir(impl->dir);
+}
+
+File::operator bool() const { return impl && (impl->file || impl->dir); }
+
+std::string FS::hostPath(const char *path) const {
+  std::string out = std::string(Host::dataDir()) + "/" + subdir;
+  if (path && *path && strcmp(path, "/") != 0)
+    out += *path == '/' ? path : std::string("/") + path;
+  return out;
+}
+
+File FS::open(const char *path, const char *mode, const bool create) {
+  if (!mounted || !path || *path != '/')
+    return File();
+  std::string host = hostPath(path);
+  if (create && *mode != 'r') {
+    std::error_code ec;
+    std::filesystem::create_directories(
+        std::filesystem::path(host).parent_path(), ec);
+  }
+  return File(openHost(path, host, mode));
+}
+
+bool FS::exists(const char *path) {
+  return mounted && access(hostPath(path).c_str(), F_OK) == 0;
+}
+
+bool FS::remove(const char *path) {
+  if (!mounted)
+    return false;
+  slowFlash();
+  return unlink(hostPath(path).c_str()) == 0;
+}
+
+bool FS::rename(const char *from, const char *to) {
+  if (!mounted)
+    return false;
+  slowFlash();
+  return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0;
+}
+
+bool FS::mkdir(const char *path) {
+  if (!mounted)
+    return false;
+  return ::mkdir(hostPath(path).c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+bool FS::rmdir(const char *path) {
+  return mounted && ::rmdir(hostPath(path).c_str()) == 0;
+}
+
+} // namespace fs
+
+// ---- FFat ----
+
+static constexpr size_t FFAT_BYTES = 0x8F0000; // partitions.csv
+static constexpr size_t CLUSTER = 4096;
+
+bool F_Fat::begin(bool formatOnFail, const char *basePath,
+                  uint8_t maxOpenFiles, const char *partitionLabel) {
+  std::error_code ec;
+  std::filesystem::create_directories(hostPath("/"), ec);
+  mounted = !ec;
+  return mounted;
+}
+
+bool F_Fat::format(bool fullWipe, char *partitionLabel) {
+  std::error_code ec;
+  std::filesystem::remove_all(hostPath("/"), ec);
+  std::filesystem::create_directories(hostPath("/"), ec);
+  return !ec;
+}
+
+void F_Fat::end() { mounted = false; }
+
+size_t F_Fat::totalBytes() { return FFAT_BYTES; }
+
+// Whole clusters, as FAT allocates them; directories take one each
+size_t F_Fat::usedBytes() {
+  size_t used = 0;
+  std::error_code ec;
+  for (auto it = std::filesystem::recursive_directory_iterator(hostPath("/"),
+                                                                ec);
+       !ec && it != std::filesystem::recursive_directory_iterator();
+       it.increment(ec)) {
+    size_t bytes = it->is_directory(ec) ? CLUSTER : it->file_size(ec);
+    used += (bytes + CLUSTER - 1) / CLUSTER * CLUSTER;
+  }
+  return std::min(used, FFAT_BYTES);
+}
+
+size_t F_Fat::freeBytes() { return totalBytes() - usedBytes(); }
@@ -0,0 +1,316 @@
+// Heap accounting for the host build. malloc and friends are interposed on
+// glibc's, so every allocation in the process is counted: the firmware's
+// own, the C++ library's and the host stand-ins'. ps_malloc() and
+// heap_caps_malloc(MALLOC_CAP_SPIRAM) land in a small pointer table so
+// PSRAM and internal RAM are tracked apart, like the two heaps on the chip.
+#include "host.h"
+#include <Arduino.h>
+#include <atomic>
+#include <cerrno>
+#include <malloc.h>
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+}
+
+#ifndef HOST_INTERNAL_HEAP_BYTES
+#define HOST_INTERNAL_HEAP_BYTES (4 * 1024 * 1024)
+#endif
+#ifndef HOST_PSRAM_BYTES
+#define HOST_PSRAM_BYTES (8 * 1024 * 1024)
+#endif
+
+enum Pool { Internal, Psram };
+
+struct Counters {
+  std::atomic<size_t> used{0};
+  std::atomic<size_t> peak{0};
+  std::atomic<size_t> blocks{0};
+};
+
+static Counters pools[2];
+static std::atomic<uint64_t> allocations{0};
+static std::atomic<uint64_t> frees{0};
+static std::atomic<uint64_t> allocatedBytes{0};
+
+static const size_t capacity[2] = {HOST_INTERNAL_HEAP_BYTES,
+                                   HOST_PSRAM_BYTES};
+
+// Open-addressed set of live PSRAM blocks. Only a few hundred exist at
+// once (pool slots, planes, rings), so it never gets close to full.
+static constexpr size_t PSRAM_SLOTS = 16384;
+static void *psramBlocks[PSRAM_SLOTS];
+static std::atomic_flag psramLock = ATOMIC_FLAG_INIT;
+static std::atomic<size_t> psramLive{0};
+static void *const TOMBSTONE = (void *)1;
+
+struct PsramGuard {
+  PsramGuard() {
+    while (psramLock.test_and_set(std::memory_order_acquire))
+      ;
+  }
+  ~PsramGuard() { psramLock.clear(std::memory_order_release); }
+};
+
+static size_t slotFor(void *p) {
+  return ((uintptr_t)p >> 4) * 2654435761u % PSRAM_SLOTS;
+}
+
+static void psramInsert(void *p) {
+  PsramGuard guard;
+  for (size_t i = slotFor(p);; i = (i + 1) % PSRAM_SLOTS) {
+    if (!psramBlocks[i] || psramBlocks[i] == TOMBSTONE) {
+      psramBlocks[i] = p;
+      psramLive.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  }
+}
+
+static bool psramErase(void *p) {
+  if (psramLive.load(std::memory_order_relaxed) == 0)
+    return false;
+  PsramGuard guard;
+  for (size_t i = slotFor(p), n = 0; n < PSRAM_SLOTS;
+       i = (i + 1) % PSRAM_SLOTS, n++) {
+    if (!psramBlocks[i])
+      return false;
+    if (psramBlocks[i] == p) {
+      psramBlocks[i] = TOMBSTONE;
+      psramLive.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+static void account(void *p, Pool pool) {
+  if (!p)
+    return;
+  Counters &c = pools[pool];
+  size_t size = malloc_usable_size(p);
+  size_t now = c.used.fetch_add(size, std::memory_order_relaxed) + size;
+  size_t peak = c.peak.load(std::memory_order_relaxed);
+  while (now > peak &&
+         !c.peak.compare_exchange_weak(peak, now, std::memory_order_relaxed))
+    ;
+  c.blocks.fetch_add(1, std::memory_order_relaxed);
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+  if (pool == Psram)
+    psramInsert(p);
+}
+
+// Returns the pool the block was counted in
+static Pool release(void *p) {
+  Pool pool = psramErase(p) ? Psram : Internal;
+  Counters &c = pools[pool];
+  c.used.fetch_sub(malloc_usable_size(p), std::memory_order_relaxed);
+  c.blocks.fetch_sub(1, std::memory_order_relaxed);
+  frees.fetch_add(1, std::memory_order_relaxed);
+  return pool;
+}
+
+extern "C" {
+
+void *malloc(size_t size) noexcept {
+  void *p = __libc_malloc(size);
+  account(p, Internal);
+  return p;
+}
+
+void *calloc(size_t n, size_t size) noexcept {
+  void *p = __libc_calloc(n, size);
+  account(p, Internal);
+  return p;
+}
+
+void *realloc(void *ptr, size_t size) noexcept {
+  if (!ptr)
+    return malloc(size);
+  if (size == 0) {
+    free(ptr);
+    return nullptr;
+  }
+  Pool pool = release(ptr);
+  void *p = __libc_realloc(ptr, size);
+  account(p ? p : ptr, pool); // on failure the old block is still live
+  return p;
+}
+
+void free(void *ptr) noexcept {
+  if (!ptr)
+    return;
+  release(ptr);
+  __libc_free(ptr);
+}
+
+void *memalign(size_t alignment, size_t size) noexcept {
+  void *p = __libc_memalign(alignment, size);
+  account(p, Internal);
+  return p;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) noexcept {
+  return memalign(alignment, size);
+}
+
+int posix_memalign(void **out, size_t alignment, size_t size) noexcept {
+  void *p = memalign(alignment, size);
+  if (!p)
+    return ENOMEM;
+  *out = p;
+  return 0;
+}
+
+void *valloc(size_t size) noexcept { return memalign(4096, size); }
+
+void *pvalloc(size_t size) noexcept {
+  return memalign(4096, (size + 4095) & ~(size_t)4095);
+}
+
+} // extern "C"
+
+// Straight into the PSRAM count, so a large block never passes through
+// the internal peak
+static void *psramAlloc(void *p) {
+  account(p, Psram);
+  return p;
+}
+
+void *ps_malloc(size_t size) { return psramAlloc(__libc_malloc(size)); }
+
+void *ps_calloc(size_t n, size_t size) {
+  return psramAlloc(__libc_calloc(n, size));
+}
+
+void *ps_realloc(void *ptr, size_t size) {
+  if (!ptr)
+    return ps_malloc(size);
+  return realloc(ptr, size); // keeps the pool the block was counted in
+}
+
+bool psramFound() { return true; }
+
+static bool wantsPsram(uint32_t caps) {
+  return (caps & MALLOC_CAP_SPIRAM) && !(caps & MALLOC_CAP_INTERNAL);
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps) {
+  return wantsPsram(caps) ? ps_malloc(size) : malloc(size);
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps) {
+  return wantsPsram(caps) ? ps_calloc(n, size) : calloc(n, size);
+}
+
+void *heap_caps_realloc(void *ptr, size_t size, uint32_t caps) {
+  if (!ptr)
+    return heap_caps_malloc(size, caps);
+  return realloc(ptr, size);
+}
+
+void *heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps) {
+  if (wantsPsram(caps))
+    return psramAlloc(__libc_memalign(alignment, size));
+  return memalign(alignment, size);
+}
+
+void heap_caps_free(void *ptr) { free(ptr); }
+
+// MALLOC_CAP_8BIT and friends cover both heaps, as on the chip
+static bool includes(uint32_t caps, Pool pool) {
+  if (caps & MALLOC_CAP_INTERNAL)
+    return pool == Internal;
+  if (caps & MALLOC_CAP_SPIRAM)
+    return pool == Psram;
+  return true;
+}
+
+static size_t freeIn(Pool pool) {
+  size_t used = pools[pool].used.load(std::memory_order_relaxed);
+  return used < capacity[pool] ? capacity[pool] - used : 0;
+}
+
+static size_t minimumFreeIn(Pool pool) {
+  size_t peak = pools[pool].peak.load(std::memory_order_relaxed);
+  return peak < capacity[pool] ? capacity[pool] - peak : 0;
+}
+
+size_t heap_caps_get_total_size(uint32_t caps) {
+  size_t n = 0;
+  for (Pool pool : {Internal, Psram})
+    if (includes(caps, pool))
+      n += capacity[pool];
+  return n;
+}
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+  size_t n = 0;
+  for (Pool pool : {Internal, Psram})
+    if (includes(caps, pool))
+      n += freeIn(pool);
+  return n;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+  size_t n = 0;
+  for (Pool pool : {Internal, Psram})
+    if (includes(caps, pool))
+      n += minimumFreeIn(pool);
+  return n;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+  size_t n = 0;
+  for (Pool pool : {Internal, Psram})
+    if (includes(caps, pool))
+      n = std::max(n, freeIn(pool));
+  return n;
+}
+
+void heap_caps_get_info(multi_heap_info_t *info, uint32_t caps) {
+  *info = {};
+  for (Pool pool : {Internal, Psram}) {
+    if (!includes(caps, pool))
+      continue;
+    info->total_free_bytes += freeIn(pool);
+    info->total_allocated_bytes +=
+        pools[pool].used.load(std::memory_order_relaxed);
+    info->largest_free_block =
+        std::max(info->largest_free_block, freeIn(pool));
+    info->minimum_free_bytes += minimumFreeIn(pool);
+    info->allocated_blocks +=
+        pools[pool].blocks.load(std::memory_order_relaxed);
+  }
+  info->free_blocks = info->total_free_bytes ? 1 : 0;
+  info->total_blocks = info->allocated_blocks + info->free_blocks;
+}
+
+namespace Host {
+
+HeapStats heapStats() {
+  HeapStats s;
+  s.internalUsed = pools[Internal].used.load(std::memory_order_relaxed);
+  s.internalPeak = pools[Internal].peak.load(std::memory_order_relaxed);
+  s.internalBlocks = pools[Internal].blocks.load(std::memory_order_relaxed);
+  s.psramUsed = pools[Psram].used.load(std::memory_order_relaxed);
+  s.psramPeak = pools[Psram].peak.load(std::memory_order_relaxed);
+  s.psramBlocks = pools[Psram].blocks.load(std::memory_order_relaxed);
+  s.allocations = allocations.load(std::memory_order_relaxed);
+  s.frees = frees.load(std::memory_order_relaxed);
+  s.allocatedBytes = allocatedBytes.load(std::memory_order_relaxed);
+  return s;
+}
+
+void resetHeapPeaks() {
+  for (Counters &c : pools)
+    c.peak.store(c.used.load(std::memory_order_relaxed),
+                 std::memory_order_relaxed);
+}
+
+} // namespace Host
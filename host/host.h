@@ -0,0 +1,53 @@
+#pragma once
+// Controls for the native (host) build: where the emulated flash lives, what
+// the mock camera sees, and what the heap accounting has counted. Nothing in
+// src/ includes this; it is for host/main.cpp and the tests in test/.
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace Host {
+  // Directory holding the FFat root (ffat/), NVS (nvs/) and the raw
+  // partition images (<label>.bin). Default "host_data"; set it before
+  // anything touches flash.
+  void setDataDir(const char *path);
+  const char *dataDir();
+  // Deletes everything in the data directory: a freshly erased chip
+  void eraseFlash();
+
+  // Mock sensor. With a directory, its *.jpg files are replayed in name
+  // order; without one, frames are generated. `fps` is the sensor rate:
+  // esp_camera_fb_get() waits for the next frame like the real driver.
+  // `moving` = false makes generated frames identical (a still scene).
+  void setCamera(const char *jpegDir, uint32_t fps, bool moving = true);
+  uint32_t cameraFrames(); // frames handed out by esp_camera_fb_get()
+
+  // Slow FFat: every file write and remove sleeps this long first
+  void setFsDelayUs(uint32_t us);
+
+  // Overrides WEB_SERVER_PORT for AsyncWebServer::begin(); 0 = any free
+  void setWebServerPort(uint16_t port);
+  uint16_t webServerPort(); // as bound, after begin()
+
+  struct HeapStats {
+    size_t internalUsed;
+    size_t internalPeak;
+    size_t internalBlocks;
+    size_t psramUsed;
+    size_t psramPeak;
+    size_t psramBlocks;
+    uint64_t allocations; // since start, both heaps
+    uint64_t frees;
+    uint64_t allocatedBytes; // summed over those allocations
+  };
+  HeapStats heapStats();
+  void resetHeapPeaks(); // peaks restart from what is in use now
+
+  // One request through the web server begun last, over a socket pair
+  // instead of the listening socket: `request` is sent as is and everything
+  // the server writes until it closes the connection (or `timeoutMs`
+  // passes) is returned. Empty when no server is running.
+  std::string fetch(const std::string &request, uint32_t timeoutMs = 5000);
+  // "GET <url> HTTP/1.1" with only a Host header
+  std::string get(const char *url, uint32_t timeoutMs = 5000);
+}
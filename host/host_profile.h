@@ -0,0 +1,15 @@
+#pragma once
+// Profile for the native build (see platformio.ini [env:native]). The
+// network settings are placeholders: the host Wi-Fi is always connected.
+// The web server listens on 8080 (no root needed, --port overrides it) and
+// takes more /stream viewers than the chip, for load tests.
+#define HOST_PROFILE                                                           \
+  Config {                                                                     \
+    .network = {.wifiSsid = "host",                                            \
+                .wifiPassword = "",                                            \
+                .mdnsHostname = "printer-cam"},                                \
+    .camera = {.framePoolSlots = 16},                                          \
+    .system = {.webServerPort = 8080, .streamMaxClients = 64}                  \
+  }
+
+#define ACTIVE_PROFILE HOST_PROFILE
@@ -0,0 +1,8 @@
+#pragma once
+extern "C++" {
+// The host network stack keeps no lwIP statistics
+#define LWIP_STATS 0
+#define CONFIG_LWIP_TCP_SND_BUF_DEFAULT 5744
+#define TCP_SND_BUF CONFIG_LWIP_TCP_SND_BUF_DEFAULT
+#define TCP_MSS 1436
+}
@@ -0,0 +1,99 @@
+// Runs the firmware as a Linux process: setup() once, then loop() forever,
+// like the Arduino core's loopTask. The test runner supplies its own main,
+// so this one is left out of [env:native] test builds.
+#ifndef PIO_UNIT_TESTING
+#include "host.h"
+#include <Arduino.h>
+#include <filesystem>
+#include <string>
+
+namespace fsys = std::filesystem;
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s [--data DIR] [--jpegs DIR] [--fps N] [--still]\n"
+          "          [--port N] [--assets FILE] [--www DIR]"
+          " [--fs-delay US]\n"
+          "  --data      flash images, FFat and NVS (default host_data)\n"
+          "  --jpegs     replay these *.jpg in name order as the sensor\n"
+          "  --fps       sensor frame rate (default 10)\n"
+          "  --still     generated frames never change\n"
+          "  --port      web server port, 0 = any (default from config)\n"
+          "  --assets    image from tools/pack_assets.py for \"assets\"\n"
+          "  --www       copied into the FFat root at start (e.g. data/)\n"
+          "  --fs-delay  added to every FFat write and remove\n",
+          argv0);
+}
+
+// The raw image stands in for the flashed "assets" partition
+static bool installAssets(const char *image) {
+  std::error_code ec;
+  fsys::path to = fsys::path(Host::dataDir()) / "assets.bin";
+  fsys::create_directories(to.parent_path(), ec);
+  fsys::copy_file(image, to, fsys::copy_options::overwrite_existing, ec);
+  if (ec)
+    fprintf(stderr, "host: assets %s: %s\n", image, ec.message().c_str());
+  return !ec;
+}
+
+static bool seedFfat(const char *dir) {
+  std::error_code ec;
+  fsys::path to = fsys::path(Host::dataDir()) / "ffat";
+  fsys::create_directories(to, ec);
+  fsys::copy(dir, to,
+             fsys::copy_options::recursive |
+                 fsys::copy_options::overwrite_existing,
+             ec);
+  if (ec)
+    fprintf(stderr, "host: www %s: %s\n", dir, ec.message().c_str());
+  return !ec;
+}
+
+int main(int argc, char **argv) {
+  const char *jpegs = nullptr;
+  const char *assets = nullptr;
+  const char *www = nullptr;
+  uint32_t fps = 10;
+  bool moving = true;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (arg == "--still") {
+      moving = false;
+      continue;
+    }
+    if (!value || arg.rfind("--", 0) != 0) {
+      usage(argv[0]);
+      return 2;
+    }
+    i++;
+    if (arg == "--data")
+      Host::setDataDir(value);
+    else if (arg == "--jpegs")
+      jpegs = value;
+    else if (arg == "--fps")
+      fps = strtoul(value, nullptr, 10);
+    else if (arg == "--port")
+      Host::setWebServerPort(strtoul(value, nullptr, 10));
+    else if (arg == "--assets")
+      assets = value;
+    else if (arg == "--www")
+      www = value;
+    else if (arg == "--fs-delay")
+      Host::setFsDelayUs(strtoul(value, nullptr, 10));
+    else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if ((assets && !installAssets(assets)) || (www && !seedFfat(www)))
+    return 1;
+  Host::setCamera(jpegs, fps ? fps : 1, moving);
+
+  setup();
+  for (;;) {
+    loop();
+    yield();
+  }
+}
+#endif
@@ -0,0 +1,268 @@
+// Flash partitions as files under the host data directory. The table
+// mirrors partitions.csv; each partition is a <label>.bin file created
+// erased (all 0xFF) on first use.
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "host.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+static std::string dataDirectory = "host_data";
+
+static const esp_partition_t table[] = {
+    {nullptr, ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_NVS, 0x9000,
+     0x5000, 0x1000, "nvs", false},
+    {nullptr, ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_OTA, 0xe000,
+     0x2000, 0x1000, "otadata", false},
+    {nullptr, ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0,
+     0x10000, 0x2C0000, 0x1000, "app0", false},
+    {nullptr, ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)0x41,
+     0x2D0000, 0x40000, 0x1000, "assets", false},
+    {nullptr, ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_FAT,
+     0x310000, 0x8F0000, 0x1000, "ffat", false},
+    {nullptr, ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)0x40,
+     0xC00000, 0x400000, 0x1000, "frames", false},
+};
+static constexpr size_t TABLE_SIZE = sizeof(table) / sizeof(table[0]);
+
+// One lock for every image: writes read, AND and write back
+static std::mutex flashLock;
+static int fds[TABLE_SIZE] = {-1, -1, -1, -1, -1, -1};
+
+namespace Host {
+
+void setDataDir(const char *path) {
+  std::lock_guard<std::mutex> guard(flashLock);
+  dataDirectory = path;
+}
+
+const char *dataDir() { return dataDirectory.c_str(); }
+
+void eraseFlash() {
+  std::lock_guard<std::mutex> guard(flashLock);
+  for (int &fd : fds) {
+    if (fd >= 0)
+      close(fd);
+    fd = -1;
+  }
+  std::error_code ec;
+  std::filesystem::remove_all(dataDirectory, ec);
+}
+
+} // namespace Host
+
+// Flash work goes through this one sector, under flashLock, so the
+// emulator never shows up in the firmware's heap figures
+static constexpr size_t SECTOR = 4096;
+static uint8_t sector[SECTOR];
+
+// Fills [offset, offset + size) of the image with 0xFF; flashLock held
+static bool eraseImage(int fd, size_t offset, size_t size) {
+  memset(sector, 0xFF, SECTOR);
+  while (size > 0) {
+    size_t n = std::min(size, SECTOR);
+    if (pwrite(fd, sector, n, offset) != (ssize_t)n)
+      return false;
+    offset += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Opens (creating it erased) the image behind `p`; flashLock held
+static int imageFor(const esp_partition_t *p) {
+  size_t i = p - table;
+  if (i >= TABLE_SIZE)
+    return -1;
+  if (fds[i] >= 0)
+    return fds[i];
+  std::filesystem::create_directories(dataDirectory);
+  std::string path = dataDirectory + "/" + p->label + ".bin";
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return -1;
+  off_t size = lseek(fd, 0, SEEK_END);
+  if (size < (off_t)p->size && !eraseImage(fd, size, p->size - size)) {
+    close(fd);
+    return -1;
+  }
+  fds[i] = fd;
+  return fd;
+}
+
+static bool inRange(const esp_partition_t *p, size_t offset, size_t size) {
+  return offset <= p->size && size <= p->size - offset;
+}
+
+struct esp_partition_iterator_opaque_ {
+  esp_partition_type_t type;
+  esp_partition_subtype_t subtype;
+  std::string label;
+  size_t index;
+};
+
+static bool matches(const esp_partition_iterator_opaque_ *it, size_t i) {
+  const esp_partition_t &p = table[i];
+  return (it->type == ESP_PARTITION_TYPE_ANY || it->type == p.type) &&
+         (it->subtype == ESP_PARTITION_SUBTYPE_ANY ||
+          it->subtype == p.subtype) &&
+         (it->label.empty() || it->label == p.label);
+}
+
+// Moves the iterator to the first match at or after `from`, or frees it
+static esp_partition_iterator_t seek(esp_partition_iterator_t it,
+                                     size_t from) {
+  for (size_t i = from; i < TABLE_SIZE; i++) {
+    if (matches(it, i)) {
+      it->index = i;
+      return it;
+    }
+  }
+  delete it;
+  return nullptr;
+}
+
+esp_partition_iterator_t esp_partition_find(esp_partition_type_t type,
+                                            esp_partition_subtype_t subtype,
+                                            const char *label) {
+  return seek(new esp_partition_iterator_opaque_{
+                  type, subtype, label ? label : "", 0},
+              0);
+}
+
+const esp_partition_t *esp_partition_find_first(
+    esp_partition_type_t type, esp_partition_subtype_t subtype,
+    const char *label) {
+  esp_partition_iterator_t it = esp_partition_find(type, subtype, label);
+  if (!it)
+    return nullptr;
+  const esp_partition_t *p = esp_partition_get(it);
+  esp_partition_iterator_release(it);
+  return p;
+}
+
+const esp_partition_t *esp_partition_get(esp_partition_iterator_t it) {
+  return &table[it->index];
+}
+
+esp_partition_iterator_t esp_partition_next(esp_partition_iterator_t it) {
+  return seek(it, it->index + 1);
+}
+
+void esp_partition_iterator_release(esp_partition_iterator_t it) {
+  delete it;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t offset,
+                             void *dst, size_t size) {
+  if (!inRange(partition, offset, size))
+    return ESP_ERR_INVALID_SIZE;
+  std::lock_guard<std::mutex> guard(flashLock);
+  int fd = imageFor(partition);
+  if (fd < 0 || pread(fd, dst, size, offset) != (ssize_t)size)
+    return ESP_FAIL;
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t offset,
+                              const void *src, size_t size) {
+  if (!inRange(partition, offset, size))
+    return ESP_ERR_INVALID_SIZE;
+  std::lock_guard<std::mutex> guard(flashLock);
+  int fd = imageFor(partition);
+  if (fd < 0)
+    return ESP_FAIL;
+  const uint8_t *in = (const uint8_t *)src;
+  while (size > 0) {
+    size_t n = std::min(size, SECTOR);
+    if (pread(fd, sector, n, offset) != (ssize_t)n)
+      return ESP_FAIL;
+    for (size_t i = 0; i < n; i++)
+      sector[i] &= in[i]; // programming only clears bits
+    if (pwrite(fd, sector, n, offset) != (ssize_t)n)
+      return ESP_FAIL;
+    in += n;
+    offset += n;
+    size -= n;
+  }
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition,
+                                    size_t offset, size_t size) {
+  if (offset % partition->erase_size || size % partition->erase_size)
+    return ESP_ERR_INVALID_ARG;
+  if (!inRange(partition, offset, size))
+    return ESP_ERR_INVALID_SIZE;
+  std::lock_guard<std::mutex> guard(flashLock);
+  int fd = imageFor(partition);
+  if (fd < 0 || !eraseImage(fd, offset, size))
+    return ESP_FAIL;
+  return ESP_OK;
+}
+
+// Mappings are anonymous pages rather than heap, as the flash cache is on
+// the chip; the handle is the mapping's index
+struct Mapping {
+  void *base = nullptr;
+  size_t size = 0;
+};
+static std::vector<Mapping> mappings;
+
+esp_err_t esp_partition_mmap(const esp_partition_t *partition, size_t offset,
+                             size_t size, esp_partition_mmap_memory_t memory,
+                             const void **out,
+                             esp_partition_mmap_handle_t *handle) {
+  if (!inRange(partition, offset, size) || size == 0)
+    return ESP_ERR_INVALID_ARG;
+  void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED)
+    return ESP_ERR_NO_MEM;
+  esp_err_t err = esp_partition_read(partition, offset, base, size);
+  if (err != ESP_OK) {
+    munmap(base, size);
+    return err;
+  }
+  mprotect(base, size, PROT_READ);
+  std::lock_guard<std::mutex> guard(flashLock);
+  size_t i = 0;
+  while (i < mappings.size() && mappings[i].base)
+    i++;
+  if (i == mappings.size())
+    mappings.emplace_back();
+  mappings[i] = {base, size};
+  *out = base;
+  *handle = i;
+  return ESP_OK;
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t handle) {
+  std::lock_guard<std::mutex> guard(flashLock);
+  if (handle >= mappings.size() || !mappings[handle].base)
+    return;
+  munmap(mappings[handle].base, mappings[handle].size);
+  mappings[handle] = {};
+}
+
+const esp_partition_t *esp_ota_get_running_partition() {
+  return esp_partition_find_first(ESP_PARTITION_TYPE_APP,
+                                  ESP_PARTITION_SUBTYPE_ANY, "app0");
+}
+
+const esp_partition_t *esp_ota_get_boot_partition() {
+  return esp_ota_get_running_partition();
+}
+
+// partitions.csv has a single app slot
+const esp_partition_t *esp_ota_get_next_update_partition(
+    const esp_partition_t *start) {
+  return nullptr;
+}
@@ -0,0 +1,72 @@
+// NVS on the host: one text file of key=value lines per namespace
+#include <Preferences.h>
+#include "host.h"
+#include <filesystem>
+#include <fstream>
+
+bool Preferences::begin(const char *name, bool readOnly,
+                        const char *partition) {
+  if (started)
+    return false;
+  std::string dir = std::string(Host::dataDir()) + "/nvs";
+  std::error_code ec;
+  std::filesystem::create_directories(dir, ec);
+  path = dir + "/" + name;
+  values.clear();
+  std::ifstream in(path);
+  std::string line;
+  while (std::getline(in, line)) {
+    size_t eq = line.find('=');
+    if (eq != std::string::npos)
+      values[line.substr(0, eq)] = strtoul(line.c_str() + eq + 1, nullptr, 10);
+  }
+  this->readOnly = readOnly;
+  started = true;
+  return true;
+}
+
+void Preferences::end() { started = false; }
+
+// Written to a temporary and renamed over, so a crash keeps the old values
+bool Preferences::save() {
+  std::string tmp = path + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::trunc);
+    for (const auto &kv : values)
+      out << kv.first << '=' << kv.second << '\n';
+    if (!out.flush())
+      return false;
+  }
+  return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+bool Preferences::clear() {
+  if (!started || readOnly)
+    return false;
+  values.clear();
+  return save();
+}
+
+bool Preferences::remove(const char *key) {
+  if (!started || readOnly || !values.erase(key))
+    return false;
+  return save();
+}
+
+bool Preferences::isKey(const char *key) {
+  return started && values.count(key);
+}
+
+uint32_t Preferences::getUInt(const char *key, uint32_t defaultValue) {
+  if (!started)
+    return defaultValue;
+  auto it = values.find(key);
+  return it == values.end() ? defaultValue : it->second;
+}
+
+size_t Preferences::putUInt(const char *key, uint32_t value) {
+  if (!started || readOnly)
+    return 0;
+  values[key] = value;
+  return save() ? sizeof(value) : 0;
+}
@@ -0,0 +1,68 @@
+// Station and mDNS stand-ins: the host is always on the network
+#include <ESPmDNS.h>
+#include <WiFi.h>
+
+WiFiClass WiFi;
+MDNSResponder MDNS;
+
+static String hostname = "printer-cam";
+
+wl_status_t WiFiClass::begin(const char *ssid, const char *passphrase) {
+  this->ssid = ssid ? ssid : "";
+  connected = true;
+  return WL_CONNECTED;
+}
+
+bool WiFiClass::disconnect(bool wifiOff, bool eraseAp) {
+  connected = false;
+  return true;
+}
+
+wl_status_t WiFiClass::status() {
+  return connected ? WL_CONNECTED : WL_DISCONNECTED;
+}
+
+bool WiFiClass::mode(wifi_mode_t m) {
+  wifiMode = m;
+  return true;
+}
+
+wifi_mode_t WiFiClass::getMode() { return wifiMode; }
+
+bool WiFiClass::softAP(const char *ssid, const char *passphrase, int channel,
+                       int ssidHidden, int maxConnection) {
+  return true;
+}
+
+bool WiFiClass::setHostname(const char *name) {
+  hostname = name;
+  return true;
+}
+
+const char *WiFiClass::getHostname() { return hostname.c_str(); }
+
+int16_t WiFiClass::scanNetworks(bool async, bool showHidden) { return 0; }
+
+String WiFiClass::SSID() { return ssid; }
+String WiFiClass::SSID(uint8_t i) { return String(); }
+int8_t WiFiClass::RSSI() { return connected ? -50 : 0; }
+int8_t WiFiClass::RSSI(uint8_t i) { return 0; }
+int32_t WiFiClass::channel() { return 1; }
+int32_t WiFiClass::channel(uint8_t i) { return 0; }
+
+String WiFiClass::macAddress() {
+  uint64_t mac = ESP.getEfuseMac();
+  char buf[18];
+  snprintf(buf, sizeof(buf), "%02X:%02X:%02X:%02X:%02X:%02X",
+           (unsigned)(mac & 0xff), (unsigned)(mac >> 8 & 0xff),
+           (unsigned)(mac >> 16 & 0xff), (unsigned)(mac >> 24 & 0xff),
+           (unsigned)(mac >> 32 & 0xff), (unsigned)(mac >> 40 & 0xff));
+  return String(buf);
+}
+
+String WiFiClass::BSSIDstr() { return String("00:00:00:00:00:00"); }
+IPAddress WiFiClass::localIP() { return IPAddress(127, 0, 0, 1); }
+IPAddress WiFiClass::gatewayIP() { return IPAddress(127, 0, 0, 1); }
+IPAddress WiFiClass::subnetMask() { return IPAddress(255, 0, 0, 0); }
+IPAddress WiFiClass::dnsIP(uint8_t i) { return IPAddress(127, 0, 0, 1); }
+IPAddress WiFiClass::softAPIP() { return IPAddress(); }
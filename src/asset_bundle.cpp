@@ -0,0 +1,197 @@
+#include "asset_bundle.h"
+#include "config.h"
+#include "http_cache.h"
+#include "metrics.h"
+#include <atomic>
+extern "C" {
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+}
+
+// Must match tools/pack_assets.py
+static constexpr uint32_t BUNDLE_MAGIC = 0x31545341; // "AST1"
+static constexpr uint16_t BUNDLE_VERSION = 1;
+static constexpr uint32_t FLAG_GZIP = 1;
+
+struct Header {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t count;
+  uint32_t crc; // of everything after the header
+  uint32_t size;
+};
+
+struct Entry {
+  char path[48];
+  char type[32];
+  uint32_t offset;
+  uint32_t length;
+  uint32_t hash;
+  uint32_t flags;
+};
+static_assert(sizeof(Header) == 16 && sizeof(Entry) == 96,
+              "layout shared with pack_assets.py");
+
+static const uint8_t *image = nullptr;
+static const Entry *entries = nullptr;
+static uint16_t entryCount = 0;
+static uint32_t imageBytes = 0;
+static uint32_t firstPaintAssetBytes = 0;
+static esp_partition_mmap_handle_t mapHandle;
+
+static std::atomic<uint32_t> servedCount{0};
+static std::atomic<uint32_t> bytesServedCount{0};
+static std::atomic<uint32_t> missCount{0};
+static std::atomic<uint32_t> paintReports{0};
+static std::atomic<uint32_t> lastPaintMs{0};
+static std::atomic<uint32_t> avgPaintMs{0};
+static std::atomic<uint32_t> lastPaintBytes{0};
+
+static bool validEntry(const Entry &e) {
+  return memchr(e.path, 0, sizeof(e.path)) &&
+         memchr(e.type, 0, sizeof(e.type)) && e.offset < imageBytes &&
+         e.length < imageBytes - e.offset && // room for the trailing NUL
+         image[e.offset + e.length] == 0;
+}
+
+namespace AssetBundle {
+
+bool setup() {
+  if (image)
+    return true;
+
+  const esp_partition_t *partition = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, ASSET_PARTITION);
+  if (!partition) {
+    Serial.printf("Assets: Partition '%s' not found, serving from FFat\n",
+                  ASSET_PARTITION);
+    return false;
+  }
+
+  Header h;
+  if (esp_partition_read(partition, 0, &h, sizeof(h)) != ESP_OK ||
+      h.magic != BUNDLE_MAGIC || h.version != BUNDLE_VERSION ||
+      h.size < sizeof(Header) + h.count * sizeof(Entry) ||
+      h.size > partition->size) {
+    Serial.println("Assets: No bundle in partition, serving from FFat");
+    return false;
+  }
+
+  int64_t start = esp_timer_get_time();
+  const void *mapped;
+  if (esp_partition_mmap(partition, 0, h.size, ESP_PARTITION_MMAP_DATA,
+                         &mapped, &mapHandle) != ESP_OK) {
+    Serial.println("Assets: Failed to map partition");
+    return false;
+  }
+  image = (const uint8_t *)mapped;
+  imageBytes = h.size;
+  if (esp_rom_crc32_le(0, image + sizeof(Header), h.size - sizeof(Header)) !=
+      h.crc) {
+    Serial.println("Assets: Bundle CRC mismatch, serving from FFat");
+    esp_partition_munmap(mapHandle);
+    image = nullptr;
+    return false;
+  }
+
+  entries = (const Entry *)(image + sizeof(Header));
+  for (uint16_t i = 0; i < h.count; i++) {
+    if (!validEntry(entries[i])) {
+      Serial.printf("Assets: Entry %u is malformed\n", (unsigned)i);
+      esp_partition_munmap(mapHandle);
+      image = nullptr;
+      return false;
+    }
+    firstPaintAssetBytes += entries[i].length;
+  }
+  entryCount = h.count;
+
+  Serial.printf("Assets: %u assets, %u bytes mapped from '%s' (%u us)\n",
+                (unsigned)entryCount, (unsigned)imageBytes, ASSET_PARTITION,
+                (unsigned)(esp_timer_get_time() - start));
+  return true;
+}
+
+bool mounted() { return image != nullptr; }
+
+bool find(const char *path, Asset &out) {
+  for (uint16_t i = 0; i < entryCount; i++) {
+    const Entry &e = entries[i];
+    if (strcmp(e.path, path) != 0)
+      continue;
+    out = {e.path, e.type, image + e.offset, e.length, e.hash,
+           (e.flags & FLAG_GZIP) != 0};
+    return true;
+  }
+  return false;
+}
+
+void handleRequest(AsyncWebServerRequest *request) {
+  // /a/<8 hex digits>/<path>
+  const char *url = request->url().c_str();
+  char *end;
+  uint32_t hash = strtoul(url + 3, &end, 16);
+  Asset asset;
+  if (strncmp(url, "/a/", 3) != 0 || end != url + 11 || *end != '/' ||
+      !find(end + 1, asset) || asset.hash != hash) {
+    missCount.fetch_add(1, std::memory_order_relaxed);
+    request->send(404, "text/plain", "Not found");
+    return;
+  }
+
+  char etag[12];
+  snprintf(etag, sizeof(etag), "\"%08lx\"", (unsigned long)asset.hash);
+  HttpCache::Resource r = {asset.length, asset.contentType, etag, 0,
+                           "public, max-age=31536000, immutable"};
+  HttpCache::Body body;
+  if (!HttpCache::begin(request, r, body))
+    return;
+
+  AsyncWebServerResponse *res = new HttpCache::Ranged<AsyncProgmemResponse>(
+      body.code, asset.contentType, asset.data + body.offset, body.length);
+  if (asset.gzip)
+    res->addHeader("Content-Encoding", "gzip");
+  servedCount.fetch_add(1, std::memory_order_relaxed);
+  bytesServedCount.fetch_add(body.length, std::memory_order_relaxed);
+  Metrics::bytesServed.add(body.length);
+  HttpCache::finish(request, res, r, body);
+}
+
+// POST /vitals?fcp=<ms>&bytes=<n>, sent once per page load by the page
+void handlePaintReport(AsyncWebServerRequest *request) {
+  AsyncWebParameter *fcp = request->getParam("fcp");
+  if (!fcp) {
+    request->send(400, "text/plain", "fcp required");
+    return;
+  }
+  uint32_t ms = strtoul(fcp->value().c_str(), nullptr, 10);
+  uint32_t n = paintReports.fetch_add(1, std::memory_order_relaxed);
+  uint32_t avg = avgPaintMs.load(std::memory_order_relaxed);
+  // EMA with 1/8 weight; seed with the first report
+  avgPaintMs.store(n == 0 ? ms : avg - avg / 8 + ms / 8,
+                   std::memory_order_relaxed);
+  lastPaintMs.store(ms, std::memory_order_relaxed);
+  if (AsyncWebParameter *bytes = request->getParam("bytes"))
+    lastPaintBytes.store(strtoul(bytes->value().c_str(), nullptr, 10),
+                         std::memory_order_relaxed);
+  request->send(204);
+}
+
+Stats getStats() {
+  Stats s;
+  s.mounted = image != nullptr;
+  s.imageBytes = imageBytes;
+  s.assets = entryCount;
+  s.firstPaintAssetBytes = firstPaintAssetBytes;
+  s.served = servedCount.load(std::memory_order_relaxed);
+  s.bytesServed = bytesServedCount.load(std::memory_order_relaxed);
+  s.misses = missCount.load(std::memory_order_relaxed);
+  s.paintReports = paintReports.load(std::memory_order_relaxed);
+  s.lastPaintMs = lastPaintMs.load(std::memory_order_relaxed);
+  s.avgPaintMs = avgPaintMs.load(std::memory_order_relaxed);
+  s.lastPaintBytes = lastPaintBytes.load(std::memory_order_relaxed);
+  return s;
+}
+
+} // namespace AssetBundle
@@ -0,0 +1,46 @@
+#pragma once
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+// Web assets packed by tools/pack_assets.py into the "assets" partition and
+// memory-mapped at boot. Responses are copied straight out of the mapped
+// flash into the TCP buffer, so serving the page never touches FFat. Assets
+// live at /a/<hash>/<path> with the hash of their bytes in the URL, and are
+// stored pre-gzipped (except the page template) and cached for good.
+namespace AssetBundle {
+  struct Asset {
+    const char *path; // e.g. "js/bundle.js"
+    const char *contentType;
+    const uint8_t *data; // in mapped flash, NUL-terminated
+    uint32_t length;
+    uint32_t hash;
+    bool gzip;
+  };
+
+  struct Stats {
+    bool mounted;
+    uint32_t imageBytes;
+    uint32_t assets;
+    uint32_t firstPaintAssetBytes; // everything the page links, as stored
+    uint32_t served;
+    uint32_t bytesServed;
+    uint32_t misses; // unknown path or stale hash
+    // Reported by the page itself after its first contentful paint
+    uint32_t paintReports;
+    uint32_t lastPaintMs;
+    uint32_t avgPaintMs; // exponential moving average
+    uint32_t lastPaintBytes; // transferred up to that paint
+  };
+
+  // Maps and validates the partition; false when it is missing or invalid,
+  // in which case the page and its assets are served from FFat as before
+  bool setup();
+  bool mounted();
+
+  bool find(const char *path, Asset &out);
+
+  void handleRequest(AsyncWebServerRequest *request); // /a/<hash>/<path>
+  void handlePaintReport(AsyncWebServerRequest *request); // POST /vitals
+
+  Stats getStats();
+}
@@ -1,16 +1,48 @@
 #include "camera_cycle.h"
+#include "capture_scheduler.h"
 #include "config.h"
 #include "esp_camera.h"
+#include "frame_cache.h"
+#include "frame_index.h"
+#include "frame_pool.h"
 #include "led_breathe.h"
+#include "metrics.h"
+#include "motion_detector.h"
+#include "mjpeg_stream.h"
+#include "storage_writer.h"
+#include "trace.h"
+#include "website_routes.h"
 #include <Arduino.h>
 #include <FFat.h>
+#include <atomic>
+extern "C" {
+#include "esp_timer.h"
+}
 
 // ===== CAMERA SETUP =====
 static bool cameraInitialized = false;
-static String latestImagePath = LATEST_IMAGE_PATH;
-static uint32_t lastCaptureTime = 0;
-static String imageHistory[MAX_STORED_IMAGES];
-static int imageIndex = 0;
+static uint32_t lastStoreTime = 0;
+
+// Motion state (capture task only, except the flag)
+static uint32_t lastMotionTime = 0;
+static std::atomic<bool> moving{false};
+
+// Capture stage counters (read from the web server task)
+static std::atomic<uint32_t> framesCaptured{0};
+static std::atomic<uint32_t> captureFailures{0};
+static std::atomic<uint32_t> allocFailures{0};
+static std::atomic<uint32_t> lowMemorySkips{0};
+static std::atomic<uint32_t> lastCaptureMs{0};
+
+// Duplicate suppression: the last stored frame (capture task only, except
+// the counters)
+static size_t referenceSize = 0;
+static uint32_t referenceStoredMs = 0;
+static std::atomic<uint32_t> framesStored{0};
+static std::atomic<uint32_t> framesSuppressed{0};
+static std::atomic<uint32_t> bytesSuppressed{0};
+static std::atomic<uint32_t> lastStoredSequence{0};
+static std::atomic<uint32_t> lastConfirmedMs{0};
 
 // ===== FILESYSTEM FUNCTIONS =====
 static bool initFilesystem() {
@@ -36,6 +68,24 @@ static bool initFilesystem() {
   return true;
 }
 
+static void wipeImages() {
+  File dir = FFat.open("/i");
+  if (!dir)
+    return;
+  File file = dir.openNextFile();
+  while (file) {
+    String fileName = file.name();
+    file.close();
+    if (fileName.endsWith(".jpg")) {
+      String fullPath = "/i/" + fileName;
+      FFat.remove(fullPath);
+      Serial.printf("Deleted old image: %s\n", fullPath.c_str());
+    }
+    file = dir.openNextFile();
+  }
+  dir.close();
+}
+
 // ===== CAMERA FUNCTIONS =====
 static bool initCamera() {
   camera_config_t config;
@@ -62,8 +112,8 @@ static bool initCamera() {
   config.frame_size = CAMERA_FRAME_SIZE;
   config.jpeg_quality = CAMERA_JPEG_QUALITY;
   config.fb_count = CAMERA_FB_COUNT;
-  config.fb_location = CAMERA_FB_IN_DRAM;
-  config.grab_mode = CAMERA_GRAB_WHEN_EMPTY;
+  config.fb_location = CAMERA_FB_LOCATION;
+  config.grab_mode = CAMERA_GRAB_MODE;
 
   esp_err_t err = esp_camera_init(&config);
   if (err != ESP_OK) {
@@ -75,94 +125,166 @@ static bool initCamera() {
   return true;
 }
 
-static void sequentialCaptureAndProcess() {
+// ===== ADAPTIVE CADENCE =====
+// Stored frames: fast while the scene changes, a heartbeat while it is still
+static uint32_t storeIntervalMs() {
+  if (!MOTION_ENABLED)
+    return CAMERA_CAPTURE_INTERVAL_MS;
+  return moving.load(std::memory_order_relaxed) ? MOTION_ACTIVE_INTERVAL_MS
+                                                : MOTION_HEARTBEAT_MS;
+}
+
+// Captures while nobody is streaming; still scenes are only probed
+static uint32_t captureIntervalMs() {
+  if (MOTION_ENABLED && moving.load(std::memory_order_relaxed))
+    return MOTION_ACTIVE_INTERVAL_MS;
+  return CAMERA_CAPTURE_INTERVAL_MS;
+}
+
+static void updateMotion(const FrameRef &frame, uint32_t now) {
+  int score = MotionDetector::analyze(frame);
+  if (score >= (int)MOTION_SCORE_THRESHOLD) {
+    if (!moving.exchange(true, std::memory_order_relaxed))
+      Serial.printf("Core 0: Motion detected (score %d)\n", score);
+    lastMotionTime = now;
+  } else if (moving.load(std::memory_order_relaxed) &&
+             now - lastMotionTime >= MOTION_HOLD_MS) {
+    moving.store(false, std::memory_order_relaxed);
+    Serial.println("Core 0: Scene still, heartbeat cadence");
+  }
+}
+
+// True if `frame` (just analyzed) repeats the last stored frame: close in
+// size and in luma. Cheap with motion on, as the planes were decoded for
+// it anyway; with motion off only frames due for storage are decoded.
+static bool isDuplicate(const FrameRef &frame, uint32_t now) {
+  if (!DEDUP_ENABLED || referenceSize == 0)
+    return false;
+  if (now - referenceStoredMs >= DEDUP_MAX_AGE_MS)
+    return false;
+  size_t size = frame.size();
+  size_t diff = size > referenceSize ? size - referenceSize
+                                     : referenceSize - size;
+  if ((uint64_t)diff * 1000 > (uint64_t)referenceSize * DEDUP_SIZE_PERMILLE)
+    return false;
+  int score = MotionDetector::referenceScore();
+  return score >= 0 && score < (int)DEDUP_SCORE_THRESHOLD;
+}
+
+// Ticks land within a few ms of the store interval; don't skip a store
+// because one arrived early
+static constexpr uint32_t STORE_SLACK_MS = 50;
+
+enum class Capture : uint8_t {
+  Scheduled, // tick at the capture cadence
+  Stream,    // tick at the stream rate, for MJPEG viewers
+  Triggered, // external trigger: always stored
+};
+
+// Capture stage: grab a frame, copy it out of the driver buffer, publish it
+// to the cache, score it and (when a store is due) hand it to the storage
+// writer. FFat latency never shows up here.
+static void sequentialCaptureAndProcess(Capture kind) {
   if (!cameraInitialized) return;
+  Trace::Span cycleSpan(kind == Capture::Triggered ? "trigger_capture"
+                        : kind == Capture::Stream  ? "stream_capture"
+                                                   : "capture_cycle");
 
   // Memory check before capture
   uint32_t freeHeap = ESP.getFreeHeap();
   if (freeHeap < 50000) {
     Serial.printf("Core 0: Low memory %d bytes, skipping capture\n", freeHeap);
+    lowMemorySkips.fetch_add(1, std::memory_order_relaxed);
     return;
   }
 
   // Step 1: Capture image (synchronous)
-  Serial.println("Core 0: Capturing image...");
+  if (kind == Capture::Scheduled)
+    Serial.println("Core 0: Capturing image...");
+  else if (kind == Capture::Triggered)
+    Serial.println("Core 0: Triggered capture...");
+  int64_t start = esp_timer_get_time();
   camera_fb_t *fb = esp_camera_fb_get();
+  uint32_t grabUs = (uint32_t)(esp_timer_get_time() - start);
+  Trace::record("fb_get", start, grabUs);
+  if (kind == Capture::Triggered)
+    CaptureScheduler::triggerCaptured(start + grabUs);
   if (!fb) {
     Serial.println("Core 0: Camera capture failed");
+    captureFailures.fetch_add(1, std::memory_order_relaxed);
     // Try to reinitialize camera on failure
     esp_camera_deinit();
     vTaskDelay(pdMS_TO_TICKS(1000));
     cameraInitialized = initCamera();
     return;
   }
+  lastCaptureMs.store(grabUs / 1000, std::memory_order_relaxed);
+  framesCaptured.fetch_add(1, std::memory_order_relaxed);
+  Metrics::captureLatency.observeUs(grabUs);
+  Metrics::framesCaptured.add();
 
-  // Step 2: Copy to PSRAM buffer (fast, non-blocking)
-  uint8_t *psramBuffer = (uint8_t*)ps_malloc(fb->len);
-  if (!psramBuffer) {
-    Serial.println("Core 0: PSRAM allocation failed");
+  // Step 2: Copy into a pooled slot so the driver gets its buffer back at
+  // once. This is the only copy; every consumer shares the slot after this.
+  int64_t copyStart = esp_timer_get_time();
+  FrameRef frame = FramePool::acquire(fb->len);
+  if (!frame) {
+    Serial.println("Core 0: No free frame slot");
+    allocFailures.fetch_add(1, std::memory_order_relaxed);
+    Metrics::framesDropped.add();
     esp_camera_fb_return(fb);
     return;
   }
   
-  memcpy(psramBuffer, fb->buf, fb->len);
-  size_t imageSize = fb->len;
+  memcpy(frame.writableData(), fb->buf, fb->len);
+  frame.setFrame(fb->len, FrameIndex::nextSequence(), millis());
   esp_camera_fb_return(fb);  // Release camera buffer immediately
+  Trace::record("copy", copyStart,
+                (uint32_t)(esp_timer_get_time() - copyStart));
   
-  // Step 3: Generate filename
-  uint32_t timestamp = millis();
-  String imagePath = String(IMAGE_PATH_PREFIX) + String(timestamp) + String(IMAGE_PATH_SUFFIX);
-  
-  // Step 4: Quick atomic write to FFat (minimal blocking)
-  Serial.printf("Core 0: Writing %s...\n", imagePath.c_str());
-  File file = FFat.open(imagePath, "w");
-  bool writeSuccess = false;
-  
-  if (file) {
-    size_t bytesWritten = file.write(psramBuffer, imageSize);
-    file.close();
-    writeSuccess = (bytesWritten == imageSize);
-    
-    if (writeSuccess) {
-      latestImagePath = imagePath;
-      Serial.printf("Core 0: Photo saved %s (%d bytes)\n", imagePath.c_str(), imageSize);
-    } else {
-      Serial.printf("Core 0: Write failed %d/%d bytes\n", bytesWritten, imageSize);
-      FFat.remove(imagePath);
-    }
-  } else {
-    Serial.println("Core 0: Failed to open file - checking filesystem");
-    // Try to remount filesystem on failure
-    FFat.end();
-    vTaskDelay(pdMS_TO_TICKS(100));
-    if (!FFat.begin()) {
-      Serial.println("Core 0: Filesystem remount failed!");
-    }
+  // Step 3: Publish for HTTP viewers straight from PSRAM
+  FrameCache::publish(frame);
+  announceFrame();
+
+  // Step 4: Score the scene; it sets how often frames are persisted
+  uint32_t now = millis();
+  if (MOTION_ENABLED)
+    updateMotion(frame, now);
+  if (kind != Capture::Triggered &&
+      now - lastStoreTime + STORE_SLACK_MS < storeIntervalMs())
+    return; // Viewers have it, nothing to persist
+  lastStoreTime = now;
+  if (!MOTION_ENABLED && DEDUP_ENABLED)
+    MotionDetector::analyze(frame); // luma for isDuplicate/markReference
+
+  // Step 5: A repeat of the last stored frame only confirms that one
+  if (kind != Capture::Triggered && isDuplicate(frame, now)) {
+    framesSuppressed.fetch_add(1, std::memory_order_relaxed);
+    bytesSuppressed.fetch_add(frame.size(), std::memory_order_relaxed);
+    lastConfirmedMs.store(now, std::memory_order_relaxed);
+    StorageWriter::confirm(lastStoredSequence.load(std::memory_order_relaxed),
+                           now);
+    Metrics::framesSuppressed.add();
+    Metrics::bytesSuppressed.add(frame.size());
+    return;
   }
-  
-  // Step 5: Free PSRAM buffer
-  free(psramBuffer);
-  
-  if (!writeSuccess) return;
-  
-  // Step 4: Delete old image if needed (synchronous)
-  if (imageHistory[imageIndex].length() > 0) {
-    Serial.printf("Core 0: Deleting %s...\n", imageHistory[imageIndex].c_str());
-    if (!FFat.remove(imageHistory[imageIndex])) {
-      Serial.println("Core 0: Failed to delete old image");
-    }
-    imageHistory[imageIndex] = ""; // Clear to free memory
+
+  // Step 6: Queue for the storage writer (never blocks; drops when full)
+  size_t size = frame.size();
+  uint32_t sequence = frame.sequence();
+  if (!StorageWriter::enqueue(std::move(frame))) {
+    Serial.println("Core 0: Storage queue full, frame dropped");
+    Metrics::framesDropped.add();
+    return;
   }
+  referenceSize = size;
+  referenceStoredMs = now;
+  if (MOTION_ENABLED || DEDUP_ENABLED)
+    MotionDetector::markReference();
+  framesStored.fetch_add(1, std::memory_order_relaxed);
+  lastStoredSequence.store(sequence, std::memory_order_relaxed);
+  lastConfirmedMs.store(now, std::memory_order_relaxed);
   
-  // Step 5: Update image history
-  imageHistory[imageIndex] = imagePath;
-  imageIndex = (imageIndex + 1) % MAX_STORED_IMAGES;
-  
-  // Memory cleanup
-  Serial.printf("Core 0: Free heap: %d bytes\n", ESP.getFreeHeap());
-  
-  // Step 6: LED breathe once (synchronous)
-  Serial.println("Core 0: LED breathe...");
+  // Step 7: LED breathe once (queued to the LED task, returns immediately)
   LEDBreathe::breatheOnce();
   
   Serial.println("Core 0: Cycle complete");
@@ -177,22 +299,14 @@ void setup() {
     return;
   }
 
-  // Clean up all existing images on boot
-  File dir = FFat.open("/i");
-  if (dir) {
-    File file = dir.openNextFile();
-    while (file) {
-      String fileName = file.name();
-      file.close();
-      if (fileName.endsWith(".jpg")) {
-        String fullPath = "/i/" + fileName;
-        FFat.remove(fullPath);
-        Serial.printf("Deleted old image: %s\n", fullPath.c_str());
-      }
-      file = dir.openNextFile();
-    }
-    dir.close();
-  }
+  // Keep indexed history across reboots; only a missing or incompatible
+  // index (first boot, older firmware) falls back to wiping /i
+  if (!FrameIndex::setup())
+    wipeImages();
+
+  // Start the storage stage before the first capture can be queued
+  FramePool::setup();
+  StorageWriter::setup();
 
   // Initialize camera
   cameraInitialized = initCamera();
@@ -200,27 +314,56 @@ void setup() {
     Serial.println("Camera initialization failed");
   }
 
-  lastCaptureTime = millis();
+  if (MOTION_ENABLED || DEDUP_ENABLED)
+    MotionDetector::setup();
+
+  CaptureScheduler::setup();
+  lastStoreTime = millis() - storeIntervalMs(); // store the first one
 }
 
 void loop() {
-  uint32_t now = millis();
+  // Fixed-rate ticks at the motion-dependent cadence, or at the stream rate
+  // while MJPEG viewers are connected
+  bool streaming = MjpegStream::activeClients() > 0 && STREAM_TARGET_FPS > 0;
+  uint32_t interval = captureIntervalMs();
+  if (streaming && 1000u / STREAM_TARGET_FPS < interval)
+    interval = 1000u / STREAM_TARGET_FPS;
+  CaptureScheduler::setInterval(interval);
 
-  // Sequential capture cycle every 3 seconds
-  if (now - lastCaptureTime >= 3000) {
-    sequentialCaptureAndProcess();
-    lastCaptureTime = now;
-  }
-  
-  // Small yield to prevent watchdog
-  vTaskDelay(10);
+  // Sleep until a tick or trigger; the timeout picks up new viewers and
+  // motion changes, which can shorten the interval
+  uint32_t events = CaptureScheduler::wait(250);
+  if (events & CaptureScheduler::Trigger)
+    sequentialCaptureAndProcess(Capture::Triggered);
+  else if (events & CaptureScheduler::Tick)
+    sequentialCaptureAndProcess(streaming ? Capture::Stream
+                                          : Capture::Scheduled);
+}
+
+void captureNow() { sequentialCaptureAndProcess(Capture::Triggered); }
+
+Stats getStats() {
+  Stats s;
+  s.framesCaptured = framesCaptured.load(std::memory_order_relaxed);
+  s.captureFailures = captureFailures.load(std::memory_order_relaxed);
+  s.allocFailures = allocFailures.load(std::memory_order_relaxed);
+  s.lowMemorySkips = lowMemorySkips.load(std::memory_order_relaxed);
+  s.lastCaptureMs = lastCaptureMs.load(std::memory_order_relaxed);
+  s.motionActive = moving.load(std::memory_order_relaxed);
+  s.storeIntervalMs = storeIntervalMs();
+  s.framesStored = framesStored.load(std::memory_order_relaxed);
+  s.framesSuppressed = framesSuppressed.load(std::memory_order_relaxed);
+  s.bytesSuppressed = bytesSuppressed.load(std::memory_order_relaxed);
+  s.lastStoredSequence = lastStoredSequence.load(std::memory_order_relaxed);
+  s.lastConfirmedMs = lastConfirmedMs.load(std::memory_order_relaxed);
+  return s;
 }
 
 } // namespace CameraCycle
 
 // Compatibility functions for existing code
 namespace Camera {
-String getCurrentImage() { return latestImagePath; }
+String getCurrentImage() { return StorageWriter::getLatestPath(); }
 } // namespace Camera
 
 namespace ImageRotator = Camera;
@@ -2,8 +2,28 @@
 #include <Arduino.h>
 
 namespace CameraCycle {
+  // Capture stage counters; the storage stage reports via StorageWriter
+  struct Stats {
+    uint32_t framesCaptured;
+    uint32_t captureFailures;
+    uint32_t allocFailures;  // no free or large-enough frame pool slot
+    uint32_t lowMemorySkips;
+    uint32_t lastCaptureMs;  // esp_camera_fb_get() duration
+    bool motionActive;       // scene changed within MOTION_HOLD_MS
+    uint32_t storeIntervalMs; // current cadence of stored frames
+    uint32_t framesStored;   // handed to the storage writer
+    uint32_t framesSuppressed; // duplicates of the last stored frame
+    uint32_t bytesSuppressed;
+    uint32_t lastStoredSequence;
+    uint32_t lastConfirmedMs; // millis() the stored frame was last seen again
+  };
+
   void setup();
   void loop();
+  // One triggered cycle on the calling task, which must be the one that ran
+  // setup() with no loop() running (the host benchmarks)
+  void captureNow();
+  Stats getStats();
 }
 
 // Compatibility namespace for web routes
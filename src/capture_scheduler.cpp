@@ -0,0 +1,200 @@
+#include "capture_scheduler.h"
+#include "config.h"
+#include "metrics.h"
+#include <atomic>
+extern "C" {
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+}
+
+static TaskHandle_t cameraTask = nullptr;
+static esp_timer_handle_t tickTimer = nullptr;
+static std::atomic<uint32_t> intervalMs{0};
+
+// Tick state. The due times are low 32 bits of esp_timer microseconds;
+// differences stay correct across the 71-minute wrap.
+static uint32_t gridUs = 0; // last due time; esp_timer task while running
+static std::atomic<uint32_t> lastDueUs{0};
+static std::atomic<bool> tickPending{false};
+static std::atomic<uint32_t> ticks{0};
+static std::atomic<uint32_t> overruns{0};
+static std::atomic<uint32_t> ticksSkipped{0};
+
+// Trigger state, shared with the GPIO ISR
+static portMUX_TYPE triggerMux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t lastEdgeUs = 0;
+static uint32_t lastAcceptedUs = 0;
+static bool anyAccepted = false;
+static uint32_t pendingTriggerUs = 0;
+static bool triggerPending = false;
+static uint32_t triggerCounts[(size_t)CaptureScheduler::Source::Count] = {};
+static uint32_t triggersRejected = 0;
+static uint32_t triggersDebounced = 0;
+
+struct LatencyCounters {
+  std::atomic<uint32_t> samples{0};
+  std::atomic<uint32_t> lastUs{0};
+  std::atomic<uint32_t> avgUs{0};
+  std::atomic<uint32_t> maxUs{0};
+};
+static LatencyCounters jitter;
+static LatencyCounters triggerLatency;
+
+static void recordLatency(LatencyCounters &c, uint32_t us) {
+  uint32_t n = c.samples.fetch_add(1, std::memory_order_relaxed);
+  uint32_t avg = c.avgUs.load(std::memory_order_relaxed);
+  // EMA with 1/16 weight; seed with the first sample
+  avg = n == 0 ? us : avg - avg / 16 + us / 16;
+  c.avgUs.store(avg, std::memory_order_relaxed);
+  c.lastUs.store(us, std::memory_order_relaxed);
+  if (us > c.maxUs.load(std::memory_order_relaxed))
+    c.maxUs.store(us, std::memory_order_relaxed);
+}
+
+static CaptureScheduler::Latency snapshotLatency(const LatencyCounters &c) {
+  return {c.samples.load(std::memory_order_relaxed),
+          c.lastUs.load(std::memory_order_relaxed),
+          c.avgUs.load(std::memory_order_relaxed),
+          c.maxUs.load(std::memory_order_relaxed)};
+}
+
+static void onTick(void *) {
+  // skip_unhandled_events drops ticks the timer task was too late for, so
+  // stepping one period per callback would drift behind. Snap to the
+  // latest grid point instead and count the ones in between.
+  uint32_t period = intervalMs.load(std::memory_order_relaxed) * 1000u;
+  uint32_t steps = ((uint32_t)esp_timer_get_time() - gridUs) / period;
+  if (steps == 0)
+    steps = 1; // fired a little early
+  else if (steps > 1)
+    ticksSkipped.fetch_add(steps - 1, std::memory_order_relaxed);
+  gridUs += steps * period;
+  lastDueUs.store(gridUs, std::memory_order_relaxed);
+  ticks.fetch_add(1, std::memory_order_relaxed);
+  if (tickPending.exchange(true, std::memory_order_relaxed))
+    overruns.fetch_add(1, std::memory_order_relaxed);
+  xTaskNotify(cameraTask, CaptureScheduler::Tick, eSetBits);
+}
+
+// Spacing check and bookkeeping; caller holds triggerMux. In IRAM because
+// the GPIO ISR calls it while FFat writes may have the flash cache off.
+static bool IRAM_ATTR acceptTrigger(CaptureScheduler::Source source,
+                                   uint32_t now) {
+  if (anyAccepted && now - lastAcceptedUs < TRIGGER_MIN_SPACING_MS * 1000u) {
+    triggersRejected++;
+    return false;
+  }
+  anyAccepted = true;
+  lastAcceptedUs = now;
+  pendingTriggerUs = now;
+  triggerPending = true;
+  triggerCounts[(size_t)source]++;
+  return true;
+}
+
+static void IRAM_ATTR onTriggerEdge() {
+  uint32_t now = (uint32_t)esp_timer_get_time();
+  portENTER_CRITICAL_ISR(&triggerMux);
+  bool bounce = now - lastEdgeUs < TRIGGER_DEBOUNCE_MS * 1000u;
+  lastEdgeUs = now;
+  bool accepted = false;
+  if (bounce)
+    triggersDebounced++;
+  else
+    accepted = acceptTrigger(CaptureScheduler::Source::Gpio, now);
+  portEXIT_CRITICAL_ISR(&triggerMux);
+
+  if (accepted && cameraTask) {
+    BaseType_t woken = pdFALSE;
+    xTaskNotifyFromISR(cameraTask, CaptureScheduler::Trigger, eSetBits,
+                       &woken);
+    portYIELD_FROM_ISR(woken);
+  }
+}
+
+namespace CaptureScheduler {
+
+void setup() {
+  cameraTask = xTaskGetCurrentTaskHandle();
+
+  esp_timer_create_args_t args = {};
+  args.callback = onTick;
+  args.dispatch_method = ESP_TIMER_TASK;
+  args.name = "capture_tick";
+  args.skip_unhandled_events = true; // a late tick is an overrun, not a burst
+  if (esp_timer_create(&args, &tickTimer) != ESP_OK) {
+    Serial.println("Scheduler: Failed to create tick timer");
+    tickTimer = nullptr;
+  }
+
+  if (TRIGGER_PIN >= 0) {
+    pinMode(TRIGGER_PIN, INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(TRIGGER_PIN), onTriggerEdge,
+                    TRIGGER_RISING_EDGE ? RISING : FALLING);
+    Serial.printf("Scheduler: Trigger on GPIO %d\n", TRIGGER_PIN);
+  }
+}
+
+void setInterval(uint32_t ms) {
+  if (!tickTimer || ms == 0 ||
+      ms == intervalMs.load(std::memory_order_relaxed))
+    return;
+  esp_timer_stop(tickTimer); // fails harmlessly if not yet started
+  intervalMs.store(ms, std::memory_order_relaxed);
+  gridUs = (uint32_t)esp_timer_get_time();
+  esp_timer_start_periodic(tickTimer, (uint64_t)ms * 1000);
+}
+
+uint32_t wait(uint32_t timeoutMs) {
+  uint32_t events = 0;
+  xTaskNotifyWait(0, UINT32_MAX, &events, pdMS_TO_TICKS(timeoutMs));
+  if (events & Tick) {
+    tickPending.store(false, std::memory_order_relaxed);
+    recordLatency(jitter, (uint32_t)esp_timer_get_time() -
+                              lastDueUs.load(std::memory_order_relaxed));
+  }
+  return events;
+}
+
+void triggerCaptured(int64_t grabbedUs) {
+  portENTER_CRITICAL(&triggerMux);
+  bool pending = triggerPending;
+  uint32_t at = pendingTriggerUs;
+  triggerPending = false;
+  portEXIT_CRITICAL(&triggerMux);
+  if (!pending)
+    return;
+  uint32_t us = (uint32_t)grabbedUs - at;
+  recordLatency(triggerLatency, us);
+  Metrics::triggerLatency.observeUs(us);
+}
+
+bool trigger(Source source) {
+  uint32_t now = (uint32_t)esp_timer_get_time();
+  portENTER_CRITICAL(&triggerMux);
+  bool accepted = acceptTrigger(source, now);
+  portEXIT_CRITICAL(&triggerMux);
+  if (accepted && cameraTask)
+    xTaskNotify(cameraTask, Trigger, eSetBits);
+  return accepted;
+}
+
+Stats getStats() {
+  Stats s = {};
+  s.intervalMs = intervalMs.load(std::memory_order_relaxed);
+  s.ticks = ticks.load(std::memory_order_relaxed);
+  s.overruns = overruns.load(std::memory_order_relaxed);
+  s.ticksSkipped = ticksSkipped.load(std::memory_order_relaxed);
+  s.jitter = snapshotLatency(jitter);
+  portENTER_CRITICAL(&triggerMux);
+  for (size_t i = 0; i < (size_t)Source::Count; i++)
+    s.triggers[i] = triggerCounts[i];
+  s.triggersRejected = triggersRejected;
+  s.triggersDebounced = triggersDebounced;
+  portEXIT_CRITICAL(&triggerMux);
+  s.triggerLatency = snapshotLatency(triggerLatency);
+  return s;
+}
+
+} // namespace CaptureScheduler
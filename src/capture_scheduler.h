@@ -0,0 +1,50 @@
+#pragma once
+#include <Arduino.h>
+
+// Capture timing for the camera task. A periodic esp_timer marks
+// fixed-rate ticks, so intervals no longer stretch by the length of each
+// cycle, and external triggers (GPIO edge, serial G-code, POST /trigger)
+// wake the task at once. Both arrive as task notifications.
+namespace CaptureScheduler {
+  enum Event : uint32_t {
+    Tick = 1u << 0,
+    Trigger = 1u << 1,
+  };
+
+  enum class Source : uint8_t { Gpio, Serial, Http, Count };
+
+  struct Latency {
+    uint32_t samples;
+    uint32_t lastUs;
+    uint32_t avgUs; // exponential moving average
+    uint32_t maxUs;
+  };
+
+  struct Stats {
+    uint32_t intervalMs;
+    uint32_t ticks;
+    uint32_t overruns;       // ticks that fired while the last was pending
+    uint32_t ticksSkipped;   // dropped by the timer when it ran late
+    Latency jitter;          // tick due time to camera task wake-up
+    uint32_t triggers[(size_t)Source::Count]; // accepted, per source
+    uint32_t triggersRejected;  // within TRIGGER_MIN_SPACING_MS
+    uint32_t triggersDebounced; // GPIO edges within TRIGGER_DEBOUNCE_MS
+    Latency triggerLatency;  // trigger to frame grabbed
+  };
+
+  void setup(); // from the camera task, which receives the notifications
+
+  // Fixed-rate period; the timer is only restarted when it changes
+  void setInterval(uint32_t ms);
+
+  // Blocks until a tick or trigger (or the timeout); returns Event bits
+  uint32_t wait(uint32_t timeoutMs);
+
+  // Camera task, once the frame answering a Trigger event was grabbed
+  void triggerCaptured(int64_t grabbedUs);
+
+  // Any task; false if too soon after the previous accepted trigger
+  bool trigger(Source source);
+
+  Stats getStats();
+}
@@ -3,8 +3,11 @@
 
 // ===== ACTIVE PROFILE SELECTION =====
 // Optional local overrides: create `src/config.local.h` (git-ignored) to define
-// credentials or switch profiles without committing secrets.
-#if __has_include("config.local.h")
+// credentials or switch profiles without committing secrets. The native
+// build (HOST_BUILD) uses host/host_profile.h instead.
+#if defined(HOST_BUILD)
+#include "host_profile.h"
+#elif __has_include("config.local.h")
 #include "config.local.h"
 #endif
 // Change this to switch between profiles at compile time (can be overridden in
@@ -25,6 +28,13 @@ struct NetworkConfig {
   const char *eapOuterIdentity;
 };
 
+// How the storage writer persists frames
+enum class RecordingMode {
+  PerFile,   // one /i/img_<sequence>.jpg per frame, oldest deleted
+  Timelapse, // appended to /r/tl_NNNN.avi MJPEG segments
+  RawLog,    // circular log on the raw "frames" partition, no FAT at all
+};
+
 struct CameraConfig {
   // GPIO pins for ESP32-S3 N16R8 CAM board
   int pinPwdn = -1;
@@ -60,7 +70,49 @@ struct CameraConfig {
   // JPEG Quality: 0-63 (lower = better quality, larger files)
   // 10 = high quality, 20 = good balance, 40 = smaller files
   int jpegQuality = 20;
-  int fbCount = 1;
+  // Frame buffers live in PSRAM so the driver can keep filling one while the
+  // capture stage copies another; GRAB_LATEST always hands back the newest.
+  int fbCount = 2;
+  camera_fb_location_t fbLocation = CAMERA_FB_IN_PSRAM;
+  camera_grab_mode_t grabMode = CAMERA_GRAB_LATEST;
+  // Shared JPEG pool: slots must cover every frame that is queued, cached or
+  // being served at once. 0 bytes = derive from frameSize (w*h/4).
+  int framePoolSlots = 8;
+  uint32_t framePoolSlotBytes = 0;
+  // Capture cadence: a frame is captured every captureIntervalMs; while
+  // MJPEG viewers are connected, frames are captured at streamTargetFps.
+  // Which of them are written to FFat follows the motion settings below.
+  uint32_t captureIntervalMs = 3000;
+  int streamTargetFps = 5;
+  // Motion-adaptive cadence: each capture is decoded at 1/8 scale and its
+  // luma compared with the previous one. While the scene changes, frames
+  // are captured and stored every motionActiveIntervalMs; once it has been
+  // still for motionHoldMs, captures drop back to captureIntervalMs and
+  // only a heartbeat frame is stored every motionHeartbeatMs.
+  bool motionEnabled = true;
+  uint8_t motionPixelDelta = 24;      // luma step that marks a pixel changed
+  uint32_t motionScoreThreshold = 15; // permille of changed pixels = motion
+  uint32_t motionActiveIntervalMs = 1000;
+  uint32_t motionHoldMs = 15000;
+  uint32_t motionHeartbeatMs = 60000;
+  // Duplicate suppression: a frame due for storage is skipped when its size
+  // is within dedupSizePermille of the last stored frame and fewer than
+  // dedupScoreThreshold permille of its luma pixels changed. The stored
+  // frame's confirmed time is bumped instead. The luma comes from the
+  // motion detector; with motionEnabled off, only frames due for storage
+  // are decoded for it.
+  bool dedupEnabled = true;
+  uint32_t dedupScoreThreshold = 5;
+  uint32_t dedupSizePermille = 30;
+  uint32_t dedupMaxAgeMs = 600000; // store a frame at least this often
+  // External triggers (e.g. the printer's layer-change signal): a GPIO
+  // edge, the serial G-code line below, or POST /trigger. Each captures and
+  // stores a frame at once, regardless of the cadence above.
+  int triggerPin = -1; // -1 = no GPIO trigger; input with pull-up
+  bool triggerRisingEdge = true;
+  uint32_t triggerDebounceMs = 20;   // GPIO edges closer than this bounce
+  uint32_t triggerMinSpacingMs = 500; // any source; closer ones are refused
+  const char *triggerGcode = "M240"; // serial trigger line, "" = off
   uint32_t breathCycleDurationMs =
       3000; // 3 seconds total breath cycle (1.5s up + 1.5s down)
 };
@@ -69,22 +121,77 @@ struct SystemConfig {
   // LED
   int ledPin = 48;
   int ledMaxBrightness = 10; // 0-255
+  uint32_t ledFrameMs = 10;  // animation step while breathing
+  uint32_t ledTaskStackSize = 3072;
+  int ledTaskPriority = 0;
+  int ledTaskCore = 0;
 
   // Web server
   int webServerPort = 80;
   int pageRefreshSeconds = 5;
+  int streamMaxClients = 4; // concurrent /stream viewers
+  // Resumes waiting /stream responses when a frame is published
+  uint32_t streamPumpTaskStackSize = 4096;
+  int streamPumpTaskPriority = 2;
+  int streamPumpTaskCore = 1;
+  int nextFrameMaxWaiters = 8;         // concurrent /i/next long-polls
+  uint32_t nextFrameTimeoutMs = 30000; // default and cap for ?timeout=
+  // Delivery scheduler: a viewer only starts its next frame once its unacked
+  // bytes drop below the per-client cap, and all viewers together may not
+  // have more than the budget in flight (lwIP buffers come from DRAM).
+  uint32_t streamClientMaxUnackedBytes = 8192;
+  uint32_t streamInFlightBudgetBytes = 48 * 1024;
+  uint32_t streamMinFreeHeap = 60000;
+  // /json and /status.html are served from a snapshot rebuilt at this rate
+  uint32_t telemetryIntervalMs = 2000;
+  uint32_t telemetryTaskStackSize = 8192;
+  int telemetryTaskPriority = 1;
+  int telemetryTaskCore = 1;
 
   // Image storage
   int maxStoredImages = 5;
   const char *imagePathPrefix = "/i/img_";
   const char *imagePathSuffix = ".jpg";
   const char *latestImagePath = "/i/latest.jpg";
+  const char *frameIndexPath = "/sys/index.bin"; // outside the served /i
+  int historyPageMax = 50;                     // entries per /history page
+  // Capture sequences reserved in NVS per write; a reset skips what's left
+  uint32_t sequenceReserveBlock = 1024;
+  int frameCacheSize = 2; // newest frames kept in PSRAM for HTTP serving
+  int filePinSlots = 8;   // history files being streamed at once
+  // File downloads read ahead into PSRAM blocks (whole 512-byte sectors);
+  // transfers beyond the block count read straight from FFat
+  int fileReadAheadBlocks = 4;
+  uint32_t fileReadAheadBytes = 32768;
+  uint32_t traceEventsPerCore = 2048; // span ring size per core, in PSRAM
+  // /bench runs on its own task below the web server, streaming each
+  // result as it finishes; cases still waiting at the time cap are skipped
+  int benchMaxIterations = 200;
+  uint32_t benchMaxMs = 10000;
+  uint32_t benchTaskStackSize = 8192;
+  int benchTaskPriority = 1;
+  int benchTaskCore = 1;
+
+  // Recording (mode can be switched at runtime via POST /recording)
+  RecordingMode recordingMode = RecordingMode::PerFile;
+  const char *recordingDir = "/r";
+  uint32_t recordingSegmentBytes = 4 * 1024 * 1024; // roll to a new .avi
+  int recordingMaxSegments = 2;                     // oldest deleted beyond
+  int recordingPlaybackFps = 10;                    // rate written to header
+  const char *frameStorePartition = "frames"; // see partitions.csv
+  const char *assetPartition = "assets";      // tools/pack_assets.py
+  int frameStoreCheckpointEvery = 16;         // records between checkpoints
 
   // System
   uint32_t serialBaudRate = 115200;
   uint32_t cameraTaskStackSize = 16384; // Increased for camera operations
   int cameraTaskPriority = 0;
   int cameraTaskCore = 0;
+  // Storage writer: drains captured frames to FFat off the capture task
+  int storageQueueDepth = 3; // frames buffered before capture starts dropping
+  uint32_t storageTaskStackSize = 8192;
+  int storageTaskPriority = 1;
+  int storageTaskCore = 0;
   uint32_t debugStartupDelayMs = 200;
 };
 
@@ -107,7 +214,7 @@ static constexpr Config CONFIG = ACTIVE_PROFILE;
 
 // ===== COMPILE-TIME SAFETY CHECK =====
 // Force use of config.local.h for credentials
-#if !__has_include("config.local.h")
+#if !defined(HOST_BUILD) && !__has_include("config.local.h")
 #error                                                                         \
     "ERROR: Copy src/config.local.example.h to src/config.local.h and add your real WiFi credentials!"
 #endif
@@ -141,18 +248,81 @@ static constexpr Config CONFIG = ACTIVE_PROFILE;
 #define CAMERA_FRAME_SIZE CONFIG.camera.frameSize
 #define CAMERA_JPEG_QUALITY CONFIG.camera.jpegQuality
 #define CAMERA_FB_COUNT CONFIG.camera.fbCount
+#define CAMERA_FB_LOCATION CONFIG.camera.fbLocation
+#define CAMERA_GRAB_MODE CONFIG.camera.grabMode
+#define FRAME_POOL_SLOTS CONFIG.camera.framePoolSlots
+#define FRAME_POOL_SLOT_BYTES CONFIG.camera.framePoolSlotBytes
+#define CAMERA_CAPTURE_INTERVAL_MS CONFIG.camera.captureIntervalMs
+#define STREAM_TARGET_FPS CONFIG.camera.streamTargetFps
+#define MOTION_ENABLED CONFIG.camera.motionEnabled
+#define MOTION_PIXEL_DELTA CONFIG.camera.motionPixelDelta
+#define MOTION_SCORE_THRESHOLD CONFIG.camera.motionScoreThreshold
+#define MOTION_ACTIVE_INTERVAL_MS CONFIG.camera.motionActiveIntervalMs
+#define MOTION_HOLD_MS CONFIG.camera.motionHoldMs
+#define MOTION_HEARTBEAT_MS CONFIG.camera.motionHeartbeatMs
+#define DEDUP_ENABLED CONFIG.camera.dedupEnabled
+#define DEDUP_SCORE_THRESHOLD CONFIG.camera.dedupScoreThreshold
+#define DEDUP_SIZE_PERMILLE CONFIG.camera.dedupSizePermille
+#define DEDUP_MAX_AGE_MS CONFIG.camera.dedupMaxAgeMs
+#define TRIGGER_PIN CONFIG.camera.triggerPin
+#define TRIGGER_RISING_EDGE CONFIG.camera.triggerRisingEdge
+#define TRIGGER_DEBOUNCE_MS CONFIG.camera.triggerDebounceMs
+#define TRIGGER_MIN_SPACING_MS CONFIG.camera.triggerMinSpacingMs
+#define TRIGGER_GCODE CONFIG.camera.triggerGcode
 #define CAMERA_BREATH_CYCLE_MS CONFIG.camera.breathCycleDurationMs
 
 #define LED_PIN CONFIG.system.ledPin
 #define LED_MAX_BRIGHTNESS CONFIG.system.ledMaxBrightness
+#define LED_FRAME_MS CONFIG.system.ledFrameMs
+#define LED_TASK_STACK_SIZE CONFIG.system.ledTaskStackSize
+#define LED_TASK_PRIORITY CONFIG.system.ledTaskPriority
+#define LED_TASK_CORE CONFIG.system.ledTaskCore
 #define WEB_SERVER_PORT CONFIG.system.webServerPort
 #define PAGE_REFRESH_SECONDS CONFIG.system.pageRefreshSeconds
+#define STREAM_MAX_CLIENTS CONFIG.system.streamMaxClients
+#define STREAM_PUMP_TASK_STACK_SIZE CONFIG.system.streamPumpTaskStackSize
+#define STREAM_PUMP_TASK_PRIORITY CONFIG.system.streamPumpTaskPriority
+#define STREAM_PUMP_TASK_CORE CONFIG.system.streamPumpTaskCore
+#define NEXT_FRAME_MAX_WAITERS CONFIG.system.nextFrameMaxWaiters
+#define NEXT_FRAME_TIMEOUT_MS CONFIG.system.nextFrameTimeoutMs
+#define STREAM_CLIENT_MAX_UNACKED_BYTES CONFIG.system.streamClientMaxUnackedBytes
+#define STREAM_IN_FLIGHT_BUDGET_BYTES CONFIG.system.streamInFlightBudgetBytes
+#define STREAM_MIN_FREE_HEAP CONFIG.system.streamMinFreeHeap
+#define TELEMETRY_INTERVAL_MS CONFIG.system.telemetryIntervalMs
+#define TELEMETRY_TASK_STACK_SIZE CONFIG.system.telemetryTaskStackSize
+#define TELEMETRY_TASK_PRIORITY CONFIG.system.telemetryTaskPriority
+#define TELEMETRY_TASK_CORE CONFIG.system.telemetryTaskCore
 #define MAX_STORED_IMAGES CONFIG.system.maxStoredImages
 #define IMAGE_PATH_PREFIX CONFIG.system.imagePathPrefix
 #define IMAGE_PATH_SUFFIX CONFIG.system.imagePathSuffix
 #define LATEST_IMAGE_PATH CONFIG.system.latestImagePath
+#define FRAME_INDEX_PATH CONFIG.system.frameIndexPath
+#define HISTORY_PAGE_MAX CONFIG.system.historyPageMax
+#define SEQUENCE_RESERVE_BLOCK CONFIG.system.sequenceReserveBlock
+#define TRACE_EVENTS_PER_CORE CONFIG.system.traceEventsPerCore
+#define BENCH_MAX_ITERATIONS CONFIG.system.benchMaxIterations
+#define BENCH_MAX_MS CONFIG.system.benchMaxMs
+#define BENCH_TASK_STACK_SIZE CONFIG.system.benchTaskStackSize
+#define BENCH_TASK_PRIORITY CONFIG.system.benchTaskPriority
+#define BENCH_TASK_CORE CONFIG.system.benchTaskCore
+#define FRAME_CACHE_SIZE CONFIG.system.frameCacheSize
+#define FILE_PIN_SLOTS CONFIG.system.filePinSlots
+#define FILE_READ_AHEAD_BLOCKS CONFIG.system.fileReadAheadBlocks
+#define FILE_READ_AHEAD_BYTES CONFIG.system.fileReadAheadBytes
+#define RECORDING_MODE CONFIG.system.recordingMode
+#define RECORDING_DIR CONFIG.system.recordingDir
+#define RECORDING_SEGMENT_BYTES CONFIG.system.recordingSegmentBytes
+#define RECORDING_MAX_SEGMENTS CONFIG.system.recordingMaxSegments
+#define RECORDING_PLAYBACK_FPS CONFIG.system.recordingPlaybackFps
+#define FRAME_STORE_PARTITION CONFIG.system.frameStorePartition
+#define ASSET_PARTITION CONFIG.system.assetPartition
+#define FRAME_STORE_CHECKPOINT_EVERY CONFIG.system.frameStoreCheckpointEvery
 #define SERIAL_BAUD_RATE CONFIG.system.serialBaudRate
 #define CAMERA_TASK_STACK_SIZE CONFIG.system.cameraTaskStackSize
 #define CAMERA_TASK_PRIORITY CONFIG.system.cameraTaskPriority
 #define CAMERA_TASK_CORE CONFIG.system.cameraTaskCore
+#define STORAGE_QUEUE_DEPTH CONFIG.system.storageQueueDepth
+#define STORAGE_TASK_STACK_SIZE CONFIG.system.storageTaskStackSize
+#define STORAGE_TASK_PRIORITY CONFIG.system.storageTaskPriority
+#define STORAGE_TASK_CORE CONFIG.system.storageTaskCore
 #define DEBUG_STARTUP_DELAY_MS CONFIG.system.debugStartupDelayMs
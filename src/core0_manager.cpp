@@ -20,16 +20,15 @@ static void cameraTask(void* parameter) {
   Serial.println("Core 0: Camera setup complete");
   
   Serial.println("Core 0: Initializing LED...");
-  LEDBreathe::setup();
+  LEDBreathe::setup(); // Starts its own animation task
   
-  Serial.println("Core 0: Camera + LED task running - continuous operation");
+  Serial.println("Core 0: Camera task running - continuous operation");
   
   uint32_t lastHealthCheck = millis();
   
   // Continuous operation on Core 0
   for (;;) {
-    CameraCycle::loop();  // Camera capture every 3 seconds
-    LEDBreathe::loop();   // LED breathing animation
+    CameraCycle::loop();  // Camera capture (LED animates on its own task)
     
     // Health check every 30 seconds
     uint32_t now = millis();
@@ -1,4 +1,5 @@
 #include "debug_manager.h"
+#include "capture_scheduler.h"
 #include "config.h"
 #include <Arduino.h>
 extern "C" {
@@ -50,7 +51,31 @@ void DebugManager::setup() {
   }
 }
 
+// Serial G-code hook: a line starting with TRIGGER_GCODE (e.g. "M240"
+// from the printer's layer-change script) triggers a capture
+static void pollSerialTrigger() {
+  static char line[32];
+  static size_t len = 0;
+  while (Serial.available() > 0) {
+    int c = Serial.read();
+    if (c != '\n' && c != '\r') {
+      if (len < sizeof(line) - 1)
+        line[len++] = (char)c;
+      continue;
+    }
+    line[len] = '\0';
+    size_t n = strlen(TRIGGER_GCODE);
+    bool match = n > 0 && len >= n && strncmp(line, TRIGGER_GCODE, n) == 0 &&
+                 (line[n] == '\0' || line[n] == ' ' || line[n] == ';');
+    if (match &&
+        !CaptureScheduler::trigger(CaptureScheduler::Source::Serial))
+      Serial.println("Trigger: Too soon after the last one, ignored");
+    len = 0;
+  }
+}
+
 void DebugManager::loop() {
+  pollSerialTrigger();
   // Feed watchdog to prevent resets
   delay(1); // Small yield to prevent tight loop
 }
\ No newline at end of file
@@ -0,0 +1,98 @@
+#include "delivery_scheduler.h"
+#include "config.h"
+extern "C" {
+#include "esp_heap_caps.h"
+}
+
+static uint32_t flowCount = 0;
+static uint32_t deferringCount = 0; // flows currently held back
+static size_t inFlightBytes = 0;
+static size_t inFlightHighWater = 0;
+static uint32_t deferredBacklog = 0;
+static uint32_t deferredBudget = 0;
+static uint32_t deferredHeap = 0;
+static uint32_t framesSkipped = 0;
+
+static bool defer(DeliveryScheduler::Flow &flow, uint32_t &reason) {
+  // Count each stalled frame boundary once, not every poll while waiting
+  if (!flow.deferring) {
+    flow.deferring = true;
+    flow.deferrals++;
+    deferringCount++;
+    reason++;
+  }
+  return false;
+}
+
+namespace DeliveryScheduler {
+
+void add(Flow &flow) {
+  if (flow.registered)
+    return;
+  flow.registered = true;
+  flow.unacked = 0;
+  flowCount++;
+}
+
+void remove(Flow &flow) {
+  if (!flow.registered)
+    return;
+  setUnacked(flow, 0);
+  if (flow.deferring) {
+    flow.deferring = false;
+    deferringCount--;
+  }
+  flow.registered = false;
+  flowCount--;
+}
+
+void setUnacked(Flow &flow, size_t unacked) {
+  if (!flow.registered)
+    return;
+  inFlightBytes = inFlightBytes - flow.unacked + unacked;
+  flow.unacked = unacked;
+  if (inFlightBytes > inFlightHighWater)
+    inFlightHighWater = inFlightBytes;
+}
+
+bool mayStartFrame(Flow &flow, size_t frameLen) {
+  if (flow.unacked > STREAM_CLIENT_MAX_UNACKED_BYTES)
+    return defer(flow, deferredBacklog);
+
+  // Always let one frame through so an oversized frame can't stall everyone
+  size_t othersInFlight = inFlightBytes - flow.unacked;
+  if (othersInFlight > 0 &&
+      othersInFlight + frameLen > STREAM_IN_FLIGHT_BUDGET_BYTES)
+    return defer(flow, deferredBudget);
+
+  if (heap_caps_get_free_size(MALLOC_CAP_INTERNAL) < STREAM_MIN_FREE_HEAP)
+    return defer(flow, deferredHeap);
+
+  if (flow.deferring) {
+    flow.deferring = false;
+    deferringCount--;
+  }
+  return true;
+}
+
+uint32_t deferring() { return deferringCount; }
+
+void noteSkipped(Flow &flow, uint32_t frames) {
+  flow.framesSkipped += frames;
+  framesSkipped += frames;
+}
+
+Stats getStats() {
+  Stats s;
+  s.flows = flowCount;
+  s.inFlightBytes = inFlightBytes;
+  s.inFlightHighWater = inFlightHighWater;
+  s.budgetBytes = STREAM_IN_FLIGHT_BUDGET_BYTES;
+  s.deferredBacklog = deferredBacklog;
+  s.deferredBudget = deferredBudget;
+  s.deferredHeap = deferredHeap;
+  s.framesSkipped = framesSkipped;
+  return s;
+}
+
+} // namespace DeliveryScheduler
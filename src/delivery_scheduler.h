@@ -0,0 +1,43 @@
+#pragma once
+#include <Arduino.h>
+
+// Decides when a streaming client may start its next frame. Each client is
+// a Flow whose unacked byte count is fed in from its response's ack path.
+// Slow clients are held at frame boundaries and then jump to the newest
+// frame; a global in-flight budget keeps lwIP from draining the heap.
+// All calls come from MjpegStream under its stream lock, except
+// getStats(), which only reads word-sized counters for the status sampler.
+namespace DeliveryScheduler {
+  struct Flow {
+    size_t unacked = 0;
+    uint32_t framesSkipped = 0;
+    uint32_t deferrals = 0;
+    bool deferring = false;
+    bool registered = false;
+  };
+
+  struct Stats {
+    uint32_t flows;
+    uint32_t inFlightBytes;
+    uint32_t inFlightHighWater;
+    uint32_t budgetBytes;
+    uint32_t deferredBacklog; // client still had too much unacked
+    uint32_t deferredBudget;  // global in-flight budget exhausted
+    uint32_t deferredHeap;    // free internal heap below threshold
+    uint32_t framesSkipped;
+  };
+
+  void add(Flow &flow);
+  void remove(Flow &flow);
+
+  void setUnacked(Flow &flow, size_t unacked);
+
+  // Called at a frame boundary; false means "ask again on the next ack"
+  bool mayStartFrame(Flow &flow, size_t frameLen);
+  uint32_t deferring(); // flows held back at a frame boundary right now
+
+  // Record frames a client never saw because it jumped to the newest one
+  void noteSkipped(Flow &flow, uint32_t frames);
+
+  Stats getStats();
+}
@@ -0,0 +1,194 @@
+#include "file_sender.h"
+#include "config.h"
+#include "http_cache.h"
+#include "metrics.h"
+#include "trace.h"
+#include <algorithm>
+#include <atomic>
+extern "C" {
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+}
+
+static uint8_t *arena = nullptr;
+static uint32_t blockCount = 0;
+static uint32_t blockBytes = 0;
+
+// Indices of unused blocks; responses may be destroyed on any task
+static QueueHandle_t freeBlocks = nullptr;
+
+static std::atomic<uint32_t> transferCount{0};
+static std::atomic<uint32_t> fallbackCount{0};
+static std::atomic<uint32_t> readCount{0};
+static std::atomic<uint32_t> readErrorCount{0};
+static std::atomic<uint32_t> lastBytes{0};
+static std::atomic<uint32_t> lastBytesPerSec{0};
+static std::atomic<uint32_t> peakBytesPerSec{0};
+
+static void noteTransfer(uint32_t bytes, uint32_t us) {
+  uint32_t rate = (uint32_t)((uint64_t)bytes * 1000000 / us);
+  lastBytes.store(bytes, std::memory_order_relaxed);
+  lastBytesPerSec.store(rate, std::memory_order_relaxed);
+  if (rate > peakBytesPerSec.load(std::memory_order_relaxed))
+    peakBytesPerSec.store(rate, std::memory_order_relaxed);
+}
+
+// Reads start on a sector boundary (a range that doesn't is read from the
+// sector it falls in) and the file position then only advances by whole
+// blocks, a multiple of the sector size, so FAT never needs a bounce buffer.
+class ReadAheadResponse : public HttpCache::Ranged<AsyncAbstractResponse> {
+public:
+  ReadAheadResponse(File file, const String &contentType, size_t offset,
+                    size_t length, std::shared_ptr<void> hold)
+      : file(file), hold(std::move(hold)), start(offset),
+        end(offset + length) {
+    _code = 200;
+    _contentType = contentType;
+    _contentLength = length;
+    uint8_t index;
+    if (freeBlocks && xQueueReceive(freeBlocks, &index, 0) == pdTRUE) {
+      blockIndex = index;
+      block = arena + (size_t)index * blockBytes;
+      position = start & ~(size_t)511;
+    } else {
+      fallbackCount.fetch_add(1, std::memory_order_relaxed);
+      position = start;
+    }
+    if (position)
+      this->file.seek(position);
+    transferCount.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  ~ReadAheadResponse() override {
+    if (sent > 0 && sent == _contentLength)
+      noteTransfer(sent, std::max<uint32_t>(
+                             1, (uint32_t)(esp_timer_get_time() - startUs)));
+    if (block)
+      xQueueSend(freeBlocks, &blockIndex, 0);
+    file.close();
+  }
+
+  bool _sourceValid() const override { return (bool)file; }
+
+  size_t _fillBuffer(uint8_t *buf, size_t maxLen) override {
+    if (!startUs)
+      startUs = esp_timer_get_time();
+    size_t len = block ? fromBlock(buf, maxLen) : direct(buf, maxLen);
+    sent += len;
+    Metrics::bytesServed.add(len);
+    return len;
+  }
+
+private:
+  // Fills all of `buf` that the file still has, refilling as it drains
+  size_t fromBlock(uint8_t *buf, size_t maxLen) {
+    size_t len = 0;
+    while (len < maxLen) {
+      if (offset == filled && !refill())
+        break;
+      size_t n = std::min(filled - offset, maxLen - len);
+      memcpy(buf + len, block + offset, n);
+      offset += n;
+      len += n;
+    }
+    return len;
+  }
+
+  bool refill() {
+    if (position >= end)
+      return false; // everything has been read
+    int64_t t0 = esp_timer_get_time();
+    size_t n = file.read(block, blockBytes);
+    Trace::record("file_read_ahead", t0,
+                  (uint32_t)(esp_timer_get_time() - t0));
+    readCount.fetch_add(1, std::memory_order_relaxed);
+    size_t blockStart = position;
+    size_t skip = start > blockStart ? start - blockStart : 0;
+    if (n <= skip) {
+      // Nothing from the range came back: the file is shorter than the
+      // length we promised (or the read failed). Treat it as an error
+      // rather than letting filled - offset wrap.
+      readErrorCount.fetch_add(1, std::memory_order_relaxed);
+      filled = offset = 0;
+      position = end;
+      return false;
+    }
+    position += n;
+    filled = std::min(n, end - blockStart);
+    offset = skip;
+    return true;
+  }
+
+  // No block to spare: read straight into the TCP buffer
+  size_t direct(uint8_t *buf, size_t maxLen) {
+    size_t n = file.read(buf, std::min(maxLen, end - position));
+    position += n;
+    return n;
+  }
+
+  File file;
+  std::shared_ptr<void> hold;
+  uint8_t *block = nullptr;
+  uint8_t blockIndex = 0;
+  size_t filled = 0; // valid bytes in the block
+  size_t offset = 0; // next byte of the block to send
+  const size_t start; // file offset of the first byte sent
+  const size_t end;   // one past the last
+  size_t position;    // file offset of the next read
+  size_t sent = 0;
+  int64_t startUs = 0;
+};
+
+namespace FileSender {
+
+void setup() {
+  if (arena)
+    return;
+
+  blockCount = FILE_READ_AHEAD_BLOCKS > 255 ? 255 : FILE_READ_AHEAD_BLOCKS;
+  blockBytes = FILE_READ_AHEAD_BYTES & ~511u; // whole sectors
+  if (blockCount == 0 || blockBytes == 0)
+    return;
+
+  arena = (uint8_t *)ps_malloc((size_t)blockCount * blockBytes);
+  freeBlocks = xQueueCreate(blockCount, sizeof(uint8_t));
+  if (!arena || !freeBlocks) {
+    Serial.printf("FileSender: Failed to reserve %u x %u bytes\n",
+                  (unsigned)blockCount, (unsigned)blockBytes);
+    free(arena);
+    arena = nullptr;
+    blockCount = 0;
+    return;
+  }
+  for (uint32_t i = 0; i < blockCount; i++) {
+    uint8_t index = (uint8_t)i;
+    xQueueSend(freeBlocks, &index, 0);
+  }
+  Serial.printf("FileSender: %u read-ahead blocks x %u bytes in PSRAM\n",
+                (unsigned)blockCount, (unsigned)blockBytes);
+}
+
+AsyncWebServerResponse *beginResponse(File file, const String &contentType,
+                                      size_t offset, size_t length,
+                                      std::shared_ptr<void> hold) {
+  return new ReadAheadResponse(file, contentType, offset, length,
+                               std::move(hold));
+}
+
+Stats getStats() {
+  Stats s;
+  s.blocks = blockCount;
+  s.blockBytes = blockBytes;
+  s.inUse = freeBlocks ? blockCount - uxQueueMessagesWaiting(freeBlocks) : 0;
+  s.transfers = transferCount.load(std::memory_order_relaxed);
+  s.fallbacks = fallbackCount.load(std::memory_order_relaxed);
+  s.reads = readCount.load(std::memory_order_relaxed);
+  s.readErrors = readErrorCount.load(std::memory_order_relaxed);
+  s.lastBytes = lastBytes.load(std::memory_order_relaxed);
+  s.lastBytesPerSec = lastBytesPerSec.load(std::memory_order_relaxed);
+  s.peakBytesPerSec = peakBytesPerSec.load(std::memory_order_relaxed);
+  return s;
+}
+
+} // namespace FileSender
@@ -0,0 +1,35 @@
+#pragma once
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <FS.h>
+#include <memory>
+
+// FFat downloads through pooled PSRAM read-ahead blocks. A transfer
+// borrows one block and refills it with a single sector-aligned read, then
+// answers every TCP ack from memory with as much as the connection can
+// take, instead of issuing a small FAT read per AsyncTCP callback.
+namespace FileSender {
+  struct Stats {
+    uint32_t blocks;
+    uint32_t blockBytes;
+    uint32_t inUse;
+    uint32_t transfers;
+    uint32_t fallbacks; // no free block; read straight into the TCP buffer
+    uint32_t reads;     // block refills
+    uint32_t readErrors;
+    uint32_t lastBytes;
+    uint32_t lastBytesPerSec; // of the last completed transfer
+    uint32_t peakBytesPerSec;
+  };
+
+  void setup(); // carves the blocks out of PSRAM
+
+  // Sends `length` bytes of `file` (open for reading) from `offset` on,
+  // e.g. the range HttpCache::begin() picked. `hold` is kept alive until
+  // the response is destroyed, e.g. to keep a file pinned.
+  AsyncWebServerResponse *beginResponse(File file, const String &contentType,
+                                        size_t offset, size_t length,
+                                        std::shared_ptr<void> hold = nullptr);
+
+  Stats getStats();
+}
@@ -0,0 +1,87 @@
+#include "frame_cache.h"
+#include "config.h"
+#include <atomic>
+
+// The camera task is the only publisher and owns the FrameRefs in the
+// ring. Readers never touch them: they see only each entry's tag and take
+// their own reference with FramePool::retain(), which refuses a slot that
+// has been freed or refilled in the meantime. Neither side ever waits.
+static FrameRef entries[FRAME_CACHE_SIZE]; // camera task only
+static int newestIndex = -1;               // camera task only
+static std::atomic<uint32_t> tags[FRAME_CACHE_SIZE];
+static std::atomic<uint32_t> newestTag{0};
+
+// A retain can only miss the newest tag if a newer frame was published
+// and the old one released in between, so a couple of retries suffice
+static constexpr int RETAIN_ATTEMPTS = 4;
+
+static std::atomic<uint32_t> publishedCount{0};
+static std::atomic<uint32_t> hitCount{0};
+static std::atomic<uint32_t> missCount{0};
+static std::atomic<uint32_t> retryCount{0};
+
+namespace FrameCache {
+
+void publish(const FrameRef &frame) {
+  if (!frame)
+    return;
+
+  newestIndex = (newestIndex + 1) % FRAME_CACHE_SIZE;
+  FrameRef evicted = std::move(entries[newestIndex]);
+  entries[newestIndex] = frame;
+  uint32_t tag = frame.tag();
+  tags[newestIndex].store(tag, std::memory_order_release);
+  newestTag.store(tag, std::memory_order_release);
+  // `evicted` drops here; readers still holding its tag either retain it
+  // intact (someone else kept a reference) or get nothing
+
+  publishedCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+FrameRef latest() {
+  for (int attempt = 0; attempt < RETAIN_ATTEMPTS; attempt++) {
+    uint32_t tag = newestTag.load(std::memory_order_acquire);
+    if (!tag)
+      break;
+    FrameRef frame = FramePool::retain(tag);
+    if (frame) {
+      hitCount.fetch_add(1, std::memory_order_relaxed);
+      return frame;
+    }
+    retryCount.fetch_add(1, std::memory_order_relaxed);
+  }
+  missCount.fetch_add(1, std::memory_order_relaxed);
+  return FrameRef();
+}
+
+FrameRef find(uint32_t sequence) {
+  for (int i = 0; i < FRAME_CACHE_SIZE; i++) {
+    uint32_t tag = tags[i].load(std::memory_order_acquire);
+    if (!tag || (tag >> 8) != (sequence & 0xffffff))
+      continue;
+    FrameRef frame = FramePool::retain(tag);
+    if (frame && frame.sequence() == sequence) {
+      hitCount.fetch_add(1, std::memory_order_relaxed);
+      return frame;
+    }
+  }
+  missCount.fetch_add(1, std::memory_order_relaxed);
+  return FrameRef();
+}
+
+Stats getStats() {
+  Stats s;
+  s.entries = 0;
+  for (int i = 0; i < FRAME_CACHE_SIZE; i++) {
+    if (tags[i].load(std::memory_order_relaxed))
+      s.entries++;
+  }
+  s.capacity = FRAME_CACHE_SIZE;
+  s.published = publishedCount.load(std::memory_order_relaxed);
+  s.hits = hitCount.load(std::memory_order_relaxed);
+  s.misses = missCount.load(std::memory_order_relaxed);
+  s.retries = retryCount.load(std::memory_order_relaxed);
+  return s;
+}
+
+} // namespace FrameCache
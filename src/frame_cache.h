@@ -0,0 +1,26 @@
+#pragma once
+#include "frame_pool.h"
+#include <Arduino.h>
+
+// The newest few captured frames, held as FrameRefs so HTTP handlers can
+// serve them straight from PSRAM without touching FFat.
+namespace FrameCache {
+  struct Stats {
+    uint32_t entries;
+    uint32_t capacity;
+    uint32_t published;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t retries; // newest frame replaced while a reader retained it
+  };
+
+  // Camera task only
+  void publish(const FrameRef &frame);
+
+  // Any task, lock-free. Empty ref if nothing has been captured yet / seq
+  // is no longer cached
+  FrameRef latest();
+  FrameRef find(uint32_t sequence);
+
+  Stats getStats();
+}
@@ -0,0 +1,415 @@
+#include "frame_index.h"
+#include "config.h"
+#include <FFat.h>
+#include <Preferences.h>
+#include <algorithm>
+#include <atomic>
+extern "C" {
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+}
+
+// ===== FILE LAYOUT =====
+// [header][slot 0][slot 1]...[slot capacity-1]
+// Slots are overwritten in rotation; the slot after the newest one is the
+// next to go. A slot that fails its CRC (torn write) is simply skipped.
+static constexpr uint32_t INDEX_MAGIC = 0x32584946; // "FIX2"
+static constexpr uint32_t INDEX_MAGIC_V1 = 0x31584946; // "FIX1"
+
+// Where older firmware kept the index, inside the publicly served /i
+static const char LEGACY_INDEX_PATH[] = "/i/index.bin";
+
+struct Header {
+  uint32_t magic;
+  uint32_t capacity;
+  uint32_t boot;
+  uint32_t crc;
+};
+
+struct Slot {
+  FrameIndex::Entry entry;
+  uint32_t replaced; // sequence whose file this slot evicted (0 = none)
+  uint32_t crc;      // over everything above
+};
+
+// FIX1 slots, from before entries kept a confirmed time. Such an index is
+// read once and rewritten in the current layout.
+struct SlotV1 {
+  struct {
+    uint32_t sequence, boot, timestamp, size, crc;
+  } entry;
+  uint32_t replaced;
+  uint32_t crc;
+};
+
+static File indexFile;
+static uint32_t capacity = 0;
+static uint32_t bootCount = 0;
+static uint32_t nextSlot = 0; // writer task only
+
+// Guarded by indexMux: written by the writer task, read by HTTP handlers
+static portMUX_TYPE indexMux = portMUX_INITIALIZER_UNLOCKED;
+static FrameIndex::Entry *slots = nullptr; // sequence 0 = empty
+static uint32_t newestSlot = 0;
+static uint32_t newestReplaced = 0; // writer task only; kept on rewrites
+
+static uint32_t loadUs = 0;
+static uint32_t writes = 0;
+static uint32_t writeFailures = 0;
+
+// ===== SEQUENCE RESERVATION =====
+// Most frames never reach the index (streamed only, suppressed as repeats,
+// or stored in the timelapse or raw log), so the newest indexed sequence
+// says little about which numbers were handed out. Sequences are issued
+// from a block whose end is saved in NVS before any of it is used, and a
+// restart resumes past that end. NVS also keeps the boot counter, so both
+// survive a lost or reformatted FFat.
+static Preferences counters;
+static SemaphoreHandle_t reserveLock = nullptr;
+static std::atomic<uint32_t> issued{0};   // last sequence handed out
+static std::atomic<uint32_t> reserved{0}; // saved end of the current block
+static std::atomic<uint32_t> reservations{0};
+static std::atomic<uint32_t> reserveFailures{0};
+
+// Called from the writer task ahead of time, and from the camera task if
+// it ever runs into the end of the block
+static bool reserve(uint32_t upTo) {
+  if (!reserveLock)
+    return false;
+  xSemaphoreTake(reserveLock, portMAX_DELAY);
+  bool ok = true;
+  if (upTo > reserved.load()) {
+    ok = counters.putUInt("seqLimit", upTo) == sizeof(uint32_t);
+    if (ok) {
+      reserved.store(upTo);
+      reservations.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      reserveFailures.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  xSemaphoreGive(reserveLock);
+  return ok;
+}
+
+template <typename T> static uint32_t crcOf(const T &v) {
+  return esp_rom_crc32_le(0, (const uint8_t *)&v, offsetof(T, crc));
+}
+
+static bool writeAt(size_t offset, const void *data, size_t len) {
+  if (!indexFile || !indexFile.seek(offset))
+    return false;
+  bool ok = indexFile.write((const uint8_t *)data, len) == len;
+  indexFile.flush();
+  return ok;
+}
+
+// Creates the index directory, and moves an index left by older firmware
+// there so its history is kept
+static void prepareDirectory() {
+  String path = FRAME_INDEX_PATH;
+  String dir = path.substring(0, path.lastIndexOf('/'));
+  if (dir.length() && !FFat.exists(dir))
+    FFat.mkdir(dir);
+  if (!FFat.exists(path) && FFat.exists(LEGACY_INDEX_PATH)) {
+    if (FFat.rename(LEGACY_INDEX_PATH, path))
+      Serial.printf("Storage: Moved frame index to %s\n", path.c_str());
+    else
+      FFat.remove(LEGACY_INDEX_PATH);
+  }
+}
+
+// Reads one slot in either layout; false on a short file. A slot that is
+// empty or fails its CRC comes back with sequence 0.
+static bool readSlot(File &f, bool v1, Slot &out) {
+  if (!v1) {
+    if (f.read((uint8_t *)&out, sizeof(out)) != sizeof(out))
+      return false;
+    if (out.crc != crcOf(out))
+      out.entry.sequence = 0;
+    return true;
+  }
+  SlotV1 s;
+  if (f.read((uint8_t *)&s, sizeof(s)) != sizeof(s))
+    return false;
+  out = {};
+  if (s.entry.sequence && s.crc == crcOf(s)) {
+    out.entry.sequence = s.entry.sequence;
+    out.entry.boot = s.entry.boot;
+    out.entry.timestamp = out.entry.confirmed = s.entry.timestamp;
+    out.entry.size = s.entry.size;
+    out.entry.crc = s.entry.crc;
+    out.replaced = s.replaced;
+  }
+  return true;
+}
+
+// Returns true if a valid index of the configured size was read; `v1` is
+// set if it has to be rewritten in the current layout
+static bool load(bool &v1) {
+  File f = FFat.open(FRAME_INDEX_PATH, "r");
+  if (!f)
+    return false;
+
+  Header h;
+  bool ok = f.read((uint8_t *)&h, sizeof(h)) == sizeof(h) &&
+            (h.magic == INDEX_MAGIC || h.magic == INDEX_MAGIC_V1) &&
+            h.crc == crcOf(h) && h.capacity == capacity;
+  if (ok) {
+    v1 = h.magic == INDEX_MAGIC_V1;
+    bootCount = h.boot;
+    Slot newest = {};
+    for (uint32_t i = 0; i < capacity; i++) {
+      Slot s;
+      if (!readSlot(f, v1, s))
+        break;
+      if (s.entry.sequence == 0)
+        continue;
+      slots[i] = s.entry;
+      if (s.entry.sequence > newest.entry.sequence) {
+        newest = s;
+        newestSlot = i;
+      }
+    }
+    nextSlot = newest.entry.sequence ? (newestSlot + 1) % capacity : 0;
+    newestReplaced = newest.replaced;
+
+    // The writer deletes the evicted file right after updating the slot; a
+    // reset in between would leave it behind
+    if (newest.replaced) {
+      String path = FrameIndex::pathFor(newest.replaced);
+      if (FFat.exists(path))
+        FFat.remove(path);
+    }
+  }
+  f.close();
+  return ok;
+}
+
+// Writes every slot from memory into a new file at full size, so later
+// writes never extend it; the header follows in setup()
+static void rewrite() {
+  File f = FFat.open(FRAME_INDEX_PATH, "w");
+  if (!f)
+    return;
+  f.seek(sizeof(Header));
+  for (uint32_t i = 0; i < capacity; i++) {
+    Slot s = {};
+    if (slots[i].sequence) {
+      s.entry = slots[i];
+      s.replaced = i == newestSlot ? newestReplaced : 0;
+      s.crc = crcOf(s);
+    }
+    f.write((const uint8_t *)&s, sizeof(s));
+  }
+  f.close();
+}
+
+namespace FrameIndex {
+
+bool setup() {
+  if (slots)
+    return true;
+
+  uint32_t start = (uint32_t)esp_timer_get_time();
+  capacity = MAX_STORED_IMAGES;
+  slots = new Entry[capacity]();
+
+  prepareDirectory();
+  bool v1 = false;
+  bool loaded = load(v1);
+  counters.begin("frames");
+  // An index from before the counters moved to NVS still has the count
+  bootCount = std::max(bootCount, counters.getUInt("boot", 0)) + 1;
+  counters.putUInt("boot", bootCount);
+  if (!loaded) {
+    memset(slots, 0, capacity * sizeof(Entry));
+    newestSlot = nextSlot = 0;
+    newestReplaced = 0;
+    rewrite();
+  } else if (v1) {
+    rewrite();
+    Serial.println("Storage: Frame index converted to the current layout");
+  }
+
+  indexFile = FFat.open(FRAME_INDEX_PATH, "r+");
+  Header h = {INDEX_MAGIC, capacity, bootCount, 0};
+  h.crc = crcOf(h);
+  if (!writeAt(0, &h, sizeof(h)))
+    Serial.println("Storage: Failed to write frame index header");
+
+  // Everything up to the saved end of the last block may have been used
+  reserveLock = xSemaphoreCreateMutex();
+  uint32_t last = std::max(counters.getUInt("seqLimit", 0), lastSequence());
+  issued.store(last);
+  reserved.store(last);
+  if (!reserve(last + SEQUENCE_RESERVE_BLOCK))
+    Serial.println("Storage: Failed to reserve frame sequences");
+
+  loadUs = (uint32_t)esp_timer_get_time() - start;
+  Serial.printf("Storage: Frame index %s, sequences from %u, boot %u "
+                "(%u us)\n",
+                loaded ? "loaded" : "created", (unsigned)(last + 1),
+                (unsigned)bootCount, (unsigned)loadUs);
+  return loaded;
+}
+
+bool add(const Entry &entry, Entry &evicted) {
+  if (!slots)
+    return false;
+
+  const uint32_t slot = nextSlot;
+  portENTER_CRITICAL(&indexMux);
+  evicted = slots[slot];
+  portEXIT_CRITICAL(&indexMux);
+
+  Slot s = {entry, evicted.sequence, 0};
+  s.entry.boot = bootCount;
+  s.crc = crcOf(s);
+  if (!writeAt(sizeof(Header) + slot * sizeof(Slot), &s, sizeof(s))) {
+    writeFailures++;
+    evicted = {};
+    return false;
+  }
+
+  portENTER_CRITICAL(&indexMux);
+  slots[slot] = s.entry;
+  newestSlot = slot;
+  portEXIT_CRITICAL(&indexMux);
+  newestReplaced = s.replaced;
+  nextSlot = (slot + 1) % capacity;
+  writes++;
+  return true;
+}
+
+bool confirm(uint32_t sequence, uint32_t ms) {
+  if (!slots || !sequence)
+    return false;
+  uint32_t slot = capacity;
+  Entry entry;
+  portENTER_CRITICAL(&indexMux);
+  for (uint32_t i = 0; i < capacity; i++) {
+    if (slots[i].sequence == sequence) {
+      slot = i;
+      entry = slots[i];
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&indexMux);
+  if (slot == capacity || entry.boot != bootCount)
+    return false;
+
+  // Only the newest slot's `replaced` is ever read back
+  entry.confirmed = ms;
+  Slot s = {entry, slot == newestSlot ? newestReplaced : 0, 0};
+  s.crc = crcOf(s);
+  if (!writeAt(sizeof(Header) + slot * sizeof(Slot), &s, sizeof(s))) {
+    writeFailures++;
+    return false;
+  }
+  portENTER_CRITICAL(&indexMux);
+  if (slots[slot].sequence == sequence)
+    slots[slot].confirmed = ms;
+  portEXIT_CRITICAL(&indexMux);
+  writes++;
+  return true;
+}
+
+uint32_t nextSequence() {
+  uint32_t sequence = issued.load(std::memory_order_relaxed) + 1;
+  // Normally the writer has moved the block on long before. If saving
+  // fails, numbering carries on rather than stopping the camera, and the
+  // writer keeps retrying.
+  if (sequence == reserved.load() + 1)
+    reserve(sequence + SEQUENCE_RESERVE_BLOCK - 1);
+  issued.store(sequence);
+  return sequence;
+}
+
+void reserveAhead() {
+  if (!reserveLock)
+    return;
+  uint32_t last = issued.load();
+  if ((int32_t)(reserved.load() - last) < (int32_t)SEQUENCE_RESERVE_BLOCK / 2)
+    reserve(last + SEQUENCE_RESERVE_BLOCK);
+}
+
+uint32_t boot() { return bootCount; }
+
+uint32_t lastSequence() {
+  Entry e;
+  return latest(e) ? e.sequence : 0;
+}
+
+bool latest(Entry &out) {
+  if (!slots)
+    return false;
+  portENTER_CRITICAL(&indexMux);
+  out = slots[newestSlot];
+  portEXIT_CRITICAL(&indexMux);
+  return out.sequence != 0;
+}
+
+bool find(uint32_t sequence, Entry &out) {
+  if (!slots || !sequence)
+    return false;
+  bool found = false;
+  portENTER_CRITICAL(&indexMux);
+  for (uint32_t i = 0; i < capacity && !found; i++) {
+    if (slots[i].sequence == sequence) {
+      out = slots[i];
+      found = true;
+    }
+  }
+  portEXIT_CRITICAL(&indexMux);
+  return found;
+}
+
+size_t page(uint32_t before, Entry *out, size_t max) {
+  if (!slots)
+    return 0;
+  size_t n = 0;
+  portENTER_CRITICAL(&indexMux);
+  // Walk back from the newest slot; sequences strictly decrease until the
+  // ring wraps onto older (or empty) slots
+  uint32_t prev = UINT32_MAX;
+  for (uint32_t i = 0; i < capacity && n < max; i++) {
+    const Entry &e = slots[(newestSlot + capacity - i) % capacity];
+    if (e.sequence == 0 || e.sequence >= prev)
+      break;
+    prev = e.sequence;
+    if (before == 0 || e.sequence < before)
+      out[n++] = e;
+  }
+  portEXIT_CRITICAL(&indexMux);
+  return n;
+}
+
+String pathFor(uint32_t sequence) {
+  return String(IMAGE_PATH_PREFIX) + String(sequence) +
+         String(IMAGE_PATH_SUFFIX);
+}
+
+Stats getStats() {
+  Stats s = {};
+  s.capacity = capacity;
+  s.boot = bootCount;
+  s.lastIssued = issued.load(std::memory_order_relaxed);
+  s.reservedThrough = reserved.load(std::memory_order_relaxed);
+  s.reservations = reservations.load(std::memory_order_relaxed);
+  s.reserveFailures = reserveFailures.load(std::memory_order_relaxed);
+  s.loadUs = loadUs;
+  s.writes = writes;
+  s.writeFailures = writeFailures;
+  if (slots) {
+    portENTER_CRITICAL(&indexMux);
+    for (uint32_t i = 0; i < capacity; i++)
+      if (slots[i].sequence)
+        s.entries++;
+    portEXIT_CRITICAL(&indexMux);
+  }
+  return s;
+}
+
+} // namespace FrameIndex
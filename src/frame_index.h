@@ -0,0 +1,60 @@
+#pragma once
+#include "frame_pool.h"
+#include <Arduino.h>
+
+// Persistent index of the per-file history in /i. Fixed-size entries live
+// in a small ring file (FRAME_INDEX_PATH) that is read in one go at boot, so
+// history survives a restart and is listed without scanning the directory.
+// Also hands out capture sequences, which never repeat across reboots.
+namespace FrameIndex {
+  struct Entry {
+    uint32_t sequence;  // capture sequence, monotonic across reboots
+    uint32_t boot;      // boot counter when the frame was captured
+    uint32_t timestamp; // millis() since that boot
+    uint32_t confirmed; // same clock; last seen again unchanged (repeats)
+    uint32_t size;
+    uint32_t crc;       // CRC32 of the JPEG
+  };
+
+  struct Stats {
+    uint32_t entries;
+    uint32_t capacity;
+    uint32_t boot;
+    uint32_t lastIssued;
+    uint32_t reservedThrough; // saved in NVS; the next boot starts past it
+    uint32_t reservations;
+    uint32_t reserveFailures;
+    uint32_t loadUs;
+    uint32_t writes;
+    uint32_t writeFailures;
+  };
+
+  // Loads the index; returns false when none was found (first boot, or
+  // files written by older firmware are still around)
+  bool setup();
+
+  // Writer task only. Records the frame stored at pathFor(entry.sequence);
+  // `evicted` receives the entry whose file must now be deleted, if any.
+  bool add(const Entry &entry, Entry &evicted);
+  // Writer task only. The frame was captured again, unchanged, at `ms`
+  // (millis() of this boot); false if it has no entry from this boot or
+  // the entry could not be rewritten.
+  bool confirm(uint32_t sequence, uint32_t ms);
+
+  // Camera task only. Sequences come from a block reserved in NVS, so a
+  // number is never handed out twice, even across resets.
+  uint32_t nextSequence();
+  // Writer task: saves the next block well before the current one runs out
+  void reserveAhead();
+  uint32_t boot(); // boot counter, kept in NVS
+
+  uint32_t lastSequence(); // newest indexed, 0 when empty
+  bool latest(Entry &out);
+  bool find(uint32_t sequence, Entry &out);
+
+  // Newest first, only entries with sequence < before (0 = from newest)
+  size_t page(uint32_t before, Entry *out, size_t max);
+
+  String pathFor(uint32_t sequence);
+  Stats getStats();
+}
@@ -0,0 +1,197 @@
+#include "frame_pool.h"
+#include "config.h"
+#include "esp_camera.h"
+#include "esp_rom_crc.h"
+#include <Arduino.h>
+extern "C" {
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+}
+
+static FrameSlot *slots = nullptr;
+static uint32_t slotCount = 0;
+static uint32_t slotBytes = 0;
+
+// Indices of unreferenced slots; any task may release a frame
+static QueueHandle_t freeSlots = nullptr;
+
+static std::atomic<uint32_t> acquiredCount{0};
+static std::atomic<uint32_t> allocFailureCount{0};
+static std::atomic<uint32_t> oversizeFailureCount{0};
+static std::atomic<uint32_t> inUseHighWater{0};
+
+static uint32_t slotBytesForFrameSize() {
+  if (FRAME_POOL_SLOT_BYTES > 0)
+    return FRAME_POOL_SLOT_BYTES;
+  // A JPEG at our quality settings stays well under 2 bits per pixel
+  uint32_t pixels = (uint32_t)resolution[CAMERA_FRAME_SIZE].width *
+                    resolution[CAMERA_FRAME_SIZE].height;
+  uint32_t bytes = pixels / 4;
+  return (bytes + 4095) & ~4095u;
+}
+
+static void releaseSlot(FrameSlot *slot) {
+  if (slot->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    uint8_t index = slot->index;
+    xQueueSend(freeSlots, &index, 0);
+  }
+}
+
+FrameRef::FrameRef(const FrameRef &other) : slot(other.slot) {
+  if (slot)
+    slot->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+FrameRef &FrameRef::operator=(const FrameRef &other) {
+  if (this != &other) {
+    if (other.slot)
+      other.slot->refs.fetch_add(1, std::memory_order_relaxed);
+    reset();
+    slot = other.slot;
+  }
+  return *this;
+}
+
+FrameRef &FrameRef::operator=(FrameRef &&other) noexcept {
+  if (this != &other) {
+    reset();
+    slot = other.slot;
+    other.slot = nullptr;
+  }
+  return *this;
+}
+
+void FrameRef::reset() {
+  if (slot) {
+    releaseSlot(slot);
+    slot = nullptr;
+  }
+}
+
+void FrameRef::setFrame(size_t len, uint32_t sequence, uint32_t timestamp) {
+  if (!slot)
+    return;
+  slot->len = len;
+  slot->timestamp = timestamp;
+  slot->sequence.store(sequence, std::memory_order_release);
+}
+
+// Racing callers compute the same value, so either store is fine
+uint32_t FrameRef::crc() const {
+  if (!slot)
+    return 0;
+  uint32_t crc = slot->crc.load(std::memory_order_relaxed);
+  if (!crc) {
+    crc = esp_rom_crc32_le(0, slot->data, slot->len);
+    slot->crc.store(crc, std::memory_order_relaxed);
+  }
+  return crc;
+}
+
+// Low byte is the slot index + 1, the rest the low 24 bits of the sequence
+uint32_t FrameRef::tag() const {
+  if (!slot)
+    return 0;
+  uint32_t seq = slot->sequence.load(std::memory_order_acquire);
+  return seq ? (seq << 8) | (uint32_t)(slot->index + 1) : 0;
+}
+
+namespace FramePool {
+
+void setup() {
+  if (slots)
+    return;
+
+  slotCount = FRAME_POOL_SLOTS > 255 ? 255 : FRAME_POOL_SLOTS;
+  slotBytes = slotBytesForFrameSize();
+
+  uint8_t *arena = (uint8_t *)ps_malloc((size_t)slotCount * slotBytes);
+  slots = new FrameSlot[slotCount];
+  freeSlots = xQueueCreate(slotCount, sizeof(uint8_t));
+  if (!arena || !freeSlots) {
+    Serial.printf("FramePool: Failed to reserve %u x %u bytes\n",
+                  (unsigned)slotCount, (unsigned)slotBytes);
+    free(arena);
+    delete[] slots;
+    slots = nullptr;
+    slotCount = 0;
+    return;
+  }
+
+  for (uint32_t i = 0; i < slotCount; i++) {
+    slots[i].data = arena + (size_t)i * slotBytes;
+    slots[i].capacity = slotBytes;
+    slots[i].index = (uint8_t)i;
+    uint8_t index = (uint8_t)i;
+    xQueueSend(freeSlots, &index, 0);
+  }
+
+  Serial.printf("FramePool: %u slots x %u bytes in PSRAM\n",
+                (unsigned)slotCount, (unsigned)slotBytes);
+}
+
+FrameRef acquire(size_t len) {
+  if (len > slotBytes) {
+    oversizeFailureCount.fetch_add(1, std::memory_order_relaxed);
+    return FrameRef();
+  }
+
+  uint8_t index;
+  if (!freeSlots || xQueueReceive(freeSlots, &index, 0) != pdTRUE) {
+    allocFailureCount.fetch_add(1, std::memory_order_relaxed);
+    return FrameRef();
+  }
+
+  FrameSlot *slot = &slots[index];
+  // Clear the old sequence first: a reader that retains the slot from here
+  // on sees a tag mismatch and lets go before the bytes are overwritten
+  slot->sequence.store(0, std::memory_order_relaxed);
+  slot->crc.store(0, std::memory_order_relaxed);
+  slot->len = 0;
+  slot->refs.store(1, std::memory_order_release);
+  acquiredCount.fetch_add(1, std::memory_order_relaxed);
+
+  uint32_t inUse = slotCount - uxQueueMessagesWaiting(freeSlots);
+  uint32_t high = inUseHighWater.load(std::memory_order_relaxed);
+  while (inUse > high &&
+         !inUseHighWater.compare_exchange_weak(high, inUse,
+                                               std::memory_order_relaxed)) {
+  }
+  return FrameRef::adopt(slot);
+}
+
+FrameRef retain(uint32_t tag) {
+  uint32_t index = (tag & 0xff) - 1;
+  if (!tag || index >= slotCount)
+    return FrameRef();
+
+  // Never revive a slot whose last reference is gone: it may already be
+  // back in the free queue
+  FrameSlot *slot = &slots[index];
+  uint32_t refs = slot->refs.load(std::memory_order_relaxed);
+  do {
+    if (refs == 0)
+      return FrameRef();
+  } while (!slot->refs.compare_exchange_weak(refs, refs + 1,
+                                             std::memory_order_acquire,
+                                             std::memory_order_relaxed));
+
+  FrameRef frame = FrameRef::adopt(slot);
+  if (frame.tag() != tag)
+    return FrameRef(); // refilled since the tag was read; drops our count
+  return frame;
+}
+
+Stats getStats() {
+  Stats s;
+  s.slots = slotCount;
+  s.slotBytes = slotBytes;
+  s.inUse = freeSlots ? slotCount - uxQueueMessagesWaiting(freeSlots) : 0;
+  s.highWater = inUseHighWater.load(std::memory_order_relaxed);
+  s.acquired = acquiredCount.load(std::memory_order_relaxed);
+  s.allocFailures = allocFailureCount.load(std::memory_order_relaxed);
+  s.oversizeFailures = oversizeFailureCount.load(std::memory_order_relaxed);
+  return s;
+}
+
+} // namespace FramePool
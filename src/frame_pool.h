@@ -0,0 +1,85 @@
+#pragma once
+#include <Arduino.h>
+#include <atomic>
+
+// Fixed-slot PSRAM pool for captured JPEGs. Slots are carved out once at
+// boot (sized from CameraConfig::frameSize) and handed out as refcounted
+// FrameRef handles, so the writer, web server and analytics can all hold
+// the same bytes without another allocation or copy.
+struct FrameSlot {
+  std::atomic<uint32_t> refs{0};
+  uint8_t *data = nullptr;
+  size_t capacity = 0;
+  size_t len = 0;
+  std::atomic<uint32_t> sequence{0}; // 0 while the producer refills it
+  std::atomic<uint32_t> crc{0};      // of the JPEG; 0 until first asked for
+  uint32_t timestamp = 0;
+  uint8_t index = 0;
+};
+
+class FrameRef {
+public:
+  FrameRef() = default;
+  FrameRef(const FrameRef &other);
+  FrameRef(FrameRef &&other) noexcept : slot(other.slot) { other.slot = nullptr; }
+  FrameRef &operator=(const FrameRef &other);
+  FrameRef &operator=(FrameRef &&other) noexcept;
+  ~FrameRef() { reset(); }
+
+  explicit operator bool() const { return slot != nullptr; }
+  const uint8_t *data() const { return slot ? slot->data : nullptr; }
+  size_t size() const { return slot ? slot->len : 0; }
+  uint32_t sequence() const {
+    return slot ? slot->sequence.load(std::memory_order_relaxed) : 0;
+  }
+  uint32_t timestamp() const { return slot ? slot->timestamp : 0; }
+  // CRC32 of the JPEG, computed on first use and kept with the slot
+  uint32_t crc() const;
+  void reset();
+
+  // Names this slot and the frame it holds in one word (0 for an empty
+  // ref), so a reader can retain it later without a lock
+  uint32_t tag() const;
+
+  // Producer side: only valid while this is the sole reference
+  uint8_t *writableData() const { return slot ? slot->data : nullptr; }
+  size_t capacity() const { return slot ? slot->capacity : 0; }
+  void setFrame(size_t len, uint32_t sequence, uint32_t timestamp);
+
+  // Pass a reference through a FreeRTOS queue (which copies raw bytes):
+  // detach() gives up ownership without dropping the count, adopt() takes
+  // it back on the other side.
+  FrameSlot *detach() {
+    FrameSlot *s = slot;
+    slot = nullptr;
+    return s;
+  }
+  static FrameRef adopt(FrameSlot *s) { return FrameRef(s); }
+
+private:
+  explicit FrameRef(FrameSlot *s) : slot(s) {}
+  FrameSlot *slot = nullptr;
+};
+
+namespace FramePool {
+  struct Stats {
+    uint32_t slots;
+    uint32_t slotBytes;
+    uint32_t inUse;
+    uint32_t highWater;
+    uint32_t acquired;
+    uint32_t allocFailures;    // every slot was still referenced
+    uint32_t oversizeFailures; // frame larger than a slot
+  };
+
+  void setup();
+
+  // Returns an empty ref if no slot is free or len exceeds the slot size
+  FrameRef acquire(size_t len);
+
+  // Takes a reference to the frame named by FrameRef::tag(), or returns an
+  // empty ref if that slot has since been freed or refilled
+  FrameRef retain(uint32_t tag);
+
+  Stats getStats();
+}
@@ -0,0 +1,432 @@
+#include "frame_store.h"
+#include "config.h"
+#include <Arduino.h>
+extern "C" {
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "freertos/FreeRTOS.h"
+}
+
+// ===== ON-FLASH LAYOUT =====
+// [checkpoint sector A][checkpoint sector B][log sectors ...]
+// Each record: 32-byte header at a sector boundary, JPEG payload after it,
+// padding to the next sector. The payload is written before the header, so
+// a header that passes its CRC always describes a complete frame.
+static constexpr uint32_t SECTOR = 4096;
+static constexpr uint32_t CHECKPOINT_SECTORS = 2;
+static constexpr uint32_t RECORD_MAGIC = 0x324D5246;     // "FRM2"
+static constexpr uint32_t CHECKPOINT_MAGIC = 0x32504B43; // "CKP2"
+
+struct RecordHeader {
+  uint32_t magic;
+  uint32_t sequence; // capture sequence
+  uint32_t timestamp;
+  uint32_t length;
+  uint32_t payloadCrc;
+  uint32_t record; // log position, one more than the record before it
+  uint32_t reserved;
+  uint32_t headerCrc; // over the 28 bytes above
+};
+static_assert(sizeof(RecordHeader) == 32, "record header must be 32 bytes");
+
+struct Checkpoint {
+  uint32_t magic;
+  uint32_t generation;
+  uint32_t headOffset; // where the next record goes
+  uint32_t nextRecord;
+  uint32_t tailOffset; // oldest live record
+  uint32_t tailRecord;
+  uint32_t reserved;
+  uint32_t crc;
+};
+static_assert(sizeof(Checkpoint) == 32, "checkpoint must be 32 bytes");
+static constexpr uint32_t SLOTS_PER_SECTOR = SECTOR / sizeof(Checkpoint);
+
+struct IndexEntry {
+  uint32_t sequence;
+  uint32_t record;
+  uint32_t offset; // record (header) offset
+  uint32_t length;
+  uint32_t timestamp;
+  uint32_t crc;
+};
+
+static const esp_partition_t *partition = nullptr;
+static uint32_t logStart = 0;
+static uint32_t logEnd = 0;
+
+// Guarded by storeMux: read from HTTP handlers, written by the writer task
+static portMUX_TYPE storeMux = portMUX_INITIALIZER_UNLOCKED;
+static IndexEntry *recordIndex = nullptr; // slot = record % indexCapacity
+static uint32_t indexCapacity = 0;  // >= max live records (one per sector)
+static uint32_t headOffset = 0;
+static uint32_t nextRecord = 1;
+static uint32_t oldestRecord = 1;
+
+// Writer task only
+static uint32_t checkpointGeneration = 0;
+static uint32_t checkpointSector = 0;
+static uint32_t checkpointSlot = 0;
+static uint32_t recordsSinceCheckpoint = 0;
+
+static uint32_t sectorErases = 0;
+static uint32_t wraps = 0;
+static uint32_t checkpointsWritten = 0;
+static uint32_t recoveryMs = 0;
+static uint32_t recoveredRecords = 0;
+
+static uint32_t crc32(const void *data, size_t len) {
+  return esp_rom_crc32_le(0, (const uint8_t *)data, len);
+}
+
+static uint32_t spanFor(uint32_t length) {
+  return (sizeof(RecordHeader) + length + SECTOR - 1) / SECTOR * SECTOR;
+}
+
+static bool readHeader(uint32_t offset, RecordHeader &h) {
+  if (esp_partition_read(partition, offset, &h, sizeof(h)) != ESP_OK)
+    return false;
+  return h.magic == RECORD_MAGIC &&
+         h.headerCrc == crc32(&h, offsetof(RecordHeader, headerCrc)) &&
+         offset + spanFor(h.length) <= logEnd;
+}
+
+static void indexRecord(uint32_t offset, const RecordHeader &h) {
+  IndexEntry e = {h.sequence, h.record, offset, h.length, h.timestamp,
+                  h.payloadCrc};
+  portENTER_CRITICAL(&storeMux);
+  recordIndex[h.record % indexCapacity] = e;
+  portEXIT_CRITICAL(&storeMux);
+}
+
+// storeMux held for these
+static const IndexEntry *oldestEntry() {
+  if (oldestRecord >= nextRecord)
+    return nullptr;
+  return &recordIndex[oldestRecord % indexCapacity];
+}
+
+static const IndexEntry *newestEntry() {
+  if (oldestRecord >= nextRecord)
+    return nullptr;
+  return &recordIndex[(nextRecord - 1) % indexCapacity];
+}
+
+// Drop the oldest records while `pred` says they sit in space we are
+// about to reuse
+template <typename Pred> static void evictWhile(Pred pred) {
+  portENTER_CRITICAL(&storeMux);
+  const IndexEntry *e;
+  while ((e = oldestEntry()) && pred(*e))
+    oldestRecord++;
+  portEXIT_CRITICAL(&storeMux);
+}
+
+static void writeCheckpoint() {
+  Checkpoint c = {};
+  c.magic = CHECKPOINT_MAGIC;
+  c.generation = ++checkpointGeneration;
+  portENTER_CRITICAL(&storeMux);
+  c.headOffset = headOffset;
+  c.nextRecord = nextRecord;
+  const IndexEntry *tail = oldestEntry();
+  c.tailOffset = tail ? tail->offset : headOffset;
+  c.tailRecord = oldestRecord;
+  portEXIT_CRITICAL(&storeMux);
+  c.crc = crc32(&c, offsetof(Checkpoint, crc));
+
+  // Fill one sector, then erase the other and continue there. The full
+  // sector keeps the previous checkpoint valid until the switch is done.
+  if (checkpointSlot >= SLOTS_PER_SECTOR) {
+    checkpointSector ^= 1;
+    checkpointSlot = 0;
+    esp_partition_erase_range(partition, checkpointSector * SECTOR, SECTOR);
+    sectorErases++;
+  }
+  esp_partition_write(partition,
+                      checkpointSector * SECTOR +
+                          checkpointSlot * sizeof(Checkpoint),
+                      &c, sizeof(c));
+  checkpointSlot++;
+  checkpointsWritten++;
+  recordsSinceCheckpoint = 0;
+}
+
+static bool loadCheckpoint(Checkpoint &best) {
+  bool found = false;
+  for (uint32_t sector = 0; sector < CHECKPOINT_SECTORS; sector++) {
+    for (uint32_t slot = 0; slot < SLOTS_PER_SECTOR; slot++) {
+      Checkpoint c = {};
+      esp_partition_read(partition, sector * SECTOR + slot * sizeof(c), &c,
+                         sizeof(c));
+      if (c.magic == 0xFFFFFFFF)
+        break; // rest of this sector is unwritten
+      if (c.magic != CHECKPOINT_MAGIC ||
+          c.crc != crc32(&c, offsetof(Checkpoint, crc)))
+        continue;
+      if (!found || c.generation > best.generation) {
+        best = c;
+        found = true;
+        checkpointSector = sector;
+        checkpointSlot = slot + 1;
+      }
+    }
+  }
+  return found;
+}
+
+static uint32_t advance(uint32_t offset, uint32_t bytes) {
+  offset += bytes;
+  return offset + SECTOR > logEnd ? logStart : offset;
+}
+
+// Rebuild the RAM index from the last checkpoint. Live records before the
+// checkpoint head are hopped header-to-header (stepping a sector at a time
+// only across space erased since); records after it are followed until
+// the record numbers break.
+static void recover() {
+  uint32_t start = millis();
+  Checkpoint c = {};
+  if (!loadCheckpoint(c) || c.headOffset < logStart || c.headOffset >= logEnd ||
+      c.tailOffset < logStart || c.tailOffset >= logEnd) {
+    Serial.println("FrameStore: No checkpoint, starting empty log");
+    esp_partition_erase_range(partition, 0, CHECKPOINT_SECTORS * SECTOR);
+    checkpointSector = 0;
+    checkpointSlot = 0;
+    headOffset = logStart;
+    writeCheckpoint();
+    return;
+  }
+  checkpointGeneration = c.generation;
+
+  uint32_t expected = c.tailRecord;
+  bool haveOldest = false;
+  uint32_t p = c.tailOffset;
+  for (uint32_t steps = 0; p != c.headOffset && steps <= indexCapacity;
+       steps++) {
+    RecordHeader h;
+    if (readHeader(p, h) && h.record >= expected &&
+        h.record < c.nextRecord) {
+      indexRecord(p, h);
+      if (!haveOldest) {
+        oldestRecord = h.record;
+        haveOldest = true;
+      }
+      expected = h.record + 1;
+      p = advance(p, spanFor(h.length));
+    } else {
+      p = advance(p, SECTOR);
+    }
+  }
+
+  p = c.headOffset;
+  expected = c.nextRecord;
+  for (;;) {
+    RecordHeader h;
+    bool ok = readHeader(p, h) && h.record == expected;
+    if (!ok && p != logStart) {
+      // The writer may have wrapped because the record didn't fit
+      ok = readHeader(logStart, h) && h.record == expected;
+      if (ok)
+        p = logStart;
+    }
+    if (!ok)
+      break;
+    indexRecord(p, h);
+    if (!haveOldest) {
+      oldestRecord = h.record;
+      haveOldest = true;
+    }
+    expected++;
+    recoveredRecords++;
+    p = advance(p, spanFor(h.length));
+  }
+
+  headOffset = p;
+  nextRecord = expected;
+  if (!haveOldest)
+    oldestRecord = nextRecord;
+  writeCheckpoint();
+  recoveryMs = millis() - start;
+  Serial.printf("FrameStore: Recovered %u records (%u after checkpoint) in "
+                "%u ms\n",
+                (unsigned)(nextRecord - oldestRecord),
+                (unsigned)recoveredRecords, (unsigned)recoveryMs);
+}
+
+namespace FrameStore {
+
+bool setup() {
+  if (partition)
+    return true;
+
+  partition = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, FRAME_STORE_PARTITION);
+  if (!partition) {
+    Serial.printf("FrameStore: Partition '%s' not found\n",
+                  FRAME_STORE_PARTITION);
+    return false;
+  }
+
+  logStart = CHECKPOINT_SECTORS * SECTOR;
+  logEnd = partition->size / SECTOR * SECTOR;
+  indexCapacity = (logEnd - logStart) / SECTOR;
+  recordIndex = (IndexEntry *)ps_malloc(indexCapacity * sizeof(IndexEntry));
+  if (!recordIndex || indexCapacity < 2) {
+    Serial.println("FrameStore: Failed to allocate index");
+    partition = nullptr;
+    return false;
+  }
+  memset(recordIndex, 0, indexCapacity * sizeof(IndexEntry));
+
+  recover();
+  return true;
+}
+
+bool append(const FrameRef &frame) {
+  if (!partition || !frame || !frame.sequence())
+    return false;
+
+  const uint32_t span = spanFor(frame.size());
+  if (span > logEnd - logStart)
+    return false;
+
+  // Lookups need sequences in log order. A sequence that went backwards
+  // means the counters were lost; the old records go rather than shadow
+  // the new ones.
+  const uint32_t sequence = frame.sequence();
+  portENTER_CRITICAL(&storeMux);
+  const IndexEntry *newest = newestEntry();
+  uint32_t newestSequence = newest ? newest->sequence : 0;
+  if (sequence < newestSequence)
+    oldestRecord = nextRecord;
+  portEXIT_CRITICAL(&storeMux);
+  if (sequence == newestSequence)
+    return false;
+
+  // A record never straddles the end of the log; the leftover tail space
+  // belongs to the oldest records, which are dropped along with it
+  if (headOffset + span > logEnd) {
+    const uint32_t wrapAt = headOffset;
+    evictWhile([&](const IndexEntry &e) { return e.offset >= wrapAt; });
+    portENTER_CRITICAL(&storeMux);
+    headOffset = logStart;
+    portEXIT_CRITICAL(&storeMux);
+    wraps++;
+  }
+
+  const uint32_t at = headOffset;
+  evictWhile([&](const IndexEntry &e) {
+    return e.offset < at + span && e.offset + spanFor(e.length) > at;
+  });
+  if (esp_partition_erase_range(partition, at, span) != ESP_OK)
+    return false;
+  sectorErases += span / SECTOR;
+
+  RecordHeader h = {};
+  h.magic = RECORD_MAGIC;
+  h.sequence = sequence;
+  h.timestamp = frame.timestamp();
+  h.length = frame.size();
+  h.payloadCrc = frame.crc();
+  h.record = nextRecord;
+  h.headerCrc = crc32(&h, offsetof(RecordHeader, headerCrc));
+
+  if (esp_partition_write(partition, at + sizeof(h), frame.data(),
+                          frame.size()) != ESP_OK ||
+      esp_partition_write(partition, at, &h, sizeof(h)) != ESP_OK)
+    return false;
+
+  indexRecord(at, h);
+  portENTER_CRITICAL(&storeMux);
+  nextRecord++;
+  headOffset = advance(at, span);
+  portEXIT_CRITICAL(&storeMux);
+
+  if (++recordsSinceCheckpoint >= (uint32_t)FRAME_STORE_CHECKPOINT_EVERY)
+    writeCheckpoint();
+  return true;
+}
+
+// storeMux held
+static void toRecord(const IndexEntry &e, Record &out) {
+  out = {e.sequence, e.timestamp, e.length, e.crc,
+         e.offset + (uint32_t)sizeof(RecordHeader), e.record};
+}
+
+static bool liveRecord(uint32_t record) {
+  portENTER_CRITICAL(&storeMux);
+  bool live = record >= oldestRecord && record < nextRecord;
+  portEXIT_CRITICAL(&storeMux);
+  return live;
+}
+
+// Binary search of the live records, which are in sequence order; at most
+// one per log sector, so a dozen steps
+static bool lookup(uint32_t sequence, Record &out) {
+  bool ok = false;
+  portENTER_CRITICAL(&storeMux);
+  uint32_t lo = oldestRecord, hi = nextRecord;
+  while (recordIndex && lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    const IndexEntry &e = recordIndex[mid % indexCapacity];
+    if (e.sequence == sequence) {
+      toRecord(e, out);
+      ok = true;
+      break;
+    }
+    if (e.sequence < sequence)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  portEXIT_CRITICAL(&storeMux);
+  return ok;
+}
+
+bool latest(Record &out) {
+  portENTER_CRITICAL(&storeMux);
+  const IndexEntry *newest = recordIndex ? newestEntry() : nullptr;
+  if (newest)
+    toRecord(*newest, out);
+  portEXIT_CRITICAL(&storeMux);
+  return newest != nullptr;
+}
+
+bool find(uint32_t sequence, Record &out) { return lookup(sequence, out); }
+
+bool isLive(uint32_t sequence) {
+  Record r;
+  return lookup(sequence, r);
+}
+
+bool read(const Record &record, size_t offset, uint8_t *buf, size_t len) {
+  if (!partition || offset + len > record.length)
+    return false;
+  if (esp_partition_read(partition, record.offset + offset, buf, len) != ESP_OK)
+    return false;
+  // The writer may have recycled the sectors while we were reading
+  return liveRecord(record.record);
+}
+
+Stats getStats() {
+  Stats s = {};
+  s.mounted = partition != nullptr;
+  s.partitionBytes = partition ? partition->size : 0;
+  portENTER_CRITICAL(&storeMux);
+  s.records = nextRecord - oldestRecord;
+  const IndexEntry *oldest = recordIndex ? oldestEntry() : nullptr;
+  const IndexEntry *newest = recordIndex ? newestEntry() : nullptr;
+  s.oldestSequence = oldest ? oldest->sequence : 0;
+  s.newestSequence = newest ? newest->sequence : 0;
+  s.headOffset = headOffset;
+  portEXIT_CRITICAL(&storeMux);
+  s.sectorErases = sectorErases;
+  s.wraps = wraps;
+  s.checkpoints = checkpointsWritten;
+  s.recoveryMs = recoveryMs;
+  s.recoveredRecords = recoveredRecords;
+  return s;
+}
+
+} // namespace FrameStore
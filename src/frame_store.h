@@ -0,0 +1,50 @@
+#pragma once
+#include "frame_pool.h"
+#include <Arduino.h>
+
+// Log-structured frame store on a dedicated raw data partition (see
+// partitions.csv). Every record starts on a flash sector boundary with a
+// CRC-protected header; the log wraps circularly, so sectors are erased in
+// strict rotation (even wear). Records carry the frame's capture sequence,
+// the same number /events, /i/next and /history use; the RAM index holds
+// them in log order, so a lookup is a binary search. A ping-pong checkpoint
+// lets boot recovery start from the last known head instead of scanning
+// the whole partition.
+namespace FrameStore {
+  struct Record {
+    uint32_t sequence; // capture sequence
+    uint32_t timestamp;
+    uint32_t length;
+    uint32_t crc; // CRC32 of the JPEG payload
+    uint32_t offset; // payload offset within the partition
+    uint32_t record; // position in the log
+  };
+
+  struct Stats {
+    bool mounted;
+    uint32_t partitionBytes;
+    uint32_t records;
+    uint32_t oldestSequence;
+    uint32_t newestSequence;
+    uint32_t headOffset;
+    uint32_t sectorErases;
+    uint32_t wraps;
+    uint32_t checkpoints;
+    uint32_t recoveryMs;
+    uint32_t recoveredRecords;
+  };
+
+  bool setup();
+
+  // Writer task only. A frame whose sequence is already the newest is
+  // refused; one below it (NVS lost its counters) restarts the log.
+  bool append(const FrameRef &frame);
+
+  // Safe from any task
+  bool latest(Record &out);
+  bool find(uint32_t sequence, Record &out);
+  bool isLive(uint32_t sequence);
+  bool read(const Record &record, size_t offset, uint8_t *buf, size_t len);
+
+  Stats getStats();
+}
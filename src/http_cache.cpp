@@ -0,0 +1,239 @@
+#include "http_cache.h"
+#include <atomic>
+#include <ctype.h>
+#include <limits.h>
+
+// FAT timestamps written before SNTP set the clock come out around 1980;
+// those are not worth sending as Last-Modified
+static constexpr time_t MIN_VALID_TIME = 1577836800; // 2020-01-01
+
+static std::atomic<uint32_t> notModifiedCount{0};
+static std::atomic<uint32_t> partialCount{0};
+static std::atomic<uint32_t> headCount{0};
+static std::atomic<uint32_t> unsatisfiableCount{0};
+
+static const char MONTHS[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+// IMF-fixdate only ("Sun, 06 Nov 1994 08:49:37 GMT"), which is all that
+// browsers send back; 0 if it doesn't parse
+static time_t parseHttpDate(const char *s) {
+  int day, year, hour, minute, second;
+  char mon[4];
+  if (sscanf(s, "%*3s, %2d %3s %4d %2d:%2d:%2d GMT", &day, mon, &year, &hour,
+             &minute, &second) != 6)
+    return 0;
+  const char *m = strstr(MONTHS, mon);
+  if (!m || (m - MONTHS) % 3 || year < 1970)
+    return 0;
+  int month = (m - MONTHS) / 3 + 1;
+
+  // Days since the epoch in the proleptic Gregorian calendar
+  int y = year - (month <= 2);
+  int era = y / 400;
+  int yoe = y - era * 400;
+  int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  long days = era * 146097L + doe - 719468;
+  return (time_t)days * 86400 + hour * 3600 + minute * 60 + second;
+}
+
+static bool validTime(time_t t) { return t >= MIN_VALID_TIME; }
+
+// If-None-Match uses the weak comparison, so a W/ prefix is ignored
+static bool etagListMatches(const char *list, const char *etag) {
+  size_t len = etag ? strlen(etag) : 0;
+  const char *p = list;
+  while (*p) {
+    while (*p == ' ' || *p == ',')
+      p++;
+    if (*p == '*')
+      return true;
+    if (p[0] == 'W' && p[1] == '/')
+      p += 2;
+    if (len && strncmp(p, etag, len) == 0 &&
+        (p[len] == '\0' || p[len] == ',' || p[len] == ' '))
+      return true;
+    while (*p && *p != ',')
+      p++;
+  }
+  return false;
+}
+
+static bool notModified(AsyncWebServerRequest *request,
+                        const HttpCache::Resource &r) {
+  // If-None-Match wins over If-Modified-Since when both are sent
+  if (AsyncWebHeader *inm = request->getHeader("If-None-Match"))
+    return etagListMatches(inm->value().c_str(), r.etag);
+  AsyncWebHeader *ims = request->getHeader("If-Modified-Since");
+  if (!ims || !validTime(r.lastModified))
+    return false;
+  time_t since = parseHttpDate(ims->value().c_str());
+  return since && r.lastModified <= since;
+}
+
+// A Range only applies while the client's copy is still current
+static bool ifRangeHolds(AsyncWebServerRequest *request,
+                         const HttpCache::Resource &r) {
+  AsyncWebHeader *h = request->getHeader("If-Range");
+  if (!h)
+    return true;
+  const char *v = h->value().c_str();
+  if (v[0] == '"')
+    return r.etag && strcmp(v, r.etag) == 0; // strong comparison
+  time_t t = parseHttpDate(v);
+  return t && validTime(r.lastModified) && r.lastModified == t;
+}
+
+enum class Range { Ignore, Satisfiable, Unsatisfiable };
+
+// One "bytes=" range; a multi-range request is answered with the whole body
+static Range parseRange(const char *spec, size_t size, size_t &first,
+                        size_t &last) {
+  if (strncmp(spec, "bytes=", 6) != 0 || strchr(spec, ','))
+    return Range::Ignore;
+  const char *p = spec + 6;
+  char *end;
+
+  if (*p == '-') { // suffix: the last n bytes
+    if (!isdigit((unsigned char)p[1]))
+      return Range::Ignore;
+    unsigned long n = strtoul(p + 1, &end, 10);
+    if (*end)
+      return Range::Ignore;
+    if (n == 0 || size == 0)
+      return Range::Unsatisfiable;
+    first = n >= size ? 0 : size - n;
+    last = size - 1;
+    return Range::Satisfiable;
+  }
+
+  if (!isdigit((unsigned char)*p))
+    return Range::Ignore;
+  unsigned long from = strtoul(p, &end, 10);
+  if (*end != '-')
+    return Range::Ignore;
+  p = end + 1;
+  unsigned long to = ULONG_MAX; // open-ended
+  if (*p) {
+    if (!isdigit((unsigned char)*p))
+      return Range::Ignore;
+    to = strtoul(p, &end, 10);
+    if (*end || to < from)
+      return Range::Ignore;
+  }
+  if (from >= size)
+    return Range::Unsatisfiable;
+  first = from;
+  last = to >= size ? size - 1 : to;
+  return Range::Satisfiable;
+}
+
+static void addValidators(AsyncWebServerResponse *res,
+                          const HttpCache::Resource &r) {
+  if (r.etag)
+    res->addHeader("ETag", r.etag);
+  if (validTime(r.lastModified)) {
+    char date[32];
+    struct tm tm;
+    gmtime_r(&r.lastModified, &tm);
+    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    res->addHeader("Last-Modified", date);
+  }
+  if (r.cacheControl)
+    res->addHeader("Cache-Control", r.cacheControl);
+}
+
+// Status line and headers with the full Content-Length, but no body
+class HeadResponse : public HttpCache::Ranged<AsyncWebServerResponse> {
+public:
+  HeadResponse(const char *contentType, size_t length) {
+    _code = 200;
+    _contentType = contentType;
+    _contentLength = length;
+  }
+
+  bool _sourceValid() const override { return true; }
+
+  void _respond(AsyncWebServerRequest *request) override {
+    String head = _assembleHead(request->version());
+    _headLength = head.length();
+    _writtenLength += request->client()->write(head.c_str(), _headLength);
+    _state = RESPONSE_WAIT_ACK;
+  }
+
+  size_t _ack(AsyncWebServerRequest *request, size_t len,
+              uint32_t time) override {
+    _ackedLength += len;
+    if (_ackedLength >= _writtenLength)
+      _state = RESPONSE_END;
+    return 0;
+  }
+};
+
+namespace HttpCache {
+
+bool begin(AsyncWebServerRequest *request, const Resource &r, Body &body) {
+  body = {200, 0, r.size};
+
+  if (notModified(request, r)) {
+    AsyncWebServerResponse *res = request->beginResponse(304);
+    addValidators(res, r);
+    request->send(res);
+    notModifiedCount.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  if (request->method() == HTTP_HEAD) {
+    AsyncWebServerResponse *res = new HeadResponse(r.contentType, r.size);
+    addValidators(res, r);
+    request->send(res);
+    headCount.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  AsyncWebHeader *range = request->getHeader("Range");
+  if (!range || !ifRangeHolds(request, r))
+    return true;
+  size_t first, last;
+  switch (parseRange(range->value().c_str(), r.size, first, last)) {
+  case Range::Ignore:
+    return true;
+  case Range::Unsatisfiable: {
+    AsyncWebServerResponse *res = request->beginResponse(416);
+    res->addHeader("Content-Range", "bytes */" + String((unsigned)r.size));
+    addValidators(res, r);
+    request->send(res);
+    unsatisfiableCount.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  case Range::Satisfiable:
+    body = {206, first, last - first + 1};
+    return true;
+  }
+  return true;
+}
+
+void finish(AsyncWebServerRequest *request, AsyncWebServerResponse *res,
+            const Resource &r, const Body &body) {
+  res->setCode(body.code);
+  addValidators(res, r);
+  if (body.code == 206) {
+    char range[48];
+    snprintf(range, sizeof(range), "bytes %u-%u/%u", (unsigned)body.offset,
+             (unsigned)(body.offset + body.length - 1), (unsigned)r.size);
+    res->addHeader("Content-Range", range);
+    partialCount.fetch_add(1, std::memory_order_relaxed);
+  }
+  request->send(res);
+}
+
+Stats getStats() {
+  Stats s;
+  s.notModified = notModifiedCount.load(std::memory_order_relaxed);
+  s.partial = partialCount.load(std::memory_order_relaxed);
+  s.heads = headCount.load(std::memory_order_relaxed);
+  s.unsatisfiable = unsatisfiableCount.load(std::memory_order_relaxed);
+  return s;
+}
+
+} // namespace HttpCache
@@ -0,0 +1,54 @@
+#pragma once
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <time.h>
+
+// Conditional and partial GETs for frames and recordings. A handler
+// describes the resource, begin() answers HEAD, 304 and 416 on its own, and
+// otherwise hands back the byte range the body has to cover; finish() then
+// sets the status, validators and Content-Range on the body response.
+namespace HttpCache {
+  struct Resource {
+    size_t size;
+    const char *contentType;
+    const char *etag;         // quoted strong validator, or nullptr
+    time_t lastModified;      // 0 when the clock was never set
+    const char *cacheControl; // or nullptr
+  };
+
+  // The library adds "Accept-Ranges: none" to every head it assembles.
+  // Bodies for finish() are built as Ranged<library response>, which sends
+  // "bytes" in its place, so the header goes out once with the right value.
+  template <typename Base> class Ranged : public Base {
+  public:
+    using Base::Base;
+    void addHeader(const String &name, const String &value) override {
+      if (name.equalsIgnoreCase("Accept-Ranges"))
+        Base::addHeader(name, "bytes");
+      else
+        Base::addHeader(name, value);
+    }
+  };
+
+  struct Body {
+    int code; // 200 or 206
+    size_t offset;
+    size_t length;
+  };
+
+  struct Stats {
+    uint32_t notModified; // 304s
+    uint32_t partial;     // 206s
+    uint32_t heads;
+    uint32_t unsatisfiable; // 416s
+  };
+
+  // False when the request has been answered without a body
+  bool begin(AsyncWebServerRequest *request, const Resource &r, Body &body);
+
+  // Adds the headers for `body` to `res` (a Ranged response) and sends it
+  void finish(AsyncWebServerRequest *request, AsyncWebServerResponse *res,
+              const Resource &r, const Body &body);
+
+  Stats getStats();
+}
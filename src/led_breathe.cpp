@@ -1,19 +1,32 @@
 #include "led_breathe.h"
 #include "config.h"
+#include "trace.h"
 #include <Adafruit_NeoPixel.h>
 extern "C" {
 #include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 #include "freertos/task.h"
 }
 
 // LED hardware
 static Adafruit_NeoPixel pixel(1, LED_PIN, NEO_GRB + NEO_KHZ800);
 
-// Breathing state
-static uint32_t breathStartTime = 0;
-static bool breathingUp = true;
+enum LedCommand : uint8_t {
+  LED_BREATHE_ONCE,
+  LED_CONTINUOUS_ON,
+  LED_CONTINUOUS_OFF,
+};
+
+static QueueHandle_t commandQueue = nullptr;
+static TaskHandle_t ledTaskHandle = nullptr;
+
+// Breathing state (owned by the LED task)
+static int64_t breathStartUs = 0;
+static bool breathing = false;
+static bool continuous = true;
 static uint8_t breathR = 0, breathG = 255, breathB = 180;
+static uint32_t shownColor = 0; // colour currently on the strip
 
 static void pickNewColor() {
   breathR = random(100, 255);
@@ -21,69 +34,106 @@ static void pickNewColor() {
   breathB = random(100, 255);
 }
 
+// Only touch the strip when the colour actually changes
 static void updateLED(float intensity) {
   float brightness = (float)LED_MAX_BRIGHTNESS / 255.0f * intensity;
   uint8_t r = (uint8_t)(breathR * brightness);
   uint8_t g = (uint8_t)(breathG * brightness);
   uint8_t b = (uint8_t)(breathB * brightness);
-  pixel.setPixelColor(0, pixel.Color(r, g, b));
+  uint32_t color = pixel.Color(r, g, b);
+  if (color == shownColor)
+    return;
+  shownColor = color;
+  pixel.setPixelColor(0, color);
+  Trace::Span span("led_show");
   pixel.show();
 }
 
+static void startBreath() {
+  pickNewColor();
+  breathStartUs = esp_timer_get_time();
+  breathing = true;
+}
+
+// Advance the current breath: up over half the cycle, down over the other
+static void renderBreath() {
+  const int64_t halfUs = (int64_t)CAMERA_BREATH_CYCLE_MS * 1000 / 2;
+  int64_t elapsed = esp_timer_get_time() - breathStartUs;
+
+  if (elapsed < halfUs) {
+    updateLED((float)elapsed / (float)halfUs);
+  } else if (elapsed < 2 * halfUs) {
+    updateLED(1.0f - (float)(elapsed - halfUs) / (float)halfUs);
+  } else {
+    updateLED(0.0f);
+    breathing = false;
+    if (continuous)
+      startBreath(); // New colour for next cycle
+  }
+}
+
+static void applyCommand(LedCommand cmd) {
+  switch (cmd) {
+  case LED_BREATHE_ONCE:
+    startBreath();
+    break;
+  case LED_CONTINUOUS_ON:
+    continuous = true;
+    if (!breathing)
+      startBreath();
+    break;
+  case LED_CONTINUOUS_OFF:
+    continuous = false; // Current breath finishes, then the LED stays dark
+    break;
+  }
+}
+
+static void ledTask(void *parameter) {
+  const TickType_t frameTicks = pdMS_TO_TICKS(LED_FRAME_MS);
+  LedCommand cmd;
+  for (;;) {
+    // Sleep until a command arrives when idle; otherwise wake per frame
+    TickType_t wait = breathing ? frameTicks : portMAX_DELAY;
+    if (xQueueReceive(commandQueue, &cmd, wait) == pdTRUE) {
+      applyCommand(cmd);
+      while (xQueueReceive(commandQueue, &cmd, 0) == pdTRUE)
+        applyCommand(cmd);
+    }
+    if (breathing)
+      renderBreath();
+  }
+}
+
+static void post(LedCommand cmd) {
+  if (commandQueue)
+    xQueueSend(commandQueue, &cmd, 0); // Drop rather than block the caller
+}
+
 namespace LEDBreathe {
 
 void setup() {
+  if (commandQueue)
+    return;
+
   pixel.begin();
   pixel.clear();
   pixel.show();
   randomSeed(esp_timer_get_time());
-  pickNewColor();
-  breathStartTime = millis();
-}
 
-void loop() {
-  uint32_t elapsed = millis() - breathStartTime;
-  
-  if (breathingUp) {
-    // Breathe up over 1.5 seconds
-    if (elapsed < 1500) {
-      float intensity = (float)elapsed / 1500.0f;
-      updateLED(intensity);
-    } else {
-      updateLED(1.0f);
-      breathingUp = false;
-      breathStartTime = millis();
-    }
-  } else {
-    // Breathe down over 1.5 seconds
-    if (elapsed < 1500) {
-      float intensity = 1.0f - ((float)elapsed / 1500.0f);
-      updateLED(intensity);
-    } else {
-      updateLED(0.0f);
-      breathingUp = true;
-      breathStartTime = millis();
-      pickNewColor(); // New color for next cycle
-    }
+  commandQueue = xQueueCreate(8, sizeof(LedCommand));
+  if (!commandQueue) {
+    Serial.println("LED: Failed to create command queue");
+    return;
   }
+  xTaskCreatePinnedToCore(ledTask, "led_engine", LED_TASK_STACK_SIZE, nullptr,
+                          LED_TASK_PRIORITY, &ledTaskHandle, LED_TASK_CORE);
+  post(LED_CONTINUOUS_ON);
 }
 
-void breatheOnce() {
-  pickNewColor();
-  
-  // Breathe up over 1.5 seconds
-  for (int i = 0; i <= 150; i++) {
-    float intensity = (float)i / 150.0f;
-    updateLED(intensity);
-    vTaskDelay(pdMS_TO_TICKS(10));
-  }
-  
-  // Breathe down over 1.5 seconds
-  for (int i = 150; i >= 0; i--) {
-    float intensity = (float)i / 150.0f;
-    updateLED(intensity);
-    vTaskDelay(pdMS_TO_TICKS(10));
-  }
+void breatheOnce() { post(LED_BREATHE_ONCE); }
+
+void setContinuous(bool enabled) {
+  post(enabled ? LED_CONTINUOUS_ON : LED_CONTINUOUS_OFF);
 }
 
-} // namespace LEDBreathe
\ No newline at end of file
+} // namespace LEDBreathe
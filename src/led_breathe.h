@@ -1,7 +1,9 @@
 #pragma once
 
+// LED breathing runs on its own low-priority task; callers only post
+// commands, so nothing here ever blocks the camera task.
 namespace LEDBreathe {
   void setup();
-  void loop();
-  void breatheOnce(); // Complete one breath cycle synchronously
-}
\ No newline at end of file
+  void breatheOnce();               // Restart the breath with a new colour
+  void setContinuous(bool enabled); // Keep breathing between captures
+}
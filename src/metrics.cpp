@@ -0,0 +1,186 @@
+#include "metrics.h"
+#include "asset_bundle.h"
+#include "file_sender.h"
+#include "mjpeg_stream.h"
+#include "storage_writer.h"
+#include <WiFi.h>
+extern "C" {
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+}
+
+// Upper bounds in microseconds; the last bucket is +Inf
+static const uint32_t BUCKET_BOUNDS_US[Metrics::Histogram::BUCKETS - 1] = {
+    100,    250,    500,     1000,    2500,    5000,   10000,
+    25000,  50000,  100000,  250000,  500000,  1000000};
+
+static const char *const ROUTE_NAMES[] = {
+    "/",           "/json",      "/status.html", "/i/latest.jpg",
+    "/i/next",     "/stream",    "/history",     "/store/frame.jpg",
+    "/recordings", "/recording", "/metrics",     "/trigger"};
+static_assert(sizeof(ROUTE_NAMES) / sizeof(ROUTE_NAMES[0]) ==
+                  (size_t)Metrics::Route::Count,
+              "one name per route");
+
+static Metrics::Histogram httpLatency[(size_t)Metrics::Route::Count];
+
+namespace Metrics {
+
+Histogram captureLatency;
+Histogram ffatWriteLatency;
+Histogram ffatDeleteLatency;
+Histogram triggerLatency;
+Counter framesCaptured;
+Counter framesDropped;
+Counter framesSuppressed;
+Counter bytesSuppressed;
+Counter bytesWritten;
+Counter bytesServed;
+
+void Counter::add(uint32_t n) {
+  uint32_t old = low.fetch_add(n, std::memory_order_relaxed);
+  if (old + n < old)
+    high.fetch_add(1, std::memory_order_relaxed); // low half wrapped
+}
+
+uint64_t Counter::value() const {
+  // A wrap between the two loads can misreport by 2^32 for one scrape
+  uint32_t h = high.load(std::memory_order_relaxed);
+  uint32_t l = low.load(std::memory_order_relaxed);
+  return ((uint64_t)h << 32) | l;
+}
+
+void Histogram::observeUs(uint32_t us) {
+  size_t i = 0;
+  while (i < BUCKETS - 1 && us > BUCKET_BOUNDS_US[i])
+    i++;
+  buckets[i].fetch_add(1, std::memory_order_relaxed);
+  sumUs.add(us);
+}
+
+void Histogram::snapshot(uint32_t *cumulative, uint32_t &count,
+                         uint64_t &sum) const {
+  uint32_t running = 0;
+  for (size_t i = 0; i < BUCKETS; i++) {
+    running += buckets[i].load(std::memory_order_relaxed);
+    cumulative[i] = running;
+  }
+  count = running;
+  sum = sumUs.value();
+}
+
+ArRequestHandlerFunction timed(Route route, ArRequestHandlerFunction handler) {
+  return [route, handler](AsyncWebServerRequest *request) {
+    int64_t start = esp_timer_get_time();
+    handler(request);
+    httpLatency[(size_t)route].observeUs(
+        (uint32_t)(esp_timer_get_time() - start));
+  };
+}
+
+static void writeHeader(Print &out, const char *name, const char *type,
+                        const char *help) {
+  out.printf("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void writeHistogram(Print &out, const char *name, const char *labels,
+                           const Histogram &h) {
+  uint32_t cumulative[Histogram::BUCKETS];
+  uint32_t count;
+  uint64_t sumUs;
+  h.snapshot(cumulative, count, sumUs);
+  const char *sep = labels[0] ? "," : "";
+  for (size_t i = 0; i < Histogram::BUCKETS - 1; i++)
+    out.printf("%s_bucket{%s%sle=\"%g\"} %u\n", name, labels, sep,
+               BUCKET_BOUNDS_US[i] / 1e6, (unsigned)cumulative[i]);
+  out.printf("%s_bucket{%s%sle=\"+Inf\"} %u\n", name, labels, sep,
+             (unsigned)count);
+  out.printf("%s_sum{%s} %.6f\n", name, labels, sumUs / 1e6);
+  out.printf("%s_count{%s} %u\n", name, labels, (unsigned)count);
+}
+
+static void writeCounter(Print &out, const char *name, const char *help,
+                         const Counter &c) {
+  writeHeader(out, name, "counter", help);
+  out.printf("%s %llu\n", name, (unsigned long long)c.value());
+}
+
+static void writeGauge(Print &out, const char *name, const char *help,
+                       double value) {
+  writeHeader(out, name, "gauge", help);
+  out.printf("%s %g\n", name, value);
+}
+
+void handleRequest(AsyncWebServerRequest *request) {
+  auto *res = request->beginResponseStream("text/plain; version=0.0.4");
+  res->addHeader("Cache-Control", "no-cache");
+
+  writeHeader(*res, "camera_capture_seconds", "histogram",
+              "Time spent in esp_camera_fb_get");
+  writeHistogram(*res, "camera_capture_seconds", "", captureLatency);
+  writeHeader(*res, "ffat_write_seconds", "histogram",
+              "Open, write and close of one frame file");
+  writeHistogram(*res, "ffat_write_seconds", "", ffatWriteLatency);
+  writeHeader(*res, "ffat_delete_seconds", "histogram",
+              "Removal of an evicted frame file");
+  writeHistogram(*res, "ffat_delete_seconds", "", ffatDeleteLatency);
+  writeHeader(*res, "capture_trigger_seconds", "histogram",
+              "External trigger to frame grabbed");
+  writeHistogram(*res, "capture_trigger_seconds", "", triggerLatency);
+
+  writeHeader(*res, "http_handler_seconds", "histogram",
+              "Synchronous handler time per route (excludes body transfer)");
+  for (size_t i = 0; i < (size_t)Route::Count; i++) {
+    char labels[48];
+    snprintf(labels, sizeof(labels), "route=\"%s\"", ROUTE_NAMES[i]);
+    writeHistogram(*res, "http_handler_seconds", labels, httpLatency[i]);
+  }
+
+  writeCounter(*res, "camera_frames_captured_total", "Frames captured",
+               framesCaptured);
+  writeCounter(*res, "camera_frames_dropped_total",
+               "Frames dropped for lack of a pool slot or queue space",
+               framesDropped);
+  writeCounter(*res, "camera_frames_suppressed_total",
+               "Frames not stored as duplicates of the last stored one",
+               framesSuppressed);
+  writeCounter(*res, "storage_bytes_suppressed_total",
+               "Frame bytes not written because they were duplicates",
+               bytesSuppressed);
+  writeCounter(*res, "storage_bytes_written_total",
+               "Frame bytes persisted by the storage writer", bytesWritten);
+  writeCounter(*res, "http_bytes_served_total",
+               "Frame, stream and status body bytes served", bytesServed);
+
+  writeGauge(*res, "heap_free_bytes", "Free heap (all capabilities)",
+             ESP.getFreeHeap());
+  writeGauge(*res, "heap_internal_free_bytes", "Free internal DRAM",
+             heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+  writeGauge(*res, "psram_free_bytes", "Free PSRAM", ESP.getFreePsram());
+  writeGauge(*res, "heap_min_free_bytes", "Lowest free heap since boot",
+             ESP.getMinFreeHeap());
+  writeGauge(*res, "psram_min_free_bytes", "Lowest free PSRAM since boot",
+             ESP.getMinFreePsram());
+  writeGauge(*res, "wifi_rssi_dbm", "Received signal strength",
+             WiFi.RSSI());
+  writeGauge(*res, "stream_clients", "Connected MJPEG viewers",
+             MjpegStream::activeClients());
+  writeGauge(*res, "http_file_bytes_per_second",
+             "Throughput of the last completed file download",
+             FileSender::getStats().lastBytesPerSec);
+  AssetBundle::Stats assets = AssetBundle::getStats();
+  writeGauge(*res, "page_first_paint_seconds",
+             "First contentful paint reported by the page (moving average)",
+             assets.avgPaintMs / 1e3);
+  writeGauge(*res, "page_first_paint_bytes",
+             "Bytes transferred up to the last reported first paint",
+             assets.lastPaintBytes);
+  writeGauge(*res, "storage_queue_depth", "Frames waiting for the writer",
+             StorageWriter::getStats().queueDepth);
+  writeGauge(*res, "uptime_seconds", "Time since boot",
+             esp_timer_get_time() / 1e6);
+
+  request->send(res);
+}
+
+} // namespace Metrics
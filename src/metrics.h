@@ -0,0 +1,67 @@
+#pragma once
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <atomic>
+
+// Prometheus text-format metrics. Every instrument is a fixed set of
+// 32-bit atomics, so recording is a few relaxed fetch_adds from any task
+// and /metrics reads them without stopping the writers.
+namespace Metrics {
+  // Monotonic 64-bit count kept as two 32-bit halves (lock-free on Xtensa)
+  class Counter {
+  public:
+    void add(uint32_t n = 1);
+    uint64_t value() const;
+
+  private:
+    std::atomic<uint32_t> low{0};
+    std::atomic<uint32_t> high{0};
+  };
+
+  // Latency histogram; all instances share the bucket bounds in metrics.cpp
+  class Histogram {
+  public:
+    static constexpr size_t BUCKETS = 14; // including +Inf
+
+    void observeUs(uint32_t us);
+
+    // Cumulative bucket counts, total count and sum, as Prometheus wants
+    void snapshot(uint32_t *cumulative, uint32_t &count, uint64_t &sumUs) const;
+
+  private:
+    std::atomic<uint32_t> buckets[BUCKETS] = {};
+    Counter sumUs;
+  };
+
+  extern Histogram captureLatency;     // esp_camera_fb_get()
+  extern Histogram ffatWriteLatency;   // open + write + close of one frame
+  extern Histogram ffatDeleteLatency;  // removal of an evicted frame file
+  extern Histogram triggerLatency;     // external trigger to frame grabbed
+  extern Counter framesCaptured;
+  extern Counter framesDropped;        // no pool slot or storage queue full
+  extern Counter framesSuppressed;     // duplicates of the last stored frame
+  extern Counter bytesSuppressed;      // their JPEG bytes, never written
+  extern Counter bytesWritten;         // frame bytes persisted, any mode
+  extern Counter bytesServed;          // response bodies produced in-process
+
+  enum class Route : uint8_t {
+    Root,
+    Json,
+    Status,
+    Latest,
+    Next,
+    Stream,
+    History,
+    StoredFrame,
+    Recordings,
+    Recording,
+    Metrics,
+    Trigger,
+    Count
+  };
+
+  // Wraps a route handler so its run time lands in the per-route histogram
+  ArRequestHandlerFunction timed(Route route, ArRequestHandlerFunction handler);
+
+  void handleRequest(AsyncWebServerRequest *request);
+}
@@ -0,0 +1,379 @@
+#include "mjpeg_stream.h"
+#include "config.h"
+#include "delivery_scheduler.h"
+#include "frame_cache.h"
+#include "metrics.h"
+#include <Arduino.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+extern "C" {
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+}
+
+#define STREAM_BOUNDARY "frame"
+
+// Backstop re-check for a client held back by the delivery scheduler. Acks
+// normally resume it first, but nothing announces that low heap recovered.
+static constexpr uint32_t DEFER_RECHECK_MS = 50;
+
+class MjpegResponse;
+
+struct StreamClient {
+  uint32_t id = 0;
+  uint32_t connectedMs = 0;
+  uint32_t lastFrameStartMs = 0;
+  uint32_t lastFrameDoneMs = 0;
+  uint32_t frameGapMs = 0; // moving average between completed frames
+  uint32_t lastSequence = 0;
+  uint32_t framesSent = 0;
+  uint64_t bytesSent = 0;
+  DeliveryScheduler::Flow flow;
+
+  // Part currently being written: boundary header, JPEG, trailing CRLF
+  FrameRef frame;
+  char header[96];
+  size_t headerLen = 0;
+  size_t offset = 0;
+
+  // Set while the filler has nothing to send; the pump task resumes the
+  // response through these, which are cleared before either goes away
+  bool waiting = false;
+  AsyncWebServerRequest *request = nullptr;
+  MjpegResponse *response = nullptr;
+};
+
+// Held for every response callback, by the pump task while it resumes
+// waiting clients, and around changes to `clients`, so the fillers and the
+// delivery scheduler only ever run on one task at a time. Recursive, as a
+// failed write can close the connection and run the disconnect handler
+// inside a callback. clientsMux also lets the status sampler read the list
+// without it.
+static SemaphoreHandle_t streamLock = nullptr;
+static std::vector<std::shared_ptr<StreamClient>> clients;
+static portMUX_TYPE clientsMux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t nextClientId = 1;
+static uint32_t framesSentTotal = 0;
+static uint64_t bytesSentTotal = 0;
+
+static std::atomic<uint32_t> activeCount{0};
+static std::atomic<uint32_t> waitingCount{0};
+static std::atomic<uint32_t> pumpWakes{0};
+static std::atomic<uint32_t> pumpResumes{0};
+static TaskHandle_t pumpTask = nullptr;
+
+struct StreamLock {
+  StreamLock() { xSemaphoreTakeRecursive(streamLock, portMAX_DELAY); }
+  ~StreamLock() { xSemaphoreGiveRecursive(streamLock); }
+};
+
+static void setWaiting(StreamClient &c, bool waiting) {
+  if (c.waiting == waiting)
+    return;
+  c.waiting = waiting;
+  if (waiting)
+    waitingCount.fetch_add(1, std::memory_order_relaxed);
+  else
+    waitingCount.fetch_sub(1, std::memory_order_relaxed);
+}
+
+static uint32_t frameIntervalMs() {
+  return STREAM_TARGET_FPS > 0 ? 1000 / STREAM_TARGET_FPS : 0;
+}
+
+static size_t copyPart(const uint8_t *src, size_t srcLen, size_t srcOffset,
+                       uint8_t *dst, size_t dstLen) {
+  size_t n = srcLen - srcOffset;
+  if (n > dstLen)
+    n = dstLen;
+  memcpy(dst, src + srcOffset, n);
+  return n;
+}
+
+// Chunked filler: never returns 0 (that would end the response). Waits with
+// RESPONSE_TRY_AGAIN until a newer frame than the last one sent is cached
+// and the delivery scheduler lets this client start it. A client that was
+// held back simply picks up whatever is newest at that point. AsyncTCP
+// only polls a waiting response every 500 ms, so the pump task resumes it
+// as soon as a frame is announced, an ack frees the window, or its frame
+// interval is up.
+static size_t fillStream(StreamClient &c, uint8_t *buf, size_t maxLen) {
+  if (!c.frame) {
+    uint32_t now = millis();
+    setWaiting(c, true);
+    if (c.framesSent > 0 && now - c.lastFrameStartMs < frameIntervalMs())
+      return RESPONSE_TRY_AGAIN;
+
+    FrameRef next = FrameCache::latest();
+    if (!next || next.sequence() == c.lastSequence)
+      return RESPONSE_TRY_AGAIN;
+    if (!DeliveryScheduler::mayStartFrame(c.flow, next.size()))
+      return RESPONSE_TRY_AGAIN;
+    setWaiting(c, false);
+
+    if (c.lastSequence && next.sequence() > c.lastSequence + 1)
+      DeliveryScheduler::noteSkipped(c.flow,
+                                     next.sequence() - c.lastSequence - 1);
+    c.frame = std::move(next);
+    c.headerLen = snprintf(c.header, sizeof(c.header),
+                           "--" STREAM_BOUNDARY "\r\n"
+                           "Content-Type: image/jpeg\r\n"
+                           "Content-Length: %u\r\n\r\n",
+                           (unsigned)c.frame.size());
+    c.offset = 0;
+    c.lastFrameStartMs = now;
+  }
+
+  static const uint8_t crlf[2] = {'\r', '\n'};
+  const size_t bodyEnd = c.headerLen + c.frame.size();
+  const size_t partLen = bodyEnd + sizeof(crlf);
+
+  size_t written = 0;
+  while (written < maxLen && c.offset < partLen) {
+    size_t n;
+    if (c.offset < c.headerLen)
+      n = copyPart((const uint8_t *)c.header, c.headerLen, c.offset,
+                   buf + written, maxLen - written);
+    else if (c.offset < bodyEnd)
+      n = copyPart(c.frame.data(), c.frame.size(), c.offset - c.headerLen,
+                   buf + written, maxLen - written);
+    else
+      n = copyPart(crlf, sizeof(crlf), c.offset - bodyEnd, buf + written,
+                   maxLen - written);
+    c.offset += n;
+    written += n;
+  }
+
+  if (c.offset == partLen) {
+    uint32_t now = millis();
+    if (c.framesSent > 0) {
+      uint32_t gap = now - c.lastFrameDoneMs;
+      c.frameGapMs = c.frameGapMs ? c.frameGapMs - c.frameGapMs / 8 + gap / 8
+                                  : gap;
+    }
+    c.lastFrameDoneMs = now;
+    c.lastSequence = c.frame.sequence();
+    c.frame.reset();
+    c.framesSent++;
+    framesSentTotal++;
+  }
+  c.bytesSent += written;
+  bytesSentTotal += written;
+  Metrics::bytesServed.add(written);
+  return written;
+}
+
+// Chunked response that reports its unacked byte count to the delivery
+// scheduler on every ack, before filling, so the frame boundary it may
+// reach in the same ack is judged on the window the ack just freed.
+class MjpegResponse : public AsyncAbstractResponse {
+public:
+  explicit MjpegResponse(std::shared_ptr<StreamClient> c)
+      : client(std::move(c)) {
+    _code = 200;
+    _contentType = "multipart/x-mixed-replace; boundary=" STREAM_BOUNDARY;
+    _contentLength = 0;
+    _sendContentLength = false;
+    _chunked = true;
+  }
+
+  ~MjpegResponse() override {
+    StreamLock lock;
+    client->request = nullptr;
+    client->response = nullptr;
+    setWaiting(*client, false);
+  }
+
+  bool _sourceValid() const override { return true; }
+
+  size_t _fillBuffer(uint8_t *buf, size_t maxLen) override {
+    return fillStream(*client, buf, maxLen);
+  }
+
+  size_t _ack(AsyncWebServerRequest *request, size_t len,
+              uint32_t time) override {
+    size_t sent;
+    bool othersHeld;
+    {
+      StreamLock lock;
+      sent = resume(request, len, time);
+      othersHeld = len && DeliveryScheduler::deferring() > 0;
+    }
+    // The budget this freed may be what other clients are held back for
+    if (othersHeld)
+      MjpegStream::wake();
+    return sent;
+  }
+
+  // With streamLock held
+  size_t resume(AsyncWebServerRequest *request, size_t len, uint32_t time) {
+    DeliveryScheduler::setUnacked(client->flow,
+                                  _writtenLength - _ackedLength - len);
+    size_t sent = AsyncAbstractResponse::_ack(request, len, time);
+    DeliveryScheduler::setUnacked(client->flow,
+                                  _writtenLength - _ackedLength);
+    return sent;
+  }
+
+private:
+  std::shared_ptr<StreamClient> client;
+};
+
+// Resumes waiting responses, then sleeps until the next announcement or
+// ack, or until the earliest frame interval of a waiting client is up.
+//
+// The pump drives responses off the async_tcp task. streamLock keeps it
+// out of their callbacks. The disconnect handler clears `request` and
+// `response` under that lock before the server deletes the request, and
+// AsyncTCP frees the AsyncClient only after that handler has returned, so
+// a client that still has both has a live request and AsyncClient. The
+// AsyncClient calls a resume makes (canSend(), space(), add(), send()) are
+// the ones AsyncEventSource and AsyncWebSocket make from application
+// tasks: writes are passed to the lwIP thread, which refuses them once the
+// connection is gone. test_stream_pump hangs up viewers mid-resume.
+static void streamPumpTask(void *parameter) {
+  TickType_t wait = portMAX_DELAY;
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, wait);
+    wait = portMAX_DELAY;
+    StreamLock lock;
+    // A resume can disconnect its client, which erases it from `clients`
+    std::shared_ptr<StreamClient> resumable[STREAM_MAX_CLIENTS];
+    size_t n = 0;
+    for (const auto &c : clients)
+      if (c->waiting && n < (size_t)STREAM_MAX_CLIENTS)
+        resumable[n++] = c;
+
+    const uint32_t interval = frameIntervalMs();
+    for (size_t i = 0; i < n; i++) {
+      StreamClient *c = resumable[i].get();
+      if (c->response && c->request->client()->canSend()) {
+        c->response->resume(c->request, 0, 0);
+        pumpResumes.fetch_add(1, std::memory_order_relaxed);
+      }
+      if (!c->waiting || !c->response)
+        continue;
+      uint32_t ms = DEFER_RECHECK_MS;
+      uint32_t since = millis() - c->lastFrameStartMs;
+      if (c->framesSent > 0 && since < interval)
+        ms = interval - since;
+      else if (!c->flow.deferring)
+        continue; // nothing newer yet; the next announcement wakes us
+      if (pdMS_TO_TICKS(ms) < wait)
+        wait = pdMS_TO_TICKS(ms) ? pdMS_TO_TICKS(ms) : 1;
+    }
+  }
+}
+
+namespace MjpegStream {
+
+void setup() {
+  if (pumpTask)
+    return;
+  streamLock = xSemaphoreCreateRecursiveMutex();
+  clients.reserve(STREAM_MAX_CLIENTS); // no allocation inside clientsMux
+  xTaskCreatePinnedToCore(streamPumpTask, "stream_pump",
+                          STREAM_PUMP_TASK_STACK_SIZE, nullptr,
+                          STREAM_PUMP_TASK_PRIORITY, &pumpTask,
+                          STREAM_PUMP_TASK_CORE);
+}
+
+void wake() {
+  if (pumpTask && waitingCount.load(std::memory_order_relaxed)) {
+    pumpWakes.fetch_add(1, std::memory_order_relaxed);
+    xTaskNotifyGive(pumpTask);
+  }
+}
+
+void handleRequest(AsyncWebServerRequest *request) {
+  if (!pumpTask) {
+    request->send(503, "text/plain", "Stream not started");
+    return;
+  }
+  StreamLock lock;
+  if (clients.size() >= (size_t)STREAM_MAX_CLIENTS) {
+    request->send(503, "text/plain", "Too many stream viewers");
+    return;
+  }
+
+  auto client = std::make_shared<StreamClient>();
+  client->id = nextClientId++;
+  client->connectedMs = millis();
+  portENTER_CRITICAL(&clientsMux);
+  clients.push_back(client);
+  portEXIT_CRITICAL(&clientsMux);
+  activeCount.fetch_add(1, std::memory_order_relaxed);
+  DeliveryScheduler::add(client->flow);
+
+  request->onDisconnect([client]() {
+    StreamLock lock;
+    client->request = nullptr;
+    client->response = nullptr;
+    setWaiting(*client, false);
+    DeliveryScheduler::remove(client->flow);
+    // Erase only moves pointers; the last reference drops after unlocking
+    std::shared_ptr<StreamClient> removed;
+    portENTER_CRITICAL(&clientsMux);
+    for (auto it = clients.begin(); it != clients.end(); ++it) {
+      if (*it == client) {
+        removed = std::move(*it);
+        clients.erase(it);
+        break;
+      }
+    }
+    portEXIT_CRITICAL(&clientsMux);
+    if (removed)
+      activeCount.fetch_sub(1, std::memory_order_relaxed);
+  });
+
+  MjpegResponse *res = new MjpegResponse(client);
+  res->addHeader("Cache-Control", "no-cache, no-store");
+  res->addHeader("Access-Control-Allow-Origin", "*");
+  client->request = request;
+  client->response = res;
+  request->send(res);
+}
+
+uint32_t activeClients() {
+  return activeCount.load(std::memory_order_relaxed);
+}
+
+size_t getClientStats(ClientStats *out, size_t max) {
+  uint32_t now = millis();
+  size_t n = 0;
+  portENTER_CRITICAL(&clientsMux);
+  for (const auto &c : clients) {
+    if (n >= max)
+      break;
+    uint32_t elapsed = now - c->connectedMs;
+    out[n].id = c->id;
+    out[n].framesSent = c->framesSent;
+    out[n].bytesPerSec =
+        elapsed ? (uint32_t)(c->bytesSent * 1000 / elapsed) : 0;
+    out[n].connectedMs = elapsed;
+    out[n].unackedBytes = c->flow.unacked;
+    out[n].framesSkipped = c->flow.framesSkipped;
+    out[n].deferrals = c->flow.deferrals;
+    out[n].frameGapMs = c->frameGapMs;
+    n++;
+  }
+  portEXIT_CRITICAL(&clientsMux);
+  return n;
+}
+
+Stats getStats() {
+  Stats s;
+  portENTER_CRITICAL(&clientsMux);
+  s.clients = clients.size();
+  portEXIT_CRITICAL(&clientsMux);
+  s.totalClients = nextClientId - 1;
+  s.framesSent = framesSentTotal;
+  s.bytesSent = bytesSentTotal;
+  s.pumpWakes = pumpWakes.load(std::memory_order_relaxed);
+  s.pumpResumes = pumpResumes.load(std::memory_order_relaxed);
+  return s;
+}
+
+} // namespace MjpegStream
@@ -0,0 +1,41 @@
+#pragma once
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+// multipart/x-mixed-replace MJPEG over AsyncWebServer. Every client reads
+// from the shared FrameCache, so one capture fans out to all viewers.
+namespace MjpegStream {
+  struct ClientStats {
+    uint32_t id;
+    uint32_t framesSent;
+    uint32_t bytesPerSec; // average since connect
+    uint32_t connectedMs;
+    uint32_t unackedBytes;  // sent but not yet acked by the peer
+    uint32_t framesSkipped; // newer frames overtook it while it was slow
+    uint32_t deferrals;     // frame starts held back by the scheduler
+    uint32_t frameGapMs;    // moving average between frames it received
+  };
+
+  struct Stats {
+    uint32_t clients;
+    uint32_t totalClients; // connections since boot
+    uint32_t framesSent;
+    uint64_t bytesSent;
+    uint32_t pumpWakes;   // announcements and acks that woke the pump
+    uint32_t pumpResumes; // waiting responses it resumed
+  };
+
+  void setup(); // starts the pump task; before any /stream request
+  void handleRequest(AsyncWebServerRequest *request);
+
+  // Any task: a frame was published, so waiting viewers are resumed now
+  // rather than on AsyncTCP's 500 ms poll
+  void wake();
+
+  // Safe to call from any task; used by the camera loop to pick its rate
+  uint32_t activeClients();
+
+  // Safe from any task. Returns the number of entries written.
+  size_t getClientStats(ClientStats *out, size_t max);
+  Stats getStats();
+}
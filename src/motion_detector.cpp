@@ -0,0 +1,171 @@
+#include "motion_detector.h"
+#include "config.h"
+#include "esp_camera.h"
+#include "trace.h"
+#include <atomic>
+extern "C" {
+#include "esp_jpg_decode.h"
+#include "esp_timer.h"
+}
+
+// Luma planes at 1/8 scale; `previous` holds the last analyzed frame and
+// `reference` the last one marked as stored
+static uint8_t *planes[3] = {nullptr, nullptr, nullptr};
+static uint8_t *current = nullptr;
+static uint8_t *previous = nullptr;
+static uint8_t *reference = nullptr;
+static size_t planeCapacity = 0;
+static uint16_t prevWidth = 0;
+static uint16_t prevHeight = 0;
+static uint16_t refWidth = 0;
+static uint16_t refHeight = 0;
+
+static std::atomic<uint32_t> analyzed{0};
+static std::atomic<uint32_t> decodeFailures{0};
+static std::atomic<uint32_t> lastScore{0};
+static std::atomic<uint32_t> lastDecodeUs{0};
+static std::atomic<uint32_t> lastDiffUs{0};
+
+struct Decode {
+  const uint8_t *src;
+  size_t len;
+  uint8_t *plane;
+  uint16_t width;
+  uint16_t height;
+};
+
+static size_t readJpeg(void *arg, size_t index, uint8_t *buf, size_t len) {
+  Decode *d = (Decode *)arg;
+  if (index >= d->len)
+    return 0;
+  if (len > d->len - index)
+    len = d->len - index;
+  if (buf)
+    memcpy(buf, d->src + index, len);
+  return len;
+}
+
+// Called once with the output size (no data), then per decoded RGB888 block
+static bool writeLuma(void *arg, uint16_t x, uint16_t y, uint16_t w,
+                      uint16_t h, uint8_t *data) {
+  Decode *d = (Decode *)arg;
+  if (!data) {
+    if (x == 0 && y == 0) {
+      if ((size_t)w * h > planeCapacity)
+        return false; // larger than the configured frame size
+      d->width = w;
+      d->height = h;
+    }
+    return true;
+  }
+  for (uint16_t row = 0; row < h; row++) {
+    uint8_t *out = d->plane + (size_t)(y + row) * d->width + x;
+    const uint8_t *rgb = data + (size_t)row * w * 3;
+    for (uint16_t col = 0; col < w; col++, rgb += 3)
+      out[col] = (77 * rgb[0] + 150 * rgb[1] + 29 * rgb[2]) >> 8;
+  }
+  return true;
+}
+
+namespace MotionDetector {
+
+void setup() {
+  if (planes[0])
+    return;
+  size_t w = (resolution[CAMERA_FRAME_SIZE].width + 7) / 8;
+  size_t h = (resolution[CAMERA_FRAME_SIZE].height + 7) / 8;
+  planeCapacity = w * h;
+  bool ok = true;
+  for (uint8_t *&plane : planes) {
+    plane = (uint8_t *)ps_malloc(planeCapacity);
+    ok = ok && plane;
+  }
+  if (!ok) {
+    Serial.println("Motion: Failed to allocate luma planes");
+    for (uint8_t *&plane : planes) {
+      free(plane);
+      plane = nullptr;
+    }
+    return;
+  }
+  current = planes[0];
+  previous = planes[1];
+  reference = planes[2];
+  Serial.printf("Motion: %ux%u luma planes\n", (unsigned)w, (unsigned)h);
+}
+
+uint32_t countChanged(const uint8_t *a, const uint8_t *b, size_t n,
+                      uint8_t delta) {
+  uint32_t changed = 0;
+  // |d| > delta as one unsigned compare: d + delta leaves [0, 2 * delta]
+  for (size_t i = 0; i < n; i++) {
+    int d = (int)a[i] - (int)b[i];
+    changed += (uint32_t)(d + delta) > 2u * delta;
+  }
+  return changed;
+}
+
+int analyze(const FrameRef &frame) {
+  if (!current || !frame)
+    return -1;
+
+  Decode d = {frame.data(), frame.size(), current, 0, 0};
+  int64_t start = esp_timer_get_time();
+  esp_err_t err =
+      esp_jpg_decode(d.len, JPG_SCALE_8X, readJpeg, writeLuma, &d);
+  uint32_t decodeUs = (uint32_t)(esp_timer_get_time() - start);
+  Trace::record("motion_decode", start, decodeUs);
+  lastDecodeUs.store(decodeUs, std::memory_order_relaxed);
+  if (err != ESP_OK || d.width == 0) {
+    decodeFailures.fetch_add(1, std::memory_order_relaxed);
+    prevWidth = prevHeight = 0; // compare the next good frame with nothing
+    return -1;
+  }
+
+  int score = -1;
+  if (d.width == prevWidth && d.height == prevHeight) {
+    size_t n = (size_t)d.width * d.height;
+    int64_t diffStart = esp_timer_get_time();
+    uint32_t changed = countChanged(current, previous, n, MOTION_PIXEL_DELTA);
+    uint32_t diffUs = (uint32_t)(esp_timer_get_time() - diffStart);
+    Trace::record("motion_diff", diffStart, diffUs);
+    lastDiffUs.store(diffUs, std::memory_order_relaxed);
+    score = (int)((uint64_t)changed * 1000 / n);
+    lastScore.store(score, std::memory_order_relaxed);
+  }
+
+  std::swap(current, previous);
+  prevWidth = d.width;
+  prevHeight = d.height;
+  analyzed.fetch_add(1, std::memory_order_relaxed);
+  return score;
+}
+
+void markReference() {
+  refWidth = prevWidth; // 0 if the last frame failed to decode
+  refHeight = prevHeight;
+  if (refWidth)
+    memcpy(reference, previous, (size_t)refWidth * refHeight);
+}
+
+int referenceScore() {
+  if (!refWidth || refWidth != prevWidth || refHeight != prevHeight)
+    return -1;
+  size_t n = (size_t)refWidth * refHeight;
+  uint32_t changed = countChanged(previous, reference, n, MOTION_PIXEL_DELTA);
+  return (int)((uint64_t)changed * 1000 / n);
+}
+
+Stats getStats() {
+  Stats s;
+  s.analyzed = analyzed.load(std::memory_order_relaxed);
+  s.decodeFailures = decodeFailures.load(std::memory_order_relaxed);
+  s.width = prevWidth;
+  s.height = prevHeight;
+  s.lastScore = lastScore.load(std::memory_order_relaxed);
+  s.lastDecodeUs = lastDecodeUs.load(std::memory_order_relaxed);
+  s.lastDiffUs = lastDiffUs.load(std::memory_order_relaxed);
+  return s;
+}
+
+} // namespace MotionDetector
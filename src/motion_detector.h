@@ -0,0 +1,40 @@
+#pragma once
+#include "frame_pool.h"
+#include <Arduino.h>
+
+// Scene-change score for captured JPEGs. Each frame is decoded at 1/8
+// scale straight into a luma plane and compared with the previous one; the
+// score drives the adaptive capture cadence and duplicate suppression in
+// CameraCycle. Only the capture task calls analyze() and the reference
+// functions.
+namespace MotionDetector {
+  struct Stats {
+    uint32_t analyzed;
+    uint32_t decodeFailures;
+    uint32_t width;        // luma plane, after scaling
+    uint32_t height;
+    uint32_t lastScore;    // permille of changed pixels
+    uint32_t lastDecodeUs;
+    uint32_t lastDiffUs;
+  };
+
+  void setup(); // allocates the planes for CAMERA_FRAME_SIZE
+
+  // Permille of pixels whose luma moved by more than MOTION_PIXEL_DELTA
+  // since the previous frame; -1 for the first frame or a failed decode
+  int analyze(const FrameRef &frame);
+
+  // Keeps the last analyzed frame as the reference for referenceScore()
+  void markReference();
+
+  // analyze()-style score of the last analyzed frame against the
+  // reference; -1 if there is none or the sizes differ
+  int referenceScore();
+
+  // The comparison kernel: pixels of `a` and `b` differing by more than
+  // `delta`
+  uint32_t countChanged(const uint8_t *a, const uint8_t *b, size_t n,
+                        uint8_t delta);
+
+  Stats getStats();
+}
@@ -0,0 +1,231 @@
+#include "page_template.h"
+#include "asset_bundle.h"
+#include "trace.h"
+#include <FFat.h>
+#include <atomic>
+extern "C" {
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+}
+
+static const char TEMPLATE_PATH[] = "/index.html";
+static const char BUNDLE_TEMPLATE[] = "index.html";
+
+// Minimal fallback if the template is missing from FFat
+static const char FALLBACK_HTML[] PROGMEM =
+    "<!doctype html><meta charset=\"utf-8\"><meta "
+    "name=\"viewport\" content=\"width=device-width, "
+    "initial-scale=1\">"
+    "<noscript><meta http-equiv=\"refresh\" "
+    "content=\"{{REFRESH_SECONDS}}\"></noscript>"
+    "<link rel=\"stylesheet\" href=\"/app.css\">"
+    "<img id=\"img\" src=\"/i/latest.jpg\" alt=\"latest "
+    "frame\">"
+    "<h1 id=\"heading\">{{HEADING}}</h1><p id=\"help\" "
+    "class=\"muted\">{{HELP}}</p>"
+    "<table "
+    "id=\"t\"><thead><tr><th>Key</th><th>Value</th></tr></"
+    "thead><tbody>{{STATUS_ROWS}}</tbody></table>"
+    "<script type=\"module\" src=\"/js/entry.js\"></script>";
+
+static const struct {
+  const char *name;
+  PageTemplate::Slot slot;
+} TOKENS[] = {
+    {"TITLE", PageTemplate::Slot::Title},
+    {"HEADING", PageTemplate::Slot::Heading},
+    {"HELP", PageTemplate::Slot::Help},
+    {"STATUS_ROWS", PageTemplate::Slot::StatusRows},
+    {"REFRESH_SECONDS", PageTemplate::Slot::RefreshSeconds},
+};
+
+static constexpr int8_t LITERAL = -1;
+
+struct Segment {
+  uint32_t offset;
+  uint32_t length;
+  int8_t slot; // LITERAL or a PageTemplate::Slot
+};
+
+// Compiled template; only touched by a render holding renderLock
+static SemaphoreHandle_t renderLock = nullptr;
+static bool compiled = false;
+static const char *text = nullptr;
+static char *fileText = nullptr; // PSRAM copy of /index.html, if read
+static uint32_t textLength = 0;
+static Segment *segments = nullptr;
+static uint32_t segmentCount = 0;
+
+static std::atomic<bool> stale{false};
+static std::atomic<uint32_t> loadUs{0};
+static std::atomic<uint32_t> renders{0};
+static std::atomic<uint32_t> avgRenderUs{0};
+static std::atomic<uint32_t> maxRenderUs{0};
+
+static void release() {
+  free(fileText);
+  free(segments);
+  fileText = nullptr;
+  segments = nullptr;
+  text = nullptr;
+  textLength = segmentCount = 0;
+  compiled = false;
+}
+
+// The bundled copy links the hashed asset URLs and needs no copy: the
+// mapped flash is NUL-terminated and stays mapped
+static bool bundledTemplate() {
+  AssetBundle::Asset asset;
+  if (!AssetBundle::find(BUNDLE_TEMPLATE, asset) || asset.gzip)
+    return false;
+  text = (const char *)asset.data;
+  textLength = asset.length;
+  return true;
+}
+
+static bool readTemplate() {
+  File f = FFat.open(TEMPLATE_PATH, "r");
+  if (!f)
+    return false;
+  size_t size = f.size();
+  fileText = (char *)ps_malloc(size + 1);
+  bool ok = fileText && f.read((uint8_t *)fileText, size) == size;
+  f.close();
+  if (!ok) {
+    free(fileText);
+    fileText = nullptr;
+    return false;
+  }
+  fileText[size] = '\0';
+  text = fileText;
+  textLength = size;
+  return true;
+}
+
+static int8_t lookupToken(const char *name, size_t len) {
+  for (const auto &t : TOKENS)
+    if (strlen(t.name) == len && memcmp(t.name, name, len) == 0)
+      return (int8_t)t.slot;
+  return LITERAL;
+}
+
+// Two passes over the text: count segments, then fill the table. Unknown
+// tokens stay in the output verbatim.
+static uint32_t parse(Segment *out) {
+  uint32_t n = 0;
+  uint32_t literalStart = 0;
+  uint32_t pos = 0;
+  auto emit = [&](uint32_t offset, uint32_t length, int8_t slot) {
+    if (out)
+      out[n] = {offset, length, slot};
+    n++;
+  };
+  while (pos + 1 < textLength) {
+    if (text[pos] != '{' || text[pos + 1] != '{') {
+      pos++;
+      continue;
+    }
+    const char *end = strstr(text + pos + 2, "}}");
+    if (!end)
+      break;
+    uint32_t nameLen = (uint32_t)(end - (text + pos + 2));
+    int8_t slot = lookupToken(text + pos + 2, nameLen);
+    if (slot == LITERAL) {
+      pos += 2;
+      continue;
+    }
+    if (pos > literalStart)
+      emit(literalStart, pos - literalStart, LITERAL);
+    emit(0, 0, slot);
+    pos += nameLen + 4;
+    literalStart = pos;
+  }
+  if (textLength > literalStart)
+    emit(literalStart, textLength - literalStart, LITERAL);
+  return n;
+}
+
+static void compile() {
+  int64_t start = esp_timer_get_time();
+  release();
+
+  const char *source = "asset bundle";
+  bool fromFile = bundledTemplate();
+  if (!fromFile) {
+    source = TEMPLATE_PATH;
+    fromFile = readTemplate();
+  }
+  if (!fromFile) {
+    Serial.println("Template not found in FFat, using fallback");
+    source = "fallback";
+    text = FALLBACK_HTML;
+    textLength = strlen(FALLBACK_HTML);
+  }
+
+  segmentCount = parse(nullptr);
+  segments = (Segment *)ps_malloc(segmentCount * sizeof(Segment));
+  if (segmentCount && !segments) {
+    Serial.println("Template: Failed to allocate segment table");
+    segmentCount = 0;
+  } else {
+    parse(segments);
+  }
+
+  compiled = true;
+  loadUs.store((uint32_t)(esp_timer_get_time() - start));
+  Serial.printf("Template: Compiled %s (%u bytes, %u segments) in %u us\n",
+                source, (unsigned)textLength, (unsigned)segmentCount,
+                (unsigned)loadUs.load());
+}
+
+namespace PageTemplate {
+
+void setup() {
+  if (!renderLock)
+    renderLock = xSemaphoreCreateMutex();
+}
+
+void render(Print &out, SlotWriter writer) {
+  if (!renderLock)
+    return;
+  xSemaphoreTake(renderLock, portMAX_DELAY);
+  if (!compiled || stale.exchange(false))
+    compile();
+
+  Trace::Span span("template_render");
+  int64_t start = esp_timer_get_time();
+  for (uint32_t i = 0; i < segmentCount; i++) {
+    const Segment &s = segments[i];
+    if (s.slot == LITERAL)
+      out.write((const uint8_t *)text + s.offset, s.length);
+    else
+      writer(out, (Slot)s.slot);
+  }
+  uint32_t us = (uint32_t)(esp_timer_get_time() - start);
+  xSemaphoreGive(renderLock);
+
+  uint32_t n = renders.fetch_add(1, std::memory_order_relaxed);
+  uint32_t avg = avgRenderUs.load(std::memory_order_relaxed);
+  avgRenderUs.store(n == 0 ? us : avg - avg / 16 + us / 16,
+                    std::memory_order_relaxed);
+  if (us > maxRenderUs.load(std::memory_order_relaxed))
+    maxRenderUs.store(us, std::memory_order_relaxed);
+}
+
+void invalidate() { stale.store(true); }
+
+Stats getStats() {
+  Stats s;
+  // Plain reads of state a render may be changing; approximate
+  s.fromFile = text && text != FALLBACK_HTML;
+  s.templateBytes = textLength;
+  s.segments = segmentCount;
+  s.loadUs = loadUs.load(std::memory_order_relaxed);
+  s.renders = renders.load(std::memory_order_relaxed);
+  s.avgRenderUs = avgRenderUs.load(std::memory_order_relaxed);
+  s.maxRenderUs = maxRenderUs.load(std::memory_order_relaxed);
+  return s;
+}
+
+} // namespace PageTemplate
@@ -0,0 +1,39 @@
+#pragma once
+#include <Arduino.h>
+
+// The page template (from the asset bundle, else /index.html in FFat)
+// compiled once into a table of literal segments and {{TOKEN}} slots held
+// in PSRAM. Rendering writes the literals and slot values straight to the
+// response; the page is never assembled in a String.
+namespace PageTemplate {
+  enum class Slot : uint8_t {
+    Title,
+    Heading,
+    Help,
+    StatusRows,
+    RefreshSeconds,
+  };
+
+  using SlotWriter = void (*)(Print &out, Slot slot);
+
+  struct Stats {
+    bool fromFile;       // false = built-in fallback page
+    uint32_t templateBytes;
+    uint32_t segments;
+    uint32_t loadUs;     // read + parse time of the last compile
+    uint32_t renders;
+    uint32_t avgRenderUs; // exponential moving average
+    uint32_t maxRenderUs;
+  };
+
+  void setup(); // before the web server starts
+
+  // Compiles the template on first use. Any task once setup() has run;
+  // renders take turns (the web server and /bench share the table).
+  void render(Print &out, SlotWriter writer);
+
+  // Recompile on the next render (after the template has been replaced)
+  void invalidate();
+
+  Stats getStats();
+}
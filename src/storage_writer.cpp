@@ -0,0 +1,453 @@
+#include "storage_writer.h"
+#include "config.h"
+#include "frame_index.h"
+#include "frame_store.h"
+#include "metrics.h"
+#include "timelapse_recorder.h"
+#include "trace.h"
+#include <Arduino.h>
+#include <FFat.h>
+#include <atomic>
+#include <vector>
+extern "C" {
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+}
+
+static QueueHandle_t writeQueue = nullptr;
+static TaskHandle_t writerTaskHandle = nullptr;
+
+// Newest per-file frame; readers build the path from it without a lock
+static std::atomic<uint32_t> latestSequence{0};
+
+// History files being streamed. Before deleting a file the writer claims
+// its sequence as `condemned` under pinMux, and pinFile() refuses that
+// sequence, so a file is never opened and deleted at the same time. An
+// evicted file that is still pinned is marked and deleted once its last
+// reader unpins it.
+struct FilePin {
+  uint32_t sequence; // 0 = free
+  uint32_t readers;
+  bool evicted;
+};
+static portMUX_TYPE pinMux = portMUX_INITIALIZER_UNLOCKED;
+static FilePin pins[FILE_PIN_SLOTS];
+static uint32_t condemned = 0;
+
+static std::atomic<uint32_t> pinsRefusedCount{0};
+static std::atomic<uint32_t> deletesDeferredCount{0};
+static std::atomic<uint32_t> orphansRemovedCount{0};
+
+static std::atomic<uint32_t> enqueuedCount{0};
+static std::atomic<uint32_t> droppedCount{0};
+static std::atomic<uint32_t> writtenCount{0};
+static std::atomic<uint32_t> writeFailureCount{0};
+static std::atomic<uint32_t> queueHighWater{0};
+static std::atomic<uint32_t> lastWriteMs{0};
+
+static std::atomic<RecordingMode> requestedMode{RECORDING_MODE};
+
+// Newest repeat reported by the camera task, not yet on the index
+static portMUX_TYPE confirmMux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t confirmSequence = 0; // 0 = nothing pending
+static uint32_t confirmMs = 0;
+
+struct LatencyCounters {
+  std::atomic<uint32_t> writes{0};
+  std::atomic<uint32_t> avgUs{0};
+  std::atomic<uint32_t> maxUs{0};
+};
+static LatencyCounters perFileLatency;
+static LatencyCounters timelapseLatency;
+static LatencyCounters rawLogLatency;
+
+static void recordLatency(LatencyCounters &c, uint32_t us) {
+  uint32_t n = c.writes.fetch_add(1, std::memory_order_relaxed);
+  uint32_t avg = c.avgUs.load(std::memory_order_relaxed);
+  // EMA with 1/16 weight; seed with the first sample
+  avg = n == 0 ? us : avg - avg / 16 + us / 16;
+  c.avgUs.store(avg, std::memory_order_relaxed);
+  if (us > c.maxUs.load(std::memory_order_relaxed))
+    c.maxUs.store(us, std::memory_order_relaxed);
+}
+
+static StorageWriter::WriteLatency snapshotLatency(const LatencyCounters &c) {
+  return {c.writes.load(std::memory_order_relaxed),
+          c.avgUs.load(std::memory_order_relaxed),
+          c.maxUs.load(std::memory_order_relaxed)};
+}
+
+// Claims the file for deletion, or marks it for later if it is pinned
+static bool condemn(uint32_t sequence) {
+  bool free = true;
+  portENTER_CRITICAL(&pinMux);
+  for (FilePin &p : pins) {
+    if (p.sequence != sequence)
+      continue;
+    if (p.readers) {
+      p.evicted = true;
+      free = false;
+    } else {
+      p = {};
+    }
+    break;
+  }
+  if (free)
+    condemned = sequence;
+  portEXIT_CRITICAL(&pinMux);
+  return free;
+}
+
+static void deleteFile(uint32_t sequence) {
+  String path = FrameIndex::pathFor(sequence);
+  if (!condemn(sequence)) {
+    deletesDeferredCount.fetch_add(1, std::memory_order_relaxed);
+    Serial.printf("Storage: %s is being served, deleting later\n",
+                  path.c_str());
+    return;
+  }
+
+  Serial.printf("Storage: Deleting %s...\n", path.c_str());
+  int64_t start = esp_timer_get_time();
+  if (!FFat.remove(path))
+    Serial.println("Storage: Failed to delete old image");
+  uint32_t us = (uint32_t)(esp_timer_get_time() - start);
+  Metrics::ffatDeleteLatency.observeUs(us);
+  Trace::record("file_delete", start, us);
+
+  portENTER_CRITICAL(&pinMux);
+  condemned = 0;
+  portEXIT_CRITICAL(&pinMux);
+}
+
+// Deletes evicted files whose last reader has gone
+static void deleteUnpinned() {
+  for (;;) {
+    uint32_t sequence = 0;
+    portENTER_CRITICAL(&pinMux);
+    for (const FilePin &p : pins) {
+      if (p.evicted && !p.readers) {
+        sequence = p.sequence;
+        break;
+      }
+    }
+    portEXIT_CRITICAL(&pinMux);
+    if (!sequence)
+      return;
+    deleteFile(sequence);
+  }
+}
+
+// Writes the pending confirmed time. A frame still in the queue has no
+// entry yet, so the pair is kept until the queue drains; after that a
+// miss means the frame was never indexed (other mode, failed write).
+static void applyConfirm() {
+  portENTER_CRITICAL(&confirmMux);
+  uint32_t sequence = confirmSequence;
+  uint32_t ms = confirmMs;
+  portEXIT_CRITICAL(&confirmMux);
+  if (!sequence)
+    return;
+  if (!FrameIndex::confirm(sequence, ms) &&
+      uxQueueMessagesWaiting(writeQueue))
+    return;
+  portENTER_CRITICAL(&confirmMux);
+  if (confirmSequence == sequence && confirmMs == ms)
+    confirmSequence = 0;
+  portEXIT_CRITICAL(&confirmMux);
+}
+
+// A reset between an eviction and its deferred delete leaves the file
+// behind with no index entry; sweep those once, off the boot path
+static void removeOrphans() {
+  const char *slash = strrchr(IMAGE_PATH_PREFIX, '/');
+  if (!slash)
+    return;
+  String dirPath = String(IMAGE_PATH_PREFIX).substring(
+      0, slash == IMAGE_PATH_PREFIX ? 1 : slash - IMAGE_PATH_PREFIX);
+  const char *prefix = slash + 1;
+  size_t prefixLen = strlen(prefix);
+
+  File dir = FFat.open(dirPath);
+  if (!dir || !dir.isDirectory())
+    return;
+  std::vector<uint32_t> orphans;
+  for (File f = dir.openNextFile(); f; f = dir.openNextFile()) {
+    const char *name = strrchr(f.name(), '/');
+    name = name ? name + 1 : f.name();
+    uint32_t sequence = 0;
+    char *end = nullptr;
+    if (!f.isDirectory() && strncmp(name, prefix, prefixLen) == 0)
+      sequence = strtoul(name + prefixLen, &end, 10);
+    FrameIndex::Entry entry;
+    if (sequence && strcmp(end, IMAGE_PATH_SUFFIX) == 0 &&
+        !FrameIndex::find(sequence, entry))
+      orphans.push_back(sequence);
+    f.close();
+  }
+  dir.close();
+
+  for (uint32_t sequence : orphans) {
+    deleteFile(sequence); // may already be pinned by an early request
+    orphansRemovedCount.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+static bool writeFrame(const FrameRef &frame, String &imagePath) {
+  imagePath = FrameIndex::pathFor(frame.sequence());
+
+  Serial.printf("Storage: Writing %s...\n", imagePath.c_str());
+  int64_t start = esp_timer_get_time();
+  File file = FFat.open(imagePath, "w");
+  int64_t opened = esp_timer_get_time();
+  Trace::record("file_open", start, (uint32_t)(opened - start));
+  if (!file) {
+    Serial.println("Storage: Failed to open file - checking filesystem");
+    // Try to remount filesystem on failure
+    FFat.end();
+    vTaskDelay(pdMS_TO_TICKS(100));
+    if (!FFat.begin()) {
+      Serial.println("Storage: Filesystem remount failed!");
+    }
+    return false;
+  }
+
+  size_t bytesWritten = file.write(frame.data(), frame.size());
+  int64_t written = esp_timer_get_time();
+  Trace::record("file_write", opened, (uint32_t)(written - opened));
+  file.close();
+  int64_t closed = esp_timer_get_time();
+  Trace::record("file_close", written, (uint32_t)(closed - written));
+  uint32_t us = (uint32_t)(closed - start);
+  lastWriteMs.store(us / 1000, std::memory_order_relaxed);
+  Metrics::ffatWriteLatency.observeUs(us);
+
+  if (bytesWritten != frame.size()) {
+    Serial.printf("Storage: Write failed %u/%u bytes\n",
+                  (unsigned)bytesWritten, (unsigned)frame.size());
+    FFat.remove(imagePath);
+    return false;
+  }
+
+  Serial.printf("Storage: Photo saved %s (%u bytes)\n", imagePath.c_str(),
+                (unsigned)frame.size());
+  return true;
+}
+
+// One file per frame, oldest deleted once MAX_STORED_IMAGES is reached.
+// The file is written before its index entry, and the evicted file is only
+// deleted once the entry that replaces it is on flash.
+static bool storePerFile(FrameRef &frame) {
+  String imagePath;
+  bool ok = writeFrame(frame, imagePath);
+  FrameIndex::Entry entry = {};
+  entry.sequence = frame.sequence();
+  entry.timestamp = entry.confirmed = frame.timestamp();
+  entry.size = frame.size();
+  entry.crc = frame.crc();
+  frame.reset(); // Give the slot back before touching the filesystem again
+  if (!ok)
+    return false;
+
+  FrameIndex::Entry evicted;
+  if (!FrameIndex::add(entry, evicted)) {
+    Serial.println("Storage: Failed to update frame index");
+    FFat.remove(imagePath);
+    return false;
+  }
+  latestSequence.store(entry.sequence, std::memory_order_release);
+
+  if (evicted.sequence)
+    deleteFile(evicted.sequence);
+  return true;
+}
+
+static void writerTask(void *parameter) {
+  Serial.println("Storage: Writer task started");
+
+  removeOrphans();
+
+  RecordingMode activeMode = requestedMode.load();
+  FrameSlot *slot;
+  for (;;) {
+    deleteUnpinned();
+    applyConfirm();
+    FrameIndex::reserveAhead();
+    // Wake up now and then to catch deletes deferred by a pin
+    if (xQueueReceive(writeQueue, &slot, pdMS_TO_TICKS(1000)) != pdTRUE)
+      continue;
+
+    FrameRef frame = FrameRef::adopt(slot);
+
+    RecordingMode mode = requestedMode.load();
+    if (mode != activeMode) {
+      if (activeMode == RecordingMode::Timelapse)
+        TimelapseRecorder::close();
+      activeMode = mode;
+    }
+
+    const uint32_t bytes = frame.size(); // frame is released while storing
+    int64_t start = esp_timer_get_time();
+    bool ok;
+    LatencyCounters *latency;
+    switch (activeMode) {
+    case RecordingMode::Timelapse:
+      ok = TimelapseRecorder::append(frame);
+      latency = &timelapseLatency;
+      break;
+    case RecordingMode::RawLog:
+      ok = FrameStore::append(frame);
+      latency = &rawLogLatency;
+      break;
+    default:
+      ok = storePerFile(frame);
+      latency = &perFileLatency;
+      break;
+    }
+    uint32_t us = (uint32_t)(esp_timer_get_time() - start);
+
+    if (!ok) {
+      writeFailureCount.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+
+    writtenCount.fetch_add(1, std::memory_order_relaxed);
+    Metrics::bytesWritten.add(bytes);
+    recordLatency(*latency, us);
+  }
+}
+
+namespace StorageWriter {
+
+void setup() {
+  if (writeQueue)
+    return;
+
+  writeQueue = xQueueCreate(STORAGE_QUEUE_DEPTH, sizeof(FrameSlot *));
+  if (!writeQueue) {
+    Serial.println("Storage: Failed to create writer queue");
+    return;
+  }
+
+  FrameIndex::Entry newest;
+  if (FrameIndex::latest(newest))
+    latestSequence.store(newest.sequence, std::memory_order_release);
+
+  TimelapseRecorder::setup();
+  FrameStore::setup();
+
+  xTaskCreatePinnedToCore(writerTask, "storage_writer",
+                          STORAGE_TASK_STACK_SIZE, nullptr,
+                          STORAGE_TASK_PRIORITY, &writerTaskHandle,
+                          STORAGE_TASK_CORE);
+}
+
+bool enqueue(FrameRef frame) {
+  FrameSlot *slot = frame.detach();
+  if (!writeQueue || xQueueSend(writeQueue, &slot, 0) != pdTRUE) {
+    droppedCount.fetch_add(1, std::memory_order_relaxed);
+    FrameRef::adopt(slot); // Drops the reference again
+    return false;
+  }
+
+  enqueuedCount.fetch_add(1, std::memory_order_relaxed);
+  uint32_t depth = uxQueueMessagesWaiting(writeQueue);
+  uint32_t high = queueHighWater.load(std::memory_order_relaxed);
+  while (depth > high &&
+         !queueHighWater.compare_exchange_weak(high, depth,
+                                               std::memory_order_relaxed)) {
+  }
+  return true;
+}
+
+void setMode(RecordingMode mode) { requestedMode.store(mode); }
+
+RecordingMode getMode() { return requestedMode.load(); }
+
+void confirm(uint32_t sequence, uint32_t ms) {
+  portENTER_CRITICAL(&confirmMux);
+  confirmSequence = sequence;
+  confirmMs = ms;
+  portEXIT_CRITICAL(&confirmMux);
+}
+
+String getLatestPath() {
+  uint32_t sequence = latestSequence.load(std::memory_order_acquire);
+  return sequence ? FrameIndex::pathFor(sequence) : String(LATEST_IMAGE_PATH);
+}
+
+bool pinFile(uint32_t sequence) {
+  bool ok = false;
+  portENTER_CRITICAL(&pinMux);
+  if (sequence && sequence != condemned) {
+    FilePin *spare = nullptr;
+    FilePin *pin = nullptr;
+    for (FilePin &p : pins) {
+      if (p.sequence == sequence) {
+        pin = &p;
+        break;
+      }
+      if (!p.sequence && !spare)
+        spare = &p;
+    }
+    if (pin) {
+      ok = !pin->evicted; // no new readers for a file on its way out
+      if (ok)
+        pin->readers++;
+    } else if (spare) {
+      *spare = {sequence, 1, false};
+      ok = true;
+    }
+  }
+  portEXIT_CRITICAL(&pinMux);
+  if (!ok)
+    pinsRefusedCount.fetch_add(1, std::memory_order_relaxed);
+  return ok;
+}
+
+void unpinFile(uint32_t sequence) {
+  portENTER_CRITICAL(&pinMux);
+  for (FilePin &p : pins) {
+    if (p.sequence != sequence || !p.readers)
+      continue;
+    // An evicted entry stays until the writer has deleted the file
+    if (--p.readers == 0 && !p.evicted)
+      p = {};
+    break;
+  }
+  portEXIT_CRITICAL(&pinMux);
+}
+
+Stats getStats() {
+  Stats s;
+  s.queueDepth = writeQueue ? uxQueueMessagesWaiting(writeQueue) : 0;
+  s.queueHighWater = queueHighWater.load(std::memory_order_relaxed);
+  s.queueCapacity = STORAGE_QUEUE_DEPTH;
+  s.enqueued = enqueuedCount.load(std::memory_order_relaxed);
+  s.dropped = droppedCount.load(std::memory_order_relaxed);
+  s.written = writtenCount.load(std::memory_order_relaxed);
+  s.writeFailures = writeFailureCount.load(std::memory_order_relaxed);
+  s.lastWriteMs = lastWriteMs.load(std::memory_order_relaxed);
+  s.mode = requestedMode.load();
+  s.filesPinned = 0;
+  s.deletesPending = 0;
+  portENTER_CRITICAL(&pinMux);
+  for (const FilePin &p : pins) {
+    if (p.readers)
+      s.filesPinned++;
+    if (p.evicted)
+      s.deletesPending++;
+  }
+  portEXIT_CRITICAL(&pinMux);
+  s.pinsRefused = pinsRefusedCount.load(std::memory_order_relaxed);
+  s.deletesDeferred = deletesDeferredCount.load(std::memory_order_relaxed);
+  s.orphansRemoved = orphansRemovedCount.load(std::memory_order_relaxed);
+  s.perFile = snapshotLatency(perFileLatency);
+  s.timelapse = snapshotLatency(timelapseLatency);
+  s.rawLog = snapshotLatency(rawLogLatency);
+  return s;
+}
+
+} // namespace StorageWriter
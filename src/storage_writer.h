@@ -0,0 +1,65 @@
+#pragma once
+#include "config.h"
+#include "frame_pool.h"
+#include <Arduino.h>
+
+// Storage stage of the capture pipeline: frames handed over by the camera
+// task are written to FFat on a separate task so a slow FAT write never
+// delays the next capture.
+namespace StorageWriter {
+  // Per-frame storage cost for one recording mode (file create + write +
+  // close + delete of the oldest file, one append to the open segment, or
+  // one erase + program of raw log sectors)
+  struct WriteLatency {
+    uint32_t writes;
+    uint32_t avgUs; // exponential moving average
+    uint32_t maxUs;
+  };
+
+  struct Stats {
+    uint32_t queueDepth;     // frames waiting to be written
+    uint32_t queueHighWater; // deepest the queue has been since boot
+    uint32_t queueCapacity;
+    uint32_t enqueued;
+    uint32_t dropped;        // rejected because the queue was full
+    uint32_t written;
+    uint32_t writeFailures;
+    uint32_t lastWriteMs;    // duration of the most recent open+write+close
+    uint32_t filesPinned;    // history files being streamed right now
+    uint32_t pinsRefused;    // file already being deleted, or table full
+    uint32_t deletesDeferred; // evicted while pinned, deleted after unpin
+    uint32_t deletesPending;
+    uint32_t orphansRemoved; // left behind by a reset, swept at start-up
+    RecordingMode mode;
+    WriteLatency perFile;
+    WriteLatency timelapse;
+    WriteLatency rawLog;
+  };
+
+  void setup();
+
+  // Queues a reference to the frame; the pool slot stays pinned until the
+  // write finishes. Returns false if the queue is full or the writer isn't
+  // running.
+  bool enqueue(FrameRef frame);
+
+  // Takes effect on the writer task before the next frame is stored
+  void setMode(RecordingMode mode);
+  RecordingMode getMode();
+
+  // Per-file frame `sequence` was captured again, unchanged, at `ms`.
+  // Recorded on its index entry by the writer task; repeated calls before
+  // that coalesce, so flash sees at most about one write a second.
+  void confirm(uint32_t sequence, uint32_t ms);
+
+  // Path of the newest per-file frame; lock-free
+  String getLatestPath();
+
+  // Keeps per-file frame `sequence` on flash while a response streams it.
+  // Returns false if the writer is already deleting it or every pin slot
+  // is taken; otherwise each pin must be matched by one unpinFile().
+  bool pinFile(uint32_t sequence);
+  void unpinFile(uint32_t sequence);
+
+  Stats getStats();
+}
@@ -1,10 +1,14 @@
 #include "system_manager.h"
 #include "config.h"
+#include "trace.h"
 #include <FFat.h>
 
 void SystemManager::setup() {
   Serial.printf("[%s] Starting setup...\n", getName());
   Serial.println("Setting up shared system resources...");
+
+  // Span rings first, so both cores can trace from their first cycle
+  Trace::setup();
   
   // Filesystem - shared between cores for camera files and web serving
   if (!FFat.begin()) {
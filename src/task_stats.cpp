@@ -0,0 +1,142 @@
+#include "task_stats.h"
+#include <algorithm>
+extern "C" {
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+}
+
+#if configUSE_TRACE_FACILITY
+
+struct PrevRunTime {
+  TaskHandle_t handle;
+  configRUN_TIME_COUNTER_TYPE runTime;
+};
+
+// Only touched by the status sampler task
+static TaskStatus_t status[TaskStats::MAX_TASKS];
+static PrevRunTime prev[TaskStats::MAX_TASKS];
+static size_t prevCount = 0;
+static configRUN_TIME_COUNTER_TYPE prevTotal = 0;
+static uint32_t prevSampleMs = 0;
+
+static TaskStats::Task building[TaskStats::MAX_TASKS];
+
+// Last published sample, copied in and out under publishMux so a reader on
+// another task never sees rows being rewritten or re-sorted
+static portMUX_TYPE publishMux = portMUX_INITIALIZER_UNLOCKED;
+static TaskStats::Task tasks[TaskStats::MAX_TASKS];
+static TaskStats::Summary summary = {};
+
+static const char *stateName(eTaskState state) {
+  switch (state) {
+  case eRunning:
+    return "running";
+  case eReady:
+    return "ready";
+  case eBlocked:
+    return "blocked";
+  case eSuspended:
+    return "suspended";
+  case eDeleted:
+    return "deleted";
+  default:
+    return "invalid";
+  }
+}
+
+static configRUN_TIME_COUNTER_TYPE previousRunTime(TaskHandle_t handle) {
+  for (size_t i = 0; i < prevCount; i++)
+    if (prev[i].handle == handle)
+      return prev[i].runTime;
+  return 0; // new task: its whole run time falls in this window
+}
+
+namespace TaskStats {
+
+void sample() {
+  configRUN_TIME_COUNTER_TYPE total = 0;
+  UBaseType_t n = uxTaskGetSystemState(status, MAX_TASKS, &total);
+  if (n == 0) {
+    // More tasks than MAX_TASKS; keep the previous sample
+    return;
+  }
+
+  uint32_t now = millis();
+  Summary next = summary; // only this task writes it
+  next.windowMs = now - prevSampleMs;
+  next.tasks = n;
+#if configGENERATE_RUN_TIME_STATS
+  next.runTimeStats = true;
+  configRUN_TIME_COUNTER_TYPE window = total - prevTotal;
+#else
+  next.runTimeStats = false;
+  configRUN_TIME_COUNTER_TYPE window = 0;
+#endif
+
+  TaskHandle_t idle[MAX_CORES] = {};
+  for (size_t c = 0; c < MAX_CORES && c < (size_t)portNUM_PROCESSORS; c++)
+    idle[c] = xTaskGetIdleTaskHandleForCore(c);
+
+  for (UBaseType_t i = 0; i < n; i++) {
+    const TaskStatus_t &s = status[i];
+    Task &t = building[i];
+    snprintf(t.name, sizeof(t.name), "%s", s.pcTaskName);
+    t.state = stateName(s.eCurrentState);
+    t.priority = (uint8_t)s.uxCurrentPriority;
+    BaseType_t affinity = xTaskGetAffinity(s.xHandle);
+    t.core = affinity == tskNO_AFFINITY ? -1 : (int8_t)affinity;
+    t.stackFree = s.usStackHighWaterMark;
+
+    uint32_t permille = 0;
+    if (window > 0) {
+      uint64_t ran = s.ulRunTimeCounter - previousRunTime(s.xHandle);
+      permille = (uint32_t)std::min<uint64_t>(ran * 1000 / window, 1000);
+    }
+    t.cpuPermille = permille;
+    for (size_t c = 0; c < MAX_CORES; c++)
+      if (s.xHandle == idle[c])
+        next.coreLoadPermille[c] = 1000 - permille;
+  }
+
+  for (UBaseType_t i = 0; i < n; i++)
+    prev[i] = {status[i].xHandle, status[i].ulRunTimeCounter};
+  prevCount = n;
+  prevTotal = total;
+  prevSampleMs = now;
+
+  std::sort(building, building + n, [](const Task &a, const Task &b) {
+    return a.cpuPermille > b.cpuPermille;
+  });
+
+  portENTER_CRITICAL(&publishMux);
+  std::copy(building, building + n, tasks);
+  summary = next;
+  portEXIT_CRITICAL(&publishMux);
+}
+
+Summary getSummary() {
+  portENTER_CRITICAL(&publishMux);
+  Summary s = summary;
+  portEXIT_CRITICAL(&publishMux);
+  return s;
+}
+
+size_t getTasks(Task *out, size_t max) {
+  portENTER_CRITICAL(&publishMux);
+  size_t n = std::min<size_t>(summary.tasks, max);
+  std::copy(tasks, tasks + n, out);
+  portEXIT_CRITICAL(&publishMux);
+  return n;
+}
+
+} // namespace TaskStats
+
+#else // !configUSE_TRACE_FACILITY
+
+namespace TaskStats {
+void sample() {}
+Summary getSummary() { return {}; }
+size_t getTasks(Task *, size_t) { return 0; }
+} // namespace TaskStats
+
+#endif
@@ -0,0 +1,32 @@
+#pragma once
+#include <Arduino.h>
+
+// Per-task CPU share, stack headroom, priority, core and state from
+// uxTaskGetSystemState(). CPU% is the run-time counter delta between two
+// consecutive samples, so each sample describes the last window only.
+namespace TaskStats {
+  static constexpr size_t MAX_TASKS = 32;
+  static constexpr size_t MAX_CORES = 2;
+
+  struct Task {
+    char name[16];
+    const char *state; // "running", "ready", "blocked", ...
+    uint8_t priority;
+    int8_t core;          // -1 = not pinned
+    uint16_t cpuPermille; // share of one core over the window
+    uint32_t stackFree;   // high-water mark: least free stack ever, bytes
+  };
+
+  struct Summary {
+    bool runTimeStats; // false if the SDK was built without run-time stats
+    uint32_t windowMs;
+    uint32_t tasks;
+    uint16_t coreLoadPermille[MAX_CORES]; // 1000 - idle task share
+  };
+
+  void sample(); // status sampler task only
+
+  // Any task; copies of the last complete sample
+  Summary getSummary();
+  size_t getTasks(Task *out, size_t max); // busiest first
+}
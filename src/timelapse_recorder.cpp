@@ -0,0 +1,361 @@
+#include "timelapse_recorder.h"
+#include "config.h"
+#include "esp_camera.h"
+#include <FFat.h>
+#include <atomic>
+#include <vector>
+extern "C" {
+#include "freertos/FreeRTOS.h"
+}
+
+// ===== AVI LAYOUT =====
+// RIFF 'AVI ' { LIST 'hdrl' { avih, LIST 'strl' { strh, strf } },
+//               LIST 'movi' { '00dc' frames... }, idx1 }
+static constexpr size_t AVI_HEADER_SIZE = 224;
+static constexpr size_t OFF_RIFF_SIZE = 4;
+static constexpr size_t OFF_AVIH_MAX_BYTES_PER_SEC = 36;
+static constexpr size_t OFF_AVIH_TOTAL_FRAMES = 48;
+static constexpr size_t OFF_AVIH_SUGGESTED_BUFFER = 60;
+static constexpr size_t OFF_STRH_LENGTH = 140;
+static constexpr size_t OFF_STRH_SUGGESTED_BUFFER = 144;
+static constexpr size_t OFF_MOVI_SIZE = 216;
+static constexpr size_t OFF_MOVI_FOURCC = 220;
+static constexpr uint32_t AVIF_HASINDEX = 0x10;  // avih.dwFlags
+static constexpr uint32_t AVIIF_KEYFRAME = 0x10; // idx1 entry flags
+
+struct IndexEntry {
+  uint32_t offset; // of the chunk header, relative to the 'movi' fourcc
+  uint32_t size;
+};
+
+// Writer task only
+static File segment;
+static String segmentPath;
+static uint32_t segmentIndex = 0; // last number used
+static uint32_t segmentBytes = 0;
+static uint32_t maxFrameSize = 0;
+static std::vector<IndexEntry> frameIndex;
+
+// Copy of the open segment's state for other tasks, guarded by
+// publishedMux; they never touch the File or String above
+static portMUX_TYPE publishedMux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t publishedIndex = 0; // 0 = none open
+static uint32_t publishedFrames = 0;
+static uint32_t publishedBytes = 0;
+
+static std::atomic<uint32_t> segmentsClosed{0};
+static std::atomic<uint32_t> segmentsRecovered{0};
+
+// Writer task, after every change to the open segment
+static void publish() {
+  const bool open = segment;
+  portENTER_CRITICAL(&publishedMux);
+  publishedIndex = open ? segmentIndex : 0;
+  publishedFrames = open ? frameIndex.size() : 0;
+  publishedBytes = open ? segmentBytes : 0;
+  portEXIT_CRITICAL(&publishedMux);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static uint32_t get32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void putFourcc(uint8_t *p, const char *cc) { memcpy(p, cc, 4); }
+
+static String pathForSegment(uint32_t index) {
+  char name[32];
+  snprintf(name, sizeof(name), "%s/tl_%04u.avi", RECORDING_DIR,
+           (unsigned)index);
+  return String(name);
+}
+
+// Header with size/length fields left at zero; they are patched on close.
+// A zero RIFF size is how recovery recognises an unfinished segment.
+static void buildHeader(uint8_t *h) {
+  const uint32_t width = resolution[CAMERA_FRAME_SIZE].width;
+  const uint32_t height = resolution[CAMERA_FRAME_SIZE].height;
+  const uint32_t fps = RECORDING_PLAYBACK_FPS > 0 ? RECORDING_PLAYBACK_FPS : 1;
+
+  memset(h, 0, AVI_HEADER_SIZE);
+  putFourcc(h + 0, "RIFF");
+  putFourcc(h + 8, "AVI ");
+
+  putFourcc(h + 12, "LIST");
+  put32(h + 16, 4 + 64 + 12 + 64 + 48); // 'hdrl' + avih + LIST strl
+  putFourcc(h + 20, "hdrl");
+
+  putFourcc(h + 24, "avih");
+  put32(h + 28, 56);
+  put32(h + 32, 1000000 / fps); // dwMicroSecPerFrame
+  put32(h + 44, AVIF_HASINDEX); // dwFlags
+  put32(h + 56, 1);             // dwStreams
+  put32(h + 64, width);
+  put32(h + 68, height);
+
+  putFourcc(h + 88, "LIST");
+  put32(h + 92, 4 + 64 + 48);
+  putFourcc(h + 96, "strl");
+
+  putFourcc(h + 100, "strh");
+  put32(h + 104, 56);
+  putFourcc(h + 108, "vids");
+  putFourcc(h + 112, "MJPG");
+  put32(h + 128, 1);   // dwScale
+  put32(h + 132, fps); // dwRate
+  put32(h + 148, 0xFFFFFFFF); // dwQuality: default
+  put16(h + 160, width);      // rcFrame.right
+  put16(h + 162, height);     // rcFrame.bottom
+
+  putFourcc(h + 164, "strf");
+  put32(h + 168, 40);
+  put32(h + 172, 40); // biSize
+  put32(h + 176, width);
+  put32(h + 180, height);
+  put16(h + 184, 1);  // biPlanes
+  put16(h + 186, 24); // biBitCount
+  putFourcc(h + 188, "MJPG");
+  put32(h + 192, width * height * 3);
+
+  putFourcc(h + 212, "LIST");
+  putFourcc(h + 220, "movi");
+}
+
+static bool patch32(File &f, size_t offset, uint32_t v) {
+  uint8_t b[4];
+  put32(b, v);
+  return f.seek(offset) && f.write(b, 4) == 4;
+}
+
+// Append idx1 at `end` and fix up every size field in the header
+static bool finalizeSegment(File &f, size_t end,
+                            const std::vector<IndexEntry> &entries,
+                            uint32_t maxFrame) {
+  if (!f.seek(end))
+    return false;
+
+  uint8_t buf[16 * 32];
+  uint8_t hdr[8];
+  putFourcc(hdr, "idx1");
+  put32(hdr + 4, entries.size() * 16);
+  if (f.write(hdr, 8) != 8)
+    return false;
+
+  size_t n = 0;
+  for (const IndexEntry &e : entries) {
+    uint8_t *p = buf + n * 16;
+    putFourcc(p, "00dc");
+    put32(p + 4, AVIIF_KEYFRAME); // every MJPEG frame is a keyframe
+    put32(p + 8, e.offset);
+    put32(p + 12, e.size);
+    if (++n == 32) {
+      if (f.write(buf, sizeof(buf)) != sizeof(buf))
+        return false;
+      n = 0;
+    }
+  }
+  if (n && f.write(buf, n * 16) != n * 16)
+    return false;
+
+  const size_t fileEnd = end + 8 + entries.size() * 16;
+  const uint32_t frames = entries.size();
+  const uint32_t fps = RECORDING_PLAYBACK_FPS > 0 ? RECORDING_PLAYBACK_FPS : 1;
+  return patch32(f, OFF_RIFF_SIZE, fileEnd - 8) &&
+         patch32(f, OFF_AVIH_MAX_BYTES_PER_SEC, maxFrame * fps) &&
+         patch32(f, OFF_AVIH_TOTAL_FRAMES, frames) &&
+         patch32(f, OFF_AVIH_SUGGESTED_BUFFER, maxFrame) &&
+         patch32(f, OFF_STRH_LENGTH, frames) &&
+         patch32(f, OFF_STRH_SUGGESTED_BUFFER, maxFrame) &&
+         patch32(f, OFF_MOVI_SIZE, end - OFF_MOVI_FOURCC);
+}
+
+// Walk the 'movi' chunks of a segment that was never closed and give it
+// an index so it plays and downloads like any other.
+static void recoverSegment(const String &path) {
+  File f = FFat.open(path, "r+");
+  if (!f)
+    return;
+
+  uint8_t h[AVI_HEADER_SIZE];
+  size_t fileSize = f.size();
+  if (f.read(h, sizeof(h)) != sizeof(h) || memcmp(h, "RIFF", 4) != 0 ||
+      get32(h + OFF_RIFF_SIZE) != 0) {
+    f.close();
+    return; // not ours, or already finalized
+  }
+
+  std::vector<IndexEntry> entries;
+  uint32_t maxFrame = 0;
+  size_t pos = AVI_HEADER_SIZE;
+  uint8_t chunk[8];
+  while (pos + 8 <= fileSize) {
+    if (!f.seek(pos) || f.read(chunk, 8) != 8 || memcmp(chunk, "00dc", 4))
+      break;
+    uint32_t size = get32(chunk + 4);
+    size_t next = pos + 8 + size + (size & 1);
+    if (next > fileSize)
+      break; // torn final frame
+    entries.push_back({(uint32_t)(pos - OFF_MOVI_FOURCC), size});
+    if (size > maxFrame)
+      maxFrame = size;
+    pos = next;
+  }
+
+  bool ok = finalizeSegment(f, pos, entries, maxFrame);
+  f.close();
+  if (ok)
+    segmentsRecovered.fetch_add(1, std::memory_order_relaxed);
+  Serial.printf("Timelapse: Recovered %s (%u frames)%s\n", path.c_str(),
+                (unsigned)entries.size(), ok ? "" : " - failed");
+}
+
+static void deleteSegment(uint32_t index) {
+  String path = pathForSegment(index);
+  if (FFat.exists(path)) {
+    FFat.remove(path);
+    Serial.printf("Timelapse: Deleted %s\n", path.c_str());
+  }
+}
+
+// Would `index` fall out of retention once segment `newest` is opened?
+static bool expired(uint32_t index, uint32_t newest) {
+  return RECORDING_MAX_SEGMENTS > 0 &&
+         index + RECORDING_MAX_SEGMENTS <= newest;
+}
+
+static bool openSegment() {
+  segmentIndex++;
+  // Keep RECORDING_MAX_SEGMENTS including the one being opened
+  if (RECORDING_MAX_SEGMENTS > 0 &&
+      segmentIndex > (uint32_t)RECORDING_MAX_SEGMENTS)
+    deleteSegment(segmentIndex - RECORDING_MAX_SEGMENTS);
+
+  segmentPath = pathForSegment(segmentIndex);
+  segment = FFat.open(segmentPath, "w");
+  if (!segment) {
+    Serial.printf("Timelapse: Failed to create %s\n", segmentPath.c_str());
+    return false;
+  }
+
+  uint8_t h[AVI_HEADER_SIZE];
+  buildHeader(h);
+  if (segment.write(h, sizeof(h)) != sizeof(h)) {
+    segment.close();
+    return false;
+  }
+
+  segmentBytes = AVI_HEADER_SIZE;
+  maxFrameSize = 0;
+  frameIndex.clear();
+  publish();
+  Serial.printf("Timelapse: Recording to %s\n", segmentPath.c_str());
+  return true;
+}
+
+namespace TimelapseRecorder {
+
+void setup() {
+  if (!FFat.exists(RECORDING_DIR))
+    FFat.mkdir(RECORDING_DIR);
+
+  // Find the highest segment number and close out any torn segment
+  std::vector<uint32_t> found;
+  File dir = FFat.open(RECORDING_DIR);
+  if (dir) {
+    for (File f = dir.openNextFile(); f; f = dir.openNextFile()) {
+      String name = f.name();
+      f.close();
+      unsigned index = 0;
+      if (sscanf(name.c_str(), "tl_%u.avi", &index) == 1) {
+        found.push_back(index);
+        if (index > segmentIndex)
+          segmentIndex = index;
+        recoverSegment(String(RECORDING_DIR) + "/" + name);
+      }
+    }
+    dir.close();
+  }
+
+  // Drop anything that would already be out of retention after a restart
+  for (uint32_t index : found) {
+    if (expired(index, segmentIndex + 1))
+      deleteSegment(index);
+  }
+}
+
+bool append(const FrameRef &frame) {
+  const uint32_t chunkBytes = 8 + frame.size() + (frame.size() & 1);
+  if (segment && segmentBytes + chunkBytes + 8 + (frameIndex.size() + 1) * 16 >
+                     RECORDING_SEGMENT_BYTES)
+    close();
+  if (!segment && !openSegment())
+    return false;
+
+  uint8_t hdr[8];
+  putFourcc(hdr, "00dc");
+  put32(hdr + 4, frame.size());
+  static const uint8_t pad = 0;
+  bool ok = segment.write(hdr, 8) == 8 &&
+            segment.write(frame.data(), frame.size()) == frame.size() &&
+            ((frame.size() & 1) == 0 || segment.write(&pad, 1) == 1);
+  if (!ok) {
+    Serial.printf("Timelapse: Append to %s failed\n", segmentPath.c_str());
+    close();
+    return false;
+  }
+  // Make the frame durable; recovery can index everything up to here
+  segment.flush();
+
+  frameIndex.push_back({segmentBytes - (uint32_t)OFF_MOVI_FOURCC,
+                        (uint32_t)frame.size()});
+  segmentBytes += chunkBytes;
+  if (frame.size() > maxFrameSize)
+    maxFrameSize = frame.size();
+  publish();
+  return true;
+}
+
+void close() {
+  if (!segment)
+    return;
+  if (finalizeSegment(segment, segmentBytes, frameIndex, maxFrameSize))
+    segmentsClosed.fetch_add(1, std::memory_order_relaxed);
+  segment.close();
+  publish();
+  Serial.printf("Timelapse: Closed %s (%u frames)\n", segmentPath.c_str(),
+                (unsigned)frameIndex.size());
+  frameIndex.clear();
+  frameIndex.shrink_to_fit();
+}
+
+String currentPath() {
+  portENTER_CRITICAL(&publishedMux);
+  uint32_t index = publishedIndex;
+  portEXIT_CRITICAL(&publishedMux);
+  return index ? pathForSegment(index) : String();
+}
+
+Stats getStats() {
+  Stats s;
+  portENTER_CRITICAL(&publishedMux);
+  s.segmentIndex = publishedIndex;
+  s.segmentFrames = publishedFrames;
+  s.segmentBytes = publishedBytes;
+  portEXIT_CRITICAL(&publishedMux);
+  s.segmentsClosed = segmentsClosed.load(std::memory_order_relaxed);
+  s.segmentsRecovered = segmentsRecovered.load(std::memory_order_relaxed);
+  return s;
+}
+
+} // namespace TimelapseRecorder
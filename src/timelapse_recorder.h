@@ -0,0 +1,26 @@
+#pragma once
+#include "frame_pool.h"
+#include <Arduino.h>
+
+// Appends frames to large MJPEG-AVI segment files instead of one FAT file
+// per frame. Writes are sequential into an already-open file; the idx1
+// index and header sizes are written when a segment is closed, and
+// rebuilt at boot for a segment that was cut off by a power loss.
+namespace TimelapseRecorder {
+  struct Stats {
+    uint32_t segmentIndex;   // current segment number (0 = none open)
+    uint32_t segmentFrames;
+    uint32_t segmentBytes;
+    uint32_t segmentsClosed;
+    uint32_t segmentsRecovered;
+  };
+
+  // Storage writer only (setup() runs before its task starts)
+  void setup();
+  bool append(const FrameRef &frame);
+  void close(); // finalize the open segment (next append starts a new one)
+
+  // Any task; read from a copy the writer publishes after each change
+  String currentPath();
+  Stats getStats();
+}
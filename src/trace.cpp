@@ -0,0 +1,177 @@
+#include "trace.h"
+#include "config.h"
+#include <atomic>
+#include <memory>
+#include <new>
+extern "C" {
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+}
+
+static constexpr size_t CORES = 2;
+
+struct Event {
+  std::atomic<uint32_t> sequence; // claimed index + 1 once written, else 0
+  uint32_t durUs;
+  int64_t startUs;
+  const char *name;
+  const char *task;
+};
+
+struct Ring {
+  std::atomic<uint32_t> head{0}; // next index to claim; never wraps back
+  Event *events = nullptr;
+};
+
+static Ring rings[CORES];
+static uint32_t capacity = 0;
+
+namespace Trace {
+
+void setup() {
+  if (rings[0].events)
+    return;
+  capacity = TRACE_EVENTS_PER_CORE;
+  for (size_t c = 0; c < CORES; c++) {
+    Event *events = (Event *)ps_malloc(capacity * sizeof(Event));
+    if (!events) {
+      Serial.println("Trace: Failed to allocate ring");
+      return;
+    }
+    for (uint32_t i = 0; i < capacity; i++)
+      new (&events[i]) Event{{0}, 0, 0, nullptr, nullptr};
+    rings[c].events = events;
+  }
+  Serial.printf("Trace: %u events per core in PSRAM\n", (unsigned)capacity);
+}
+
+void record(const char *name, int64_t startUs, uint32_t durUs) {
+  Ring &ring = rings[xPortGetCoreID() & 1];
+  if (!ring.events)
+    return;
+
+  uint32_t index = ring.head.fetch_add(1, std::memory_order_relaxed);
+  Event &e = ring.events[index % capacity];
+  e.sequence.store(0, std::memory_order_relaxed); // readers skip it for now
+  e.startUs = startUs;
+  e.durUs = durUs;
+  e.name = name;
+  e.task = pcTaskGetName(nullptr);
+  e.sequence.store(index + 1, std::memory_order_release);
+}
+
+// Copies event `index` if it is still the one in its slot
+static bool readEvent(const Ring &ring, uint32_t index, Event &out) {
+  const Event &e = ring.events[index % capacity];
+  uint32_t before = e.sequence.load(std::memory_order_acquire);
+  if (before != index + 1)
+    return false;
+  out.startUs = e.startUs;
+  out.durUs = e.durUs;
+  out.name = e.name;
+  out.task = e.task;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return e.sequence.load(std::memory_order_relaxed) == before;
+}
+
+// Streams the rings as they are, one JSON event per fill step. Events
+// overwritten while the dump is in progress are skipped.
+struct Dump {
+  enum Stage { Header, Events, Footer, Done } stage = Header;
+  size_t core = 0;
+  uint32_t next[CORES];
+  uint32_t end[CORES];
+  char pending[256];
+  size_t pendingLen = 0;
+};
+
+static size_t formatNext(Dump &d, char *buf, size_t size) {
+  for (;;) {
+    switch (d.stage) {
+    case Dump::Header:
+      d.stage = Dump::Events;
+      return snprintf(
+          buf, size,
+          "{\"displayTimeUnit\":\"ms\",\"traceEvents\":["
+          "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+          "\"args\":{\"name\":\"core 0\"}},"
+          "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,"
+          "\"args\":{\"name\":\"core 1\"}}");
+    case Dump::Events:
+      while (d.core < CORES && d.next[d.core] == d.end[d.core])
+        d.core++;
+      if (d.core == CORES) {
+        d.stage = Dump::Footer;
+        continue;
+      }
+      {
+        uint32_t index = d.next[d.core]++;
+        Event e;
+        if (!readEvent(rings[d.core], index, e))
+          continue;
+        return snprintf(buf, size,
+                        ",{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                        "\"ts\":%lld,\"dur\":%u,\"args\":{\"task\":\"%s\"}}",
+                        e.name, (unsigned)d.core, (long long)e.startUs,
+                        (unsigned)e.durUs, e.task ? e.task : "?");
+      }
+    case Dump::Footer:
+      d.stage = Dump::Done;
+      return snprintf(buf, size, "]}");
+    case Dump::Done:
+      return 0;
+    }
+  }
+}
+
+void handleRequest(AsyncWebServerRequest *request) {
+  if (!rings[0].events) {
+    request->send(503, "text/plain", "Tracing not available");
+    return;
+  }
+
+  auto dump = std::make_shared<Dump>();
+  for (size_t c = 0; c < CORES; c++) {
+    uint32_t head = rings[c].head.load(std::memory_order_acquire);
+    dump->end[c] = head;
+    dump->next[c] = head > capacity ? head - capacity : 0;
+  }
+
+  AsyncWebServerResponse *res = request->beginChunkedResponse(
+      "application/json",
+      [dump](uint8_t *buf, size_t maxLen, size_t index) -> size_t {
+        size_t len = 0;
+        for (;;) {
+          if (dump->pendingLen == 0) {
+            dump->pendingLen =
+                formatNext(*dump, dump->pending, sizeof(dump->pending));
+            if (dump->pendingLen == 0)
+              break; // done
+            if (dump->pendingLen >= sizeof(dump->pending))
+              dump->pendingLen = sizeof(dump->pending) - 1; // truncated
+          }
+          if (len + dump->pendingLen > maxLen)
+            break;
+          memcpy(buf + len, dump->pending, dump->pendingLen);
+          len += dump->pendingLen;
+          dump->pendingLen = 0;
+        }
+        // Nothing fit this time; a zero return would end the response
+        if (len == 0 && dump->pendingLen > 0)
+          return RESPONSE_TRY_AGAIN;
+        return len;
+      });
+  res->addHeader("Cache-Control", "no-cache");
+  res->addHeader("Content-Disposition", "inline; filename=\"trace.json\"");
+  request->send(res);
+}
+
+Stats getStats() {
+  Stats s = {};
+  s.capacityPerCore = capacity;
+  for (size_t c = 0; c < CORES; c++)
+    s.recorded[c] = rings[c].head.load(std::memory_order_relaxed);
+  return s;
+}
+
+} // namespace Trace
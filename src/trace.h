@@ -0,0 +1,39 @@
+#pragma once
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+extern "C" {
+#include "esp_timer.h"
+}
+
+// Span tracing into per-core PSRAM rings. A writer claims a slot with one
+// atomic increment and publishes it by storing the slot's sequence last,
+// so any task on either core can record without a lock. /trace dumps the
+// rings as Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev).
+namespace Trace {
+  struct Stats {
+    uint32_t capacityPerCore;
+    uint32_t recorded[2]; // per core, since boot
+  };
+
+  void setup(); // allocates the rings; spans before this are dropped
+
+  // `name` must be a string literal (only the pointer is stored)
+  void record(const char *name, int64_t startUs, uint32_t durUs);
+
+  // Records the enclosing scope as one complete ("X") event
+  class Span {
+  public:
+    explicit Span(const char *name)
+        : name(name), start(esp_timer_get_time()) {}
+    ~Span() { record(name, start, (uint32_t)(esp_timer_get_time() - start)); }
+    Span(const Span &) = delete;
+    Span &operator=(const Span &) = delete;
+
+  private:
+    const char *name;
+    int64_t start;
+  };
+
+  void handleRequest(AsyncWebServerRequest *request);
+  Stats getStats();
+}
@@ -1,9 +1,29 @@
 #include "website_routes.h"
+#include "asset_bundle.h"
 #include "camera_cycle.h"
+#include "capture_scheduler.h"
 #include "config.h"
+#include "delivery_scheduler.h"
+#include "file_sender.h"
+#include "frame_cache.h"
+#include "frame_index.h"
+#include "frame_pool.h"
+#include "frame_store.h"
+#include "http_cache.h"
+#include "metrics.h"
+#include "mjpeg_stream.h"
+#include "motion_detector.h"
+#include "page_template.h"
+#include "storage_writer.h"
+#include "task_stats.h"
+#include "timelapse_recorder.h"
+#include "trace.h"
 #include <FFat.h>
 #include <WiFi.h>
 #include <string.h>
+#include <atomic>
+#include <memory>
+#include <vector>
 
 // ===== ESP-IDF headers needed for /json =====
 extern "C" {
@@ -22,6 +42,7 @@ extern "C" {
 // FreeRTOS primitives for the status cache
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
+#include "freertos/stream_buffer.h"
 #include "freertos/task.h"
 }
 
@@ -42,20 +63,36 @@ static inline String uptimeStr() {
   return String(buf);
 }
 
+static const char *recordingModeName(RecordingMode mode) {
+  switch (mode) {
+  case RecordingMode::Timelapse:
+    return "timelapse";
+  case RecordingMode::RawLog:
+    return "raw";
+  default:
+    return "files";
+  }
+}
+
 // Provide prototype for htmlEscape used by the status rows builder
 static String htmlEscape(const String &in);
 
-static void buildStatusRowsHtml(String &out) {
+static void appendRow(String &out, const char *k, const String &vHtml) {
+  const bool hasSubTable = vHtml.indexOf(F("<table")) >= 0;
+  out += F("<tr><td>");
+  out += k;
+  out += F("</td><td");
+  if (hasSubTable)
+    out += F(" class=\"has-table\"");
+  out += F(">");
+  out += vHtml;
+  out += F("</td></tr>");
+}
+
+// Rows that cannot change until reboot (chip, build, reset reason)
+static void buildChipRowsHtml(String &out) {
   auto row = [&](const char *k, const String &vHtml) {
-    const bool hasSubTable = vHtml.indexOf(F("<table")) >= 0;
-    out += F("<tr><td>");
-    out += k;
-    out += F("</td><td");
-    if (hasSubTable)
-      out += F(" class=\"has-table\"");
-    out += F(">");
-    out += vHtml;
-    out += F("</td></tr>");
+    appendRow(out, k, vHtml);
   };
 
   esp_chip_info_t chip;
@@ -75,17 +112,13 @@ static void buildStatusRowsHtml(String &out) {
   row("sketchMD5", htmlEscape(ESP.getSketchMD5()));
 
   row("resetReason", String((int)esp_reset_reason()));
-  row("espTimer_us", String((unsigned long long)esp_timer_get_time()));
-  row("uptime", htmlEscape(String(uptimeStr())));
+}
 
-  row("heapFree", String(ESP.getFreeHeap()));
-  row("heapMinFreeEver", String(ESP.getMinFreeHeap()));
-  row("heapMaxAlloc", String(ESP.getMaxAllocHeap()));
-  row("heapIntFree", String(heap_caps_get_free_size(MALLOC_CAP_INTERNAL)));
-  row("heapSPIRAM_Free", String(heap_caps_get_free_size(MALLOC_CAP_SPIRAM)));
-  row("psramSize", String(ESP.getPsramSize()));
-  row("psramFree", String(ESP.getFreePsram()));
-  row("psramMinFreeEver", String(ESP.getMinFreePsram()));
+// Static rows: flash chip, partition table, OTA slots
+static void buildFlashRowsHtml(String &out) {
+  auto row = [&](const char *k, const String &vHtml) {
+    appendRow(out, k, vHtml);
+  };
 
   uint32_t fsize = 0, fid = 0;
   esp_flash_get_size(nullptr, &fsize);
@@ -150,6 +183,31 @@ static void buildStatusRowsHtml(String &out) {
     th += F("</tbody></table>");
     row("ota", th);
   }
+}
+
+static String staticChipRows;  // built once by the sampler
+static String staticFlashRows;
+
+// Full status rows: the cached static fragments around the live values
+static void buildStatusRowsHtml(String &out) {
+  auto row = [&](const char *k, const String &vHtml) {
+    appendRow(out, k, vHtml);
+  };
+
+  out += staticChipRows;
+  row("espTimer_us", String((unsigned long long)esp_timer_get_time()));
+  row("uptime", htmlEscape(String(uptimeStr())));
+
+  row("heapFree", String(ESP.getFreeHeap()));
+  row("heapMinFreeEver", String(ESP.getMinFreeHeap()));
+  row("heapMaxAlloc", String(ESP.getMaxAllocHeap()));
+  row("heapIntFree", String(heap_caps_get_free_size(MALLOC_CAP_INTERNAL)));
+  row("heapSPIRAM_Free", String(heap_caps_get_free_size(MALLOC_CAP_SPIRAM)));
+  row("psramSize", String(ESP.getPsramSize()));
+  row("psramFree", String(ESP.getFreePsram()));
+  row("psramMinFreeEver", String(ESP.getMinFreePsram()));
+
+  out += staticFlashRows;
 
   // Wi-Fi
   row("ssid", htmlEscape(WiFi.SSID()));
@@ -164,8 +222,8 @@ static void buildStatusRowsHtml(String &out) {
   row("dns", htmlEscape(WiFi.dnsIP().toString()));
   row("mdnsHostname", htmlEscape(MDNS_HOSTNAME));
 
-  // FFat filesystem details
-  if (FFat.begin()) {
+  // FFat filesystem details (mounted by the camera task at boot)
+  if (FFat.totalBytes() > 0) {
     row("ffatMounted", F("true"));
     row("ffatTotalBytes", String((unsigned long long)FFat.totalBytes()));
     row("ffatUsedBytes", String((unsigned long long)FFat.usedBytes()));
@@ -174,11 +232,186 @@ static void buildStatusRowsHtml(String &out) {
   } else {
     row("ffatMounted", F("false"));
   }
+
+  // Capture pipeline subtable
+  {
+    CameraCycle::Stats cs = CameraCycle::getStats();
+    StorageWriter::Stats ss = StorageWriter::getStats();
+    String th = F("<table class='sub'><tbody>");
+    auto sub = [&](const char *k, uint32_t v) {
+      th += F("<tr><th>");
+      th += k;
+      th += F("</th><td>");
+      th += String((unsigned long)v);
+      th += F("</td></tr>");
+    };
+    sub("framesCaptured", cs.framesCaptured);
+    sub("captureFailures", cs.captureFailures);
+    sub("allocFailures", cs.allocFailures);
+    sub("lowMemorySkips", cs.lowMemorySkips);
+    sub("lastCaptureMs", cs.lastCaptureMs);
+    MotionDetector::Stats ms = MotionDetector::getStats();
+    sub("motionActive", cs.motionActive);
+    sub("motionScore", ms.lastScore);
+    sub("motionDecodeUs", ms.lastDecodeUs);
+    sub("storeIntervalMs", cs.storeIntervalMs);
+    sub("framesStored", cs.framesStored);
+    sub("framesSuppressed", cs.framesSuppressed);
+    sub("bytesSuppressed", cs.bytesSuppressed);
+    CaptureScheduler::Stats sc = CaptureScheduler::getStats();
+    sub("captureIntervalMs", sc.intervalMs);
+    sub("tickJitterMaxUs", sc.jitter.maxUs);
+    sub("triggerLatencyUs", sc.triggerLatency.lastUs);
+    sub("storageQueueDepth", ss.queueDepth);
+    sub("storageQueueHighWater", ss.queueHighWater);
+    sub("storageQueueCapacity", ss.queueCapacity);
+    sub("storageDropped", ss.dropped);
+    sub("storageWritten", ss.written);
+    sub("storageWriteFailures", ss.writeFailures);
+    sub("lastWriteMs", ss.lastWriteMs);
+    sub("filesPinned", ss.filesPinned);
+    sub("deletesDeferred", ss.deletesDeferred);
+    sub("deletesPending", ss.deletesPending);
+    sub("perFileWrites", ss.perFile.writes);
+    sub("perFileAvgUs", ss.perFile.avgUs);
+    sub("perFileMaxUs", ss.perFile.maxUs);
+    FrameIndex::Stats is = FrameIndex::getStats();
+    sub("indexEntries", is.entries);
+    sub("indexBoot", is.boot);
+    sub("indexLoadUs", is.loadUs);
+    sub("timelapseWrites", ss.timelapse.writes);
+    sub("timelapseAvgUs", ss.timelapse.avgUs);
+    sub("timelapseMaxUs", ss.timelapse.maxUs);
+    sub("rawLogWrites", ss.rawLog.writes);
+    sub("rawLogAvgUs", ss.rawLog.avgUs);
+    sub("rawLogMaxUs", ss.rawLog.maxUs);
+    FrameStore::Stats fs = FrameStore::getStats();
+    sub("rawRecords", fs.records);
+    sub("rawNewestSequence", fs.newestSequence);
+    sub("rawSectorErases", fs.sectorErases);
+    sub("rawWraps", fs.wraps);
+    TimelapseRecorder::Stats ts = TimelapseRecorder::getStats();
+    sub("segmentIndex", ts.segmentIndex);
+    sub("segmentFrames", ts.segmentFrames);
+    sub("segmentBytes", ts.segmentBytes);
+    th += F("</tbody></table>");
+    row("pipeline", th);
+    row("recordingMode", recordingModeName(ss.mode));
+  }
+
+  // Frame pool subtable
+  {
+    FramePool::Stats ps = FramePool::getStats();
+    String th = F("<table class='sub'><tbody>");
+    auto sub = [&](const char *k, uint32_t v) {
+      th += F("<tr><th>");
+      th += k;
+      th += F("</th><td>");
+      th += String((unsigned long)v);
+      th += F("</td></tr>");
+    };
+    sub("slots", ps.slots);
+    sub("slotBytes", ps.slotBytes);
+    sub("inUse", ps.inUse);
+    sub("highWater", ps.highWater);
+    sub("acquired", ps.acquired);
+    sub("allocFailures", ps.allocFailures);
+    sub("oversizeFailures", ps.oversizeFailures);
+    FrameCache::Stats fc = FrameCache::getStats();
+    sub("cacheEntries", fc.entries);
+    sub("cacheCapacity", fc.capacity);
+    sub("cachePublished", fc.published);
+    sub("cacheHits", fc.hits);
+    sub("cacheMisses", fc.misses);
+    sub("cacheRetries", fc.retries);
+    FileSender::Stats sender = FileSender::getStats();
+    sub("readAheadInUse", sender.inUse);
+    sub("fileBytesPerSec", sender.lastBytesPerSec);
+    th += F("</tbody></table>");
+    row("framePool", th);
+  }
+
+  // MJPEG stream viewers subtable
+  {
+    MjpegStream::Stats ms = MjpegStream::getStats();
+    MjpegStream::ClientStats cs[8];
+    size_t n = MjpegStream::getClientStats(cs, 8);
+    String th =
+        F("<table class='sub'><thead><tr><th>client</th><th>frames</th>"
+          "<th>skipped</th><th>fps</th><th>bytes/s</th><th>unacked</th>"
+          "<th>connected ms</th></tr></thead><tbody>");
+    for (size_t i = 0; i < n; i++) {
+      th += F("<tr><td>");
+      th += String((unsigned long)cs[i].id);
+      th += F("</td><td>");
+      th += String((unsigned long)cs[i].framesSent);
+      th += F("</td><td>");
+      th += String((unsigned long)cs[i].framesSkipped);
+      th += F("</td><td>");
+      th += String(cs[i].frameGapMs ? 1000.0f / cs[i].frameGapMs : 0.0f, 1);
+      th += F("</td><td>");
+      th += String((unsigned long)cs[i].bytesPerSec);
+      th += F("</td><td>");
+      th += String((unsigned long)cs[i].unackedBytes);
+      th += F("</td><td>");
+      th += String((unsigned long)cs[i].connectedMs);
+      th += F("</td></tr>");
+    }
+    th += F("</tbody></table>");
+    row("streamClients", th);
+    row("streamFramesSent", String((unsigned long)ms.framesSent));
+    row("streamBytesSent", String((unsigned long long)ms.bytesSent));
+    DeliveryScheduler::Stats ds = DeliveryScheduler::getStats();
+    row("streamInFlightBytes", String((unsigned long)ds.inFlightBytes));
+    row("streamInFlightHighWater",
+        String((unsigned long)ds.inFlightHighWater));
+    row("streamDeferrals",
+        String((unsigned long)(ds.deferredBacklog + ds.deferredBudget +
+                               ds.deferredHeap)));
+  }
+
+  // FreeRTOS tasks subtable (busiest first)
+  {
+    TaskStats::Summary sum = TaskStats::getSummary();
+    TaskStats::Task tasks[TaskStats::MAX_TASKS];
+    size_t n = TaskStats::getTasks(tasks, TaskStats::MAX_TASKS);
+    auto pct = [](uint16_t permille) {
+      return String(permille / 10) + "." + String(permille % 10) + "%";
+    };
+    String load;
+    for (size_t c = 0; c < TaskStats::MAX_CORES; c++) {
+      if (c)
+        load += F(" / ");
+      load += pct(sum.coreLoadPermille[c]);
+    }
+    row("coreLoad", sum.runTimeStats ? load : String(F("unavailable")));
+    String th =
+        F("<table class='sub'><thead><tr><th>task</th><th>core</th>"
+          "<th>prio</th><th>state</th><th>cpu</th><th>stack free</th>"
+          "</tr></thead><tbody>");
+    for (size_t i = 0; i < n; i++) {
+      th += F("<tr><td>");
+      th += htmlEscape(tasks[i].name);
+      th += F("</td><td>");
+      th += tasks[i].core < 0 ? String("any") : String((int)tasks[i].core);
+      th += F("</td><td>");
+      th += String((unsigned)tasks[i].priority);
+      th += F("</td><td>");
+      th += tasks[i].state;
+      th += F("</td><td>");
+      th += pct(tasks[i].cpuPermille);
+      th += F("</td><td>");
+      th += String((unsigned long)tasks[i].stackFree);
+      th += F("</td></tr>");
+    }
+    th += F("</tbody></table>");
+    row("tasks", th);
+  }
 }
 
 // Settings are now compile-time constants from config.h
 
-static void emit_lwip_stats(AsyncResponseStream *res) {
+static void emit_lwip_stats(Print *res) {
 #if defined(LWIP_STATS) && LWIP_STATS
   res->print("\"lwip\":{");
   res->printf("\"ip.recv\":%u,", (unsigned)lwip_stats.ip.recv);
@@ -190,86 +423,326 @@ static void emit_lwip_stats(AsyncResponseStream *res) {
 #endif
 }
 
-static void emit_freertos_stats(AsyncResponseStream *res) {
-  res->print(
-      "\"freertosStats\":\"enabled (populate uxTaskGetSystemState here)\",");
+static void emit_pipeline_stats(Print *res) {
+  CameraCycle::Stats cs = CameraCycle::getStats();
+  StorageWriter::Stats ss = StorageWriter::getStats();
+  res->print("\"pipeline\":{");
+  res->printf("\"framesCaptured\":%u,", (unsigned)cs.framesCaptured);
+  res->printf("\"captureFailures\":%u,", (unsigned)cs.captureFailures);
+  res->printf("\"allocFailures\":%u,", (unsigned)cs.allocFailures);
+  res->printf("\"lowMemorySkips\":%u,", (unsigned)cs.lowMemorySkips);
+  res->printf("\"lastCaptureMs\":%u,", (unsigned)cs.lastCaptureMs);
+  MotionDetector::Stats ms = MotionDetector::getStats();
+  res->printf("\"motion\":{\"active\":%s,\"storeIntervalMs\":%u,"
+              "\"analyzed\":%u,\"decodeFailures\":%u,\"width\":%u,"
+              "\"height\":%u,\"score\":%u,\"decodeUs\":%u,\"diffUs\":%u},",
+              cs.motionActive ? "true" : "false",
+              (unsigned)cs.storeIntervalMs, (unsigned)ms.analyzed,
+              (unsigned)ms.decodeFailures, (unsigned)ms.width,
+              (unsigned)ms.height, (unsigned)ms.lastScore,
+              (unsigned)ms.lastDecodeUs, (unsigned)ms.lastDiffUs);
+  res->printf("\"dedup\":{\"stored\":%u,\"suppressed\":%u,"
+              "\"bytesSuppressed\":%u,\"lastStoredSequence\":%u,"
+              "\"lastConfirmedMs\":%u},",
+              (unsigned)cs.framesStored, (unsigned)cs.framesSuppressed,
+              (unsigned)cs.bytesSuppressed, (unsigned)cs.lastStoredSequence,
+              (unsigned)cs.lastConfirmedMs);
+  CaptureScheduler::Stats sc = CaptureScheduler::getStats();
+  res->printf("\"scheduler\":{\"intervalMs\":%u,\"ticks\":%u,"
+              "\"overruns\":%u,\"ticksSkipped\":%u,"
+              "\"jitterAvgUs\":%u,\"jitterMaxUs\":%u,"
+              "\"triggers\":{\"gpio\":%u,\"serial\":%u,\"http\":%u},"
+              "\"triggersRejected\":%u,\"triggersDebounced\":%u,"
+              "\"triggerLatencyLastUs\":%u,\"triggerLatencyAvgUs\":%u,"
+              "\"triggerLatencyMaxUs\":%u},",
+              (unsigned)sc.intervalMs, (unsigned)sc.ticks,
+              (unsigned)sc.overruns, (unsigned)sc.ticksSkipped,
+              (unsigned)sc.jitter.avgUs,
+              (unsigned)sc.jitter.maxUs,
+              (unsigned)sc.triggers[(size_t)CaptureScheduler::Source::Gpio],
+              (unsigned)sc.triggers[(size_t)CaptureScheduler::Source::Serial],
+              (unsigned)sc.triggers[(size_t)CaptureScheduler::Source::Http],
+              (unsigned)sc.triggersRejected, (unsigned)sc.triggersDebounced,
+              (unsigned)sc.triggerLatency.lastUs,
+              (unsigned)sc.triggerLatency.avgUs,
+              (unsigned)sc.triggerLatency.maxUs);
+  res->printf("\"storageQueueDepth\":%u,", (unsigned)ss.queueDepth);
+  res->printf("\"storageQueueHighWater\":%u,", (unsigned)ss.queueHighWater);
+  res->printf("\"storageQueueCapacity\":%u,", (unsigned)ss.queueCapacity);
+  res->printf("\"storageDropped\":%u,", (unsigned)ss.dropped);
+  res->printf("\"storageWritten\":%u,", (unsigned)ss.written);
+  res->printf("\"storageWriteFailures\":%u,", (unsigned)ss.writeFailures);
+  res->printf("\"lastWriteMs\":%u,", (unsigned)ss.lastWriteMs);
+  res->printf("\"filePins\":{\"pinned\":%u,\"refused\":%u,"
+              "\"deletesDeferred\":%u,\"deletesPending\":%u,"
+              "\"orphansRemoved\":%u},",
+              (unsigned)ss.filesPinned, (unsigned)ss.pinsRefused,
+              (unsigned)ss.deletesDeferred, (unsigned)ss.deletesPending,
+              (unsigned)ss.orphansRemoved);
+  res->printf("\"recordingMode\":\"%s\",", recordingModeName(ss.mode));
+  res->printf("\"perFile\":{\"writes\":%u,\"avgUs\":%u,\"maxUs\":%u},",
+              (unsigned)ss.perFile.writes, (unsigned)ss.perFile.avgUs,
+              (unsigned)ss.perFile.maxUs);
+  FrameIndex::Stats is = FrameIndex::getStats();
+  res->printf("\"frameIndex\":{\"entries\":%u,\"capacity\":%u,\"boot\":%u,"
+              "\"lastIssued\":%u,\"reservedThrough\":%u,"
+              "\"reservations\":%u,\"reserveFailures\":%u,"
+              "\"loadUs\":%u,\"writes\":%u,\"writeFailures\":%u},",
+              (unsigned)is.entries, (unsigned)is.capacity, (unsigned)is.boot,
+              (unsigned)is.lastIssued, (unsigned)is.reservedThrough,
+              (unsigned)is.reservations, (unsigned)is.reserveFailures,
+              (unsigned)is.loadUs, (unsigned)is.writes,
+              (unsigned)is.writeFailures);
+  res->printf("\"timelapse\":{\"writes\":%u,\"avgUs\":%u,\"maxUs\":%u},",
+              (unsigned)ss.timelapse.writes, (unsigned)ss.timelapse.avgUs,
+              (unsigned)ss.timelapse.maxUs);
+  res->printf("\"rawLog\":{\"writes\":%u,\"avgUs\":%u,\"maxUs\":%u},",
+              (unsigned)ss.rawLog.writes, (unsigned)ss.rawLog.avgUs,
+              (unsigned)ss.rawLog.maxUs);
+  FrameStore::Stats fs = FrameStore::getStats();
+  res->printf("\"frameStore\":{\"mounted\":%s,\"partitionBytes\":%u,"
+              "\"records\":%u,\"oldestSequence\":%u,\"newestSequence\":%u,"
+              "\"headOffset\":%u,\"sectorErases\":%u,\"wraps\":%u,"
+              "\"checkpoints\":%u,\"recoveryMs\":%u,"
+              "\"recoveredRecords\":%u},",
+              fs.mounted ? "true" : "false", (unsigned)fs.partitionBytes,
+              (unsigned)fs.records, (unsigned)fs.oldestSequence,
+              (unsigned)fs.newestSequence, (unsigned)fs.headOffset,
+              (unsigned)fs.sectorErases, (unsigned)fs.wraps,
+              (unsigned)fs.checkpoints, (unsigned)fs.recoveryMs,
+              (unsigned)fs.recoveredRecords);
+  TimelapseRecorder::Stats ts = TimelapseRecorder::getStats();
+  res->printf("\"segment\":{\"index\":%u,\"frames\":%u,\"bytes\":%u,"
+              "\"closed\":%u,\"recovered\":%u}",
+              (unsigned)ts.segmentIndex, (unsigned)ts.segmentFrames,
+              (unsigned)ts.segmentBytes, (unsigned)ts.segmentsClosed,
+              (unsigned)ts.segmentsRecovered);
+  res->print("},");
+
+  FramePool::Stats ps = FramePool::getStats();
+  res->print("\"framePool\":{");
+  res->printf("\"slots\":%u,", (unsigned)ps.slots);
+  res->printf("\"slotBytes\":%u,", (unsigned)ps.slotBytes);
+  res->printf("\"inUse\":%u,", (unsigned)ps.inUse);
+  res->printf("\"highWater\":%u,", (unsigned)ps.highWater);
+  res->printf("\"acquired\":%u,", (unsigned)ps.acquired);
+  res->printf("\"allocFailures\":%u,", (unsigned)ps.allocFailures);
+  res->printf("\"oversizeFailures\":%u,", (unsigned)ps.oversizeFailures);
+  FrameCache::Stats fc = FrameCache::getStats();
+  res->printf("\"cacheEntries\":%u,", (unsigned)fc.entries);
+  res->printf("\"cacheCapacity\":%u,", (unsigned)fc.capacity);
+  res->printf("\"cachePublished\":%u,", (unsigned)fc.published);
+  res->printf("\"cacheHits\":%u,", (unsigned)fc.hits);
+  res->printf("\"cacheMisses\":%u,", (unsigned)fc.misses);
+  res->printf("\"cacheRetries\":%u", (unsigned)fc.retries);
+  res->print("},");
+
+  HttpCache::Stats hc = HttpCache::getStats();
+  res->printf("\"httpCache\":{\"notModified\":%u,\"partial\":%u,"
+              "\"heads\":%u,\"unsatisfiable\":%u},",
+              (unsigned)hc.notModified, (unsigned)hc.partial,
+              (unsigned)hc.heads, (unsigned)hc.unsatisfiable);
+  FileSender::Stats sender = FileSender::getStats();
+  res->printf("\"fileSender\":{\"blocks\":%u,\"blockBytes\":%u,"
+              "\"inUse\":%u,\"transfers\":%u,\"fallbacks\":%u,"
+              "\"reads\":%u,\"readErrors\":%u,\"lastBytes\":%u,"
+              "\"lastBytesPerSec\":%u,\"peakBytesPerSec\":%u},",
+              (unsigned)sender.blocks, (unsigned)sender.blockBytes,
+              (unsigned)sender.inUse, (unsigned)sender.transfers,
+              (unsigned)sender.fallbacks, (unsigned)sender.reads,
+              (unsigned)sender.readErrors, (unsigned)sender.lastBytes,
+              (unsigned)sender.lastBytesPerSec,
+              (unsigned)sender.peakBytesPerSec);
 }
 
-static void emit_sntp_details(AsyncResponseStream *res) {
-  res->print("\"sntpDetails\":\"enabled (populate SNTP servers here)\",");
+// /i/next counters (see handleNextFrame)
+static std::atomic<uint32_t> nextFrameWaiters{0};
+static std::atomic<uint32_t> nextFrameServed{0};
+static std::atomic<uint32_t> nextFrameTimeouts{0};
+static std::atomic<uint32_t> nextFrameResets{0};
+static std::atomic<uint32_t> nextFrameWoken{0};
+
+static void emit_stream_stats(Print *res) {
+  MjpegStream::Stats ms = MjpegStream::getStats();
+  MjpegStream::ClientStats cs[8];
+  size_t n = MjpegStream::getClientStats(cs, 8);
+  res->print("\"stream\":{");
+  res->printf("\"clients\":%u,", (unsigned)ms.clients);
+  res->printf("\"totalClients\":%u,", (unsigned)ms.totalClients);
+  res->printf("\"framesSent\":%u,", (unsigned)ms.framesSent);
+  res->printf("\"bytesSent\":%llu,", (unsigned long long)ms.bytesSent);
+  res->print("\"perClient\":[");
+  for (size_t i = 0; i < n; i++) {
+    if (i)
+      res->print(",");
+    res->printf("{\"id\":%u,\"framesSent\":%u,\"framesSkipped\":%u,"
+                "\"bytesPerSec\":%u,\"unackedBytes\":%u,\"deferrals\":%u,"
+                "\"fps\":%.1f,\"connectedMs\":%u}",
+                (unsigned)cs[i].id, (unsigned)cs[i].framesSent,
+                (unsigned)cs[i].framesSkipped, (unsigned)cs[i].bytesPerSec,
+                (unsigned)cs[i].unackedBytes, (unsigned)cs[i].deferrals,
+                cs[i].frameGapMs ? 1000.0 / cs[i].frameGapMs : 0.0,
+                (unsigned)cs[i].connectedMs);
+  }
+  res->print("],");
+  res->printf("\"targetFps\":%u,\"pumpWakes\":%u,\"pumpResumes\":%u,",
+              (unsigned)STREAM_TARGET_FPS, (unsigned)ms.pumpWakes,
+              (unsigned)ms.pumpResumes);
+  DeliveryScheduler::Stats ds = DeliveryScheduler::getStats();
+  res->printf("\"inFlightBytes\":%u,", (unsigned)ds.inFlightBytes);
+  res->printf("\"inFlightHighWater\":%u,", (unsigned)ds.inFlightHighWater);
+  res->printf("\"inFlightBudget\":%u,", (unsigned)ds.budgetBytes);
+  res->printf("\"deferredBacklog\":%u,", (unsigned)ds.deferredBacklog);
+  res->printf("\"deferredBudget\":%u,", (unsigned)ds.deferredBudget);
+  res->printf("\"deferredHeap\":%u,", (unsigned)ds.deferredHeap);
+  res->printf("\"framesSkipped\":%u", (unsigned)ds.framesSkipped);
+  res->print("},");
+  res->printf("\"nextFrame\":{\"waiters\":%u,\"served\":%u,"
+              "\"timeouts\":%u,\"resets\":%u,\"woken\":%u},",
+              (unsigned)nextFrameWaiters.load(std::memory_order_relaxed),
+              (unsigned)nextFrameServed.load(std::memory_order_relaxed),
+              (unsigned)nextFrameTimeouts.load(std::memory_order_relaxed),
+              (unsigned)nextFrameResets.load(std::memory_order_relaxed),
+              (unsigned)nextFrameWoken.load(std::memory_order_relaxed));
 }
 
-// Forward declaration for helpers used below (definition appears below)
+static void emit_template_stats(Print *res) {
+  PageTemplate::Stats ts = PageTemplate::getStats();
+  res->printf("\"template\":{\"fromFile\":%s,\"bytes\":%u,\"segments\":%u,"
+              "\"loadUs\":%u,\"renders\":%u,\"avgRenderUs\":%u,"
+              "\"maxRenderUs\":%u},",
+              ts.fromFile ? "true" : "false", (unsigned)ts.templateBytes,
+              (unsigned)ts.segments, (unsigned)ts.loadUs, (unsigned)ts.renders,
+              (unsigned)ts.avgRenderUs, (unsigned)ts.maxRenderUs);
+  AssetBundle::Stats as = AssetBundle::getStats();
+  res->printf("\"assets\":{\"mounted\":%s,\"imageBytes\":%u,\"count\":%u,"
+              "\"firstPaintAssetBytes\":%u,\"served\":%u,"
+              "\"bytesServed\":%u,\"misses\":%u,\"paintReports\":%u,"
+              "\"lastPaintMs\":%u,\"avgPaintMs\":%u,"
+              "\"lastPaintBytes\":%u},",
+              as.mounted ? "true" : "false", (unsigned)as.imageBytes,
+              (unsigned)as.assets, (unsigned)as.firstPaintAssetBytes,
+              (unsigned)as.served, (unsigned)as.bytesServed,
+              (unsigned)as.misses, (unsigned)as.paintReports,
+              (unsigned)as.lastPaintMs, (unsigned)as.avgPaintMs,
+              (unsigned)as.lastPaintBytes);
+}
 
-static void handleJson(AsyncWebServerRequest *request) {
-  AsyncResponseStream *res = request->beginResponseStream("application/json");
-  res->addHeader("Cache-Control", "no-cache");
+static void emit_trace_stats(Print *res) {
+  Trace::Stats ts = Trace::getStats();
+  res->printf("\"trace\":{\"capacityPerCore\":%u,\"recorded\":[%u,%u]},",
+              (unsigned)ts.capacityPerCore, (unsigned)ts.recorded[0],
+              (unsigned)ts.recorded[1]);
+}
 
-  auto kv = [&](const char *k, uint64_t v, bool last = false) {
-    res->print("\"");
-    res->print(k);
-    res->print("\":");
-    res->print(v);
-    if (!last)
-      res->print(",");
-  };
-  auto kvs = [&](const char *k, const char *v, bool last = false) {
-    res->print("\"");
-    res->print(k);
-    res->print("\":\"");
-    res->print(v ? v : "");
-    res->print("\"");
-    if (!last)
-      res->print(",");
-  };
-  auto kvsS = [&](const char *k, const String &v, bool last = false) {
-    res->print("\"");
-    res->print(k);
-    res->print("\":\"");
-    res->print(v);
-    res->print("\"");
-    if (!last)
-      res->print(",");
-  };
+// Status snapshot counters (see STATUS SNAPSHOT below)
+static std::atomic<uint32_t> snapshotBuilds{0};
+static std::atomic<uint32_t> snapshotBusySkips{0};
+static std::atomic<uint32_t> snapshotBuildUs{0};
+static std::atomic<uint32_t> snapshotNotModified{0};
 
-  res->print("{");
+// /events counters (see LIVE EVENTS below)
+static std::atomic<uint32_t> eventsFrames{0};
+static std::atomic<uint32_t> eventsRows{0};
+static std::atomic<uint32_t> eventsFull{0};
+static size_t eventClients();
+
+static void emit_snapshot_stats(Print *res) {
+  res->printf("\"statusSnapshot\":{\"builds\":%u,\"busySkips\":%u,"
+              "\"buildUs\":%u,\"notModified\":%u},",
+              (unsigned)snapshotBuilds.load(std::memory_order_relaxed),
+              (unsigned)snapshotBusySkips.load(std::memory_order_relaxed),
+              (unsigned)snapshotBuildUs.load(std::memory_order_relaxed),
+              (unsigned)snapshotNotModified.load(std::memory_order_relaxed));
+  res->printf("\"events\":{\"clients\":%u,\"frames\":%u,\"rows\":%u,"
+              "\"full\":%u},",
+              (unsigned)eventClients(),
+              (unsigned)eventsFrames.load(std::memory_order_relaxed),
+              (unsigned)eventsRows.load(std::memory_order_relaxed),
+              (unsigned)eventsFull.load(std::memory_order_relaxed));
+}
+
+static void emit_freertos_stats(Print *res) {
+  TaskStats::Summary sum = TaskStats::getSummary();
+  TaskStats::Task tasks[TaskStats::MAX_TASKS];
+  size_t n = TaskStats::getTasks(tasks, TaskStats::MAX_TASKS);
+  res->printf("\"freertosStats\":{\"runTimeStats\":%s,\"windowMs\":%u,"
+              "\"coreLoad\":[",
+              sum.runTimeStats ? "true" : "false", (unsigned)sum.windowMs);
+  for (size_t c = 0; c < TaskStats::MAX_CORES; c++)
+    res->printf("%s%u.%u", c ? "," : "", sum.coreLoadPermille[c] / 10,
+                sum.coreLoadPermille[c] % 10);
+  res->print("],\"tasks\":[");
+  for (size_t i = 0; i < n; i++) {
+    const TaskStats::Task &t = tasks[i];
+    res->printf("%s{\"name\":\"%s\",\"core\":%d,\"priority\":%u,"
+                "\"state\":\"%s\",\"cpu\":%u.%u,\"stackFree\":%u}",
+                i ? "," : "", t.name, (int)t.core, (unsigned)t.priority,
+                t.state, t.cpuPermille / 10, t.cpuPermille % 10,
+                (unsigned)t.stackFree);
+  }
+  res->print("]},");
+}
+
+static void emit_sntp_details(Print *res) {
+  res->print("\"sntpDetails\":\"enabled (populate SNTP servers here)\",");
+}
+
+// JSON member writers; `last` omits the trailing comma
+static void kv(Print *res, const char *k, uint64_t v, bool last = false) {
+  res->print("\"");
+  res->print(k);
+  res->print("\":");
+  res->print(v);
+  if (!last)
+    res->print(",");
+}
+
+static void kvs(Print *res, const char *k, const char *v, bool last = false) {
+  res->print("\"");
+  res->print(k);
+  res->print("\":\"");
+  res->print(v ? v : "");
+  res->print("\"");
+  if (!last)
+    res->print(",");
+}
 
+static void kvsS(Print *res, const char *k, const String &v,
+                 bool last = false) {
+  kvs(res, k, v.c_str(), last);
+}
+
+// JSON members that cannot change until reboot (chip, build, reset reason)
+static void buildChipJson(Print *res) {
   esp_chip_info_t chip;
   esp_chip_info(&chip);
-  kvs("chipModel", "ESP32-S3");
-  kv("chipRevision", chip.revision);
-  kv("chipCores", chip.cores);
-  kvs("idfVersion", esp_get_idf_version());
-  kvs("arduinoSdk", ESP.getSdkVersion());
-  kv("cpuFreqMHz", ESP.getCpuFreqMHz());
+  kvs(res, "chipModel", "ESP32-S3");
+  kv(res, "chipRevision", chip.revision);
+  kv(res, "chipCores", chip.cores);
+  kvs(res, "idfVersion", esp_get_idf_version());
+  kvs(res, "arduinoSdk", ESP.getSdkVersion());
+  kv(res, "cpuFreqMHz", ESP.getCpuFreqMHz());
 
   const esp_app_desc_t *app = esp_app_get_description();
-  kvs("appProjectName", app ? app->project_name : "");
-  kvs("appVersion", app ? app->version : "");
-  kvs("appBuildDate", app ? app->date : "");
-  kvs("appBuildTime", app ? app->time : "");
-  kvsS("sketchMD5", ESP.getSketchMD5());
-
-  kv("resetReason", (int)esp_reset_reason());
-  kv("espTimer_us", (uint64_t)esp_timer_get_time());
-  kvs("uptime", uptimeStr().c_str());
-
-  kv("heapFree", ESP.getFreeHeap());
-  kv("heapMinFreeEver", ESP.getMinFreeHeap());
-  kv("heapMaxAlloc", ESP.getMaxAllocHeap());
-  kv("heapIntFree", heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
-  kv("heapSPIRAM_Free", heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
-  kv("psramSize", ESP.getPsramSize());
-  kv("psramFree", ESP.getFreePsram());
-  kv("psramMinFreeEver", ESP.getMinFreePsram());
+  kvs(res, "appProjectName", app ? app->project_name : "");
+  kvs(res, "appVersion", app ? app->version : "");
+  kvs(res, "appBuildDate", app ? app->date : "");
+  kvs(res, "appBuildTime", app ? app->time : "");
+  kvsS(res, "sketchMD5", ESP.getSketchMD5());
+
+  kv(res, "resetReason", (int)esp_reset_reason());
+}
 
+// Static JSON members: flash chip, partition table, OTA slots
+static void buildFlashJson(Print *res) {
   uint32_t fsize = 0, fid = 0;
   esp_flash_get_size(nullptr, &fsize);
-  kv("flashSize", (uint64_t)fsize);
-  kv("flashSpeedHz", ESP.getFlashChipSpeed());
-  kv("flashMode", ESP.getFlashChipMode());
+  kv(res, "flashSize", (uint64_t)fsize);
+  kv(res, "flashSpeedHz", ESP.getFlashChipSpeed());
+  kv(res, "flashMode", ESP.getFlashChipMode());
   esp_flash_read_id(nullptr, &fid);
-  kv("flashJedecID", fid);
+  kv(res, "flashJedecID", fid);
 
   res->print("\"partitions\":[");
   const esp_partition_t *p = nullptr;
@@ -283,11 +756,11 @@ static void handleJson(AsyncWebServerRequest *request) {
     first = false;
     pcount++;
     res->print("{");
-    kvs("label", p->label);
-    kv("type", p->type);
-    kv("subtype", p->subtype);
-    kv("address", (uint32_t)p->address);
-    kv("size", (uint32_t)p->size, /*last=*/true);
+    kvs(res, "label", p->label);
+    kv(res, "type", p->type);
+    kv(res, "subtype", p->subtype);
+    kv(res, "address", (uint32_t)p->address);
+    kv(res, "size", (uint32_t)p->size, /*last=*/true);
     res->print("}");
     it = esp_partition_next(it);
   }
@@ -322,47 +795,402 @@ static void handleJson(AsyncWebServerRequest *request) {
     res->print("\"");
   }
   res->print("},");
+}
+
+static String staticChipJson; // built once by the sampler
+static String staticFlashJson;
 
-  kvsS("ssid", WiFi.SSID());
-  kv("rssi", WiFi.RSSI());
-  kv("channel", WiFi.channel());
-  kvsS("mac", WiFi.macAddress());
-  kvsS("bssid", WiFi.BSSIDstr());
-  kvs("hostname", WiFi.getHostname() ? WiFi.getHostname() : "");
-  kvsS("ip", WiFi.localIP().toString());
-  kvsS("gateway", WiFi.gatewayIP().toString());
-  kvsS("subnet", WiFi.subnetMask().toString());
-  kvsS("dns", WiFi.dnsIP().toString());
+static void buildJson(Print *res) {
+  res->print("{");
+  res->print(staticChipJson);
+  kv(res, "espTimer_us", (uint64_t)esp_timer_get_time());
+  kvs(res, "uptime", uptimeStr().c_str());
+
+  kv(res, "heapFree", ESP.getFreeHeap());
+  kv(res, "heapMinFreeEver", ESP.getMinFreeHeap());
+  kv(res, "heapMaxAlloc", ESP.getMaxAllocHeap());
+  kv(res, "heapIntFree", heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+  kv(res, "heapSPIRAM_Free", heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+  kv(res, "psramSize", ESP.getPsramSize());
+  kv(res, "psramFree", ESP.getFreePsram());
+  kv(res, "psramMinFreeEver", ESP.getMinFreePsram());
+
+  res->print(staticFlashJson);
 
-  kvs("mdnsHostname", MDNS_HOSTNAME);
+  kvsS(res, "ssid", WiFi.SSID());
+  kv(res, "rssi", WiFi.RSSI());
+  kv(res, "channel", WiFi.channel());
+  kvsS(res, "mac", WiFi.macAddress());
+  kvsS(res, "bssid", WiFi.BSSIDstr());
+  kvs(res, "hostname", WiFi.getHostname() ? WiFi.getHostname() : "");
+  kvsS(res, "ip", WiFi.localIP().toString());
+  kvsS(res, "gateway", WiFi.gatewayIP().toString());
+  kvsS(res, "subnet", WiFi.subnetMask().toString());
+  kvsS(res, "dns", WiFi.dnsIP().toString());
+
+  kvs(res, "mdnsHostname", MDNS_HOSTNAME);
 
   // FFat filesystem details
-  if (FFat.begin()) {
-    kvs("ffatMounted", "true");
-    kv("ffatTotalBytes", (uint64_t)FFat.totalBytes());
-    kv("ffatUsedBytes", (uint64_t)FFat.usedBytes());
-    kv("ffatFreeBytes", (uint64_t)(FFat.totalBytes() - FFat.usedBytes()));
+  if (FFat.totalBytes() > 0) {
+    kvs(res, "ffatMounted", "true");
+    kv(res, "ffatTotalBytes", (uint64_t)FFat.totalBytes());
+    kv(res, "ffatUsedBytes", (uint64_t)FFat.usedBytes());
+    kv(res, "ffatFreeBytes", (uint64_t)(FFat.totalBytes() - FFat.usedBytes()));
   } else {
-    kvs("ffatMounted", "false");
+    kvs(res, "ffatMounted", "false");
   }
 
   emit_lwip_stats(res);
+  emit_pipeline_stats(res);
+  emit_stream_stats(res);
+  emit_template_stats(res);
+  emit_snapshot_stats(res);
+  emit_trace_stats(res);
   emit_freertos_stats(res);
   emit_sntp_details(res);
 
-  kv("flashEncryptionEnabled", 0);
+  kv(res, "flashEncryptionEnabled", 0);
 
   uint8_t mac[6] = {0};
   esp_read_mac(mac, ESP_MAC_WIFI_STA);
   char macf[18];
   snprintf(macf, sizeof(macf), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1],
            mac[2], mac[3], mac[4], mac[5]);
-  kvs("efuseMAC_FACTORY", macf, /*last=*/true);
+  kvs(res, "efuseMAC_FACTORY", macf, /*last=*/true);
 
   res->print("}");
+}
+
+// ===== STATUS SNAPSHOT =====
+// A sampler task rebuilds /json and the status rows every
+// TELEMETRY_INTERVAL_MS into the back buffer of a pair, then flips it to
+// the front. Handlers only copy bytes out of the front buffer, so polling
+// cost no longer depends on how many tabs are open.
+struct StatusSnapshot {
+  mutable std::atomic<uint32_t> pins{0}; // responses still reading it
+  uint32_t version = 0;
+  String json;
+  String tbody; // "<tbody>...</tbody>"
+};
+
+using SnapshotRef = std::shared_ptr<const StatusSnapshot>;
+
+static StatusSnapshot snapshots[2];
+static portMUX_TYPE snapshotMux = portMUX_INITIALIZER_UNLOCKED;
+static StatusSnapshot *frontSnapshot = nullptr; // guarded by snapshotMux
+
+// Adapts Print output onto a String so the builders can target either
+class StringPrint : public Print {
+public:
+  explicit StringPrint(String &s) : out(s) {}
+  size_t write(uint8_t c) override {
+    out += (char)c;
+    return 1;
+  }
+  size_t write(const uint8_t *buf, size_t len) override {
+    out.concat((const char *)buf, len);
+    return len;
+  }
+
+private:
+  String &out;
+};
+
+static SnapshotRef pinSnapshot() {
+  portENTER_CRITICAL(&snapshotMux);
+  StatusSnapshot *s = frontSnapshot;
+  if (s)
+    s->pins.fetch_add(1, std::memory_order_relaxed);
+  portEXIT_CRITICAL(&snapshotMux);
+  if (!s)
+    return nullptr;
+  return SnapshotRef(s, [](const StatusSnapshot *p) {
+    p->pins.fetch_sub(1, std::memory_order_release);
+  });
+}
+
+static void pushStatus(const StatusSnapshot *previous,
+                       const StatusSnapshot &next);
+
+static void sampleStatus() {
+  if (staticChipRows.isEmpty()) {
+    buildChipRowsHtml(staticChipRows);
+    buildFlashRowsHtml(staticFlashRows);
+    StringPrint chip(staticChipJson), flash(staticFlashJson);
+    buildChipJson(&chip);
+    buildFlashJson(&flash);
+  }
+
+  // Only the buffer that isn't published can be rebuilt, and only once no
+  // slow client is still streaming it out
+  portENTER_CRITICAL(&snapshotMux);
+  StatusSnapshot *back =
+      frontSnapshot == &snapshots[0] ? &snapshots[1] : &snapshots[0];
+  bool busy = back->pins.load(std::memory_order_acquire) != 0;
+  uint32_t version = frontSnapshot ? frontSnapshot->version + 1 : 1;
+  portEXIT_CRITICAL(&snapshotMux);
+  if (busy) {
+    snapshotBusySkips.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  int64_t start = esp_timer_get_time();
+  TaskStats::sample(); // window = time since the previous snapshot
+  // Assigning keeps each String's capacity, so steady state allocates little
+  {
+    Trace::Span span("json_build");
+    back->json = "";
+    StringPrint json(back->json);
+    buildJson(&json);
+  }
+  {
+    Trace::Span span("rows_build");
+    back->tbody = F("<tbody>");
+    buildStatusRowsHtml(back->tbody);
+    back->tbody += F("</tbody>");
+  }
+  back->version = version;
+  snapshotBuildUs.store((uint32_t)(esp_timer_get_time() - start),
+                        std::memory_order_relaxed);
+  snapshotBuilds.fetch_add(1, std::memory_order_relaxed);
+
+  portENTER_CRITICAL(&snapshotMux);
+  const StatusSnapshot *previous = frontSnapshot;
+  frontSnapshot = back;
+  portEXIT_CRITICAL(&snapshotMux);
+
+  // The old front is only ever rebuilt by this task, so it can be read here
+  pushStatus(previous, *back);
+}
+
+// ===== LIVE EVENTS =====
+// /events (server-sent events) announces each cached frame ("frame") and,
+// after every snapshot, only the status cells that changed ("rows"). A
+// client connecting, or a change in the row layout, gets the whole tbody
+// ("status"). Broadcasts only happen on the sampler task.
+static AsyncEventSource events("/events");
+static TaskHandle_t samplerTask = nullptr;
+static uint32_t announcedSequence = 0; // sampler task only
+
+static void resumeNextFrames(); // /i/next long-polls waiting for a frame
+
+static size_t eventClients() { return events.count(); }
+
+// One top-level row of a status tbody: <tr><td>key</td><td ...>…</td></tr>
+struct RowSpan {
+  int keyStart, keyEnd;   // key text
+  int cellStart, cellEnd; // the whole value <td>, end exclusive
+};
+
+// Finds the row at or after `from`, skipping rows of nested tables
+static bool nextRow(const String &html, int from, RowSpan &row) {
+  int tr = html.indexOf("<tr><td>", from);
+  if (tr < 0)
+    return false;
+  row.keyStart = tr + 8;
+  row.keyEnd = html.indexOf("</td>", row.keyStart);
+  if (row.keyEnd < 0)
+    return false;
+  row.cellStart = row.keyEnd + 5;
+
+  int depth = 0;
+  int pos = row.cellStart;
+  for (;;) {
+    int end = html.indexOf("</td></tr>", pos);
+    if (end < 0)
+      return false;
+    int open = html.indexOf("<table", pos);
+    int close = html.indexOf("</table>", pos);
+    if (open >= 0 && open < end && (close < 0 || open < close)) {
+      depth++;
+      pos = open + 6;
+    } else if (close >= 0 && close < end) {
+      depth--;
+      pos = close + 8;
+    } else if (depth == 0) {
+      row.cellEnd = end + 5;
+      return true;
+    } else {
+      pos = end + 10; // end of a nested row
+    }
+  }
+}
+
+static void appendJsonString(String &out, const char *s, size_t len) {
+  out += '"';
+  for (size_t i = 0; i < len; i++) {
+    char c = s[i];
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if ((uint8_t)c < 0x20) {
+      char esc[8];
+      snprintf(esc, sizeof(esc), "\\u%04x", (unsigned)c);
+      out += esc;
+    } else {
+      out += c;
+    }
+  }
+  out += '"';
+}
+
+// {"key":"<td…>…</td>",…} for the cells of `after` that differ from
+// `before`; false if the rows themselves differ
+static bool diffRows(const String &before, const String &after, String &json) {
+  json = "{";
+  bool first = true;
+  RowSpan a, b;
+  int pa = 0, pb = 0;
+  for (;;) {
+    bool hasA = nextRow(before, pa, a);
+    bool hasB = nextRow(after, pb, b);
+    if (hasA != hasB)
+      return false;
+    if (!hasA)
+      break;
+    int keyLen = a.keyEnd - a.keyStart;
+    if (keyLen != b.keyEnd - b.keyStart ||
+        memcmp(before.c_str() + a.keyStart, after.c_str() + b.keyStart,
+               keyLen) != 0)
+      return false;
+    int cellLen = b.cellEnd - b.cellStart;
+    if (cellLen != a.cellEnd - a.cellStart ||
+        memcmp(before.c_str() + a.cellStart, after.c_str() + b.cellStart,
+               cellLen) != 0) {
+      if (!first)
+        json += ',';
+      first = false;
+      appendJsonString(json, after.c_str() + b.keyStart, keyLen);
+      json += ':';
+      appendJsonString(json, after.c_str() + b.cellStart, cellLen);
+    }
+    pa = a.cellEnd + 5; // past "</tr>"
+    pb = b.cellEnd + 5;
+  }
+  json += '}';
+  return true;
+}
+
+static void formatFrameEvent(char *buf, size_t size, const FrameRef &frame) {
+  snprintf(buf, size, "{\"seq\":%lu,\"bytes\":%u}",
+           (unsigned long)frame.sequence(), (unsigned)frame.size());
+}
+
+static void pushFrame() {
+  FrameRef frame = FrameCache::latest();
+  if (!frame || frame.sequence() == announcedSequence)
+    return;
+  announcedSequence = frame.sequence();
+  if (events.count() == 0)
+    return;
+  char msg[48];
+  formatFrameEvent(msg, sizeof(msg), frame);
+  events.send(msg, "frame");
+  eventsFrames.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void pushStatus(const StatusSnapshot *previous,
+                       const StatusSnapshot &next) {
+  if (events.count() == 0)
+    return;
+  static String delta; // keeps its capacity between snapshots
+  if (previous && diffRows(previous->tbody, next.tbody, delta)) {
+    if (delta.length() > 2) {
+      events.send(delta.c_str(), "rows");
+      eventsRows.fetch_add(1, std::memory_order_relaxed);
+    }
+    return;
+  }
+  events.send(next.tbody.c_str(), "status");
+  eventsFull.fetch_add(1, std::memory_order_relaxed);
+}
+
+// A new client gets the current tbody and frame, then deltas from there
+static void onEventsConnect(AsyncEventSourceClient *client) {
+  SnapshotRef snap = pinSnapshot();
+  if (snap)
+    client->send(snap->tbody.c_str(), "status");
+  FrameRef frame = FrameCache::latest();
+  if (frame) {
+    char msg[48];
+    formatFrameEvent(msg, sizeof(msg), frame);
+    client->send(msg, "frame");
+  }
+}
+
+void announceFrame() {
+  MjpegStream::wake();
+  if (samplerTask)
+    xTaskNotifyGive(samplerTask);
+}
+
+// Snapshot every TELEMETRY_INTERVAL_MS; announceFrame() wakes it in between
+static void statusSamplerTask(void *parameter) {
+  uint32_t nextSample = millis();
+  for (;;) {
+    int32_t wait = (int32_t)(nextSample - millis());
+    if (wait <= 0) {
+      sampleStatus();
+      nextSample += TELEMETRY_INTERVAL_MS;
+      if ((int32_t)(nextSample - millis()) < 0)
+        nextSample = millis() + TELEMETRY_INTERVAL_MS; // fell behind
+      continue;
+    }
+    if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait))) {
+      resumeNextFrames();
+      pushFrame();
+    }
+  }
+}
+
+// Serve one part of the current snapshot; the ETag is the snapshot version,
+// so a poll within the same interval is answered with a bodiless 304
+static void sendSnapshot(AsyncWebServerRequest *request, const char *type,
+                         String StatusSnapshot::*part) {
+  SnapshotRef snap = pinSnapshot();
+  if (!snap) {
+    AsyncWebServerResponse *res =
+        request->beginResponse(503, "text/plain", "Status not sampled yet");
+    res->addHeader("Retry-After", "1");
+    request->send(res);
+    return;
+  }
+
+  // Versions restart at every boot; the boot counter keeps a validator
+  // from before a reset from matching different content
+  char etag[28];
+  snprintf(etag, sizeof(etag), "\"s%lu-%lu\"",
+           (unsigned long)FrameIndex::boot(), (unsigned long)snap->version);
+  AsyncWebHeader *inm = request->getHeader("If-None-Match");
+  if (inm && inm->value() == etag) {
+    snapshotNotModified.fetch_add(1, std::memory_order_relaxed);
+    AsyncWebServerResponse *res = request->beginResponse(304);
+    res->addHeader("ETag", etag);
+    res->addHeader("Cache-Control", "no-cache");
+    request->send(res);
+    return;
+  }
+
+  AsyncWebServerResponse *res = request->beginResponse(
+      type, ((*snap).*part).length(),
+      [snap, part](uint8_t *buf, size_t maxLen, size_t index) -> size_t {
+        const String &body = (*snap).*part;
+        size_t n = body.length() - index;
+        if (n > maxLen)
+          n = maxLen;
+        memcpy(buf, body.c_str() + index, n);
+        Metrics::bytesServed.add(n);
+        return n;
+      });
+  res->addHeader("ETag", etag);
+  res->addHeader("Cache-Control", "no-cache");
   request->send(res);
 }
 
+static void handleJson(AsyncWebServerRequest *request) {
+  sendSnapshot(request, "application/json", &StatusSnapshot::json);
+}
+
 static void handleFavicon(AsyncWebServerRequest *request) {
   request->send(204);
 }
@@ -425,111 +1253,882 @@ static String htmlEscape(const String &in) {
 
 // Return a full <tbody>...</tbody> snapshot for client hydration
 static void handleStatusTbody(AsyncWebServerRequest *request) {
+  sendSnapshot(request, "text/html; charset=utf-8", &StatusSnapshot::tbody);
+}
+
+static void writePageSlot(Print &out, PageTemplate::Slot slot) {
+  switch (slot) {
+  case PageTemplate::Slot::Title:
+  case PageTemplate::Slot::Heading:
+    out.print(F("ESP32-S3 Camera"));
+    break;
+  case PageTemplate::Slot::Help:
+    out.print(F("ESP diagnostics at time of load."));
+    break;
+  case PageTemplate::Slot::StatusRows: {
+    // Rows only, without the snapshot's <tbody> wrapper
+    SnapshotRef snap = pinSnapshot();
+    const size_t wrap = strlen("<tbody>");
+    if (snap && snap->tbody.length() >= 2 * wrap + 1)
+      out.write((const uint8_t *)snap->tbody.c_str() + wrap,
+                snap->tbody.length() - 2 * wrap - 1);
+    break;
+  }
+  case PageTemplate::Slot::RefreshSeconds: {
+    int refresh = PAGE_REFRESH_SECONDS;
+    if (refresh < 1)
+      refresh = 1; // never emit 0; minimum 1s
+    out.print(refresh);
+    break;
+  }
+  }
+}
+
+static void handlePrefilled(AsyncWebServerRequest *request) {
   auto *res = request->beginResponseStream("text/html; charset=utf-8");
   res->addHeader("Cache-Control", "no-cache");
-  String rows;
-  rows.reserve(4096);
-  buildStatusRowsHtml(rows);
-  res->print(F("<tbody>"));
-  res->print(rows);
-  res->print(F("</tbody>"));
+  PageTemplate::render(*res, writePageSlot);
   request->send(res);
 }
 
-static void handlePrefilled(AsyncWebServerRequest *request) {
-  auto *res = request->beginResponseStream("text/html; charset=utf-8");
+// Current storage mode; only POST changes it
+static void handleRecordingMode(AsyncWebServerRequest *request) {
+  request->send(200, "application/json",
+                String("{\"mode\":\"") +
+                    recordingModeName(StorageWriter::getMode()) + "\"}");
+}
+
+// POST /recording?mode=files|timelapse|raw switches between per-file,
+// timelapse-segment and raw-log storage at runtime
+static void handleSetRecordingMode(AsyncWebServerRequest *request) {
+  AsyncWebParameter *p = request->getParam("mode");
+  if (p && p->value() == "timelapse")
+    StorageWriter::setMode(RecordingMode::Timelapse);
+  else if (p && p->value() == "files")
+    StorageWriter::setMode(RecordingMode::PerFile);
+  else if (p && p->value() == "raw")
+    StorageWriter::setMode(RecordingMode::RawLog);
+  else {
+    request->send(400, "text/plain", "mode must be files, timelapse or raw");
+    return;
+  }
+  handleRecordingMode(request);
+}
+
+// List timelapse segments; each one downloads as a single .avi from /r
+static void handleRecordingList(AsyncWebServerRequest *request) {
+  auto *res = request->beginResponseStream("application/json");
   res->addHeader("Cache-Control", "no-cache");
+  String current = TimelapseRecorder::currentPath();
+  res->print("[");
+  File dir = FFat.open(RECORDING_DIR);
+  bool first = true;
+  if (dir && dir.isDirectory()) {
+    for (File f = dir.openNextFile(); f; f = dir.openNextFile()) {
+      String path = String(RECORDING_DIR) + "/" + f.name();
+      if (!first)
+        res->print(",");
+      first = false;
+      res->printf("{\"path\":\"%s\",\"bytes\":%u,\"recording\":%s}",
+                  path.c_str(), (unsigned)f.size(),
+                  path == current ? "true" : "false");
+      f.close();
+    }
+    dir.close();
+  }
+  res->print("]");
+  request->send(res);
+}
 
-  // Load template HTML from FFat
-  String html;
-  File f = FFat.open("/index.html", "r");
-  if (f) {
-    Serial.printf("Loading template from FFat, size: %d bytes\n", f.size());
-    html.reserve((size_t)f.size() + 4096);
-    while (f.available())
-      html += (char)f.read();
-    f.close();
-    Serial.println("Template loaded successfully from FFat");
+// Paginated per-file history from the persistent index (newest first):
+// /history?before=<seq>&limit=<n>. "next" is the cursor for the next page.
+static void handleHistory(AsyncWebServerRequest *request) {
+  uint32_t before = 0;
+  size_t limit = HISTORY_PAGE_MAX;
+  if (AsyncWebParameter *p = request->getParam("before"))
+    before = strtoul(p->value().c_str(), nullptr, 10);
+  if (AsyncWebParameter *p = request->getParam("limit")) {
+    long n = p->value().toInt();
+    if (n > 0 && n < (long)limit)
+      limit = n;
+  }
+
+  std::unique_ptr<FrameIndex::Entry[]> entries(new FrameIndex::Entry[limit]);
+  size_t n = FrameIndex::page(before, entries.get(), limit);
+
+  auto *res = request->beginResponseStream("application/json");
+  res->addHeader("Cache-Control", "no-cache");
+  res->print("{\"items\":[");
+  for (size_t i = 0; i < n; i++) {
+    const FrameIndex::Entry &e = entries[i];
+    res->printf("%s{\"seq\":%u,\"boot\":%u,\"ms\":%u,"
+                "\"confirmedMs\":%u,\"bytes\":%u,\"crc\":\"%08x\","
+                "\"url\":\"%s\"}",
+                i ? "," : "", (unsigned)e.sequence, (unsigned)e.boot,
+                (unsigned)e.timestamp, (unsigned)e.confirmed, (unsigned)e.size,
+                (unsigned)e.crc, FrameIndex::pathFor(e.sequence).c_str());
+  }
+  if (n == limit)
+    res->printf("],\"next\":%u}", (unsigned)entries[n - 1].sequence);
+  else
+    res->print("],\"next\":null}");
+  request->send(res);
+}
+
+// Stream a cached frame from PSRAM. The filler lambda holds a FrameRef, so
+// the slot stays valid until the response is destroyed.
+static void sendCachedFrame(AsyncWebServerRequest *request,
+                            const FrameRef &frame, bool immutable = false) {
+  // Same validator as a stored copy of the frame: sequence plus CRC
+  char etag[24];
+  snprintf(etag, sizeof(etag), "\"%lu-%08lx\"",
+           (unsigned long)frame.sequence(), (unsigned long)frame.crc());
+  // An exact frame never changes; otherwise revalidate, and the ETag makes
+  // an unchanged frame a bodiless 304
+  HttpCache::Resource r = {frame.size(), "image/jpeg", etag, 0,
+                           immutable ? "public, max-age=31536000, immutable"
+                                     : "no-cache"};
+  HttpCache::Body body;
+  if (!HttpCache::begin(request, r, body))
+    return;
+
+  AsyncWebServerResponse *res = new HttpCache::Ranged<AsyncCallbackResponse>(
+      "image/jpeg", body.length,
+      [frame, body](uint8_t *buf, size_t maxLen, size_t index) -> size_t {
+        size_t n = body.length - index;
+        if (n > maxLen)
+          n = maxLen;
+        memcpy(buf, frame.data() + body.offset + index, n);
+        Metrics::bytesServed.add(n);
+        return n;
+      });
+  HttpCache::finish(request, res, r, body);
+}
+
+// Per-file history frames (/i/img_<seq>.jpg, also under /photos). The file
+// stays pinned for as long as the response exists, so the storage writer
+// puts off deleting an evicted frame until its last download is done.
+struct FilePin {
+  explicit FilePin(uint32_t sequence) : sequence(sequence) {}
+  FilePin(const FilePin &) = delete;
+  FilePin &operator=(const FilePin &) = delete;
+  ~FilePin() { StorageWriter::unpinFile(sequence); }
+  const uint32_t sequence;
+};
+
+static void handleHistoryFile(AsyncWebServerRequest *request) {
+  const char *prefix = strrchr(IMAGE_PATH_PREFIX, '/');
+  prefix = prefix ? prefix + 1 : IMAGE_PATH_PREFIX;
+  const char *name = strrchr(request->url().c_str(), '/');
+  name = name ? name + 1 : request->url().c_str();
+  char *end = nullptr;
+  uint32_t sequence = 0;
+  if (strncmp(name, prefix, strlen(prefix)) == 0)
+    sequence = strtoul(name + strlen(prefix), &end, 10);
+  FrameIndex::Entry entry;
+  if (!sequence || strcmp(end, IMAGE_PATH_SUFFIX) != 0 ||
+      !FrameIndex::find(sequence, entry)) {
+    request->send(404, "text/plain", "Frame no longer stored");
+    return;
+  }
+
+  if (!StorageWriter::pinFile(sequence)) {
+    // Being deleted right now, or too many downloads at once
+    AsyncWebServerResponse *res =
+        request->beginResponse(503, "text/plain", "Frame busy");
+    res->addHeader("Retry-After", "1");
+    request->send(res);
+    return;
+  }
+  auto pin = std::make_shared<FilePin>(sequence);
+  File file = FFat.open(FrameIndex::pathFor(sequence), "r");
+  if (!file) {
+    request->send(404, "text/plain", "Frame no longer stored");
+    return;
+  }
+
+  // Same validator as the raw log: sequence plus CRC of the JPEG
+  char etag[24];
+  snprintf(etag, sizeof(etag), "\"%lu-%08lx\"", (unsigned long)sequence,
+           (unsigned long)entry.crc);
+  HttpCache::Resource r = {file.size(), "image/jpeg", etag,
+                           file.getLastWrite(),
+                           "public, max-age=31536000, immutable"};
+  HttpCache::Body body;
+  if (!HttpCache::begin(request, r, body))
+    return;
+  HttpCache::finish(request,
+                    FileSender::beginResponse(file, r.contentType, body.offset,
+                                              body.length, pin),
+                    r, body);
+}
+
+// Timelapse segments under /r. The open one keeps growing, so no caching;
+// its length is whatever had been written when the request arrived, and
+// the size in its ETag makes a resume of a stale copy start over.
+static void handleRecordingFile(AsyncWebServerRequest *request) {
+  const String &url = request->url();
+  String name = url.substring(url.lastIndexOf('/') + 1);
+  if (name.length() == 0 || name.indexOf("..") >= 0) {
+    request->send(404, "text/plain", "Not found");
+    return;
+  }
+  File file = FFat.open(String(RECORDING_DIR) + "/" + name, "r");
+  if (!file || file.isDirectory()) {
+    request->send(404, "text/plain", "Not found");
+    return;
+  }
+
+  time_t modified = file.getLastWrite();
+  char etag[24];
+  snprintf(etag, sizeof(etag), "\"%lx-%lx\"", (unsigned long)file.size(),
+           (unsigned long)modified);
+  HttpCache::Resource r = {
+      file.size(),
+      name.endsWith(".avi") ? "video/x-msvideo" : "application/octet-stream",
+      etag, modified, "no-cache"};
+  HttpCache::Body body;
+  if (!HttpCache::begin(request, r, body))
+    return;
+  HttpCache::finish(request,
+                    FileSender::beginResponse(file, r.contentType, body.offset,
+                                              body.length),
+                    r, body);
+}
+
+// Serve a frame from the raw log: ?seq=N, newest when omitted. Records are
+// immutable once written, so the sequence+CRC ETag can be cached for good.
+static void handleStoredFrame(AsyncWebServerRequest *request) {
+  FrameStore::Record rec;
+  AsyncWebParameter *p = request->getParam("seq");
+  bool found = p ? FrameStore::find(strtoul(p->value().c_str(), nullptr, 10),
+                                    rec)
+                 : FrameStore::latest(rec);
+  if (!found) {
+    request->send(404, "text/plain", "Frame not in store");
+    return;
+  }
+
+  char etag[24];
+  snprintf(etag, sizeof(etag), "\"%lu-%08lx\"", (unsigned long)rec.sequence,
+           (unsigned long)rec.crc);
+  HttpCache::Resource r = {rec.length, "image/jpeg", etag, 0,
+                           p ? "public, max-age=31536000, immutable"
+                             : "no-cache"};
+  HttpCache::Body body;
+  if (!HttpCache::begin(request, r, body))
+    return;
+
+  AsyncWebServerResponse *res = new HttpCache::Ranged<AsyncCallbackResponse>(
+      "image/jpeg", body.length,
+      [rec, body](uint8_t *buf, size_t maxLen, size_t index) -> size_t {
+        size_t n = body.length - index;
+        if (n > maxLen)
+          n = maxLen;
+        // A record recycled mid-response ends the body early
+        if (!FrameStore::read(rec, body.offset + index, buf, n))
+          return 0;
+        Metrics::bytesServed.add(n);
+        return n;
+      });
+  HttpCache::finish(request, res, r, body);
+}
+
+// External capture trigger (layer change); the frame is stored at once
+static void handleTrigger(AsyncWebServerRequest *request) {
+  if (CaptureScheduler::trigger(CaptureScheduler::Source::Http))
+    request->send(202, "text/plain", "Capture triggered");
+  else
+    request->send(429, "text/plain", "Too soon after the last trigger");
+}
+
+// Newest frame; ?seq=N (from a "frame" event) names one exactly, which can
+// then be cached for good while it is still in the PSRAM cache. Sequences
+// are never reused across reboots, so N can't name another frame later.
+static void handleLatestFrame(AsyncWebServerRequest *request) {
+  if (AsyncWebParameter *p = request->getParam("seq")) {
+    uint32_t seq = strtoul(p->value().c_str(), nullptr, 10);
+    FrameRef exact = FrameCache::find(seq);
+    if (exact) {
+      sendCachedFrame(request, exact, true);
+      return;
+    }
+  }
+  FrameRef frame = FrameCache::latest();
+  if (!frame) {
+    request->send(404, "text/plain", "Camera not available");
+    return;
+  }
+  sendCachedFrame(request, frame);
+}
+
+// Long-poll for the next frame. Nothing is written until a frame newer
+// than `after` is cached or the timeout passes, and only then are the
+// status line and headers chosen. A waiting response is listed in
+// `nextFrameWaiting`; announceFrame() wakes the sampler task, which resumes
+// them all as soon as a frame is published. The server's own re-poll
+// (about every 500 ms via AsyncTCP, through _ack()) catches the timeout.
+//
+// nextFrameLock is held for every callback, for the resume and around
+// changes to the list, so a response is only ever driven by one task at a
+// time. The request outlives its response, and the response leaves the
+// list in its destructor, so a listed response's request and AsyncClient
+// are still there while the lock is held. As for /stream, the AsyncClient
+// calls the sampler makes (space(), add(), send()) are the ones AsyncTCP
+// already takes from tasks other than lwIP's: writes are passed to the
+// lwIP thread, which refuses them once the connection is gone.
+class NextFrameResponse;
+static SemaphoreHandle_t nextFrameLock = nullptr;
+static std::vector<NextFrameResponse *> nextFrameWaiting;
+
+struct NextFrameLock {
+  NextFrameLock() { xSemaphoreTakeRecursive(nextFrameLock, portMAX_DELAY); }
+  ~NextFrameLock() { xSemaphoreGiveRecursive(nextFrameLock); }
+};
+
+class NextFrameResponse : public AsyncAbstractResponse {
+public:
+  NextFrameResponse(uint32_t after, uint32_t timeoutMs)
+      : after(after), timeoutMs(timeoutMs), startMs(millis()) {
+    nextFrameWaiters.fetch_add(1, std::memory_order_relaxed);
+  }
+  ~NextFrameResponse() override {
+    NextFrameLock lock;
+    setWaiting(false);
+    nextFrameWaiters.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  bool _sourceValid() const override { return true; }
+
+  void _respond(AsyncWebServerRequest *request) override {
+    NextFrameLock lock;
+    this->request = request;
+    poll();
+  }
+
+  size_t _ack(AsyncWebServerRequest *request, size_t len,
+              uint32_t time) override {
+    NextFrameLock lock;
+    if (waiting) {
+      poll();
+      return 0;
+    }
+    return AsyncAbstractResponse::_ack(request, len, time);
+  }
+
+  size_t _fillBuffer(uint8_t *buf, size_t maxLen) override {
+    size_t n = frame.size() - offset;
+    if (n > maxLen)
+      n = maxLen;
+    memcpy(buf, frame.data() + offset, n);
+    offset += n;
+    Metrics::bytesServed.add(n);
+    return n;
+  }
+
+  // Sampler task, with nextFrameLock held
+  void resume() {
+    if (waiting && request->client()->canSend()) {
+      nextFrameWoken.fetch_add(1, std::memory_order_relaxed);
+      poll();
+    }
+  }
+
+private:
+  void setWaiting(bool on) {
+    if (waiting == on)
+      return;
+    waiting = on;
+    if (on) {
+      nextFrameWaiting.push_back(this);
+      return;
+    }
+    for (auto it = nextFrameWaiting.begin(); it != nextFrameWaiting.end();
+         ++it) {
+      if (*it == this) {
+        nextFrameWaiting.erase(it);
+        break;
+      }
+    }
+  }
+
+  void poll() {
+    FrameRef latest = FrameCache::latest();
+    if (latest && latest.sequence() > after) {
+      frame = std::move(latest);
+      char seq[12], cursor[24];
+      snprintf(seq, sizeof(seq), "%lu", (unsigned long)frame.sequence());
+      snprintf(cursor, sizeof(cursor), "%lu-%s",
+               (unsigned long)FrameIndex::boot(), seq);
+      _code = 200;
+      _contentType = "image/jpeg";
+      _contentLength = frame.size();
+      addHeader("X-Frame-Sequence", seq);
+      addHeader("X-Frame-Cursor", cursor);
+      nextFrameServed.fetch_add(1, std::memory_order_relaxed);
+    } else if (millis() - startMs >= timeoutMs) {
+      _code = 204; // nothing newer; ask again with the same `after`
+      _contentLength = 0;
+      nextFrameTimeouts.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      setWaiting(true);
+      return;
+    }
+    setWaiting(false);
+    addHeader("Cache-Control", "no-store");
+    AsyncAbstractResponse::_respond(request);
+  }
+
+  const uint32_t after;
+  const uint32_t timeoutMs;
+  const uint32_t startMs;
+  AsyncWebServerRequest *request = nullptr;
+  bool waiting = false;
+  FrameRef frame;
+  size_t offset = 0;
+};
+
+// A resume can end its response, which then leaves the list; the ones
+// still to go are taken from a copy and checked against the list first
+static void resumeNextFrames() {
+  if (!nextFrameLock)
+    return;
+  NextFrameLock lock;
+  if (nextFrameWaiting.empty())
+    return;
+  NextFrameResponse *waiting[NEXT_FRAME_MAX_WAITERS];
+  size_t n = 0;
+  for (NextFrameResponse *r : nextFrameWaiting)
+    if (n < (size_t)NEXT_FRAME_MAX_WAITERS)
+      waiting[n++] = r;
+  for (size_t i = 0; i < n; i++) {
+    for (NextFrameResponse *r : nextFrameWaiting) {
+      if (r == waiting[i]) {
+        r->resume();
+        break;
+      }
+    }
+  }
+}
+
+// /i/next?after=<seq>&timeout=<ms>: the first frame newer than `after`
+// (default: the newest now, i.e. wait for the next one), or 204 on timeout.
+// Sequences are never reused across reboots, so X-Frame-Sequence is all a
+// client needs to pass back. `after` may also be an X-Frame-Cursor
+// (<boot>-<seq>); one from before a reset makes any cached frame new to
+// that client, so it is sent at once.
+static void handleNextFrame(AsyncWebServerRequest *request) {
+  if (nextFrameWaiters.load(std::memory_order_relaxed) >=
+      (uint32_t)NEXT_FRAME_MAX_WAITERS) {
+    request->send(503, "text/plain", "Too many waiting requests");
+    return;
+  }
+
+  uint32_t after;
+  if (AsyncWebParameter *p = request->getParam("after")) {
+    const char *value = p->value().c_str();
+    char *end;
+    after = strtoul(value, &end, 10);
+    if (*end == '-') {
+      // X-Frame-Cursor form, <boot>-<seq>
+      uint32_t boot = after;
+      after = strtoul(end + 1, &end, 10);
+      if (boot != FrameIndex::boot()) {
+        after = 0;
+        nextFrameResets.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+    if (*end != '\0') {
+      request->send(400, "text/plain", "after must be a frame sequence");
+      return;
+    }
   } else {
-    Serial.println("Template not found in FFat, using fallback");
-    // Minimal fallback if template is missing
-    html = F("<!doctype html><meta charset=\"utf-8\"><meta "
-             "name=\"viewport\" content=\"width=device-width, "
-             "initial-scale=1\">"
-             "<noscript><meta http-equiv=\"refresh\" "
-             "content=\"{{REFRESH_SECONDS}}\"></noscript>"
-             "<link rel=\"stylesheet\" href=\"/app.css\">"
-             "<img id=\"img\" src=\"/i/latest.jpg\" alt=\"latest "
-             "frame\">"
-             "<h1 id=\"heading\">{{HEADING}}</h1><p id=\"help\" "
-             "class=\"muted\">{{HELP}}</p>"
-             "<table "
-             "id=\"t\"><thead><tr><th>Key</th><th>Value</th></tr></"
-             "thead><tbody>{{STATUS_ROWS}}</tbody></table>"
-             "<script type=\"module\" src=\"/js/entry.js\"></script>");
-  }
-
-  // Build status rows directly
-  String rows;
-  rows.reserve(4096);
-  buildStatusRowsHtml(rows);
-
-  // Replace tokens (simple substring rebuild, since Arduino String lacks
-  // insert)
-  auto replaceToken = [](String &s, const char *from, const String &to) {
-    int pos = 0;
-    size_t flen = strlen(from);
-    while ((pos = s.indexOf(from, pos)) != -1) {
-      s = s.substring(0, pos) + to + s.substring(pos + (int)flen);
-      pos += to.length();
+    FrameRef latest = FrameCache::latest();
+    after = latest ? latest.sequence() : 0;
+  }
+  uint32_t timeoutMs = NEXT_FRAME_TIMEOUT_MS;
+  if (AsyncWebParameter *p = request->getParam("timeout")) {
+    long ms = p->value().toInt();
+    if (ms >= 0 && ms < (long)timeoutMs)
+      timeoutMs = ms;
+  }
+  request->send(new NextFrameResponse(after, timeoutMs));
+}
+
+// ===== ON-DEVICE MICROBENCHMARKS =====
+// /bench?n=<iterations> times the hot paths in place, on the real heap,
+// PSRAM and index, as a baseline to compare firmware builds against. The
+// cases run on their own task below the web server's priority, so the
+// async_tcp watchdog never sees them. Each result is streamed as it
+// finishes, and the run stops at BENCH_MAX_MS.
+struct BenchResult {
+  const char *name;
+  uint32_t iterations;
+  uint32_t minUs;
+  uint32_t maxUs;
+  uint64_t totalUs;
+  size_t bytes;       // output size of one operation
+  int32_t heapBytes;  // net heap change over the loop (includes other tasks)
+  int32_t heapBlocks; // net allocated blocks over the loop
+};
+
+// Shared by the bench task and the response filler. Whichever lets go
+// last frees it, so a client that disconnects mid-run is harmless.
+struct BenchRun {
+  uint32_t iterations = 0;
+  int64_t deadlineUs = 0;
+  StreamBufferHandle_t out = nullptr;
+  std::atomic<bool> done{false};      // all output is in `out`
+  std::atomic<bool> cancelled{false}; // client went away
+  ~BenchRun() {
+    if (out)
+      vStreamBufferDelete(out);
+  }
+};
+static std::atomic<bool> benchRunning{false};
+
+// Keeps results of otherwise unused benchmark calls live
+static volatile uint32_t benchSink;
+
+// Discards output, counting the bytes
+class NullPrint : public Print {
+public:
+  size_t write(uint8_t) override {
+    bytes++;
+    return 1;
+  }
+  size_t write(const uint8_t *, size_t len) override {
+    bytes += len;
+    return len;
+  }
+  size_t bytes = 0;
+};
+
+// `op` runs once untimed first so reused buffers reach their steady size;
+// it returns the number of bytes it produced. Stops early at the deadline,
+// so `iterations` in the result is what actually ran.
+template <typename Op>
+static BenchResult runBench(const char *name, uint32_t iterations,
+                            int64_t deadlineUs, Op op) {
+  BenchResult r = {name, 0, UINT32_MAX, 0, 0, 0, 0, 0};
+  r.bytes = op();
+  multi_heap_info_t before, after;
+  heap_caps_get_info(&before, MALLOC_CAP_8BIT);
+  for (uint32_t i = 0; i < iterations; i++) {
+    int64_t start = esp_timer_get_time();
+    if (start >= deadlineUs)
+      break;
+    op();
+    uint32_t us = (uint32_t)(esp_timer_get_time() - start);
+    r.iterations++;
+    r.totalUs += us;
+    if (us < r.minUs)
+      r.minUs = us;
+    if (us > r.maxUs)
+      r.maxUs = us;
+  }
+  heap_caps_get_info(&after, MALLOC_CAP_8BIT);
+  r.heapBytes = (int32_t)(after.total_allocated_bytes -
+                          before.total_allocated_bytes);
+  r.heapBlocks = (int32_t)(after.allocated_blocks - before.allocated_blocks);
+  return r;
+}
+
+// Queues text for the response; false once the client has gone
+static bool benchSend(BenchRun &run, const char *text, size_t len) {
+  while (len > 0) {
+    if (run.cancelled.load(std::memory_order_relaxed))
+      return false;
+    size_t n = xStreamBufferSend(run.out, text, len, pdMS_TO_TICKS(100));
+    text += n;
+    len -= n;
+  }
+  return true;
+}
+
+// Streams one result; the first one opens the array
+static bool benchEmit(BenchRun &run, const BenchResult &r, bool first) {
+  char line[192];
+  int len = snprintf(
+      line, sizeof(line),
+      "%s{\"name\":\"%s\",\"iterations\":%u,\"avgUs\":%u,\"minUs\":%u,"
+      "\"maxUs\":%u,\"bytes\":%u,\"heapBytes\":%d,\"heapBlocks\":%d}",
+      first ? "" : ",", r.name, (unsigned)r.iterations,
+      (unsigned)(r.iterations ? r.totalUs / r.iterations : 0),
+      (unsigned)(r.iterations ? r.minUs : 0), (unsigned)r.maxUs,
+      (unsigned)r.bytes, (int)r.heapBytes, (int)r.heapBlocks);
+  return benchSend(run, line, std::min<size_t>(len, sizeof(line) - 1));
+}
+
+// Runs every case that fits before the deadline, streaming as it goes
+static void runBenchSuite(BenchRun &run) {
+  int64_t startUs = esp_timer_get_time();
+  uint32_t iterations = run.iterations;
+  size_t emitted = 0;
+  size_t skipped = 0;
+  // Each case checks in here: false skips it (deadline or client gone)
+  auto due = [&] {
+    vTaskDelay(1); // let the idle task and its watchdog in between cases
+    if (run.cancelled.load(std::memory_order_relaxed))
+      return false;
+    if (esp_timer_get_time() >= run.deadlineUs) {
+      skipped++;
+      return false;
     }
+    return true;
   };
-  replaceToken(html, "{{TITLE}}", "ESP32-S3 Camera");
-  replaceToken(html, "{{HEADING}}", "ESP32-S3 Camera");
-  replaceToken(html, "{{HELP}}", "ESP diagnostics at time of load.");
-  replaceToken(html, "{{STATUS_ROWS}}", rows);
-  int refresh = PAGE_REFRESH_SECONDS;
-  if (refresh < 1)
-    refresh = 1; // never emit 0; minimum 1s
-  replaceToken(html, "{{REFRESH_SECONDS}}", String(refresh));
-
-  res->print(html);
+  auto emit = [&](const BenchResult &r) {
+    benchEmit(run, r, emitted++ == 0);
+  };
+
+  char head[48];
+  int len = snprintf(head, sizeof(head), "{\"iterations\":%u,\"results\":[",
+                     (unsigned)iterations);
+  benchSend(run, head, len);
+
+  static const String escapeInput =
+      F("<td class=\"k\">a & b</td><td>\"quoted\" <b>bold</b></td>"
+        "<td class=\"k\">a & b</td><td>\"quoted\" <b>bold</b></td>"
+        "plain text without anything to escape in it at all, twice over. "
+        "plain text without anything to escape in it at all, twice over. ");
+  if (due())
+    emit(runBench("html_escape", iterations, run.deadlineUs, [] {
+      return htmlEscape(escapeInput).length();
+    }));
+
+  if (due())
+    emit(runBench("template_render", iterations, run.deadlineUs, [] {
+      NullPrint out;
+      PageTemplate::render(out, writePageSlot);
+      return out.bytes;
+    }));
+
+  // The builders only read shared state, so running them beside the
+  // sampler is safe; each reuses its String like the sampler does
+  String json, rows;
+  if (due())
+    emit(runBench("json_build", iterations, run.deadlineUs, [&json] {
+      json = "";
+      StringPrint out(json);
+      buildJson(&out);
+      return (size_t)json.length();
+    }));
+  if (due())
+    emit(runBench("rows_build", iterations, run.deadlineUs, [&rows] {
+      rows = "";
+      buildStatusRowsHtml(rows);
+      return (size_t)rows.length();
+    }));
+  json = String();
+  rows = String();
+
+  if (due()) {
+    size_t pageSize = HISTORY_PAGE_MAX;
+    std::unique_ptr<FrameIndex::Entry[]> entries(
+        new FrameIndex::Entry[pageSize]);
+    emit(runBench("history_page", iterations, run.deadlineUs, [&] {
+      return FrameIndex::page(0, entries.get(), pageSize) *
+             sizeof(FrameIndex::Entry);
+    }));
+  }
+
+  // Motion kernel on full-size luma planes; the detector itself runs it at
+  // 1/8 scale, so these are upper bounds
+  static const struct {
+    const char *name;
+    size_t pixels;
+  } planes[] = {{"motion_diff_qvga", 320 * 240},
+                {"motion_diff_svga", 800 * 600}};
+  for (const auto &plane : planes) {
+    if (!due())
+      continue;
+    uint8_t *a = (uint8_t *)ps_malloc(plane.pixels);
+    uint8_t *b = (uint8_t *)ps_malloc(plane.pixels);
+    if (a && b) {
+      uint32_t seed = 1;
+      for (size_t i = 0; i < plane.pixels; i++) {
+        seed = seed * 1664525 + 1013904223;
+        a[i] = seed >> 24;
+        b[i] = seed >> 16;
+      }
+      emit(runBench(plane.name, iterations, run.deadlineUs, [&] {
+        benchSink = MotionDetector::countChanged(a, b, plane.pixels,
+                                                 MOTION_PIXEL_DELTA);
+        return plane.pixels;
+      }));
+    }
+    free(a);
+    free(b);
+  }
+
+  // The PSRAM copy the capture path makes of each frame, on the newest
+  // frame's bytes. Both buffers are private: the pool keeps every slot for
+  // the camera, and the cached frame is let go before the loop.
+  if (due()) {
+    size_t size = 0;
+    uint8_t *src = nullptr;
+    if (FrameRef latest = FrameCache::latest()) {
+      size = latest.size();
+      src = (uint8_t *)ps_malloc(size);
+      if (src)
+        memcpy(src, latest.data(), size);
+    }
+    uint8_t *dst = src ? (uint8_t *)ps_malloc(size) : nullptr;
+    if (dst)
+      emit(runBench("capture_copy", iterations, run.deadlineUs, [&] {
+        memcpy(dst, src, size);
+        return size;
+      }));
+    free(src);
+    free(dst);
+  }
+
+  char tail[80];
+  len = snprintf(tail, sizeof(tail),
+                 "],\"skipped\":%u,\"elapsedMs\":%u,\"maxMs\":%u}",
+                 (unsigned)skipped,
+                 (unsigned)((esp_timer_get_time() - startUs) / 1000),
+                 (unsigned)BENCH_MAX_MS);
+  benchSend(run, tail, len);
+}
+
+static void benchTask(void *param) {
+  {
+    auto *handoff = static_cast<std::shared_ptr<BenchRun> *>(param);
+    std::shared_ptr<BenchRun> run = std::move(*handoff);
+    delete handoff;
+    runBenchSuite(*run);
+    run->done.store(true, std::memory_order_release);
+  } // drops this task's reference before the task goes away
+  benchRunning.store(false, std::memory_order_release);
+  vTaskDelete(nullptr);
+}
+
+static void handleBench(AsyncWebServerRequest *request) {
+  uint32_t iterations = 20;
+  if (AsyncWebParameter *p = request->getParam("n")) {
+    long n = p->value().toInt();
+    if (n > 0)
+      iterations = n < BENCH_MAX_ITERATIONS ? n : BENCH_MAX_ITERATIONS;
+  }
+
+  if (benchRunning.exchange(true, std::memory_order_acquire)) {
+    request->send(503, "text/plain", "A benchmark is already running");
+    return;
+  }
+  auto run = std::make_shared<BenchRun>();
+  run->iterations = iterations;
+  run->deadlineUs = esp_timer_get_time() + (int64_t)BENCH_MAX_MS * 1000;
+  run->out = xStreamBufferCreate(2048, 1);
+  auto *handoff = new std::shared_ptr<BenchRun>(run);
+  if (!run->out ||
+      xTaskCreatePinnedToCore(benchTask, "bench", BENCH_TASK_STACK_SIZE,
+                              handoff, BENCH_TASK_PRIORITY, nullptr,
+                              BENCH_TASK_CORE) != pdPASS) {
+    delete handoff;
+    benchRunning.store(false, std::memory_order_release);
+    request->send(503, "text/plain", "Benchmark task not started");
+    return;
+  }
+
+  // Output shows up at the next poll after each case finishes; done is
+  // checked before draining so the last bytes are never left behind
+  AsyncWebServerResponse *res = request->beginChunkedResponse(
+      "application/json",
+      [run](uint8_t *buf, size_t maxLen, size_t) -> size_t {
+        bool done = run->done.load(std::memory_order_acquire);
+        size_t n = xStreamBufferReceive(run->out, buf, maxLen, 0);
+        if (n > 0)
+          return n;
+        return done ? 0 : RESPONSE_TRY_AGAIN;
+      });
+  res->addHeader("Cache-Control", "no-cache");
+  request->onDisconnect([run] {
+    run->cancelled.store(true, std::memory_order_relaxed);
+  });
   request->send(res);
 }
 
 void setupRoutes(AsyncWebServer &srvr) {
-  // Dynamic overrides first (more specific), then static handlers.
-  // Stream the current image directly to avoid redirect races that can
-  // manifest as partially rendered (e.g., "top half only") images on clients.
-  srvr.on("/i/latest.jpg", HTTP_GET, [](AsyncWebServerRequest *req) {
-    String latestPath = Camera::getCurrentImage();
-    if (FFat.exists(latestPath)) {
-      req->redirect(latestPath);
-      // Ensure browsers don’t cache this endpoint across updates
+  FileSender::setup();
+  AssetBundle::setup();
+  PageTemplate::setup();
+  MjpegStream::setup();
+  nextFrameLock = xSemaphoreCreateRecursiveMutex();
+  nextFrameWaiting.reserve(NEXT_FRAME_MAX_WAITERS); // no allocation when full
 
-    } else {
-      req->send(404, "text/plain", "Camera not available");
-    }
-  });
-  srvr.on("/photos/latest.jpg", HTTP_GET, [](AsyncWebServerRequest *req) {
-    req->redirect(Camera::getCurrentImage());
-  });
+  // Status snapshot sampler; /json and /status.html serve what it built
+  xTaskCreatePinnedToCore(statusSamplerTask, "status_sampler",
+                          TELEMETRY_TASK_STACK_SIZE, nullptr,
+                          TELEMETRY_TASK_PRIORITY, &samplerTask,
+                          TELEMETRY_TASK_CORE);
+
+  // Dynamic overrides first (more specific), then static handlers.
+  // The newest frame is streamed straight from the PSRAM cache: no redirect,
+  // no FAT lookup, and no race with the writer deleting old files.
+  // Handlers are wrapped with Metrics::timed for per-route latency
+  using Metrics::Route;
+  using Metrics::timed;
+  // Frame and recording routes also answer HEAD, Range and conditional
+  // GETs (see HttpCache)
+  srvr.on("/i/latest.jpg", HTTP_GET | HTTP_HEAD,
+          timed(Route::Latest, handleLatestFrame));
+  srvr.on("/photos/latest.jpg", HTTP_GET | HTTP_HEAD,
+          timed(Route::Latest, handleLatestFrame));
+  // Long-poll: one request per new frame instead of fixed-interval polling
+  srvr.on("/i/next", HTTP_GET, timed(Route::Next, handleNextFrame));
+  // Live MJPEG; each capture is fanned out from the cache to every viewer
+  srvr.on("/stream", HTTP_GET,
+          timed(Route::Stream, MjpegStream::handleRequest));
+  // Chrome/Perfetto trace of the span rings
+  srvr.on("/trace", HTTP_GET, Trace::handleRequest);
+  // Server push of new frames and changed status cells
+  events.onConnect(onEventsConnect);
+  srvr.addHandler(&events);
+  // Prometheus scrape target
+  srvr.on("/metrics", HTTP_GET,
+          timed(Route::Metrics, Metrics::handleRequest));
+  // Microbenchmarks of the hot paths, in place on the device
+  srvr.on("/bench", HTTP_GET, handleBench);
 
-  // Static files
-  srvr.serveStatic("/app.css", FFat, "/app.css");
-  srvr.serveStatic("/js", FFat, "/js");
+  // Page assets: hash-named and pre-gzipped from the mapped bundle, which
+  // the bundled page links to; the FFat copies only without a bundle
+  srvr.on("/a/*", HTTP_GET | HTTP_HEAD, AssetBundle::handleRequest);
+  srvr.on("/vitals", HTTP_POST, AssetBundle::handlePaintReport);
+  if (!AssetBundle::mounted()) {
+    srvr.serveStatic("/app.css", FFat, "/app.css");
+    srvr.serveStatic("/js", FFat, "/js");
+  }
+  // History frames are pinned while they stream; see handleHistoryFile
+  const char *imageName = strrchr(IMAGE_PATH_PREFIX, '/');
+  imageName = imageName ? imageName + 1 : IMAGE_PATH_PREFIX;
+  srvr.on((String(IMAGE_PATH_PREFIX) + "*").c_str(), HTTP_GET | HTTP_HEAD,
+          handleHistoryFile);
+  srvr.on((String("/photos/") + imageName + "*").c_str(),
+          HTTP_GET | HTTP_HEAD, handleHistoryFile);
   srvr.serveStatic("/i", FFat, "/i")
       .setCacheControl("public, max-age=31536000, immutable");
   srvr.serveStatic("/photos", FFat, "/i")
       .setCacheControl("public, max-age=31536000, immutable");
+  // Per-file history from the persistent index
+  srvr.on("/history", HTTP_GET, timed(Route::History, handleHistory));
+  // Timelapse segments (the open one keeps growing, so no caching)
+  srvr.on("/recordings", HTTP_GET,
+          timed(Route::Recordings, handleRecordingList));
+  srvr.on("/recording", HTTP_GET,
+          timed(Route::Recording, handleRecordingMode));
+  srvr.on("/recording", HTTP_POST,
+          timed(Route::Recording, handleSetRecordingMode));
+  srvr.on("/trigger", HTTP_POST, timed(Route::Trigger, handleTrigger));
+  srvr.on("/r/*", HTTP_GET | HTTP_HEAD, handleRecordingFile);
+  // Raw-log frames, addressed by store sequence
+  srvr.on("/store/frame.jpg", HTTP_GET | HTTP_HEAD,
+          timed(Route::StoredFrame, handleStoredFrame));
   // Serve the root dynamically with a prefilled, safe HTML snapshot
-  srvr.on("/", HTTP_GET,
-          [](AsyncWebServerRequest *req) { handlePrefilled(req); });
+  srvr.on("/", HTTP_GET, timed(Route::Root, handlePrefilled));
   // Hydration endpoint for JS client (returns full <tbody>...)
-  srvr.on("/status.html", HTTP_GET,
-          [](AsyncWebServerRequest *req) { handleStatusTbody(req); });
-  srvr.on("/json", HTTP_GET,
-          [](AsyncWebServerRequest *req) { handleJson(req); });
+  srvr.on("/status.html", HTTP_GET, timed(Route::Status, handleStatusTbody));
+  srvr.on("/json", HTTP_GET, timed(Route::Json, handleJson));
   srvr.on("/prefilled", HTTP_GET,
           [](AsyncWebServerRequest *req) { handlePrefilled(req); });
   srvr.on("/favicon.ico", HTTP_GET, handleFavicon);
@@ -4,3 +4,6 @@
 
 void setupRoutes(AsyncWebServer &srvr);
 
+// Tells /events listeners a new frame is in the cache; any task
+void announceFrame();
+
@@ -0,0 +1,23 @@
+#pragma once
+// Baseline JPEGs for synthetic test frames. The host decoder
+// (host/camera.cpp) reads each 1/8-scale pixel straight from the scan byte
+// at the same position, as grey, so a frame whose scan is
+// (width / 8) * (height / 8) bytes decodes to exactly those luma values.
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+inline std::string syntheticJpeg(uint16_t width, uint16_t height,
+                                 const uint8_t *scan, size_t len) {
+  const uint8_t header[] = {
+      0xff, 0xd8,                                     // SOI
+      0xff, 0xc0, 0x00, 0x11, 0x08, (uint8_t)(height >> 8), (uint8_t)height,
+      (uint8_t)(width >> 8), (uint8_t)width, 0x03, 0x01, 0x22, 0x00, 0x02,
+      0x11, 0x01, 0x03, 0x11, 0x01,                   // SOF0, 4:2:0
+      0xff, 0xda, 0x00, 0x0c, 0x03, 0x01, 0x00, 0x02,
+      0x11, 0x03, 0x11, 0x00, 0x3f, 0x00,             // SOS
+  };
+  std::string jpeg((const char *)header, sizeof(header));
+  jpeg.append((const char *)scan, len);
+  return jpeg;
+}
@@ -0,0 +1,155 @@
+// Host benchmarks of the capture and web hot paths, on the real managers
+// with the host stand-ins underneath. Each case reports time per operation
+// and what it allocated; the counts cover every task in the process, so
+// the web cases include the server's work as well as the handler's.
+//   pio test -e native -f test_bench
+#include "camera_cycle.h"
+#include "config.h"
+#include "core1_manager.h"
+#include "debug_manager.h"
+#include "host.h"
+#include "led_breathe.h"
+#include "storage_writer.h"
+#include "system_manager.h"
+#include <Arduino.h>
+#include <FFat.h>
+#include <string>
+#include <unity.h>
+
+struct Result {
+  uint32_t iterations;
+  uint64_t totalUs;
+  uint32_t maxUs;
+  uint64_t allocations;
+  uint64_t bytes;
+};
+
+template <typename Op> static Result measure(uint32_t iterations, Op op) {
+  Result r = {};
+  op(); // warm-up, so reused buffers are at their steady size
+  Host::HeapStats before = Host::heapStats();
+  for (uint32_t i = 0; i < iterations; i++) {
+    int64_t start = esp_timer_get_time();
+    op();
+    uint32_t us = (uint32_t)(esp_timer_get_time() - start);
+    r.totalUs += us;
+    r.maxUs = std::max(r.maxUs, us);
+  }
+  Host::HeapStats after = Host::heapStats();
+  r.iterations = iterations;
+  r.allocations = after.allocations - before.allocations;
+  r.bytes = after.allocatedBytes - before.allocatedBytes;
+  return r;
+}
+
+static void report(const char *name, const Result &r) {
+  uint32_t n = r.iterations ? r.iterations : 1;
+  printf("bench %-16s n=%-4u avg=%7lluus max=%7uus allocs/op=%6.1f "
+         "bytes/op=%9.0f\n",
+         name, (unsigned)r.iterations, (unsigned long long)(r.totalUs / n),
+         (unsigned)r.maxUs, (double)r.allocations / n, (double)r.bytes / n);
+}
+
+static bool waitFor(uint32_t timeoutMs, bool (*done)()) {
+  uint32_t start = millis();
+  while (!done()) {
+    if (millis() - start > timeoutMs)
+      return false;
+    delay(1);
+  }
+  return true;
+}
+
+static uint32_t writtenTarget;
+static bool writerCaughtUp() {
+  return StorageWriter::getStats().written >= writtenTarget;
+}
+
+// The managers' setup as main.cpp runs it, except that the camera task's
+// part runs here: captureNow() then has no competing loop()
+static void boot() {
+  Host::setDataDir("host_data/test_bench");
+  Host::eraseFlash();
+  Host::setCamera(nullptr, 2000);
+  Host::setWebServerPort(0);
+  DebugManager::getInstance().setup();
+  SystemManager::getInstance().setup();
+  Core1Manager::getInstance().setup();
+  CameraCycle::setup();
+  LEDBreathe::setup();
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_capture_cycle() {
+  uint32_t before = CameraCycle::getStats().framesCaptured;
+  Result r = measure(50, CameraCycle::captureNow);
+  report("capture_cycle", r);
+  TEST_ASSERT_EQUAL(before + 51, CameraCycle::getStats().framesCaptured);
+}
+
+// htmlEscape, the template's token replacement and the JSON builder run
+// on the firmware's own /bench task; its results are passed through
+static void test_device_bench() {
+  std::string body = Host::get("/bench?n=100", 30000);
+  TEST_ASSERT_TRUE(body.rfind("HTTP/1.1 200", 0) == 0);
+  for (const char *name : {"html_escape", "template_render", "json_build"})
+    TEST_ASSERT_TRUE_MESSAGE(
+        body.find(std::string("\"name\":\"") + name + "\"") !=
+            std::string::npos,
+        name);
+  for (size_t at = body.find("{\"name\""); at != std::string::npos;
+       at = body.find("{\"name\"", at + 1))
+    printf("bench /bench %s\n",
+           body.substr(at, body.find('}', at) - at + 1).c_str());
+}
+
+// The whole request: parse, route, handleJson, response, close. A request
+// to an unknown URL is the baseline to subtract.
+static void test_json_emission() {
+  std::string body;
+  report("http_404", measure(50, [&] { body = Host::get("/no-such-page"); }));
+  TEST_ASSERT_TRUE(body.rfind("HTTP/1.1 404", 0) == 0);
+  report("json_request", measure(50, [&] { body = Host::get("/json"); }));
+  TEST_ASSERT_TRUE(body.rfind("HTTP/1.1 200", 0) == 0);
+  TEST_ASSERT_TRUE(body.find("\"heapFree\"") != std::string::npos);
+  TEST_ASSERT_EQUAL('}', body.back());
+}
+
+// Triggered captures are always stored; past MAX_STORED_IMAGES each store
+// also deletes the oldest file. Timed from capture to the writer's done.
+static void test_history_rotation() {
+  Result r = measure(3 * MAX_STORED_IMAGES, [] {
+    writtenTarget = StorageWriter::getStats().written + 1;
+    CameraCycle::captureNow();
+    TEST_ASSERT_TRUE(waitFor(5000, writerCaughtUp));
+  });
+  report("history_rotate", r);
+  StorageWriter::Stats s = StorageWriter::getStats();
+  printf("bench writer per-file avg=%uus max=%uus writes=%u\n",
+         (unsigned)s.perFile.avgUs, (unsigned)s.perFile.maxUs,
+         (unsigned)s.perFile.writes);
+  TEST_ASSERT_EQUAL(0u, s.writeFailures);
+
+  int files = 0;
+  File dir = FFat.open("/i");
+  for (File f = dir.openNextFile(); f; f = dir.openNextFile())
+    if (String(f.name()).endsWith(".jpg"))
+      files++;
+  TEST_ASSERT_TRUE(files <= MAX_STORED_IMAGES);
+}
+
+int main() {
+  boot();
+  UNITY_BEGIN();
+  RUN_TEST(test_capture_cycle);
+  RUN_TEST(test_device_bench);
+  RUN_TEST(test_json_emission);
+  RUN_TEST(test_history_rotation);
+  int failures = UNITY_END();
+  // The firmware's tasks are still running; skip the static destructors
+  // they would race with, as the chip never returns from setup() either
+  fflush(stdout);
+  _Exit(failures);
+}
@@ -0,0 +1,149 @@
+// FrameIndex across restarts: confirmed times of repeated frames stay on
+// their entries, and an index written before entries had them is read and
+// converted in place.
+//   pio test -e native -f test_frame_index
+#include "config.h"
+#include "frame_index.h"
+#include "host.h"
+#include <Arduino.h>
+#include <FFat.h>
+#include <cstddef>
+#include <esp_rom_crc.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unity.h>
+
+// FrameIndex loads once per process and keeps its state in statics, so
+// each boot is a child process on the same flash image. A failed check
+// ends the child with a non-zero status.
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);         \
+      fflush(stdout);                                                          \
+      _exit(1);                                                                \
+    }                                                                          \
+  } while (0)
+
+static int boot(void (*body)()) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    CHECK(FFat.begin(true));
+    FFat.mkdir("/i");
+    body();
+    fflush(stdout);
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+static FrameIndex::Entry entryFor(uint32_t sequence) {
+  FrameIndex::Entry e = {};
+  e.sequence = sequence;
+  e.boot = FrameIndex::boot();
+  e.timestamp = e.confirmed = sequence * 100;
+  e.size = 1000 + sequence;
+  e.crc = sequence * 0x01010101u;
+  return e;
+}
+
+void setUp() {
+  Host::setDataDir("host_data/test_frame_index");
+  Host::eraseFlash();
+}
+void tearDown() {}
+
+// A confirm rewrites only that entry; the next boot reads it back, and no
+// longer accepts confirms for frames from the boot before
+static void test_confirmed_survives_restart() {
+  TEST_ASSERT_EQUAL(0, boot([] {
+    CHECK(!FrameIndex::setup());
+    FrameIndex::Entry evicted;
+    for (uint32_t sequence = 1; sequence <= 3; sequence++)
+      CHECK(FrameIndex::add(entryFor(sequence), evicted));
+    CHECK(FrameIndex::confirm(2, 5000));
+    CHECK(FrameIndex::confirm(3, 7000));
+    CHECK(!FrameIndex::confirm(9, 7000)); // never indexed
+
+    FrameIndex::Entry e;
+    CHECK(FrameIndex::find(2, e) && e.confirmed == 5000 && e.timestamp == 200);
+  }));
+
+  TEST_ASSERT_EQUAL(0, boot([] {
+    CHECK(FrameIndex::setup());
+    FrameIndex::Entry e;
+    CHECK(FrameIndex::find(1, e) && e.confirmed == e.timestamp);
+    CHECK(FrameIndex::find(2, e) && e.confirmed == 5000 && e.size == 1002);
+    CHECK(FrameIndex::find(3, e) && e.confirmed == 7000);
+    CHECK(FrameIndex::lastSequence() == 3);
+    CHECK(!FrameIndex::confirm(3, 100)); // that clock belongs to a past boot
+  }));
+}
+
+// The layout before confirmed times: same header, five-word entries
+struct HeaderV1 {
+  uint32_t magic, capacity, boot, crc;
+};
+struct SlotV1 {
+  uint32_t sequence, boot, timestamp, size, entryCrc;
+  uint32_t replaced;
+  uint32_t crc;
+};
+
+template <typename T> static uint32_t crcOf(const T &v) {
+  return esp_rom_crc32_le(0, (const uint8_t *)&v, offsetof(T, crc));
+}
+
+static void writeV1Index() {
+  FFat.mkdir("/sys");
+  File f = FFat.open(FRAME_INDEX_PATH, "w");
+  CHECK(f);
+  HeaderV1 h = {0x31584946, (uint32_t)MAX_STORED_IMAGES, 4, 0};
+  h.crc = crcOf(h);
+  f.write((const uint8_t *)&h, sizeof(h));
+  for (uint32_t i = 0; i < MAX_STORED_IMAGES; i++) {
+    SlotV1 s = {};
+    if (i < 2) {
+      s = {10 + i, 4, 100 * (i + 1), 2000, 0xabcd0000 + i, 0, 0};
+      s.crc = crcOf(s);
+    }
+    f.write((const uint8_t *)&s, sizeof(s));
+  }
+  f.close();
+}
+
+static void test_v1_index_converted() {
+  TEST_ASSERT_EQUAL(0, boot([] {
+    writeV1Index();
+    CHECK(FrameIndex::setup());
+    CHECK(FrameIndex::boot() == 5);
+    FrameIndex::Entry e;
+    CHECK(FrameIndex::find(11, e) && e.boot == 4 && e.timestamp == 200 &&
+          e.confirmed == 200 && e.size == 2000 && e.crc == 0xabcd0001);
+    FrameIndex::Entry evicted;
+    CHECK(FrameIndex::add(entryFor(12), evicted) && !evicted.sequence);
+  }));
+
+  // Read back in the current layout, nothing lost
+  TEST_ASSERT_EQUAL(0, boot([] {
+    CHECK(FrameIndex::setup());
+    FrameIndex::Entry e;
+    CHECK(FrameIndex::find(10, e) && e.timestamp == 100 && e.confirmed == 100);
+    CHECK(FrameIndex::find(12, e) && e.boot == 5);
+    CHECK(FrameIndex::lastSequence() == 12);
+    File f = FFat.open(FRAME_INDEX_PATH, "r");
+    HeaderV1 h;
+    CHECK(f && f.read((uint8_t *)&h, sizeof(h)) == sizeof(h));
+    CHECK(h.magic == 0x32584946); // "FIX2"
+  }));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_confirmed_survives_restart);
+  RUN_TEST(test_v1_index_converted);
+  return UNITY_END();
+}
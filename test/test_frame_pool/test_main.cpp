@@ -0,0 +1,151 @@
+// FramePool slots and FrameRef counting, including the tag that lets a
+// reader retain a frame without a lock.
+//   pio test -e native -f test_frame_pool
+#include "config.h"
+#include "frame_pool.h"
+#include <Arduino.h>
+#include <unity.h>
+#include <vector>
+
+static uint32_t inUse() { return FramePool::getStats().inUse; }
+
+static FrameRef fill(uint32_t sequence, size_t len = 1000) {
+  FrameRef frame = FramePool::acquire(len);
+  if (frame) {
+    memset(frame.writableData(), (int)sequence, len);
+    frame.setFrame(len, sequence, sequence * 10);
+  }
+  return frame;
+}
+
+void setUp() { TEST_ASSERT_EQUAL(0u, inUse()); }
+void tearDown() {}
+
+static void test_exhaustion() {
+  FramePool::Stats before = FramePool::getStats();
+  std::vector<FrameRef> held;
+  for (uint32_t i = 0; i < before.slots; i++) {
+    held.push_back(fill(i + 1));
+    TEST_ASSERT_TRUE(held.back());
+  }
+  TEST_ASSERT_EQUAL(before.slots, inUse());
+
+  TEST_ASSERT_FALSE(FramePool::acquire(100));
+  FramePool::Stats after = FramePool::getStats();
+  TEST_ASSERT_EQUAL(before.allocFailures + 1, after.allocFailures);
+  TEST_ASSERT_EQUAL(before.slots, after.highWater);
+
+  // One slot back is one acquire that works
+  held.pop_back();
+  FrameRef again = FramePool::acquire(100);
+  TEST_ASSERT_TRUE(again);
+  TEST_ASSERT_FALSE(FramePool::acquire(100));
+}
+
+static void test_oversize() {
+  FramePool::Stats before = FramePool::getStats();
+  TEST_ASSERT_FALSE(FramePool::acquire(before.slotBytes + 1));
+  FrameRef exact = FramePool::acquire(before.slotBytes);
+  TEST_ASSERT_TRUE(exact);
+  TEST_ASSERT_EQUAL(before.slotBytes, exact.capacity());
+  FramePool::Stats after = FramePool::getStats();
+  TEST_ASSERT_EQUAL(before.oversizeFailures + 1, after.oversizeFailures);
+  TEST_ASSERT_EQUAL(before.allocFailures, after.allocFailures);
+}
+
+// Copies, moves, assignments and detach/adopt leave the slot in use until
+// the last holder lets go, and no longer
+static void test_refcount_balance() {
+  FrameRef a = fill(7);
+  const uint8_t *bytes = a.data();
+  {
+    FrameRef b = a;
+    FrameRef c;
+    c = b;
+    c = c; // self-assignment keeps the count
+    FrameRef d = std::move(b);
+    TEST_ASSERT_FALSE(b);
+    TEST_ASSERT_EQUAL_PTR(bytes, d.data());
+    FrameRef e = fill(8);
+    e = d; // drops e's own slot
+    TEST_ASSERT_EQUAL(1u, inUse());
+    FrameSlot *raw = c.detach();
+    TEST_ASSERT_FALSE(c);
+    FrameRef f = FrameRef::adopt(raw);
+    TEST_ASSERT_EQUAL(7u, f.sequence());
+  }
+  TEST_ASSERT_EQUAL(1u, inUse());
+  a.reset();
+  TEST_ASSERT_EQUAL(0u, inUse());
+  a.reset(); // already empty
+  TEST_ASSERT_EQUAL(0u, inUse());
+}
+
+static void test_retain() {
+  FrameRef frame = fill(42);
+  uint32_t tag = frame.tag();
+  TEST_ASSERT_NOT_EQUAL(0u, tag);
+  FrameRef reader = FramePool::retain(tag);
+  TEST_ASSERT_TRUE(reader);
+  TEST_ASSERT_EQUAL_PTR(frame.data(), reader.data());
+  TEST_ASSERT_EQUAL(42u, reader.sequence());
+  reader.reset();
+  TEST_ASSERT_FALSE(FramePool::retain(0));
+  TEST_ASSERT_FALSE(FramePool::retain(0xffffffffu)); // slot 254: none such
+}
+
+// Once its last reference is gone a slot is not revived, and after a
+// refill the old tag names nothing: the reader must not get the new bytes
+static void test_retain_stale_tag() {
+  uint32_t tag;
+  {
+    FrameRef frame = fill(5);
+    tag = frame.tag();
+  }
+  TEST_ASSERT_FALSE(FramePool::retain(tag));
+  TEST_ASSERT_EQUAL(0u, inUse());
+
+  // Cycle the pool until the same slot comes back with another frame
+  uint32_t slots = FramePool::getStats().slots;
+  FrameRef refilled;
+  for (uint32_t i = 0; i < slots; i++) {
+    FrameRef next = fill(100 + i);
+    if ((next.tag() & 0xff) == (tag & 0xff)) {
+      refilled = std::move(next);
+      break;
+    }
+  }
+  TEST_ASSERT_TRUE(refilled);
+  TEST_ASSERT_FALSE(FramePool::retain(tag));
+  TEST_ASSERT_EQUAL(1u, inUse()); // the failed retain gave its count back
+
+  // While the producer refills a slot its sequence is 0, so no tag
+  // matches it until setFrame() publishes the new one
+  uint32_t liveTag = refilled.tag();
+  const uint8_t *bytes = refilled.data();
+  refilled.reset();
+  FrameRef writing;
+  for (uint32_t i = 0; i < slots && !writing; i++) {
+    FrameRef next = FramePool::acquire(10);
+    if (next.data() == bytes)
+      writing = std::move(next);
+  }
+  TEST_ASSERT_TRUE(writing);
+  TEST_ASSERT_EQUAL(0u, writing.tag());
+  TEST_ASSERT_FALSE(FramePool::retain(liveTag));
+  writing.setFrame(10, 200, 0);
+  TEST_ASSERT_NOT_EQUAL(liveTag, writing.tag());
+  TEST_ASSERT_TRUE(FramePool::retain(writing.tag()));
+  TEST_ASSERT_EQUAL(1u, inUse());
+}
+
+int main() {
+  FramePool::setup();
+  UNITY_BEGIN();
+  RUN_TEST(test_exhaustion);
+  RUN_TEST(test_oversize);
+  RUN_TEST(test_refcount_balance);
+  RUN_TEST(test_retain);
+  RUN_TEST(test_retain_stale_tag);
+  return UNITY_END();
+}
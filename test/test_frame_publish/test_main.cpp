@@ -0,0 +1,275 @@
+// The lock-free hand-offs between the camera task, the writer and the web
+// handlers, raced from many reader threads: FrameCache publish and pool
+// refill against retain/release, and history pins against the writer's
+// deletion ring.
+//   pio test -e native -f test_frame_publish
+#include "config.h"
+#include "frame_cache.h"
+#include "frame_index.h"
+#include "frame_pool.h"
+#include "host.h"
+#include "storage_writer.h"
+#include <Arduino.h>
+#include <FFat.h>
+#include <atomic>
+#include <thread>
+#include <unity.h>
+#include <vector>
+
+static constexpr int READERS = 8;
+
+static size_t lengthFor(uint32_t sequence) {
+  return 2000 + (sequence * 997) % 6000;
+}
+
+static uint8_t byteAt(uint32_t sequence, size_t i) {
+  return (uint8_t)(sequence * 31 + i * 7 + (i >> 8));
+}
+
+static FrameRef makeFrame(uint32_t sequence) {
+  size_t len = lengthFor(sequence);
+  FrameRef frame = FramePool::acquire(len);
+  if (!frame)
+    return frame;
+  uint8_t *p = frame.writableData();
+  for (size_t i = 0; i < len; i++)
+    p[i] = byteAt(sequence, i);
+  frame.setFrame(len, sequence, sequence * 10);
+  return frame;
+}
+
+// Readers can't use TEST_ASSERT off the main thread; they count failures
+// and keep the first one for the report
+static std::atomic<uint32_t> failures{0};
+static std::atomic<const char *> firstFailure{nullptr};
+
+static bool check(bool ok, const char *what) {
+  if (!ok && failures.fetch_add(1) == 0)
+    firstFailure.store(what);
+  return ok;
+}
+
+static void assertNoFailures() {
+  const char *what = firstFailure.load();
+  TEST_ASSERT_EQUAL_MESSAGE(0u, failures.load(), what ? what : "");
+}
+
+// Descriptor and bytes all belong to one capture
+static bool intact(const FrameRef &frame) {
+  uint32_t sequence = frame.sequence();
+  if (!check(sequence != 0, "retained a frame being refilled") ||
+      !check(frame.size() == lengthFor(sequence) &&
+                 frame.timestamp() == sequence * 10 &&
+                 (frame.tag() >> 8) == (sequence & 0xffffff),
+             "torn frame descriptor"))
+    return false;
+  const uint8_t *p = frame.data();
+  for (size_t i = 0; i < frame.size(); i++)
+    if (!check(p[i] == byteAt(sequence, i), "frame bytes changed"))
+      return false;
+  return true;
+}
+
+void setUp() {
+  failures = 0;
+  firstFailure = nullptr;
+}
+void tearDown() {}
+
+// The camera side publishes as fast as it can. With the rest of the pool
+// held back, the few spare slots are refilled over and over, each one the
+// moment it is freed, while readers hold, copy and drop references to it.
+// A held reference must keep its bytes: each reader checks the frame again
+// after letting the publisher run.
+static constexpr uint32_t PUBLISH_MS = 1000;
+static constexpr uint32_t SPARE_SLOTS = 2;
+
+static void test_cache_publish_against_readers() {
+  std::vector<FrameRef> ballast;
+  while (FramePool::getStats().inUse + FRAME_CACHE_SIZE + SPARE_SLOTS <
+         FramePool::getStats().slots)
+    ballast.push_back(FramePool::acquire(1));
+
+  std::atomic<uint32_t> newest{0};
+  std::atomic<bool> stop{false};
+  std::atomic<uint32_t> reads{0};
+
+  std::vector<std::thread> readers;
+  for (int r = 0; r < READERS; r++) {
+    readers.emplace_back([&, r] {
+      uint32_t lastLatest = 0;
+      for (uint32_t n = r; !stop.load(); n++) {
+        FrameRef frame;
+        if (n % 2) {
+          frame = FrameCache::latest();
+          if (frame) {
+            check(frame.sequence() >= lastLatest, "latest went backwards");
+            lastLatest = frame.sequence();
+          }
+        } else {
+          uint32_t wanted = newest.load() - n % FRAME_CACHE_SIZE;
+          frame = FrameCache::find(wanted);
+          if (frame)
+            check(frame.sequence() == wanted, "find returned another frame");
+        }
+        if (!frame || !intact(frame))
+          continue;
+
+        // While any reference is held the tag keeps naming this frame
+        FrameRef again = FramePool::retain(frame.tag());
+        check(again && again.data() == frame.data(), "retain of a held frame");
+        FrameRef copy = frame;
+        frame.reset();
+        std::this_thread::yield();
+        intact(copy);
+        reads.fetch_add(1);
+      }
+    });
+  }
+
+  uint32_t allocFailures = 0;
+  uint32_t sequence = 1;
+  for (uint32_t start = millis(); millis() - start < PUBLISH_MS;) {
+    FrameRef frame = makeFrame(sequence);
+    if (!frame) { // readers hold every spare slot for a moment
+      allocFailures++;
+      std::this_thread::yield();
+      continue;
+    }
+    FrameCache::publish(frame);
+    newest.store(sequence++);
+  }
+  stop = true;
+  for (std::thread &t : readers)
+    t.join();
+
+  assertNoFailures();
+  FrameCache::Stats s = FrameCache::getStats();
+  uint32_t published = sequence - 1;
+  printf("cache published=%u reads=%u hits=%u misses=%u retries=%u "
+         "alloc-waits=%u\n",
+         (unsigned)published, (unsigned)reads.load(), (unsigned)s.hits,
+         (unsigned)s.misses, (unsigned)s.retries, (unsigned)allocFailures);
+  TEST_ASSERT_EQUAL(published, s.published);
+  TEST_ASSERT_TRUE(reads.load() > 0);
+  // Every reader reference went back: only the cache's own are left
+  ballast.clear();
+  TEST_ASSERT_EQUAL((uint32_t)FRAME_CACHE_SIZE, FramePool::getStats().inUse);
+  FrameRef newestFrame = FrameCache::latest();
+  TEST_ASSERT_TRUE(newestFrame);
+  TEST_ASSERT_EQUAL(published, newestFrame.sequence());
+}
+
+static uint32_t countImages() {
+  uint32_t files = 0;
+  File dir = FFat.open("/i");
+  for (File f = dir.openNextFile(); f; f = dir.openNextFile())
+    if (String(f.name()).endsWith(".jpg"))
+      files++;
+  return files;
+}
+
+static bool waitFor(uint32_t timeoutMs, bool (*done)()) {
+  uint32_t start = millis();
+  while (!done()) {
+    if (millis() - start > timeoutMs)
+      return false;
+    delay(10);
+  }
+  return true;
+}
+
+// Readers stream the oldest history files, the ones the writer is about to
+// delete, as handleHistoryFile() does: find, pin, open. Once a pinned file
+// is open it must stay on flash, whole, until the pin is dropped; deletes
+// held back by a pin must happen once the last reader has gone.
+static constexpr uint32_t STORED_FRAMES = 300;
+
+static void test_pins_against_deletion_ring() {
+  Host::setDataDir("host_data/test_frame_publish");
+  Host::eraseFlash();
+  TEST_ASSERT_TRUE(FFat.begin(true));
+  FFat.mkdir("/i");
+  FrameIndex::setup();
+  StorageWriter::setMode(RecordingMode::PerFile);
+  StorageWriter::setup();
+
+  std::atomic<bool> stop{false};
+  std::atomic<uint32_t> reads{0};
+  std::vector<std::thread> readers;
+  for (int r = 0; r < READERS; r++) {
+    readers.emplace_back([&, r] {
+      uint8_t buf[512];
+      for (uint32_t n = r; !stop.load(); n++) {
+        uint32_t last = FrameIndex::lastSequence();
+        uint32_t sequence = last - (MAX_STORED_IMAGES - 1) + n % 2;
+        FrameIndex::Entry entry;
+        if (!last || !FrameIndex::find(sequence, entry) ||
+            !StorageWriter::pinFile(sequence)) {
+          std::this_thread::yield();
+          continue;
+        }
+        String path = FrameIndex::pathFor(sequence);
+        File file = FFat.open(path, "r");
+        if (file) {
+          check(file.size() == lengthFor(sequence), "stored frame truncated");
+          size_t at = 0;
+          while (size_t got = file.read(buf, sizeof(buf))) {
+            for (size_t i = 0; i < got; i++)
+              check(buf[i] == byteAt(sequence, at + i), "stored bytes differ");
+            at += got;
+            delay(1); // a slow client keeps the pin for a while
+          }
+          file.close();
+          check(at == lengthFor(sequence), "short read");
+          check(FFat.exists(path), "file deleted while pinned");
+          reads.fetch_add(1);
+        }
+        StorageWriter::unpinFile(sequence);
+      }
+    });
+  }
+
+  for (uint32_t i = 0; i < STORED_FRAMES; i++) {
+    FrameRef frame;
+    uint32_t sequence = FrameIndex::nextSequence();
+    while (!(frame = makeFrame(sequence)))
+      delay(1);
+    while (!StorageWriter::enqueue(frame)) // retries keep every frame
+      delay(1);
+  }
+  TEST_ASSERT_TRUE(waitFor(20000, [] {
+    return StorageWriter::getStats().written >= STORED_FRAMES;
+  }));
+  stop = true;
+  for (std::thread &t : readers)
+    t.join();
+  assertNoFailures();
+
+  // The writer picks up deferred deletes on its next wake-up; a pin is
+  // cleared just before its file is removed, so wait for the files too
+  TEST_ASSERT_TRUE(waitFor(3000, [] {
+    return StorageWriter::getStats().deletesPending == 0 &&
+           countImages() == (uint32_t)MAX_STORED_IMAGES;
+  }));
+  StorageWriter::Stats s = StorageWriter::getStats();
+  printf("pins reads=%u deferred=%u refused=%u\n", (unsigned)reads.load(),
+         (unsigned)s.deletesDeferred, (unsigned)s.pinsRefused);
+  TEST_ASSERT_EQUAL(0u, s.writeFailures);
+  TEST_ASSERT_EQUAL(0u, s.filesPinned);
+  TEST_ASSERT_TRUE(reads.load() > 0);
+  TEST_ASSERT_TRUE(s.deletesDeferred > 0); // the race was actually run
+  TEST_ASSERT_EQUAL((uint32_t)MAX_STORED_IMAGES, countImages());
+}
+
+int main() {
+  FramePool::setup();
+  UNITY_BEGIN();
+  RUN_TEST(test_cache_publish_against_readers);
+  RUN_TEST(test_pins_against_deletion_ring);
+  int result = UNITY_END();
+  // The writer task is still running; skip the static destructors it
+  // would race with
+  fflush(stdout);
+  _Exit(result);
+}
@@ -0,0 +1,279 @@
+// FrameStore on the emulated "frames" partition: appends, wraparound,
+// recovery after a torn record, and write throughput next to FFat.
+//   pio test -e native -f test_frame_store
+#include "config.h"
+#include "frame_pool.h"
+#include "frame_store.h"
+#include "host.h"
+#include <Arduino.h>
+#include <FFat.h>
+#include <esp_partition.h>
+#include <algorithm>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unity.h>
+#include <vector>
+
+// FrameStore mounts once per process and keeps its state in statics, so
+// each boot is a child process on the same flash image. A failed check
+// ends the child with a non-zero status.
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);         \
+      fflush(stdout);                                                          \
+      _exit(1);                                                                \
+    }                                                                          \
+  } while (0)
+
+static int boot(void (*body)()) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    FramePool::setup();
+    body();
+    fflush(stdout);
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+static size_t lengthFor(uint32_t sequence) {
+  return 6000 + (sequence * 997) % 30000;
+}
+
+static uint8_t byteAt(uint32_t sequence, size_t i) {
+  return (uint8_t)(sequence * 31 + i * 7 + (i >> 8));
+}
+
+static FrameRef makeFrame(uint32_t sequence) {
+  size_t len = lengthFor(sequence);
+  FrameRef frame = FramePool::acquire(len);
+  CHECK(frame);
+  uint8_t *p = frame.writableData();
+  for (size_t i = 0; i < len; i++)
+    p[i] = byteAt(sequence, i);
+  frame.setFrame(len, sequence, sequence * 100);
+  return frame;
+}
+
+static bool append(uint32_t sequence) {
+  return FrameStore::append(makeFrame(sequence));
+}
+
+// Found, and every byte read back is the one written
+static bool holds(uint32_t sequence) {
+  FrameStore::Record r;
+  if (!FrameStore::find(sequence, r) || r.sequence != sequence ||
+      r.length != lengthFor(sequence) || r.timestamp != sequence * 100)
+    return false;
+  uint8_t buf[4096];
+  for (size_t at = 0; at < r.length; at += sizeof(buf)) {
+    size_t n = std::min(sizeof(buf), r.length - at);
+    if (!FrameStore::read(r, at, buf, n))
+      return false;
+    for (size_t i = 0; i < n; i++)
+      if (buf[i] != byteAt(sequence, at + i))
+        return false;
+  }
+  return true;
+}
+
+static const esp_partition_t *framesPartition() {
+  return esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                  ESP_PARTITION_SUBTYPE_ANY,
+                                  FRAME_STORE_PARTITION);
+}
+
+void setUp() {
+  Host::setDataDir("host_data/test_frame_store");
+  Host::eraseFlash();
+}
+void tearDown() {}
+
+// Capture sequences with gaps, as the writer sees them; lookups use them
+static void test_append_and_find() {
+  TEST_ASSERT_EQUAL(0, boot([] {
+    CHECK(FrameStore::setup());
+    FrameStore::Record r;
+    CHECK(!FrameStore::latest(r));
+    for (uint32_t seq = 100; seq < 200; seq += 5)
+      CHECK(append(seq));
+    for (uint32_t seq = 100; seq < 200; seq += 5)
+      CHECK(holds(seq));
+    CHECK(!FrameStore::find(101, r));
+    CHECK(!FrameStore::find(99, r));
+    CHECK(!FrameStore::find(200, r));
+    CHECK(FrameStore::latest(r) && r.sequence == 195);
+    CHECK(!append(195)); // already the newest
+    FrameStore::Stats s = FrameStore::getStats();
+    CHECK(s.records == 20);
+    CHECK(s.oldestSequence == 100 && s.newestSequence == 195);
+  }));
+}
+
+// Past the end of the log the oldest records give way, and every sector
+// is erased just before it is programmed again
+static void test_wraparound() {
+  TEST_ASSERT_EQUAL(0, boot([] {
+    CHECK(FrameStore::setup());
+    uint32_t logSectors = framesPartition()->size / 4096 - 2;
+    uint32_t last = 0;
+    for (uint32_t seq = 1; FrameStore::getStats().wraps < 2; seq += 3) {
+      CHECK(append(seq));
+      last = seq;
+    }
+    FrameStore::Stats s = FrameStore::getStats();
+    CHECK(s.newestSequence == last);
+    CHECK(s.records > 0 && s.records < last / 3);
+    CHECK(s.sectorErases > logSectors);
+    CHECK(!holds(1));
+    CHECK(holds(s.oldestSequence));
+    CHECK(holds(last));
+    // The live records are exactly the newest ones, in order
+    uint32_t live = 0;
+    for (uint32_t seq = s.oldestSequence; seq <= last; seq += 3) {
+      CHECK(holds(seq));
+      live++;
+    }
+    CHECK(live == s.records);
+  }));
+}
+
+// A reader holding a record learns when the writer recycles its sectors
+static void test_read_after_eviction() {
+  TEST_ASSERT_EQUAL(0, boot([] {
+    CHECK(FrameStore::setup());
+    CHECK(append(1));
+    FrameStore::Record first;
+    CHECK(FrameStore::find(1, first));
+    uint8_t buf[64];
+    CHECK(FrameStore::read(first, 0, buf, sizeof(buf)));
+    for (uint32_t seq = 2; FrameStore::getStats().wraps < 1; seq++)
+      CHECK(append(seq));
+    CHECK(!FrameStore::read(first, 0, buf, sizeof(buf)));
+  }));
+}
+
+// A wiped chip, or counters that went backwards, start an empty log
+static void test_erase_and_restart() {
+  TEST_ASSERT_EQUAL(0, boot([] {
+    CHECK(FrameStore::setup());
+    for (uint32_t seq = 500; seq < 510; seq++)
+      CHECK(append(seq));
+  }));
+  Host::eraseFlash();
+  TEST_ASSERT_EQUAL(0, boot([] {
+    CHECK(FrameStore::setup());
+    FrameStore::Record r;
+    CHECK(!FrameStore::latest(r));
+    CHECK(FrameStore::getStats().records == 0);
+    for (uint32_t seq = 500; seq < 510; seq++)
+      CHECK(append(seq));
+    CHECK(append(7)); // NVS lost: the old records must not shadow new ones
+    FrameStore::Stats s = FrameStore::getStats();
+    CHECK(s.records == 1 && s.oldestSequence == 7 && s.newestSequence == 7);
+    CHECK(holds(7));
+    CHECK(!FrameStore::find(505, r));
+  }));
+}
+
+// Power lost while a record was being written: its payload is half
+// programmed and its header cut short. The next boot recovers from the
+// last checkpoint, follows the complete records written after it, stops
+// at the torn one and writes over it.
+static constexpr uint32_t BEFORE_CRASH = 40; // not a checkpoint multiple
+
+static void test_recovery_after_torn_record() {
+  TEST_ASSERT_EQUAL(0, boot([] {
+    CHECK(FrameStore::setup());
+    for (uint32_t seq = 1; seq <= BEFORE_CRASH; seq++)
+      CHECK(append(seq * 2));
+    uint32_t head = FrameStore::getStats().headOffset;
+    FrameRef torn = makeFrame(BEFORE_CRASH * 2 + 2);
+    const esp_partition_t *p = framesPartition();
+    CHECK(esp_partition_erase_range(p, head, 4096 * 8) == ESP_OK);
+    CHECK(esp_partition_write(p, head + 32, torn.data(), torn.size() / 2) ==
+          ESP_OK);
+    uint32_t header[4] = {0x324D5246, BEFORE_CRASH * 2 + 2, 0, 0};
+    CHECK(esp_partition_write(p, head, header, sizeof(header)) == ESP_OK);
+    _exit(0); // no checkpoint, no clean shutdown
+  }));
+  TEST_ASSERT_EQUAL(0, boot([] {
+    CHECK(FrameStore::setup());
+    FrameStore::Stats s = FrameStore::getStats();
+    CHECK(s.records == BEFORE_CRASH);
+    CHECK(s.recoveredRecords ==
+          BEFORE_CRASH % (uint32_t)FRAME_STORE_CHECKPOINT_EVERY);
+    for (uint32_t seq = 1; seq <= BEFORE_CRASH; seq++)
+      CHECK(holds(seq * 2));
+    FrameStore::Record r;
+    CHECK(!FrameStore::find(BEFORE_CRASH * 2 + 2, r));
+    CHECK(append(BEFORE_CRASH * 2 + 4));
+  }));
+  TEST_ASSERT_EQUAL(0, boot([] {
+    CHECK(FrameStore::setup());
+    CHECK(FrameStore::getStats().records == BEFORE_CRASH + 1);
+    CHECK(holds(2));
+    CHECK(holds(BEFORE_CRASH * 2 + 4));
+  }));
+}
+
+// The same frames through the raw log and through one FFat file each,
+// the per-file path's open/write/close. Both run on the host's disk, so
+// the ratio, not the absolute figure, is the number to watch.
+static constexpr uint32_t TIMED_FRAMES = 200;
+
+static void report(const char *name, int64_t us, uint64_t bytes) {
+  printf("bench %-16s n=%-4u avg=%7lluus %6.1f MB/s\n", name,
+         (unsigned)TIMED_FRAMES, (unsigned long long)(us / TIMED_FRAMES),
+         us ? (double)bytes / us : 0.0);
+}
+
+static void test_throughput_against_ffat() {
+  TEST_ASSERT_EQUAL(0, boot([] {
+    CHECK(FrameStore::setup());
+    CHECK(FFat.begin(true));
+    FFat.mkdir("/t");
+    std::vector<FrameRef> frames;
+    uint64_t bytes = 0;
+    for (uint32_t seq = 1; seq <= 8; seq++)
+      frames.push_back(makeFrame(seq));
+    for (const FrameRef &f : frames)
+      bytes += f.size();
+    bytes = bytes * TIMED_FRAMES / frames.size();
+
+    int64_t start = esp_timer_get_time();
+    for (uint32_t i = 0; i < TIMED_FRAMES; i++) {
+      const FrameRef &f = frames[i % frames.size()];
+      String path = "/t/img_" + String(i) + ".jpg";
+      File file = FFat.open(path, "w");
+      CHECK(file);
+      CHECK(file.write(f.data(), f.size()) == f.size());
+      file.close();
+    }
+    report("ffat_write", esp_timer_get_time() - start, bytes);
+
+    start = esp_timer_get_time();
+    for (uint32_t i = 0; i < TIMED_FRAMES; i++) {
+      FrameRef &f = frames[i % frames.size()];
+      f.setFrame(f.size(), 1000 + i, 0); // fresh sequence, same bytes
+      CHECK(FrameStore::append(f));
+    }
+    report("raw_log_append", esp_timer_get_time() - start, bytes);
+    CHECK(FrameStore::getStats().records == TIMED_FRAMES);
+  }));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_append_and_find);
+  RUN_TEST(test_wraparound);
+  RUN_TEST(test_read_after_eviction);
+  RUN_TEST(test_erase_and_restart);
+  RUN_TEST(test_recovery_after_torn_record);
+  RUN_TEST(test_throughput_against_ffat);
+  return UNITY_END();
+}
@@ -0,0 +1,470 @@
+// End-to-end load: the whole firmware (setup(), then loop() on its own
+// thread) with a directory of JPEGs replayed as the sensor, ~50 /stream
+// viewers, a few /i/latest.jpg pollers and as many /i/next long-polls as it
+// admits, each on a real socket. Every frame a client receives must be one
+// of the replayed files, byte for byte, and /i/next must only go forward.
+// Each client records its latencies, reported as percentiles next to the
+// heap and PSRAM high-water marks the load left behind.
+//   pio test -e native -f test_load
+#include "../common/synthetic_jpeg.h"
+#include "config.h"
+#include "esp_camera.h"
+#include "frame_pool.h"
+#include "host.h"
+#include "mjpeg_stream.h"
+#include <Arduino.h>
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <unity.h>
+#include <vector>
+
+static constexpr const char *JPEG_DIR = "host_data/test_load_jpegs";
+static constexpr uint32_t REPLAY_FRAMES = 12;
+static constexpr uint32_t SENSOR_FPS = 20;
+static constexpr uint32_t LOAD_MS = 4000;
+static constexpr uint32_t VIEWERS = 50;
+static constexpr uint32_t SNAPSHOT_CLIENTS = 4;
+
+static std::vector<std::string> replayed;
+
+// A random scan at the configured frame size, so the motion detector sees
+// every replayed frame as a new scene
+static std::string makeJpeg(uint32_t seed) {
+  srand(seed);
+  std::vector<uint8_t> scan(8000 + seed * 1500);
+  for (uint8_t &byte : scan)
+    byte = (uint8_t)rand();
+  return syntheticJpeg(resolution[CAMERA_FRAME_SIZE].width,
+                       resolution[CAMERA_FRAME_SIZE].height, scan.data(),
+                       scan.size());
+}
+
+static void writeReplayFiles() {
+  std::filesystem::remove_all(JPEG_DIR);
+  std::filesystem::create_directories(JPEG_DIR);
+  for (uint32_t i = 0; i < REPLAY_FRAMES; i++) {
+    replayed.push_back(makeJpeg(i + 1));
+    char path[64];
+    snprintf(path, sizeof(path), "%s/%02u.jpg", JPEG_DIR, (unsigned)i);
+    std::ofstream(path, std::ios::binary) << replayed.back();
+  }
+}
+
+static bool isReplayed(const std::string &body) {
+  for (const std::string &jpeg : replayed)
+    if (body == jpeg)
+      return true;
+  return false;
+}
+
+// ---- a blocking HTTP client on the loopback listener ----
+
+struct Client {
+  int fd = -1;
+  std::string raw; // received from the socket, not yet decoded
+  std::string in;  // decoded, not yet consumed
+  bool chunked = false;
+  size_t chunkLeft = 0;
+  bool chunkEnded = false; // its CRLF is still in `raw`
+
+  explicit Client(const std::string &request) {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(Host::webServerPort());
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+        send(fd, request.data(), request.size(), MSG_NOSIGNAL) !=
+            (ssize_t)request.size()) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  ~Client() {
+    if (fd >= 0)
+      close(fd);
+  }
+
+  // Moves what `raw` holds into `in`, unwrapping chunked encoding
+  void decode() {
+    if (!chunked) {
+      in += raw;
+      raw.clear();
+      return;
+    }
+    for (;;) {
+      if (!chunkLeft) {
+        if (chunkEnded) {
+          if (raw.size() < 2)
+            return;
+          raw.erase(0, 2);
+          chunkEnded = false;
+        }
+        size_t eol = raw.find("\r\n");
+        if (eol == std::string::npos)
+          return;
+        chunkLeft = strtoul(raw.c_str(), nullptr, 16);
+        raw.erase(0, eol + 2);
+        if (!chunkLeft)
+          return; // last chunk
+      }
+      size_t n = std::min(chunkLeft, raw.size());
+      if (!n)
+        return;
+      in.append(raw, 0, n);
+      raw.erase(0, n);
+      chunkLeft -= n;
+      chunkEnded = !chunkLeft;
+    }
+  }
+
+  // Until `in` holds `bytes` bytes; false on close or timeout
+  bool fill(size_t bytes, uint32_t timeoutMs) {
+    uint32_t start = millis();
+    while (fd >= 0 && in.size() < bytes) {
+      pollfd p = {fd, POLLIN, 0};
+      int32_t left = (int32_t)(timeoutMs - (millis() - start));
+      if (left <= 0 || poll(&p, 1, left) <= 0)
+        return false;
+      char buf[4096];
+      ssize_t n = recv(fd, buf, sizeof(buf), 0);
+      if (n <= 0)
+        return false;
+      raw.append(buf, n);
+      decode();
+    }
+    return in.size() >= bytes;
+  }
+
+  // Headers up to the blank line, consumed from `in`
+  bool headers(std::string &out, uint32_t timeoutMs) {
+    size_t end;
+    while ((end = in.find("\r\n\r\n")) == std::string::npos)
+      if (!fill(in.size() + 1, timeoutMs))
+        return false;
+    out = in.substr(0, end + 4);
+    in.erase(0, end + 4);
+    return true;
+  }
+
+  // The response head; a chunked body is unwrapped from here on
+  bool response(std::string &out, uint32_t timeoutMs) {
+    if (!headers(out, timeoutMs))
+      return false;
+    if (out.find("\r\nTransfer-Encoding: chunked\r\n") !=
+        std::string::npos) {
+      raw.insert(0, in);
+      in.clear();
+      chunked = true;
+      decode();
+    }
+    return true;
+  }
+
+  bool body(size_t len, std::string &out, uint32_t timeoutMs) {
+    if (!fill(len, timeoutMs))
+      return false;
+    out = in.substr(0, len);
+    in.erase(0, len);
+    return true;
+  }
+};
+
+static long headerValue(const std::string &headers, const char *name) {
+  size_t at = headers.find(std::string("\r\n") + name + ": ");
+  return at == std::string::npos
+             ? -1
+             : strtol(headers.c_str() + at + strlen(name) + 4, nullptr, 10);
+}
+
+static std::string headerText(const std::string &headers, const char *name) {
+  size_t at = headers.find(std::string("\r\n") + name + ": ");
+  if (at == std::string::npos)
+    return "";
+  at += strlen(name) + 4;
+  return headers.substr(at, headers.find("\r\n", at) - at);
+}
+
+static std::string request(const std::string &url) {
+  return "GET " + url + " HTTP/1.1\r\nHost: host\r\nConnection: close\r\n\r\n";
+}
+
+// Readers can't use TEST_ASSERT off the main thread; they count failures
+// and keep the first one for the report
+static std::atomic<uint32_t> failures{0};
+static std::atomic<const char *> firstFailure{nullptr};
+
+static bool check(bool ok, const char *what) {
+  if (!ok && failures.fetch_add(1) == 0)
+    firstFailure.store(what);
+  return ok;
+}
+
+// Per-request latencies from every client thread, in microseconds
+class Latencies {
+public:
+  explicit Latencies(const char *name) : name(name) {}
+
+  void add(int64_t us) {
+    std::lock_guard<std::mutex> lock(mutex);
+    samples.push_back((uint32_t)us);
+  }
+
+  // Nearest rank; 0 when nothing was recorded
+  uint32_t percentile(uint32_t p) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (samples.empty())
+      return 0;
+    std::sort(samples.begin(), samples.end());
+    size_t rank = (samples.size() * p + 99) / 100;
+    return samples[rank ? rank - 1 : 0];
+  }
+
+  size_t count() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return samples.size();
+  }
+
+  void report() {
+    printf("load %-22s n=%-5u p50=%7uus p95=%7uus p99=%7uus\n", name,
+           (unsigned)count(), (unsigned)percentile(50),
+           (unsigned)percentile(95), (unsigned)percentile(99));
+  }
+
+private:
+  const char *name;
+  std::mutex mutex;
+  std::vector<uint32_t> samples;
+};
+
+static Latencies firstFrame("/stream first frame");
+static Latencies frameGap("/stream frame gap");
+static Latencies snapshot("/i/latest.jpg");
+static Latencies nextFrame("/i/next");
+
+struct ClientResult {
+  uint32_t frames = 0;
+  uint32_t timeouts = 0;
+};
+
+// One viewer for the whole run; parts are read as they arrive
+static void streamViewer(std::atomic<bool> &stop, ClientResult &result) {
+  int64_t last = esp_timer_get_time();
+  Client c(request("/stream"));
+  std::string head;
+  if (!check(c.fd >= 0 && c.response(head, 5000), "stream not answered") ||
+      !check(head.rfind("HTTP/1.1 200", 0) == 0, "stream refused"))
+    return;
+  while (!stop.load()) {
+    std::string part, jpeg, crlf;
+    if (!c.headers(part, 2000)) {
+      result.timeouts++;
+      continue;
+    }
+    long len = headerValue(part, "Content-Length");
+    if (!check(part.rfind("--frame\r\n", 0) == 0 && len > 0,
+               "malformed stream part") ||
+        !check(c.body(len, jpeg, 5000) && c.body(2, crlf, 5000),
+               "stream part cut short"))
+      return;
+    check(isReplayed(jpeg), "stream frame is not a replayed file");
+    int64_t now = esp_timer_get_time();
+    (result.frames ? frameGap : firstFrame).add(now - last);
+    last = now;
+    result.frames++;
+  }
+}
+
+// Fetches the latest frame in a loop, a new connection each time
+static void snapshotPoller(std::atomic<bool> &stop, ClientResult &result) {
+  while (!stop.load()) {
+    int64_t start = esp_timer_get_time();
+    Client c(request("/i/latest.jpg"));
+    std::string head, jpeg;
+    if (!check(c.fd >= 0 && c.response(head, 5000),
+               "/i/latest.jpg not answered"))
+      return;
+    if (head.rfind("HTTP/1.1 404", 0) == 0) {
+      result.timeouts++; // nothing captured yet
+      delay(50);
+      continue;
+    }
+    long len = headerValue(head, "Content-Length");
+    if (!check(head.rfind("HTTP/1.1 200", 0) == 0 && len > 0,
+               "/i/latest.jpg refused") ||
+        !check(c.body(len, jpeg, 5000), "/i/latest.jpg body cut short"))
+      return;
+    snapshot.add(esp_timer_get_time() - start);
+    check(isReplayed(jpeg), "/i/latest.jpg is not a replayed file");
+    result.frames++;
+    delay(20);
+  }
+}
+
+// Long-polls in a loop, each time after the cursor it last got
+static void nextPoller(std::atomic<bool> &stop, ClientResult &result) {
+  std::string cursor;
+  long after = -1;
+  while (!stop.load()) {
+    int64_t start = esp_timer_get_time();
+    Client c(request(cursor.empty() ? std::string("/i/next?timeout=2000")
+                                    : "/i/next?timeout=2000&after=" + cursor));
+    std::string head, jpeg;
+    if (!check(c.fd >= 0 && c.response(head, 5000), "/i/next not answered"))
+      return;
+    if (head.rfind("HTTP/1.1 204", 0) == 0) {
+      result.timeouts++;
+      continue;
+    }
+    if (!check(head.rfind("HTTP/1.1 200", 0) == 0, "/i/next refused"))
+      return;
+    long sequence = headerValue(head, "X-Frame-Sequence");
+    long len = headerValue(head, "Content-Length");
+    if (!check(len > 0 && c.body(len, jpeg, 5000), "/i/next body cut short"))
+      return;
+    nextFrame.add(esp_timer_get_time() - start);
+    check(sequence > after, "/i/next went backwards");
+    check(isReplayed(jpeg), "/i/next frame is not a replayed file");
+    after = sequence;
+    cursor = headerText(head, "X-Frame-Cursor");
+    result.frames++;
+  }
+}
+
+// A gauge from /metrics, or -1 when it is missing
+static double metric(const std::string &body, const char *name) {
+  size_t at = body.find(std::string("\n") + name + " ");
+  return at == std::string::npos
+             ? -1
+             : strtod(body.c_str() + at + strlen(name) + 2, nullptr);
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_stream_snapshots_and_next_under_load() {
+  TEST_ASSERT_TRUE(VIEWERS <= STREAM_MAX_CLIENTS);
+  Host::resetHeapPeaks();
+  Host::HeapStats idle = Host::heapStats();
+
+  std::atomic<bool> stop{false};
+  std::vector<ClientResult> viewers(VIEWERS);
+  std::vector<ClientResult> pollers(SNAPSHOT_CLIENTS);
+  std::vector<ClientResult> waiters(NEXT_FRAME_MAX_WAITERS);
+  std::vector<std::thread> clients;
+  for (ClientResult &r : viewers)
+    clients.emplace_back(streamViewer, std::ref(stop), std::ref(r));
+  for (ClientResult &r : pollers)
+    clients.emplace_back(snapshotPoller, std::ref(stop), std::ref(r));
+  for (ClientResult &r : waiters)
+    clients.emplace_back(nextPoller, std::ref(stop), std::ref(r));
+
+  delay(LOAD_MS / 2);
+  // Every long-poll slot is taken: one more is turned away, not queued
+  std::string head;
+  Client extra(request("/i/next?timeout=2000"));
+  TEST_ASSERT_TRUE(extra.response(head, 5000));
+  TEST_ASSERT_TRUE(head.rfind("HTTP/1.1 503", 0) == 0);
+  delay(LOAD_MS / 2);
+  stop = true;
+  for (std::thread &t : clients)
+    t.join();
+  const char *what = firstFailure.load();
+  TEST_ASSERT_EQUAL_MESSAGE(0u, failures.load(), what ? what : "");
+
+  uint32_t fewest = UINT32_MAX, stalls = 0, served = 0;
+  for (const ClientResult &r : viewers) {
+    fewest = std::min(fewest, r.frames);
+    stalls += r.timeouts;
+    served += r.frames > 0;
+  }
+  printf("load %u viewers: served=%u fewest frames=%u stalls=%u\n",
+         (unsigned)VIEWERS, (unsigned)served, (unsigned)fewest,
+         (unsigned)stalls);
+  // At STREAM_TARGET_FPS over the run, with room for a slow start
+  TEST_ASSERT_EQUAL(VIEWERS, served);
+  TEST_ASSERT_TRUE(fewest >= STREAM_TARGET_FPS * LOAD_MS / 1000 / 3);
+  for (const ClientResult &r : pollers)
+    TEST_ASSERT_TRUE(r.frames > 0);
+  for (const ClientResult &r : waiters) {
+    printf("load /i/next frames=%u timeouts=%u\n", (unsigned)r.frames,
+           (unsigned)r.timeouts);
+    TEST_ASSERT_TRUE(r.frames > 0);
+  }
+
+  firstFrame.report();
+  frameGap.report();
+  snapshot.report();
+  nextFrame.report();
+  // A viewer is served at the stream rate, not behind the others: every
+  // gap but the rare outlier stays near one frame interval
+  TEST_ASSERT_TRUE(frameGap.percentile(95) < 3000000 / STREAM_TARGET_FPS);
+  // A snapshot is answered from the cache, never behind the viewers
+  TEST_ASSERT_TRUE(snapshot.percentile(99) < 500000);
+
+  Host::HeapStats peak = Host::heapStats();
+  std::string metrics = Host::get("/metrics");
+  double heapMinFree = metric(metrics, "heap_min_free_bytes");
+  double psramMinFree = metric(metrics, "psram_min_free_bytes");
+  printf("load memory: internal peak=%u (+%u) psram peak=%u (+%u) "
+         "heap_min_free=%.0f psram_min_free=%.0f\n",
+         (unsigned)peak.internalPeak,
+         (unsigned)(peak.internalPeak - idle.internalUsed),
+         (unsigned)peak.psramPeak, (unsigned)(peak.psramPeak - idle.psramUsed),
+         heapMinFree, psramMinFree);
+  // The high-water gauges are exported and the load never ran a heap dry
+  TEST_ASSERT_TRUE(heapMinFree > 0);
+  TEST_ASSERT_TRUE(psramMinFree > 0);
+}
+
+static bool viewersGone() { return MjpegStream::activeClients() == 0; }
+
+// Closed sockets give back every viewer slot and frame reference,
+static void test_clients_released() {
+  uint32_t start = millis();
+  while (!viewersGone() && millis() - start < 5000)
+    delay(10);
+  TEST_ASSERT_TRUE(viewersGone());
+  // The cache, a capture in hand and the storage queue, nothing more
+  TEST_ASSERT_TRUE(FramePool::getStats().inUse <=
+                   (uint32_t)(FRAME_CACHE_SIZE + 1 + STORAGE_QUEUE_DEPTH + 1));
+  // and the long-poll slots: a new one is admitted again
+  std::string body = Host::get("/i/next?timeout=0");
+  TEST_ASSERT_TRUE(body.rfind("HTTP/1.1 204", 0) == 0 ||
+                   body.rfind("HTTP/1.1 200", 0) == 0);
+}
+
+int main() {
+  writeReplayFiles();
+  Host::setDataDir("host_data/test_load");
+  Host::eraseFlash();
+  Host::setCamera(JPEG_DIR, SENSOR_FPS);
+  Host::setWebServerPort(0);
+  setup();
+  // The Arduino core's loopTask
+  std::thread([] {
+    for (;;) {
+      loop();
+      yield();
+    }
+  }).detach();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_stream_snapshots_and_next_under_load);
+  RUN_TEST(test_clients_released);
+  int result = UNITY_END();
+  // The firmware's tasks are still running; skip the static destructors
+  // they would race with, as the chip never returns from setup() either
+  fflush(stdout);
+  _Exit(result);
+}
@@ -0,0 +1,127 @@
+// MotionDetector's scores against a plain scalar loop: the comparison
+// kernel on its own, and analyze()/referenceScore() on synthetic frames of
+// a still scene, a small moving patch and a full change.
+//   pio test -e native -f test_motion
+#include "../common/synthetic_jpeg.h"
+#include "config.h"
+#include "esp_camera.h"
+#include "frame_pool.h"
+#include "motion_detector.h"
+#include <Arduino.h>
+#include <stdlib.h>
+#include <unity.h>
+#include <vector>
+
+// The obvious version of countChanged(): what the scores must equal
+static uint32_t scalarChanged(const uint8_t *a, const uint8_t *b, size_t n,
+                              uint8_t delta) {
+  uint32_t changed = 0;
+  for (size_t i = 0; i < n; i++)
+    if (abs((int)a[i] - (int)b[i]) > delta)
+      changed++;
+  return changed;
+}
+
+static int scalarScore(const std::vector<uint8_t> &a,
+                       const std::vector<uint8_t> &b) {
+  uint32_t changed =
+      scalarChanged(a.data(), b.data(), a.size(), MOTION_PIXEL_DELTA);
+  return (int)((uint64_t)changed * 1000 / a.size());
+}
+
+// Luma plane at 1/8 of the configured frame size, as analyze() decodes it
+static const uint16_t planeWidth = resolution[CAMERA_FRAME_SIZE].width / 8;
+static const uint16_t planeHeight = resolution[CAMERA_FRAME_SIZE].height / 8;
+
+// A frame whose scan is `luma`, which it decodes back to exactly
+static FrameRef makeFrame(const std::vector<uint8_t> &luma) {
+  std::string jpeg =
+      syntheticJpeg(planeWidth * 8, planeHeight * 8, luma.data(), luma.size());
+  FrameRef frame = FramePool::acquire(jpeg.size());
+  TEST_ASSERT_TRUE(frame);
+  memcpy(frame.writableData(), jpeg.data(), jpeg.size());
+  static uint32_t sequence = 0;
+  frame.setFrame(jpeg.size(), ++sequence, millis());
+  return frame;
+}
+
+static std::vector<uint8_t> scene(uint32_t seed) {
+  std::vector<uint8_t> luma((size_t)planeWidth * planeHeight);
+  srand(seed);
+  for (uint8_t &v : luma)
+    v = (uint8_t)rand();
+  return luma;
+}
+
+void setUp() {}
+void tearDown() {}
+
+// Random planes at every threshold, lengths that leave a tail, and the
+// differences right at the threshold
+static void test_kernel_matches_scalar() {
+  std::vector<uint8_t> one = scene(1), other = scene(2);
+  for (int delta = 0; delta <= 255; delta++) {
+    for (size_t n : {(size_t)0, (size_t)1, (size_t)7, (size_t)33, one.size()})
+      TEST_ASSERT_EQUAL(
+          scalarChanged(one.data(), other.data(), n, delta),
+          MotionDetector::countChanged(one.data(), other.data(), n, delta));
+  }
+
+  const uint8_t delta = 20;
+  const uint8_t x[] = {0, 255, 100, 100, 100, 100, 100, 120, 121, 0};
+  const uint8_t y[] = {255, 0, 80, 79, 120, 121, 100, 100, 100, 20};
+  TEST_ASSERT_EQUAL(scalarChanged(x, y, sizeof(x), delta),
+                    MotionDetector::countChanged(x, y, sizeof(x), delta));
+  TEST_ASSERT_EQUAL(5u, MotionDetector::countChanged(x, y, sizeof(x), delta));
+}
+
+// Each analyze() scores against the frame before it
+static void test_still_small_and_full_change() {
+  std::vector<uint8_t> still = scene(3);
+  TEST_ASSERT_EQUAL(-1, MotionDetector::analyze(makeFrame(still)));
+  TEST_ASSERT_EQUAL(0, MotionDetector::analyze(makeFrame(still)));
+  MotionDetector::markReference();
+
+  // A bright patch a few percent of the plane in size
+  std::vector<uint8_t> patch = still;
+  for (uint16_t y = 2; y < 2 + planeHeight / 5; y++)
+    for (uint16_t x = 3; x < 3 + planeWidth / 5; x++) {
+      uint8_t &v = patch[(size_t)y * planeWidth + x];
+      v = v < 128 ? v + 100 : v - 100;
+    }
+  int small = MotionDetector::analyze(makeFrame(patch));
+  TEST_ASSERT_EQUAL(scalarScore(patch, still), small);
+  TEST_ASSERT_TRUE(small > 0 && small < 100);
+  TEST_ASSERT_EQUAL(small, MotionDetector::referenceScore());
+
+  // Every pixel inverted
+  std::vector<uint8_t> inverted = patch;
+  for (uint8_t &v : inverted)
+    v = v < 128 ? 255 - v / 2 : v / 2;
+  int full = MotionDetector::analyze(makeFrame(inverted));
+  TEST_ASSERT_EQUAL(scalarScore(inverted, patch), full);
+  TEST_ASSERT_EQUAL(1000, full);
+  TEST_ASSERT_EQUAL(scalarScore(inverted, still),
+                    MotionDetector::referenceScore());
+
+  // Sensor noise below the threshold is a still scene
+  std::vector<uint8_t> noisy = inverted;
+  for (size_t i = 0; i < noisy.size(); i++)
+    noisy[i] =
+        (uint8_t)std::min(255, noisy[i] + (int)(i % MOTION_PIXEL_DELTA));
+  TEST_ASSERT_EQUAL(0, MotionDetector::analyze(makeFrame(noisy)));
+
+  MotionDetector::Stats s = MotionDetector::getStats();
+  TEST_ASSERT_EQUAL(planeWidth, s.width);
+  TEST_ASSERT_EQUAL(planeHeight, s.height);
+  TEST_ASSERT_EQUAL(0u, s.decodeFailures);
+}
+
+int main() {
+  FramePool::setup();
+  MotionDetector::setup();
+  UNITY_BEGIN();
+  RUN_TEST(test_kernel_matches_scalar);
+  RUN_TEST(test_still_small_and_full_change);
+  return UNITY_END();
+}
@@ -0,0 +1,106 @@
+// /i/next against the capture that ends its wait: the managers run as in
+// main.cpp, but captures are made here, one at a time, so the moment a
+// frame is published is known. The waiting long-poll must be answered
+// right after it, not at the server's next half-second poll.
+//   pio test -e native -f test_next_frame
+#include "camera_cycle.h"
+#include "config.h"
+#include "core1_manager.h"
+#include "debug_manager.h"
+#include "frame_cache.h"
+#include "host.h"
+#include "led_breathe.h"
+#include "system_manager.h"
+#include <Arduino.h>
+#include <string>
+#include <thread>
+#include <unity.h>
+
+static constexpr uint32_t ROUNDS = 10;
+static constexpr uint32_t MAX_WAKE_US = 20000;
+
+// The managers' setup as main.cpp runs it, with the capture loop left to
+// the tests (see test_bench)
+static void boot() {
+  Host::setDataDir("host_data/test_next_frame");
+  Host::eraseFlash();
+  Host::setCamera(nullptr, 50);
+  Host::setWebServerPort(0);
+  DebugManager::getInstance().setup();
+  SystemManager::getInstance().setup();
+  Core1Manager::getInstance().setup();
+  CameraCycle::setup();
+  LEDBreathe::setup();
+}
+
+struct Poll {
+  std::string response;
+  int64_t doneUs = 0;
+};
+
+// One long-poll on its own thread; Host::get() returns once it is answered
+static std::thread longPoll(const char *url, Poll &poll) {
+  return std::thread([url, &poll] {
+    poll.response = Host::get(url, 10000);
+    poll.doneUs = esp_timer_get_time();
+  });
+}
+
+static long headerValue(const std::string &response, const char *name) {
+  size_t at = response.find(std::string("\r\n") + name + ": ");
+  return at == std::string::npos
+             ? -1
+             : strtol(response.c_str() + at + strlen(name) + 4, nullptr, 10);
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_answered_on_publish() {
+  CameraCycle::captureNow(); // something to wait past
+  uint32_t slowest = 0;
+  for (uint32_t i = 0; i < ROUNDS; i++) {
+    Poll poll;
+    std::thread t = longPoll("/i/next?timeout=5000", poll);
+    delay(100 + i * 37); // parked, at a different point of the poll cycle
+
+    CameraCycle::captureNow();
+    int64_t publishedUs = esp_timer_get_time();
+    uint32_t sequence = FrameCache::latest().sequence();
+    t.join();
+
+    TEST_ASSERT_TRUE(poll.response.rfind("HTTP/1.1 200", 0) == 0);
+    TEST_ASSERT_EQUAL((long)sequence,
+                      headerValue(poll.response, "X-Frame-Sequence"));
+    uint32_t us = poll.doneUs > publishedUs
+                      ? (uint32_t)(poll.doneUs - publishedUs)
+                      : 0;
+    slowest = std::max(slowest, us);
+  }
+  printf("next slowest answer after publish=%uus\n", (unsigned)slowest);
+  TEST_ASSERT_TRUE(slowest < MAX_WAKE_US);
+}
+
+// Nothing published: the timeout still ends the wait, with a 204
+static void test_timeout_without_publish() {
+  Poll poll;
+  int64_t start = esp_timer_get_time();
+  std::thread t = longPoll("/i/next?timeout=200", poll);
+  t.join();
+  uint32_t ms = (uint32_t)((poll.doneUs - start) / 1000);
+  printf("next timeout answered after=%ums\n", (unsigned)ms);
+  TEST_ASSERT_TRUE(poll.response.rfind("HTTP/1.1 204", 0) == 0);
+  TEST_ASSERT_TRUE(ms >= 200 && ms < 1000);
+}
+
+int main() {
+  boot();
+  UNITY_BEGIN();
+  RUN_TEST(test_answered_on_publish);
+  RUN_TEST(test_timeout_without_publish);
+  int result = UNITY_END();
+  // The firmware's tasks are still running; skip the static destructors
+  // they would race with, as the chip never returns from setup() either
+  fflush(stdout);
+  _Exit(result);
+}
@@ -0,0 +1,153 @@
+// The capture pipeline against a slow filesystem: the mock sensor sets the
+// frame rate, every FFat write and remove is stretched, and the camera
+// task must neither slow down nor block while the writer falls behind.
+//   pio test -e native -f test_pipeline
+#include "camera_cycle.h"
+#include "config.h"
+#include "core1_manager.h"
+#include "debug_manager.h"
+#include "frame_pool.h"
+#include "host.h"
+#include "led_breathe.h"
+#include "storage_writer.h"
+#include "system_manager.h"
+#include <Arduino.h>
+#include <unity.h>
+
+static constexpr uint32_t SENSOR_FPS = 50;
+static constexpr uint32_t FRAME_US = 1000000 / SENSOR_FPS;
+static constexpr uint32_t SLOW_FS_US = 300000; // per write and per remove
+
+struct Run {
+  uint32_t captures;
+  uint64_t totalUs;
+  uint32_t maxUs;
+};
+
+static Run captureFor(uint32_t captures) {
+  Run r = {captures, 0, 0};
+  for (uint32_t i = 0; i < captures; i++) {
+    int64_t start = esp_timer_get_time();
+    CameraCycle::captureNow();
+    uint32_t us = (uint32_t)(esp_timer_get_time() - start);
+    r.totalUs += us;
+    r.maxUs = std::max(r.maxUs, us);
+  }
+  printf("pipeline n=%-4u avg=%6lluus max=%7uus\n", (unsigned)captures,
+         (unsigned long long)(r.totalUs / captures), (unsigned)r.maxUs);
+  return r;
+}
+
+static bool waitFor(uint32_t timeoutMs, bool (*done)()) {
+  uint32_t start = millis();
+  while (!done()) {
+    if (millis() - start > timeoutMs)
+      return false;
+    delay(10);
+  }
+  return true;
+}
+
+// The managers' setup as main.cpp runs it, with the capture loop left to
+// the tests (see test_bench)
+static void boot() {
+  Host::setDataDir("host_data/test_pipeline");
+  Host::eraseFlash();
+  Host::setCamera(nullptr, SENSOR_FPS);
+  Host::setWebServerPort(0);
+  DebugManager::getInstance().setup();
+  SystemManager::getInstance().setup();
+  Core1Manager::getInstance().setup();
+  CameraCycle::setup();
+  LEDBreathe::setup();
+}
+
+void setUp() {}
+void tearDown() {}
+
+static uint32_t baselineUs;
+
+// Fast flash: every triggered frame is queued and written
+static void test_baseline() {
+  StorageWriter::Stats before = StorageWriter::getStats();
+  Run r = captureFor(50);
+  baselineUs = (uint32_t)(r.totalUs / r.captures);
+  TEST_ASSERT_TRUE(waitFor(5000, [] {
+    return StorageWriter::getStats().queueDepth == 0;
+  }));
+  StorageWriter::Stats after = StorageWriter::getStats();
+  TEST_ASSERT_EQUAL(before.dropped, after.dropped);
+  TEST_ASSERT_EQUAL(before.enqueued + 50, after.enqueued);
+}
+
+// Each stored frame now costs the writer a write and a remove, ~0.6 s,
+// against a capture every 20 ms. The queue fills in a few frames and the
+// rest are dropped at the hand-off, while captures go on at sensor rate.
+static constexpr uint32_t STALLED_CAPTURES = 100;
+
+static void test_capture_rate_while_writes_stall() {
+  Host::setFsDelayUs(SLOW_FS_US);
+  CameraCycle::Stats cameraBefore = CameraCycle::getStats();
+  StorageWriter::Stats before = StorageWriter::getStats();
+  uint32_t sensorBefore = Host::cameraFrames();
+
+  Run r = captureFor(STALLED_CAPTURES);
+
+  CameraCycle::Stats camera = CameraCycle::getStats();
+  StorageWriter::Stats after = StorageWriter::getStats();
+  uint32_t avgUs = (uint32_t)(r.totalUs / r.captures);
+  // Paced by the sensor, as with fast flash; no capture waited on a write
+  TEST_ASSERT_TRUE(avgUs < FRAME_US * 3 / 2);
+  TEST_ASSERT_TRUE(avgUs < baselineUs + FRAME_US / 4);
+  TEST_ASSERT_TRUE(r.maxUs < SLOW_FS_US / 2);
+  TEST_ASSERT_EQUAL(sensorBefore + STALLED_CAPTURES, Host::cameraFrames());
+  TEST_ASSERT_EQUAL(cameraBefore.framesCaptured + STALLED_CAPTURES,
+                    camera.framesCaptured);
+  TEST_ASSERT_EQUAL(cameraBefore.allocFailures, camera.allocFailures);
+
+  // Every frame was either queued or dropped, and the drops are the ones
+  // the full queue refused
+  uint32_t enqueued = after.enqueued - before.enqueued;
+  uint32_t dropped = after.dropped - before.dropped;
+  printf("pipeline enqueued=%u dropped=%u written=%u high-water=%u/%u\n",
+         (unsigned)enqueued, (unsigned)dropped,
+         (unsigned)(after.written - before.written),
+         (unsigned)after.queueHighWater, (unsigned)after.queueCapacity);
+  TEST_ASSERT_EQUAL(STALLED_CAPTURES, enqueued + dropped);
+  TEST_ASSERT_EQUAL(camera.framesStored - cameraBefore.framesStored,
+                    enqueued);
+  TEST_ASSERT_TRUE(dropped > STALLED_CAPTURES / 2);
+  TEST_ASSERT_EQUAL(after.queueCapacity, after.queueHighWater);
+  TEST_ASSERT_TRUE(after.written - before.written < enqueued);
+}
+
+// With fast flash back the writer drains what it accepted, and the next
+// frame is queued again
+static void test_recovers_after_stall() {
+  Host::setFsDelayUs(0);
+  TEST_ASSERT_TRUE(waitFor(10000, [] {
+    StorageWriter::Stats s = StorageWriter::getStats();
+    return s.queueDepth == 0 && s.written + s.writeFailures == s.enqueued;
+  }));
+  StorageWriter::Stats before = StorageWriter::getStats();
+  captureFor(5);
+  StorageWriter::Stats after = StorageWriter::getStats();
+  TEST_ASSERT_EQUAL(before.dropped, after.dropped);
+  TEST_ASSERT_EQUAL(0u, after.writeFailures);
+  // Queue and cache hold the only references left
+  TEST_ASSERT_TRUE(FramePool::getStats().inUse <=
+                   (uint32_t)(STORAGE_QUEUE_DEPTH + FRAME_CACHE_SIZE + 1));
+}
+
+int main() {
+  boot();
+  UNITY_BEGIN();
+  RUN_TEST(test_baseline);
+  RUN_TEST(test_capture_rate_while_writes_stall);
+  RUN_TEST(test_recovers_after_stall);
+  int result = UNITY_END();
+  // The firmware's tasks are still running; skip the static destructors
+  // they would race with, as the chip never returns from setup() either
+  fflush(stdout);
+  _Exit(result);
+}
@@ -0,0 +1,187 @@
+// /stream viewers that hang up while the pump task is resuming them: the
+// managers run as in main.cpp, captures are made back to back on a thread
+// of their own, and every announcement sends the pump through the waiting
+// viewers just as some of them close, cleanly or with a reset. Every
+// viewer slot and frame reference must come back, and the stream must
+// still serve a new viewer afterwards.
+//   pio test -e native -f test_stream_pump
+#include "camera_cycle.h"
+#include "config.h"
+#include "core1_manager.h"
+#include "debug_manager.h"
+#include "frame_pool.h"
+#include "host.h"
+#include "led_breathe.h"
+#include "mjpeg_stream.h"
+#include "storage_writer.h"
+#include "system_manager.h"
+#include <Arduino.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <unity.h>
+#include <vector>
+
+static constexpr uint32_t SENSOR_FPS = 100;
+static constexpr uint32_t VIEWERS = 16;
+static constexpr uint32_t ROUNDS = 25; // connections per viewer thread
+
+// The managers' setup as main.cpp runs it, with the capture loop left to
+// the tests (see test_bench)
+static void boot() {
+  Host::setDataDir("host_data/test_stream_pump");
+  Host::eraseFlash();
+  Host::setCamera(nullptr, SENSOR_FPS);
+  Host::setWebServerPort(0);
+  DebugManager::getInstance().setup();
+  SystemManager::getInstance().setup();
+  Core1Manager::getInstance().setup();
+  CameraCycle::setup();
+  LEDBreathe::setup();
+}
+
+static int connectStream() {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(Host::webServerPort());
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  static const char request[] = "GET /stream HTTP/1.1\r\nHost: host\r\n\r\n";
+  if (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+      send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL) !=
+          (ssize_t)(sizeof(request) - 1)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Reads for `ms`, or until `until` bytes arrived if that is sooner
+static size_t readFor(int fd, uint32_t ms, size_t until = SIZE_MAX) {
+  size_t got = 0;
+  uint32_t start = millis();
+  while (got < until) {
+    int32_t left = (int32_t)(ms - (millis() - start));
+    pollfd p = {fd, POLLIN, 0};
+    if (left <= 0 || poll(&p, 1, left) <= 0)
+      break;
+    char buf[4096];
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n <= 0)
+      break;
+    got += n;
+  }
+  return got;
+}
+
+// With SO_LINGER at zero, close() sends a reset instead of a FIN
+static void hangUp(int fd, bool reset) {
+  if (reset) {
+    linger l = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+  }
+  close(fd);
+}
+
+static bool waitFor(uint32_t timeoutMs, bool (*done)()) {
+  uint32_t start = millis();
+  while (!done()) {
+    if (millis() - start > timeoutMs)
+      return false;
+    delay(10);
+  }
+  return true;
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_disconnect_while_resumed() {
+  std::atomic<bool> stop{false};
+  std::thread camera([&] {
+    while (!stop.load())
+      CameraCycle::captureNow();
+  });
+
+  MjpegStream::Stats before = MjpegStream::getStats();
+  std::atomic<uint32_t> served{0};
+  std::vector<std::thread> viewers;
+  for (uint32_t v = 0; v < VIEWERS; v++) {
+    viewers.emplace_back([&, v] {
+      srand(v + 1);
+      for (uint32_t round = 0; round < ROUNDS; round++) {
+        int fd = connectStream();
+        if (fd < 0)
+          continue;
+        // Past the headers and into the stream, then a little further, so
+        // the hang-up lands at a different point of the pump's pass
+        if (readFor(fd, 2000, 1) > 0)
+          served.fetch_add(1);
+        readFor(fd, rand() % 40);
+        hangUp(fd, (v + round) % 2);
+      }
+    });
+  }
+  for (std::thread &t : viewers)
+    t.join();
+  stop = true;
+  camera.join();
+
+  TEST_ASSERT_TRUE(waitFor(5000, [] {
+    return MjpegStream::activeClients() == 0;
+  }));
+  TEST_ASSERT_TRUE(waitFor(5000, [] {
+    return StorageWriter::getStats().queueDepth == 0;
+  }));
+  MjpegStream::Stats after = MjpegStream::getStats();
+  printf("pump connections=%u served=%u resumes=%u wakes=%u inUse=%u\n",
+         (unsigned)(after.totalClients - before.totalClients),
+         (unsigned)served.load(),
+         (unsigned)(after.pumpResumes - before.pumpResumes),
+         (unsigned)(after.pumpWakes - before.pumpWakes),
+         (unsigned)FramePool::getStats().inUse);
+  TEST_ASSERT_EQUAL(VIEWERS * ROUNDS, after.totalClients - before.totalClients);
+  TEST_ASSERT_EQUAL(0u, after.clients);
+  TEST_ASSERT_TRUE(after.pumpResumes > before.pumpResumes);
+  // The cache and a capture in hand, nothing more
+  TEST_ASSERT_TRUE(FramePool::getStats().inUse <=
+                   (uint32_t)(FRAME_CACHE_SIZE + 1));
+}
+
+// The pump survived: a new viewer is still fed, frame after frame
+static void test_new_viewer_served() {
+  std::atomic<bool> stop{false};
+  std::thread camera([&] {
+    while (!stop.load())
+      CameraCycle::captureNow();
+  });
+  int fd = connectStream();
+  TEST_ASSERT_TRUE(fd >= 0);
+  size_t got = readFor(fd, 1000);
+  hangUp(fd, false);
+  stop = true;
+  camera.join();
+  printf("pump new viewer bytes=%u\n", (unsigned)got);
+  TEST_ASSERT_TRUE(got > 0);
+  TEST_ASSERT_TRUE(waitFor(5000, [] {
+    return MjpegStream::activeClients() == 0;
+  }));
+}
+
+int main() {
+  boot();
+  UNITY_BEGIN();
+  RUN_TEST(test_disconnect_while_resumed);
+  RUN_TEST(test_new_viewer_served);
+  int result = UNITY_END();
+  // The firmware's tasks are still running; skip the static destructors
+  // they would race with, as the chip never returns from setup() either
+  fflush(stdout);
+  _Exit(result);
+}
@@ -0,0 +1,123 @@
+"""Packs the web assets in data/ into one image for the "assets" partition.
+
+The page template (index.html) is stored as plain text because the firmware
+fills its {{TOKEN}} slots at request time; everything else is gzipped. Each
+asset is addressed as /a/<hash>/<path>, where <hash> is the first 8 hex
+digits of the SHA-256 of the stored bytes, and index.html is rewritten to
+those URLs, so every asset can be cached forever.
+
+Image layout (little-endian):
+  header   magic "AST1", u16 version, u16 count, u32 crc32 of everything
+           after the header, u32 image size
+  entries  count x 96 bytes: char path[48], char type[32], u32 offset,
+           u32 length, u32 hash, u32 flags (1 = gzip)
+  blobs    4-byte aligned, each followed by at least one NUL
+
+Run standalone (python tools/pack_assets.py [out.bin]) or as a PlatformIO
+pre-script, which also flashes the image at the partition's offset.
+"""
+
+import csv
+import gzip
+import hashlib
+import os
+import re
+import struct
+import sys
+import zlib
+
+MAGIC = b"AST1"
+VERSION = 1
+HEADER = struct.Struct("<4sHHII")
+ENTRY = struct.Struct("<48s32sIIII")
+FLAG_GZIP = 1
+PARTITION = "assets"
+
+# (path under data/, content type, gzip)
+ASSETS = [
+    ("app.css", "text/css", True),
+    ("js/bundle.js", "application/javascript", True),
+    ("index.html", "text/html; charset=utf-8", False),  # last: links others
+]
+
+
+def asset_url(path, digest):
+    return "/a/%s/%s" % (digest, path)
+
+
+def rewrite_index(html, urls):
+    html = html.replace('href="/app.css"', 'href="%s"' % urls["app.css"])
+    # One classic script for every browser instead of the module graph
+    html = re.sub(r'<script type="module" src="/js/entry\.js"></script>\s*',
+                  "", html)
+    html = html.replace('<script nomodule src="/js/bundle.js"></script>',
+                        '<script defer src="%s"></script>'
+                        % urls["js/bundle.js"])
+    return html
+
+
+def pack(data_dir):
+    blobs = []
+    urls = {}
+    for path, content_type, compress in ASSETS:
+        with open(os.path.join(data_dir, path), "rb") as f:
+            raw = f.read()
+        if path == "index.html":
+            raw = rewrite_index(raw.decode("utf-8"), urls).encode("utf-8")
+        stored = gzip.compress(raw, 9, mtime=0) if compress else raw
+        digest = hashlib.sha256(stored).hexdigest()[:8]
+        urls[path] = asset_url(path, digest)
+        blobs.append((path, content_type, compress, stored, digest, len(raw)))
+
+    offset = HEADER.size + ENTRY.size * len(blobs)
+    entries = b""
+    body = b""
+    for path, content_type, compress, stored, digest, _ in blobs:
+        entries += ENTRY.pack(path.encode(), content_type.encode(),
+                              offset + len(body), len(stored),
+                              int(digest, 16), FLAG_GZIP if compress else 0)
+        body += stored + b"\0"
+        body += b"\0" * (-len(body) % 4)
+
+    payload = entries + body
+    size = HEADER.size + len(payload)
+    header = HEADER.pack(MAGIC, VERSION, len(blobs),
+                         zlib.crc32(payload) & 0xFFFFFFFF, size)
+    return header + payload, blobs
+
+
+def partition_offset(csv_path):
+    with open(csv_path) as f:
+        for row in csv.reader(f):
+            if row and row[0].strip() == PARTITION:
+                return int(row[3].strip(), 0), int(row[4].strip(), 0)
+    raise SystemExit("pack_assets: no '%s' partition in %s"
+                     % (PARTITION, csv_path))
+
+
+def write(project_dir, out_path):
+    image, blobs = pack(os.path.join(project_dir, "data"))
+    offset, capacity = partition_offset(
+        os.path.join(project_dir, "partitions.csv"))
+    if len(image) > capacity:
+        raise SystemExit("pack_assets: image is %u bytes, partition holds %u"
+                         % (len(image), capacity))
+    os.makedirs(os.path.dirname(out_path) or ".", exist_ok=True)
+    with open(out_path, "wb") as f:
+        f.write(image)
+    for path, _, compress, stored, digest, raw_len in blobs:
+        print("  %-14s %6u -> %6u bytes  %s" % (
+            path, raw_len, len(stored), asset_url(path, digest)))
+    print("pack_assets: %u bytes -> %s" % (len(image), out_path))
+    return offset
+
+
+if __name__ == "__main__":
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    write(root, sys.argv[1] if len(sys.argv) > 1
+          else os.path.join(root, "assets.bin"))
+else:
+    Import("env")  # noqa: F821 (PlatformIO pre-script)
+    out = os.path.join(env.subst("$BUILD_DIR"), "assets.bin")  # noqa: F821
+    offset = write(env.subst("$PROJECT_DIR"), out)  # noqa: F821
+    env.Append(FLASH_EXTRA_IMAGES=[("0x%x" % offset, out)])  # noqa: F821